@@ -0,0 +1,407 @@
+/*
+ * device_capability.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  Capabilities are cached process-wide, keyed by (device_id, firmware
+ *  version).  Each device ID also remembers which firmware it was last seen
+ *  running, so a lookup needs no round-trips until upgrade() or set_device()
+ *  forgets it again.  Only called with the GIL held.
+ */
+
+#define CAPABILITY_MAX_TUNERS 16
+#define CAPABILITY_FILE_MAGIC "# hdhomerun capability cache v1"
+#define CAPABILITY_SUPPORTED_MAX 65536
+
+static struct capability_entry *capability_cache = NULL;
+
+static struct capability_entry *capability_find(uint32_t device_id, uint32_t version_num) {
+    struct capability_entry *entry;
+
+    for(entry = capability_cache; entry; entry = entry->next) {
+        if(entry->device_id == device_id && entry->version_num == version_num)
+            return entry;
+    }
+    return NULL;
+}
+
+static struct capability_entry *capability_find_current(uint32_t device_id) {
+    struct capability_entry *entry;
+
+    for(entry = capability_cache; entry; entry = entry->next) {
+        if(entry->device_id == device_id && entry->current)
+            return entry;
+    }
+    return NULL;
+}
+
+static void capability_set_current(struct capability_entry *current) {
+    struct capability_entry *entry;
+
+    for(entry = capability_cache; entry; entry = entry->next) {
+        if(entry->device_id == current->device_id)
+            entry->current = (entry == current);
+    }
+}
+
+/* Internal: forget which firmware a device runs, e.g. after an upgrade */
+void capability_forget_version(uint32_t device_id) {
+    struct capability_entry *entry;
+
+    for(entry = capability_cache; entry; entry = entry->next) {
+        if(entry->device_id == device_id)
+            entry->current = 0;
+    }
+}
+
+/* Splits "name: tok tok tok" lines into {name: (tok, ...)} */
+static PyObject *parse_supported(const char *text) {
+    PyObject *sections, *tokens, *token;
+    const char *line, *eol, *colon, *p, *q;
+
+    sections = PyDict_New();
+    if(!sections)
+        return NULL;
+
+    for(line = text; *line; line = (*eol ? eol + 1 : eol)) {
+        eol = strchr(line, '\n');
+        if(!eol)
+            eol = line + strlen(line);
+        colon = memchr(line, ':', (size_t)(eol - line));
+        if(!colon || colon == line)
+            continue;
+
+        tokens = PyList_New(0);
+        if(!tokens) { Py_DECREF(sections); return NULL; }
+        for(p = colon + 1; p < eol; p = q) {
+            while(p < eol && (*p == ' ' || *p == '\t' || *p == '\r'))
+                p++;
+            for(q = p; q < eol && *q != ' ' && *q != '\t' && *q != '\r'; q++)
+                ;
+            if(q == p)
+                continue;
+            token = PyString_FromStringAndSize(p, (Py_ssize_t)(q - p));
+            if(!token || PyList_Append(tokens, token) != 0) {
+                Py_XDECREF(token); Py_DECREF(tokens); Py_DECREF(sections); return NULL;
+            }
+            Py_DECREF(token);
+        }
+
+        token = PyList_AsTuple(tokens);
+        Py_DECREF(tokens);
+        if(!token) { Py_DECREF(sections); return NULL; }
+        tokens = token;
+        token = PyString_FromStringAndSize(line, (Py_ssize_t)(colon - line));
+        if(!token) { Py_DECREF(tokens); Py_DECREF(sections); return NULL; }
+        if(PyDict_SetItem(sections, token, tokens) != 0) {
+            Py_DECREF(token); Py_DECREF(tokens); Py_DECREF(sections); return NULL;
+        }
+        Py_DECREF(token);
+        Py_DECREF(tokens);
+    }
+    return sections;
+}
+
+/*
+ *  Internal: adds or replaces an entry, parsing the text once so lookups only
+ *  copy the result.  With current, the entry becomes the firmware the device
+ *  is taken to be running.  Returns NULL with an exception set on failure.
+ */
+struct capability_entry *capability_insert(uint32_t device_id, uint32_t version_num, const char *version_str,
+                                           unsigned int tuner_count, const char *supported, size_t supported_len,
+                                           int current) {
+    struct capability_entry *entry;
+    PyObject *features;
+    char *copy;
+
+    copy = malloc(supported_len + 1);
+    if(!copy) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    memcpy(copy, supported, supported_len);
+    copy[supported_len] = '\0';
+    features = parse_supported(copy);
+    if(!features) {
+        free(copy);
+        return NULL;
+    }
+
+    entry = capability_find(device_id, version_num);
+    if(!entry) {
+        entry = calloc(1, sizeof(*entry));
+        if(!entry) {
+            Py_DECREF(features);
+            free(copy);
+            PyErr_NoMemory();
+            return NULL;
+        }
+        entry->device_id = device_id;
+        entry->version_num = version_num;
+        entry->next = capability_cache;
+        capability_cache = entry;
+    }
+    free(entry->supported);
+    entry->supported = copy;
+    Py_XDECREF(entry->features);
+    entry->features = features;
+    strncpy(entry->version_str, version_str, sizeof(entry->version_str) - 1);
+    entry->tuner_count = tuner_count;
+    if(current)
+        capability_set_current(entry);
+    return entry;
+}
+
+static PyObject *build_capability_dict(struct capability_entry *entry) {
+    PyObject *rv, *features, *empty, *channelmaps, *modulations;
+
+    /* The values are tuples, so a shallow copy keeps the cached table intact */
+    features = PyDict_Copy(entry->features);
+    if(!features)
+        return NULL;
+    empty = PyTuple_New(0);
+    if(!empty) { Py_DECREF(features); return NULL; }
+    channelmaps = PyDict_GetItemString(features, "channelmap");
+    modulations = PyDict_GetItemString(features, "modulation");
+
+    rv = Py_BuildValue("{s:k,s:s,s:k,s:I,s:O,s:O,s:O}",
+                       "device_id", (unsigned long)entry->device_id,
+                       "version", entry->version_str,
+                       "version_num", (unsigned long)entry->version_num,
+                       "tuner_count", entry->tuner_count,
+                       "channelmaps", channelmaps ? channelmaps : empty,
+                       "modulations", modulations ? modulations : empty,
+                       "features", features);
+    Py_DECREF(empty);
+    Py_DECREF(features);
+    return rv;
+}
+
+/* Internal: probes /tunerN/status until the device rejects the name */
+int capability_count_tuners(struct hdhomerun_device_t *hd, unsigned int *pcount) {
+    char item[32];
+    char *value, *error;
+    unsigned int i;
+    int success;
+
+    for(i = 0; i < CAPABILITY_MAX_TUNERS; i++) {
+        snprintf(item, sizeof(item), "/tuner%u/status", i);
+        success = hdhomerun_device_get_var(hd, item, &value, &error);
+        if(success < 0)
+            return -1;
+        if(success == 0)
+            break;
+    }
+    *pcount = i;
+    return 1;
+}
+
+/* Internal: the cached entry for the device's firmware, fetching it if needed; sets an exception on failure */
+struct capability_entry *capability_lookup(py_device_object *self, int refresh) {
+    struct capability_entry *entry;
+    uint32_t device_id, version_num;
+    unsigned int tuner_count;
+    char *version_str = NULL;
+    char *supported = NULL;
+    char version_copy[32];
+    int success;
+
+    device_id = hdhomerun_device_get_device_id(device_hd(self));
+    if(!refresh) {
+        entry = capability_find_current(device_id);
+        if(entry)
+            return entry;
+    }
+
+    success = hdhomerun_device_get_version(device_hd(self), &version_str, &version_num);
+    if(success == -1) {
+        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+        return NULL;
+    } else if(success == 0) {
+        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
+        return NULL;
+    } else if(success != 1) {
+        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
+        return NULL;
+    }
+    /* version_str points into libhdhomerun's reply buffer, which the next request reuses */
+    memset(version_copy, 0, sizeof(version_copy));
+    strncpy(version_copy, version_str, sizeof(version_copy) - 1);
+
+    entry = capability_find(device_id, version_num);
+    if(entry) {
+        capability_set_current(entry);
+        return entry;
+    }
+
+    success = capability_count_tuners(device_hd(self), &tuner_count);
+    if(success == 1)
+        success = hdhomerun_device_get_supported(device_hd(self), NULL, &supported);
+    if(success == -1) {
+        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+        return NULL;
+    } else if(success == 0) {
+        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
+        return NULL;
+    } else if(success != 1) {
+        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
+        return NULL;
+    }
+
+    return capability_insert(device_id, version_num, version_copy, tuner_count, supported, strlen(supported), 1);
+}
+
+const char Device_DOC_get_capabilities[] =
+    "Get the device's parsed capabilities (channel maps, modulations, tuner count\n"
+    "and the full feature table).  Results are cached per device ID and firmware\n"
+    "version, so repeated calls do not contact the device; pass refresh=True to\n"
+    "re-check the firmware version first.";
+PyObject *py_device_get_capabilities(py_device_object *self, PyObject *args, PyObject *kwds) {
+    PyObject *refresh_obj = NULL;
+    char *kwlist[] = {"refresh", NULL};
+    struct capability_entry *entry;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|O!", kwlist, &PyBool_Type, &refresh_obj))
+        return NULL;
+
+    entry = capability_lookup(self, refresh_obj == Py_True);
+    if(!entry)
+        return NULL;
+    return build_capability_dict(entry);
+}
+
+/*
+ *  Module-level persistence.  The file holds one header line per entry
+ *  followed by the raw get_supported text:
+ *    device <device_id> <version_num> <tuner_count> <length> <current> <version_str>
+ */
+
+const char hdhomerun_DOC_save_capabilities[] = "Write the in-process capability cache to a file.";
+
+PyObject *py_hdhomerun_save_capabilities(PyObject *module, PyObject *args, PyObject *kwds) {
+    char *filename = NULL;
+    char *kwlist[] = {"filename", NULL};
+    struct capability_entry *entry;
+    FILE *fp;
+    int failed;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &filename))
+        return NULL;
+
+    fp = fopen(filename, "w");
+    if(!fp)
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, filename);
+    fprintf(fp, "%s\n", CAPABILITY_FILE_MAGIC);
+    for(entry = capability_cache; entry; entry = entry->next) {
+        /* The header line could not be parsed back without a version string */
+        if(!entry->version_str[0])
+            continue;
+        fprintf(fp, "device %08X %lu %u %lu %d %s\n", (unsigned int)entry->device_id,
+                (unsigned long)entry->version_num, entry->tuner_count,
+                (unsigned long)strlen(entry->supported), entry->current ? 1 : 0, entry->version_str);
+        fputs(entry->supported, fp);
+        fputc('\n', fp);
+    }
+    failed = ferror(fp);
+    if(fclose(fp) != 0 || failed)
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, filename);
+    Py_RETURN_NONE;
+}
+
+const char hdhomerun_DOC_load_capabilities[] =
+    "Merge a capability cache written by save_capabilities() into this process.\n"
+    "The entries which were current when saved are assumed to describe the\n"
+    "firmware each device is running until Device.get_capabilities(refresh=True)\n"
+    "says otherwise.  Returns the number of entries loaded.";
+
+PyObject *py_hdhomerun_load_capabilities(PyObject *module, PyObject *args, PyObject *kwds) {
+    char *filename = NULL;
+    char *kwlist[] = {"filename", NULL};
+    char line[256];
+    char version_str[32];
+    char *supported;
+    unsigned int device_id, tuner_count;
+    unsigned long version_num, length;
+    long count = 0;
+    int current;
+    FILE *fp;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &filename))
+        return NULL;
+
+    fp = fopen(filename, "r");
+    if(!fp)
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, filename);
+    if(!fgets(line, sizeof(line), fp)) {
+        line[0] = '\0';
+    }
+    if(strncmp(line, CAPABILITY_FILE_MAGIC, strlen(CAPABILITY_FILE_MAGIC)) != 0) {
+        fclose(fp);
+        PyErr_SetString(hdhomerun_device_error, "not a capability cache file");
+        return NULL;
+    }
+    while(fgets(line, sizeof(line), fp)) {
+        memset(version_str, 0, sizeof(version_str));
+        current = 0;
+        if(sscanf(line, "device %x %lu %u %lu %d %31s", &device_id, &version_num, &tuner_count, &length,
+                  &current, version_str) != 6 || length > CAPABILITY_SUPPORTED_MAX) {
+            fclose(fp);
+            PyErr_SetString(hdhomerun_device_error, "capability cache file is corrupt");
+            return NULL;
+        }
+        supported = malloc(length + 1);
+        if(!supported) {
+            fclose(fp);
+            return PyErr_NoMemory();
+        }
+        if(fread(supported, 1, length, fp) != length || fgetc(fp) != '\n') {
+            free(supported);
+            fclose(fp);
+            PyErr_SetString(hdhomerun_device_error, "capability cache file is corrupt");
+            return NULL;
+        }
+        if(!capability_insert((uint32_t)device_id, (uint32_t)version_num, version_str, tuner_count, supported,
+                              (size_t)length, current != 0)) {
+            free(supported);
+            fclose(fp);
+            return NULL;
+        }
+        free(supported);
+        count++;
+    }
+    fclose(fp);
+    return PyInt_FromLong(count);
+}
+
+const char hdhomerun_DOC_clear_capabilities[] = "Discard all cached device capabilities.";
+
+PyObject *py_hdhomerun_clear_capabilities(PyObject *module) {
+    struct capability_entry *entry;
+
+    while((entry = capability_cache) != NULL) {
+        capability_cache = entry->next;
+        Py_XDECREF(entry->features);
+        free(entry->supported);
+        free(entry);
+    }
+    Py_RETURN_NONE;
+}
@@ -20,11 +20,76 @@
  */
 
 #include "device_common.h"
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
 
 /* String constants for use when raising exceptions */
 const char * const DEVICE_ERR_REJECTED_OP = "the operation was rejected";
 const char * const DEVICE_ERR_COMMUNICATION = "communication error sending request to hdhomerun device";
 const char * const DEVICE_ERR_UNDOCUMENTED = "undocumented error reported by library";
+const char * const DEVICE_ERR_TIMEOUT = "timed out waiting for the hdhomerun device to reply";
+
+static unsigned int status_parse_value(const char *status_str, const char *key) {
+    const char *p = strstr(status_str, key);
+
+    return p ? (unsigned int)strtoul(p + strlen(key), NULL, 10) : 0;
+}
+
+/*
+ *  Internal: fills in status from a /tunerN/status reply the way
+ *  hdhomerun_device_get_tuner_status() does.  libhdhomerun only parses the
+ *  replies it fetched itself, so every status fetched here goes through this.
+ */
+void parse_tuner_status(const char *status_str, struct hdhomerun_tuner_status_t *status) {
+    const char *p;
+
+    memset(status, 0, sizeof(*status));
+    p = strstr(status_str, "ch=");
+    if(p)
+        sscanf(p + 3, "%31s", status->channel);
+    p = strstr(status_str, "lock=");
+    if(p)
+        sscanf(p + 5, "%31s", status->lock_str);
+    status->signal_strength = status_parse_value(status_str, "ss=");
+    status->signal_to_noise_quality = status_parse_value(status_str, "snq=");
+    status->symbol_error_quality = status_parse_value(status_str, "seq=");
+    status->raw_bits_per_second = status_parse_value(status_str, "bps=");
+    status->packets_per_second = status_parse_value(status_str, "pps=");
+    status->signal_present = status->signal_strength >= 45;
+    if(strcmp(status->lock_str, "none") != 0) {
+        if(status->lock_str[0] == '(')
+            status->lock_unsupported = 1;
+        else
+            status->lock_supported = 1;
+    }
+}
+
+/* Internal: as parse_tuner_status(), for a /tunerN/vstatus reply */
+void parse_tuner_vstatus(const char *vstatus_str, struct hdhomerun_tuner_vstatus_t *vstatus) {
+    const char *p;
+
+    memset(vstatus, 0, sizeof(*vstatus));
+    p = strstr(vstatus_str, "vch=");
+    if(p)
+        sscanf(p + 4, "%31s", vstatus->vchannel);
+    p = strstr(vstatus_str, "name=");
+    if(p)
+        sscanf(p + 5, "%31s", vstatus->name);
+    p = strstr(vstatus_str, "auth=");
+    if(p)
+        sscanf(p + 5, "%31s", vstatus->auth);
+    p = strstr(vstatus_str, "cci=");
+    if(p)
+        sscanf(p + 4, "%31s", vstatus->cci);
+    p = strstr(vstatus_str, "cgms=");
+    if(p)
+        sscanf(p + 5, "%31s", vstatus->cgms);
+    vstatus->not_subscribed = strncmp(vstatus->auth, "not-subscribed", 14) == 0;
+    vstatus->not_available = strncmp(vstatus->auth, "error", 5) == 0 || strncmp(vstatus->auth, "dialog", 6) == 0;
+    vstatus->copy_protected = strncmp(vstatus->cci, "protected", 9) == 0 || strncmp(vstatus->cgms, "protected", 9) == 0;
+}
 
 /* Internal */
 PyObject *build_tuner_status_dict(struct hdhomerun_tuner_status_t *status) {
@@ -86,3 +151,98 @@ PyObject *build_tuner_status_dict(struct hdhomerun_tuner_status_t *status) {
 
     return rv;
 }
+
+/* Internal: nanoseconds from an arbitrary, never-adjusted origin */
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Internal: seconds since the epoch, as returned by time.time() */
+double wallclock_time(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+/*
+ *  Internal: stream access through whichever receiver stream_start selected.
+ *  These may be called without the GIL, so the caller runs device_fork_check()
+ *  beforehand while it still holds it.
+ */
+uint8_t *device_stream_recv(py_device_object *self, size_t max_size, size_t *pactual_size) {
+    uint8_t *data;
+
+    if(self->rx) {
+        data = stream_rx_recv(self->rx, max_size, pactual_size);
+    } else {
+        /* The native receiver runs the stages itself as data arrives */
+        data = hdhomerun_device_stream_recv(self->hd, max_size, pactual_size);
+        if(data)
+            stream_stages_run(&self->stages, data, *pactual_size, monotonic_ns());
+    }
+    /* Trace where a run of empty reads starts and ends, not every one */
+    if(!data) {
+        if(self->empty_recvs++ == 0)
+            trace_device(self, TRACE_STREAM_EMPTY, NULL, 0, 0);
+    } else if(self->empty_recvs) {
+        trace_device(self, TRACE_STREAM_RESUME, NULL, self->empty_recvs > INT_MAX ? INT_MAX : (int)self->empty_recvs, 0);
+        self->empty_recvs = 0;
+    }
+    return data;
+}
+
+void device_stream_flush(py_device_object *self) {
+    if(self->rx)
+        stream_rx_flush(self->rx);
+    else
+        hdhomerun_device_stream_flush(self->hd);
+}
+
+/* Internal: writes everything, retrying short writes; returns 0 or an errno value */
+int write_all(int fd, const uint8_t *data, size_t length) {
+    ssize_t written;
+
+    while(length > 0) {
+        written = write(fd, data, length);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            return errno;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/* Internal: little-endian field access for the on-disk formats */
+void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+void put_le32(uint8_t *p, uint32_t v) {
+    put_le16(p, (uint16_t)v);
+    put_le16(p + 2, (uint16_t)(v >> 16));
+}
+
+void put_le64(uint8_t *p, uint64_t v) {
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)get_le16(p) | ((uint32_t)get_le16(p + 2) << 16);
+}
+
+uint64_t get_le64(const uint8_t *p) {
+    return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
@@ -22,29 +22,548 @@
 #ifndef _DEVICE_COMMON_H
 #define _DEVICE_COMMON_H
 
+/* Python.h must come first so its feature test macros apply everywhere */
+#include <Python.h>
+#include <structmember.h>
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
-#include <Python.h>
-#include <structmember.h>
+#include <pthread.h>
+#include <sys/socket.h>
 #include <libhdhomerun/hdhomerun.h>
 
+/* Per-device control variable cache, see device_varcache.c */
+#define VAR_CACHE_TTL_FOREVER (-1)
+
+struct var_cache_entry {
+    struct var_cache_entry *next;
+    char *item;
+    char *value;
+    uint64_t expires_ns;    /* 0 if the entry never expires */
+};
+
+struct var_cache_policy {
+    struct var_cache_policy *next;
+    char *pattern;
+    long ttl_ms;
+};
+
+struct var_cache {
+    struct var_cache_entry *entries;
+    struct var_cache_policy *policies;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long invalidations;
+    char *reply;            /* the last uncached reply, see device_get_var_cached() */
+};
+
+/*
+ *  A set of counters the metrics exporter reads from its own thread, see
+ *  device_exporter.c.  sample() fills in the values for the source's kind
+ *  without the GIL; it may take the owner's own lock, but nothing else.
+ */
+#define EXPORTER_CONTROL 0
+#define EXPORTER_STREAM 1
+#define EXPORTER_WATCH 2
+#define EXPORTER_VALUES_MAX 24
+#define EXPORTER_LABELS_MAX 96
+
+struct exporter_source {
+    struct exporter_source *next;
+    int registered;
+    int kind;
+    void *owner;
+    void (*sample)(void *, double *);
+    char labels[EXPORTER_LABELS_MAX];   /* e.g. device="1234ABCD",tuner="0" */
+};
+
+/* Pipelined control connection, see device_control.c */
+#define CONTROL_DEFAULT_TIMEOUT_MS 5000
+/* No reply frame outgrows libhdhomerun's packet buffer, so no value does either */
+#define CONTROL_REPLY_MAX sizeof(((struct hdhomerun_pkt_t *)0)->buffer)
+#define CONTROL_LATENCY_BUCKETS 12
+
+struct control_pipe_stats {
+    unsigned long long requests;
+    unsigned long long rejected;
+    unsigned long long failures;
+    unsigned long long timeouts;
+    unsigned long long latency_count;
+    uint64_t latency_sum_ns;
+    unsigned long long latency_buckets[CONTROL_LATENCY_BUCKETS + 1];    /* the last one is +Inf */
+};
+
+struct control_pipe {
+    int sock;
+    int connected;
+    uint32_t device_ip;
+    /* Written by whoever holds the pipe and read by the exporter, both under stats_lock */
+    pthread_mutex_t stats_lock;
+    struct control_pipe_stats stats;
+    struct exporter_source metrics;
+};
+
+struct control_op {
+    const char *name;
+    const char *value;      /* NULL for a get request */
+    int result;             /* 1 accepted, 0 rejected, -1 no reply */
+    char reply[CONTROL_REPLY_MAX];  /* the value, or the device's error message */
+    const char *text;       /* reply, or libhdhomerun's own buffer for an untimed device_control_var() */
+    uint64_t done_ns;
+};
+
+/* Marks a libhdhomerun handle in use with the GIL released, see device_connection.c */
+struct device_reservation {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int busy;
+};
+
+/* A control connection shared by the tuners of one device, see device_connection.c */
+struct device_connection {
+    struct hdhomerun_device_t *hd;
+    struct control_pipe pipe;
+    struct var_cache vcache;    /* shared by every handle on the connection */
+    struct device_reservation reservation;
+    unsigned long handles;
+    unsigned long generation;   /* see device_fork.c */
+};
+
+/*
+ *  Recording index (.tsidx) format, see ts_index.c.  A 32 byte header is
+ *  followed by fixed 32 byte records in time order, all little-endian:
+ *    header: magic[8], u32 version, u32 record_size, u64 start time (ns
+ *            since the epoch), u64 reserved
+ *    record: u64 byte offset in the .ts, u64 stream time (27MHz ticks since
+ *            the start of the recording, continuous across PCR
+ *            discontinuities), u64 wall clock (ns since the epoch), u16 PID,
+ *            u8 flags, u8[5] reserved
+ */
+#define TSIDX_MAGIC "HDHRTSIX"
+#define TSIDX_VERSION 1
+#define TSIDX_HEADER_SIZE 32
+#define TSIDX_RECORD_SIZE 32
+#define TSIDX_FLAG_PAT 0x01             /* a PAT starts at offset */
+#define TSIDX_FLAG_RAP 0x02             /* random_access_indicator set at offset */
+#define TSIDX_FLAG_TIME 0x04            /* periodic time reference */
+#define TSIDX_FLAG_DISCONTINUITY 0x08   /* the PCR restarted at offset */
+
+struct tsidx_record {
+    uint64_t offset;
+    uint64_t time;
+    uint64_t wallclock_ns;
+    uint16_t pid;
+    uint8_t flags;
+};
+
+/*
+ *  Device registry format, see device_registry.c.  A 32 byte header is
+ *  followed by fixed 128 byte records and then the capability text they
+ *  point at, all little-endian:
+ *    header: magic[8], u32 version, u32 record_size, u32 count,
+ *            u32 reserved, u64 time saved (ns since the epoch)
+ *    record: u32 device ID, u32 IP, u32 device type, u32 tuner count,
+ *            u32 firmware version, u32 offset and u32 length of the
+ *            get_supported text, u32 reserved, u64 last successful contact
+ *            (ns since the epoch), char model[32], char version[32],
+ *            u8[24] reserved
+ */
+#define REGISTRY_MAGIC "HDHRREGY"
+#define REGISTRY_VERSION 1
+#define REGISTRY_HEADER_SIZE 32
+#define REGISTRY_RECORD_SIZE 128
+
+/* Native packet processing stages, see stream_stage.c */
+struct stream_stage {
+    struct stream_stage *next;
+    void (*process)(struct stream_stage *, const uint8_t *, size_t, uint64_t);
+};
+
+struct stream_stages {
+    pthread_mutex_t lock;
+    struct stream_stage *head;
+};
+
+/* Packet header flag counts, see ts_simd.c */
+struct ts_scan_counts {
+    unsigned long long packets;
+    unsigned long long sync_errors;
+    unsigned long long transport_errors;
+    unsigned long long scrambled;
+};
+
+/* Native stream receiver, see stream_rx.c */
+struct stream_group;
+
+/* Capture file playback in place of the socket, see stream_replay.c */
+struct stream_replay_config {
+    const char *path;
+    double speed;           /* 1.0 for real time from the PCR, 0 for as fast as possible */
+    double loss;            /* probability of dropping each datagram */
+    unsigned int jitter_us; /* maximum extra delay added to each datagram */
+    int loop;
+    uint64_t seed;
+};
+
+struct stream_replay {
+    int fd;
+    double speed;
+    uint32_t loss_threshold;
+    uint64_t jitter_ns;
+    int loop;
+    uint64_t rng;
+
+    int pcr_pid;            /* -1 until the first PCR (or after looping) */
+    uint64_t last_pcr;
+    uint64_t stream_ns;     /* stream time at the last PCR */
+    uint64_t bytes_since_pcr;
+    double bytes_per_ns;    /* rate over the previous PCR interval, 0 until known */
+    uint64_t base_ns;       /* monotonic time at which stream time 0 plays */
+    uint64_t last_due_ns;
+
+    /* Protected by the receiver's lock */
+    unsigned long long dropped;
+    unsigned long loops;
+    int finished;
+};
+
+struct stream_rx_config {
+    size_t buffer_size;
+    int hugepages;
+    int mlock;
+    unsigned int batch;     /* datagrams per recvmmsg call */
+    int rcvbuf;             /* SO_RCVBUF bytes, 0 for the system default */
+    int busy_poll_us;       /* SO_BUSY_POLL, 0 to leave it off */
+    int timestamps;         /* SO_TIMESTAMPNS arrival analysis */
+    struct stream_stages *stages;
+    struct stream_group *group;     /* serviced by the group instead of a thread of its own */
+    const struct stream_replay_config *replay;  /* read from a file instead of a socket */
+};
+
+/* Bucket i counts values in [2**i, 2**(i+1)), bucket 0 also counts 0 */
+#define STREAM_RX_HISTOGRAM_BUCKETS 32
+
+struct stream_rx_timing {
+    int enabled;
+    uint64_t last_ns;
+    uint64_t last_gap_ns;
+    uint64_t max_gap_ns;
+    unsigned long burst_length;
+    double jitter_ns;
+    unsigned long long missing;     /* datagrams without a timestamp */
+    unsigned long long interarrival[STREAM_RX_HISTOGRAM_BUCKETS];  /* microseconds */
+    unsigned long long bursts[STREAM_RX_HISTOGRAM_BUCKETS];        /* datagrams */
+    unsigned long long gaps[STREAM_RX_HISTOGRAM_BUCKETS];          /* microseconds between bursts */
+    unsigned long long latency[STREAM_RX_HISTOGRAM_BUCKETS];       /* microseconds, kernel to receiver thread */
+};
+
+struct stream_rx {
+    int sock;
+    uint16_t port;
+    uint8_t *buffer;
+    size_t size;            /* ring size, a multiple of VIDEO_DATA_PACKET_SIZE */
+    size_t mapped_size;
+    int hugepages;
+    int locked;
+    unsigned int batch;
+    int rcvbuf;
+    int busy_poll_us;
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    uint8_t *controls;      /* SO_TIMESTAMPNS control buffers, one per message */
+    struct stream_rx_timing timing;
+    struct stream_stages *stages;
+    struct stream_group *group;
+    unsigned int group_thread;  /* member slot in the group, see stream_group.c */
+    unsigned int group_slot;
+    struct stream_replay *replay;
+    uint8_t scratch[VIDEO_DATA_PACKET_SIZE];
+    pthread_mutex_t lock;
+    pthread_t thread;
+    int running;
+    volatile int stopping;
+    unsigned long generation;   /* see device_fork.c */
+    struct exporter_source metrics;
+    size_t head;            /* written by the receiver thread */
+    size_t tail;
+    size_t pending;         /* handed out by the last stream_rx_recv */
+    size_t high_water;
+    unsigned long long packets;
+    unsigned long long bytes;
+    unsigned long long overflow_packets;
+    unsigned long long network_errors;
+    unsigned long long syscalls;
+    struct ts_scan_counts scan;
+};
+
+struct stream_rx_stats {
+    size_t buffer_size;
+    size_t occupancy;
+    size_t high_water;
+    unsigned long long packets;
+    unsigned long long bytes;
+    unsigned long long overflow_packets;
+    unsigned long long network_errors;
+    unsigned long long syscalls;
+    struct ts_scan_counts scan;
+    unsigned int batch;
+    int rcvbuf;
+    int busy_poll_us;
+    int hugepages;
+    int locked;
+    struct stream_rx_timing timing;
+    int replay;
+    unsigned long long replay_dropped;
+    unsigned long replay_loops;
+    int replay_finished;
+};
+
 typedef struct {
     PyObject_HEAD
     struct hdhomerun_device_t *hd;
     unsigned int locked;
+    uint32_t lockkey;
+    struct var_cache vcache;
+    struct control_pipe pipe;
+    struct stream_rx *rx;   /* NULL when streaming through libhdhomerun */
+    PyObject *stream_group; /* borrowed; the StreamGroup rx belongs to, or NULL */
+    struct stream_stages stages;
+    PyObject *watchdog;     /* the running StreamWatchdog, see device_watchdog.c */
+    PyObject *connection;   /* the Connection this handle shares, or NULL */
+    struct device_connection *conn;
+    unsigned int tuner;     /* only meaningful with a connection */
+    struct device_reservation reservation;  /* only used without a connection */
+    unsigned long generation;   /* the fork generation hd and the sockets belong to */
+    unsigned long empty_recvs;  /* stream_recv() calls without data since the last with */
+    unsigned int control_timeout_ms;    /* default timeout_ms for gets and sets, 0 for libhdhomerun's */
 } py_device_object;
 
 /* Defined in device_type.c */
 extern PyObject *hdhomerun_device_error;
+extern PyObject *hdhomerun_timeout_error;
 
 /* Defined in device_common.c */
+void parse_tuner_status(const char *, struct hdhomerun_tuner_status_t *);
+void parse_tuner_vstatus(const char *, struct hdhomerun_tuner_vstatus_t *);
 PyObject *build_tuner_status_dict(struct hdhomerun_tuner_status_t *);
+uint64_t monotonic_ns(void);
+double wallclock_time(void);
+uint8_t *device_stream_recv(py_device_object *, size_t, size_t *);
+void device_stream_flush(py_device_object *);
+int write_all(int, const uint8_t *, size_t);
+void put_le16(uint8_t *, uint16_t);
+void put_le32(uint8_t *, uint32_t);
+void put_le64(uint8_t *, uint64_t);
+uint16_t get_le16(const uint8_t *);
+uint32_t get_le32(const uint8_t *);
+uint64_t get_le64(const uint8_t *);
+
+/* Defined in event_queue.c */
+
+/*
+ *  A bounded FIFO filled by native threads and drained by Python.  The read
+ *  end of pipe_fd becomes readable whenever the queue is non-empty, so it can
+ *  be handed to select()/poll() via fileno().
+ */
+struct event_queue_item {
+    struct event_queue_item *next;
+    size_t length;
+    uint8_t data[];
+};
+
+struct event_queue {
+    pthread_mutex_t lock;
+    struct event_queue_item *head;
+    struct event_queue_item *tail;
+    size_t count;
+    size_t limit;
+    unsigned long dropped;
+    int signalled;
+    int pipe_fd[2];
+};
+
+int event_queue_init(struct event_queue *, size_t);
+void event_queue_destroy(struct event_queue *);
+int event_queue_push(struct event_queue *, const void *, size_t);
+struct event_queue_item *event_queue_pop(struct event_queue *);
+
+/* Defined in write_queue.c */
+
+/*
+ *  Jobs handed to a writer thread.  A job is embedded at the start of the
+ *  owner's own structure; run() writes it out (or only releases it when
+ *  discard is set) and frees it.
+ */
+struct write_job {
+    struct write_job *next;
+};
+
+typedef void (*write_job_fn)(void *owner, struct write_job *job, int discard);
+
+struct write_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    struct write_job *head;
+    struct write_job *tail;
+    size_t pending;             /* pushed but not yet finished */
+    size_t limit;
+    int started;
+    int stopping;
+    unsigned long generation;
+    write_job_fn run;
+    void *owner;
+};
+
+int write_queue_start(struct write_queue *, size_t, write_job_fn, void *);
+void write_queue_push(struct write_queue *, struct write_job *);
+void write_queue_stop(struct write_queue *);
+
+/* Defined in device_watch.c */
+extern PyTypeObject hdhomerun_Watcher_type;
+
+extern const char Device_DOC_watch[];
+PyObject *py_device_watch(py_device_object *, PyObject *, PyObject *);
+
+/* Defined in device_info.c */
+extern PyTypeObject hdhomerun_DeviceInfo_type;
+
+PyObject *device_info_from_discover(const struct hdhomerun_discover_device_t *);
+
+/* Defined in device_connection.c */
+extern PyTypeObject hdhomerun_Connection_type;
+
+struct hdhomerun_device_t *device_hd(py_device_object *);
+struct hdhomerun_device_t *device_hd_acquire(py_device_object *);
+struct hdhomerun_device_t *device_hd_held(py_device_object *);
+void device_hd_release(py_device_object *);
+struct device_reservation *device_reservation(py_device_object *);
+struct control_pipe *device_pipe(py_device_object *);
+struct var_cache *device_var_cache(py_device_object *);
+unsigned int device_tuner(py_device_object *);
+int device_connection_attach(py_device_object *, PyObject *, unsigned int);
+void device_connection_detach(py_device_object *);
+void connection_fork_check(struct device_connection *);
+void device_reservation_init(struct device_reservation *);
+void device_reservation_destroy(struct device_reservation *);
+
+/* Defined in device_fork.c */
+void fork_handlers_install(void);
+unsigned long fork_generation_current(void);
+struct hdhomerun_device_t *fork_replace_hd(struct hdhomerun_device_t *);
+void device_fork_check(py_device_object *);
+
+extern const char Device_DOC_reduce[];
+PyObject *py_device_reduce(py_device_object *);
+
+extern const char Device_DOC_setstate[];
+PyObject *py_device_setstate(py_device_object *, PyObject *);
+
+/* Defined in device_trace.c */
+#define TRACE_CONTROL_GET 1         /* pipelined, see device_control.c */
+#define TRACE_CONTROL_SET 2
+#define TRACE_GET_VAR 3             /* through libhdhomerun */
+#define TRACE_SET_VAR 4
+#define TRACE_STREAM_START 5
+#define TRACE_STREAM_STOP 6
+#define TRACE_STREAM_EMPTY 7        /* the first of a run of empty stream_recv() calls */
+#define TRACE_STREAM_RESUME 8       /* data again; result is the number of empty calls */
+#define TRACE_LOCKKEY_REQUEST 9
+#define TRACE_LOCKKEY_FORCE 10
+#define TRACE_LOCKKEY_RELEASE 11
+#define TRACE_TUNER_LOCK 12         /* the lock a Watcher saw changed; item is the new lock */
+#define TRACE_NO_TUNER 0xFF
+
+void trace_event(int, uint32_t, uint32_t, unsigned int, const char *, int, uint64_t);
+void trace_device(py_device_object *, int, const char *, int, uint64_t);
+
+extern const char hdhomerun_DOC_trace_events[];
+PyObject *py_hdhomerun_trace_events(PyObject *, PyObject *, PyObject *);
+
+extern const char hdhomerun_DOC_trace_dump[];
+PyObject *py_hdhomerun_trace_dump(PyObject *, PyObject *, PyObject *);
+
+/* Defined in device_exporter.c */
+void exporter_register(struct exporter_source *, int, void *, void (*)(void *, double *), const char *);
+void exporter_unregister(struct exporter_source *);
+void exporter_after_fork(void);
+
+extern const char hdhomerun_DOC_start_exporter[];
+PyObject *py_hdhomerun_start_exporter(PyObject *, PyObject *, PyObject *);
+
+extern const char hdhomerun_DOC_stop_exporter[];
+PyObject *py_hdhomerun_stop_exporter(PyObject *);
+
+extern const char hdhomerun_DOC_exporter_metrics[];
+PyObject *py_hdhomerun_exporter_metrics(PyObject *);
+
+/* Defined in device_watchdog.c */
+extern PyTypeObject hdhomerun_StreamWatchdog_type;
+
+void device_watchdog_stop(py_device_object *);
+
+extern const char Device_DOC_stream_watchdog[];
+PyObject *py_device_stream_watchdog(py_device_object *, PyObject *, PyObject *);
+
+/* Defined in device_fastzap.c */
+extern PyTypeObject hdhomerun_FastZap_type;
+
+/* Defined in device_type.c */
+extern PyTypeObject hdhomerun_Device_type;
+
+PyObject *py_device_tuner_lockkey_request(py_device_object *);
+PyObject *py_device_tuner_lockkey_release(py_device_object *);
+PyObject *py_device_stream_stop(py_device_object *);
+void device_identity(py_device_object *, uint32_t *, uint32_t *, unsigned int *);
+
+/* Defined in device_pcr.c */
+extern PyTypeObject hdhomerun_PcrAnalyzer_type;
+
+extern const char Device_DOC_analyze_pcr[];
+PyObject *py_device_analyze_pcr(py_device_object *, PyObject *, PyObject *);
+
+/* Defined in device_record.c */
+extern PyTypeObject hdhomerun_Recorder_type;
+
+extern const char Device_DOC_record[];
+PyObject *py_device_record(py_device_object *, PyObject *, PyObject *);
+
+/* Defined in device_segment.c */
+extern PyTypeObject hdhomerun_Segmenter_type;
+
+extern const char Device_DOC_segment[];
+PyObject *py_device_segment(py_device_object *, PyObject *, PyObject *);
+
+/* Defined in device_epg.c */
+extern PyTypeObject hdhomerun_EpgCollector_type;
+
+extern const char Device_DOC_collect_epg[];
+PyObject *py_device_collect_epg(py_device_object *, PyObject *, PyObject *);
+
+/* Defined in device_registry.c */
+extern PyTypeObject hdhomerun_Registry_type;
+
+/* Defined in ts_table.c */
+extern PyTypeObject hdhomerun_PacketTable_type;
+extern PyTypeObject hdhomerun_PacketIndex_type;
+
+int ts_table_add_constants(void);
+
+extern const char hdhomerun_DOC_parse_packets[];
+PyObject *py_hdhomerun_parse_packets(PyObject *, PyObject *, PyObject *);
+
+/* Defined in ts_index.c */
+extern PyTypeObject hdhomerun_TsIndex_type;
+
+void tsidx_encode_header(uint8_t *, uint64_t);
+void tsidx_encode_record(uint8_t *, const struct tsidx_record *);
+void tsidx_decode_record(const uint8_t *, struct tsidx_record *);
 
 /* String constants for use when raising exceptions */
 extern const char * const DEVICE_ERR_REJECTED_OP;
 extern const char * const DEVICE_ERR_COMMUNICATION;
 extern const char * const DEVICE_ERR_UNDOCUMENTED;
+extern const char * const DEVICE_ERR_TIMEOUT;
 
 /* Defined in device_get.c */
 
@@ -70,49 +589,49 @@ extern const char Device_DOC_get_var[];
 PyObject *py_device_get_var(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_tuner_status[];
-PyObject *py_device_get_tuner_status(py_device_object *);
+PyObject *py_device_get_tuner_status(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_tuner_vstatus[];
-PyObject *py_device_get_tuner_vstatus(py_device_object *);
+PyObject *py_device_get_tuner_vstatus(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_tuner_streaminfo[];
-PyObject *py_device_get_tuner_streaminfo(py_device_object *);
+PyObject *py_device_get_tuner_streaminfo(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_tuner_channel[];
-PyObject *py_device_get_tuner_channel(py_device_object *);
+PyObject *py_device_get_tuner_channel(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_tuner_vchannel[];
-PyObject *py_device_get_tuner_vchannel(py_device_object *);
+PyObject *py_device_get_tuner_vchannel(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_tuner_channelmap[];
-PyObject *py_device_get_tuner_channelmap(py_device_object *);
+PyObject *py_device_get_tuner_channelmap(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_tuner_filter[];
-PyObject *py_device_get_tuner_filter(py_device_object *);
+PyObject *py_device_get_tuner_filter(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_tuner_program[];
-PyObject *py_device_get_tuner_program(py_device_object *);
+PyObject *py_device_get_tuner_program(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_tuner_target[];
-PyObject *py_device_get_tuner_target(py_device_object *);
+PyObject *py_device_get_tuner_target(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_tuner_plotsample[];
-PyObject *py_device_get_tuner_plotsample(py_device_object *);
+PyObject *py_device_get_tuner_plotsample(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_tuner_lockkey_owner[];
-PyObject *py_device_get_tuner_lockkey_owner(py_device_object *);
+PyObject *py_device_get_tuner_lockkey_owner(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_oob_status[];
-PyObject *py_device_get_oob_status(py_device_object *);
+PyObject *py_device_get_oob_status(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_oob_plotsample[];
-PyObject *py_device_get_oob_plotsample(py_device_object *);
+PyObject *py_device_get_oob_plotsample(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_ir_target[];
-PyObject *py_device_get_ir_target(py_device_object *);
+PyObject *py_device_get_ir_target(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_version[];
-PyObject *py_device_get_version(py_device_object *);
+PyObject *py_device_get_version(py_device_object *, PyObject *, PyObject *);
 
 extern const char Device_DOC_get_supported[];
 PyObject *py_device_get_supported(py_device_object *, PyObject *, PyObject *);
@@ -146,4 +665,174 @@ PyObject *py_device_set_tuner_channelmap(py_device_object *, PyObject *, PyObjec
 extern const char Device_DOC_set_tuner_filter[];
 PyObject *py_device_set_tuner_filter(py_device_object *, PyObject *, PyObject *);
 
+/* Defined in device_varcache.c */
+int var_cache_init(struct var_cache *);
+void var_cache_free(struct var_cache *);
+void var_cache_clear(struct var_cache *);
+void var_cache_invalidate(struct var_cache *, const char *);
+int device_get_var_cached(py_device_object *, const char *, unsigned int, char **, char **);
+
+extern const char Device_DOC_set_var_cache_policy[];
+PyObject *py_device_set_var_cache_policy(py_device_object *, PyObject *, PyObject *);
+
+extern const char Device_DOC_get_var_cache_stats[];
+PyObject *py_device_get_var_cache_stats(py_device_object *);
+
+extern const char Device_DOC_clear_var_cache[];
+PyObject *py_device_clear_var_cache(py_device_object *);
+
+/* Defined in device_control.c */
+extern const uint64_t control_latency_bounds_ns[CONTROL_LATENCY_BUCKETS];
+
+void control_pipe_init(struct control_pipe *);
+void control_pipe_close(struct control_pipe *);
+void control_pipe_release(struct control_pipe *);
+void control_pipe_after_fork(struct control_pipe *);
+int control_pipe_execute(struct control_pipe *, uint32_t, uint32_t, struct control_op *, size_t, unsigned int);
+int device_control_var(py_device_object *, struct control_op *, unsigned int);
+PyObject *device_control_error(int, const char *);
+
+extern const char Device_DOC_set_control_timeout[];
+PyObject *py_device_set_control_timeout(py_device_object *, PyObject *, PyObject *);
+
+extern const char Device_DOC_get_control_timeout[];
+PyObject *py_device_get_control_timeout(py_device_object *);
+
+/* Defined in device_tune.c */
+extern const char Device_DOC_tune[];
+PyObject *py_device_tune(py_device_object *, PyObject *, PyObject *);
+
+/* Defined in stream_stage.c */
+void stream_stages_init(struct stream_stages *);
+void stream_stages_destroy(struct stream_stages *);
+void stream_stages_attach(struct stream_stages *, struct stream_stage *);
+void stream_stages_detach(struct stream_stages *, struct stream_stage *);
+void stream_stages_run(struct stream_stages *, const uint8_t *, size_t, uint64_t);
+
+/* Defined in stream_rx.c */
+struct stream_rx *stream_rx_create(const struct stream_rx_config *);
+void stream_rx_destroy(struct stream_rx *);
+uint8_t *stream_rx_recv(struct stream_rx *, size_t, size_t *);
+size_t stream_rx_available(struct stream_rx *);
+void stream_rx_flush(struct stream_rx *);
+void stream_rx_get_stats(struct stream_rx *, struct stream_rx_stats *, int);
+void stream_rx_export(struct stream_rx *, const char *);
+int stream_rx_service(struct stream_rx *);
+unsigned int stream_rx_free_slots(struct stream_rx *);
+void stream_rx_push(struct stream_rx *, unsigned int, uint64_t);
+
+/* Defined in stream_replay.c */
+int stream_replay_open(struct stream_rx *, const struct stream_replay_config *);
+void stream_replay_close(struct stream_replay *);
+void *stream_replay_thread(void *);
+
+/* Defined in stream_group.c */
+
+/*
+ *  Native receivers sharing a few epoll threads.  Each thread services the
+ *  sockets in its member table; a slot is cleared under the thread's lock
+ *  when its receiver leaves, so the thread never touches a freed receiver.
+ */
+struct stream_group_thread {
+    struct stream_group *group;
+    pthread_t thread;
+    int running;
+    int epoll_fd;
+    pthread_mutex_t lock;
+    struct stream_rx **members;
+    unsigned int capacity;
+    unsigned int count;
+    unsigned long long wakeups;
+    unsigned long long services;
+};
+
+struct stream_group {
+    struct stream_group_thread *threads;
+    unsigned int thread_count;
+    volatile int stopping;
+    pthread_mutex_t lock;
+    int signalled;
+    int pipe_fd[2];         /* readable while some member has data waiting */
+    unsigned long generation;   /* see device_fork.c */
+};
+
+extern PyTypeObject hdhomerun_StreamGroup_type;
+
+int stream_group_add(struct stream_group *, struct stream_rx *);
+void stream_group_remove(struct stream_group *, struct stream_rx *);
+struct stream_group *py_stream_group_join(PyObject *, py_device_object *);
+void py_stream_group_leave(py_device_object *);
+
+/* Defined in ts_util.c */
+#define TS_SYNC_BYTE 0x47
+#define TS_PID(p)               ((uint16_t)((((p)[1] & 0x1F) << 8) | (p)[2]))
+#define TS_TEI(p)               (((p)[1] & 0x80) != 0)
+#define TS_PUSI(p)              (((p)[1] & 0x40) != 0)
+#define TS_SCRAMBLING(p)        (((p)[3] >> 6) & 0x03)
+#define TS_HAS_ADAPTATION(p)    (((p)[3] & 0x20) != 0)
+#define TS_HAS_PAYLOAD(p)       (((p)[3] & 0x10) != 0)
+#define TS_CC(p)                ((p)[3] & 0x0F)
+#define TS_PID_COUNT 8192
+
+int ts_payload_offset(const uint8_t *);
+const uint8_t *ts_section_start(const uint8_t *, size_t *);
+int ts_parse_pat(const uint8_t *, size_t, uint16_t *, int);
+int ts_parse_pmt(const uint8_t *, size_t, uint16_t *, uint16_t *, uint16_t *, uint8_t *, int);
+int ts_get_pcr(const uint8_t *, uint64_t *, int *);
+
+/* Defined in ts_simd.c */
+void ts_simd_init(void);
+void ts_scan(const uint8_t *, size_t, struct ts_scan_counts *);
+size_t ts_find_sync(const uint8_t *, size_t, size_t);
+size_t ts_realign(const uint8_t *, size_t, uint8_t *, size_t *);
+uint32_t crc32_mpeg2(const uint8_t *, size_t, uint32_t);
+
+extern const char hdhomerun_DOC_ts_check[];
+PyObject *py_hdhomerun_ts_check(PyObject *, PyObject *, PyObject *);
+
+extern const char hdhomerun_DOC_ts_find_sync[];
+PyObject *py_hdhomerun_ts_find_sync(PyObject *, PyObject *, PyObject *);
+
+extern const char hdhomerun_DOC_ts_realign[];
+PyObject *py_hdhomerun_ts_realign(PyObject *, PyObject *, PyObject *);
+
+extern const char hdhomerun_DOC_crc32_mpeg2[];
+PyObject *py_hdhomerun_crc32_mpeg2(PyObject *, PyObject *, PyObject *);
+
+extern const char hdhomerun_DOC_simd_level[];
+PyObject *py_hdhomerun_simd_level(PyObject *);
+
+/* Defined in device_zap.c */
+extern const char Device_DOC_measure_zap[];
+PyObject *py_device_measure_zap(py_device_object *, PyObject *, PyObject *);
+
+/* Defined in device_capability.c */
+struct capability_entry {
+    struct capability_entry *next;
+    uint32_t device_id;
+    uint32_t version_num;
+    char version_str[32];
+    unsigned int tuner_count;
+    int current;    /* the firmware this device was last seen running */
+    char *supported;
+    PyObject *features; /* supported, parsed into {name: (token, ...)} */
+};
+
+void capability_forget_version(uint32_t);
+struct capability_entry *capability_insert(uint32_t, uint32_t, const char *, unsigned int, const char *, size_t, int);
+struct capability_entry *capability_lookup(py_device_object *, int);
+int capability_count_tuners(struct hdhomerun_device_t *, unsigned int *);
+
+extern const char Device_DOC_get_capabilities[];
+PyObject *py_device_get_capabilities(py_device_object *, PyObject *, PyObject *);
+
+extern const char hdhomerun_DOC_save_capabilities[];
+PyObject *py_hdhomerun_save_capabilities(PyObject *, PyObject *, PyObject *);
+
+extern const char hdhomerun_DOC_load_capabilities[];
+PyObject *py_hdhomerun_load_capabilities(PyObject *, PyObject *, PyObject *);
+
+extern const char hdhomerun_DOC_clear_capabilities[];
+PyObject *py_hdhomerun_clear_capabilities(PyObject *);
+
 #endif /* _DEVICE_COMMON_H */
@@ -0,0 +1,325 @@
+/*
+ * device_connection.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  A Connection owns one hdhomerun_device_t, and so one libhdhomerun control
+ *  socket, plus one pipelined control_pipe, for a physical device.  Device
+ *  handles opened on it carry only their tuner number and lock key; every
+ *  request they make goes through device_hd(), which points the shared
+ *  handle at the right tuner first.
+ *
+ *  Requests made with the GIL held are serialized by the GIL itself, since
+ *  no libhdhomerun call releases it.  A handle which needs the connection
+ *  while the GIL is dropped (waiting for lock, pipelined tuning) marks it
+ *  busy with device_hd_acquire(); anyone else then waits for
+ *  device_hd_release() before touching it.  A standalone Device reserves
+ *  its own handle, and its receiver, the same way.
+ */
+
+typedef struct {
+    PyObject_HEAD
+    struct device_connection *conn;
+} py_connection_object;
+
+/* Internal: a reservation starts out idle */
+void device_reservation_init(struct device_reservation *res) {
+    pthread_mutex_init(&res->lock, NULL);
+    pthread_cond_init(&res->cond, NULL);
+    res->busy = 0;
+}
+
+void device_reservation_destroy(struct device_reservation *res) {
+    pthread_cond_destroy(&res->cond);
+    pthread_mutex_destroy(&res->lock);
+}
+
+/* Internal: what device_hd_acquire() reserves; Devices on one Connection share it */
+struct device_reservation *device_reservation(py_device_object *self) {
+    return self->conn ? &self->conn->reservation : &self->reservation;
+}
+
+/* Waits until nobody holds the reservation; called with the GIL held, which is dropped while waiting */
+static void reservation_wait_idle(struct device_reservation *res) {
+    pthread_mutex_lock(&res->lock);
+    while(res->busy) {
+        pthread_mutex_unlock(&res->lock);
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&res->lock);
+        while(res->busy)
+            pthread_cond_wait(&res->cond, &res->lock);
+        pthread_mutex_unlock(&res->lock);
+        Py_END_ALLOW_THREADS
+        /* Someone else may have taken it while we waited for the GIL */
+        pthread_mutex_lock(&res->lock);
+    }
+    pthread_mutex_unlock(&res->lock);
+}
+
+static struct hdhomerun_device_t *connection_select(py_device_object *self) {
+    struct hdhomerun_device_t *hd = self->conn->hd;
+
+    hdhomerun_device_set_tuner(hd, self->tuner);
+    hdhomerun_device_tuner_lockkey_use_value(hd, self->lockkey);
+    return hd;
+}
+
+/* Internal: replaces what a Connection inherited across fork(), see device_fork.c; the GIL must be held */
+void connection_fork_check(struct device_connection *conn) {
+    if(conn->generation == fork_generation_current())
+        return;
+    conn->generation = fork_generation_current();
+    conn->hd = fork_replace_hd(conn->hd);
+    control_pipe_after_fork(&conn->pipe);
+    /* A handle in another thread may have held this; that thread is gone */
+    device_reservation_init(&conn->reservation);
+}
+
+/* Internal: the libhdhomerun handle for this Device's next request, with the GIL held throughout */
+struct hdhomerun_device_t *device_hd(py_device_object *self) {
+    device_fork_check(self);
+    reservation_wait_idle(device_reservation(self));
+    return self->conn ? connection_select(self) : self->hd;
+}
+
+/* Internal: as device_hd(), but the handle stays reserved until device_hd_release() so the GIL can be dropped */
+struct hdhomerun_device_t *device_hd_acquire(py_device_object *self) {
+    struct device_reservation *res;
+
+    device_fork_check(self);
+    res = device_reservation(self);
+    reservation_wait_idle(res);
+    /* No other thread can run until we drop the GIL, so the handle is still idle */
+    pthread_mutex_lock(&res->lock);
+    res->busy = 1;
+    pthread_mutex_unlock(&res->lock);
+    return self->conn ? connection_select(self) : self->hd;
+}
+
+/* Internal: the handle for a Device whose reservation this thread already holds; may be called without the GIL */
+struct hdhomerun_device_t *device_hd_held(py_device_object *self) {
+    if(!self->conn)
+        return self->hd;
+    return connection_select(self);
+}
+
+/* Internal: may be called without the GIL */
+void device_hd_release(py_device_object *self) {
+    struct device_reservation *res = device_reservation(self);
+
+    pthread_mutex_lock(&res->lock);
+    res->busy = 0;
+    pthread_cond_broadcast(&res->cond);
+    pthread_mutex_unlock(&res->lock);
+}
+
+/* Internal: the pipelined control connection; only use it between device_hd_acquire() and device_hd_release() */
+struct control_pipe *device_pipe(py_device_object *self) {
+    return self->conn ? &self->conn->pipe : &self->pipe;
+}
+
+/* Internal: the control variable cache for this Device's physical device */
+struct var_cache *device_var_cache(py_device_object *self) {
+    return self->conn ? &self->conn->vcache : &self->vcache;
+}
+
+/* Internal: the tuner without touching the libhdhomerun handle, which another thread may hold */
+unsigned int device_tuner(py_device_object *self) {
+    return self->conn ? self->tuner : hdhomerun_device_get_tuner(self->hd);
+}
+
+/* Internal: binds a Device being initialized to a Connection */
+int device_connection_attach(py_device_object *self, PyObject *connection, unsigned int tuner) {
+    struct device_connection *conn = ((py_connection_object *)connection)->conn;
+
+    if(!conn) {
+        PyErr_SetString(PyExc_ValueError, "Connection is not initialized");
+        return -1;
+    }
+    Py_INCREF(connection);
+    self->connection = connection;
+    self->conn = conn;
+    self->tuner = tuner;
+    self->hd = conn->hd;
+    conn->handles++;
+    return 0;
+}
+
+/* Internal: called from the Device's dealloc */
+void device_connection_detach(py_device_object *self) {
+    if(!self->conn)
+        return;
+    self->conn->handles--;
+    self->conn = NULL;
+    self->hd = NULL;
+    Py_CLEAR(self->connection);
+}
+
+static int py_connection_init(py_connection_object *self, PyObject *args, PyObject *kwds) {
+    unsigned int device_id = HDHOMERUN_DEVICE_ID_WILDCARD;
+    unsigned int device_ip = 0;
+    char *kwlist[] = {"device_ip", "device_id", NULL};
+    struct device_connection *conn;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|II", kwlist, &device_ip, &device_id))
+        return -1;
+    if(self->conn) {
+        PyErr_SetString(PyExc_RuntimeError, "Connection is already initialized");
+        return -1;
+    }
+    if(device_ip == 0 && device_id == HDHOMERUN_DEVICE_ID_WILDCARD) {
+        PyErr_SetString(hdhomerun_device_error, "Insufficient information provided to initialize instance");
+        return -1;
+    }
+
+    conn = calloc(1, sizeof(*conn));
+    if(!conn) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if(var_cache_init(&conn->vcache) != 0) {
+        var_cache_free(&conn->vcache);
+        free(conn);
+        PyErr_NoMemory();
+        return -1;
+    }
+    conn->hd = hdhomerun_device_create(device_id, device_ip, 0, NULL);
+    if(!conn->hd) {
+        var_cache_free(&conn->vcache);
+        free(conn);
+        PyErr_SetString(hdhomerun_device_error, "Failed to initialize Device object");
+        return -1;
+    }
+    control_pipe_init(&conn->pipe);
+    conn->generation = fork_generation_current();
+    device_reservation_init(&conn->reservation);
+    self->conn = conn;
+    return 0;
+}
+
+static void py_connection_dealloc(py_connection_object *self) {
+    struct device_connection *conn = self->conn;
+
+    /* Every handle holds a reference, so none is left by now */
+    if(conn) {
+        connection_fork_check(conn);
+        hdhomerun_device_destroy(conn->hd);
+        control_pipe_release(&conn->pipe);
+        var_cache_free(&conn->vcache);
+        device_reservation_destroy(&conn->reservation);
+        free(conn);
+    }
+    self->ob_type->tp_free((PyObject*)self);
+}
+
+PyDoc_STRVAR(Connection_DOC_open,
+    "Return a Device for the given tuner which makes its requests through this\n"
+    "connection.");
+
+static PyObject *py_connection_open(py_connection_object *self, PyObject *args, PyObject *kwds) {
+    unsigned int tuner = 0;
+    char *kwlist[] = {"tuner", NULL};
+    PyObject *empty, *options, *device;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &tuner))
+        return NULL;
+    empty = PyTuple_New(0);
+    options = Py_BuildValue("{s:I,s:O}", "tuner", tuner, "connection", (PyObject *)self);
+    device = (empty && options) ? PyObject_Call((PyObject *)&hdhomerun_Device_type, empty, options) : NULL;
+    Py_XDECREF(empty);
+    Py_XDECREF(options);
+    return device;
+}
+
+PyDoc_STRVAR(Connection_DOC_stats,
+    "Return the device, the number of open handles and the connection state.");
+
+static PyObject *py_connection_stats(py_connection_object *self) {
+    struct device_connection *conn = self->conn;
+
+    if(!conn) {
+        PyErr_SetString(PyExc_ValueError, "Connection is not initialized");
+        return NULL;
+    }
+    connection_fork_check(conn);
+    return Py_BuildValue("{s:k,s:k,s:k,s:O,s:O}",
+                         "device_id", (unsigned long)hdhomerun_device_get_device_id(conn->hd),
+                         "device_ip", (unsigned long)hdhomerun_device_get_device_ip(conn->hd),
+                         "handles", conn->handles, "busy", conn->reservation.busy ? Py_True : Py_False,
+                         "pipelined", conn->pipe.connected ? Py_True : Py_False);
+}
+
+static PyMethodDef py_connection_methods[] = {
+    {"open",                    (PyCFunction)py_connection_open,                METH_KEYWORDS,              Connection_DOC_open},
+    {"stats",                   (PyCFunction)py_connection_stats,               METH_NOARGS,                Connection_DOC_stats},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_Connection_type_doc,
+    "Connection(device_ip, device_id)\n\n"
+    "A control connection to one physical device, shared by the Device handles\n"
+    "opened on it with open() or Device(tuner=n, connection=c).  Handles on a\n"
+    "connection cannot be pointed at another device and always stream through\n"
+    "the native receiver.");
+
+PyTypeObject hdhomerun_Connection_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.Connection",         /* tp_name */
+    sizeof(py_connection_object),   /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_connection_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    hdhomerun_Connection_type_doc,  /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_connection_methods,          /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    (initproc)py_connection_init,   /* tp_init */
+    (allocfunc)PyType_GenericAlloc, /* tp_alloc */
+    (newfunc)PyType_GenericNew,     /* tp_new */
+    (freefunc)PyObject_Del,         /* tp_free */
+};
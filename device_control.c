@@ -0,0 +1,518 @@
+/*
+ * device_control.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/*
+ *  libhdhomerun's control socket waits for each reply before sending the next
+ *  request.  The control protocol is a plain framed TCP stream which the
+ *  device answers in order, so a batch of requests can be written in one go
+ *  and the replies collected afterwards, costing a single round-trip.
+ *
+ *  Frames are built and checked with libhdhomerun's hdhomerun_pkt helpers.
+ *  Nothing in here touches Python state; callers may drop the GIL around it.
+ */
+
+#define CONTROL_FRAME_OVERHEAD 8    /* type, length and CRC */
+#define CONTROL_RX_BUFFER_SIZE 16384
+
+/* Upper bounds of the reply latency histogram, see device_exporter.c */
+const uint64_t control_latency_bounds_ns[CONTROL_LATENCY_BUCKETS] = {
+    1000000ULL, 2500000ULL, 5000000ULL, 10000000ULL, 25000000ULL, 50000000ULL,
+    100000000ULL, 250000000ULL, 500000000ULL, 1000000000ULL, 2500000000ULL, 5000000000ULL
+};
+
+void control_pipe_init(struct control_pipe *cp) {
+    cp->sock = -1;
+    cp->connected = 0;
+    cp->device_ip = 0;
+    pthread_mutex_init(&cp->stats_lock, NULL);
+    memset(&cp->stats, 0, sizeof(cp->stats));
+    memset(&cp->metrics, 0, sizeof(cp->metrics));
+}
+
+void control_pipe_close(struct control_pipe *cp) {
+    if(cp->connected)
+        close(cp->sock);
+    cp->sock = -1;
+    cp->connected = 0;
+}
+
+/* As control_pipe_close(), but also stops exporting the pipe's counters; call it before freeing the pipe */
+void control_pipe_release(struct control_pipe *cp) {
+    exporter_unregister(&cp->metrics);
+    control_pipe_close(cp);
+    pthread_mutex_destroy(&cp->stats_lock);
+}
+
+/* Internal: closes a pipe inherited across fork(); a thread of the parent may have held its lock */
+void control_pipe_after_fork(struct control_pipe *cp) {
+    control_pipe_close(cp);
+    pthread_mutex_init(&cp->stats_lock, NULL);
+}
+
+static void control_pipe_sample(void *owner, double *values) {
+    struct control_pipe *cp = owner;
+    const struct control_pipe_stats *stats = &cp->stats;
+    int i;
+
+    pthread_mutex_lock(&cp->stats_lock);
+    values[0] = (double)stats->requests;
+    values[1] = (double)stats->rejected;
+    values[2] = (double)stats->failures;
+    values[3] = (double)stats->timeouts;
+    values[4] = (double)stats->latency_sum_ns / 1e9;
+    values[5] = (double)stats->latency_count;
+    for(i = 0; i < CONTROL_LATENCY_BUCKETS; i++)
+        values[6 + i] = (double)stats->latency_buckets[i];
+    pthread_mutex_unlock(&cp->stats_lock);
+}
+
+/* Internal: updates the exported counters and traces each op */
+static void control_pipe_account(struct control_pipe *cp, uint32_t device_ip, struct control_op *ops, size_t count,
+                                 uint64_t start_ns, int rv) {
+    struct control_pipe_stats *stats = &cp->stats;
+    uint64_t latency_ns;
+    size_t i;
+    int b;
+
+    pthread_mutex_lock(&cp->stats_lock);
+    stats->requests += count;
+    if(rv == -1)
+        stats->failures++;
+    else if(rv == -2)
+        stats->timeouts++;
+    for(i = 0; i < count; i++) {
+        if(ops[i].result == -1) {
+            trace_event(ops[i].value ? TRACE_CONTROL_SET : TRACE_CONTROL_GET, 0, device_ip, TRACE_NO_TUNER,
+                        ops[i].name, rv, monotonic_ns() - start_ns);
+            continue;
+        }
+        trace_event(ops[i].value ? TRACE_CONTROL_SET : TRACE_CONTROL_GET, 0, device_ip, TRACE_NO_TUNER,
+                    ops[i].name, ops[i].result, ops[i].done_ns - start_ns);
+        if(ops[i].result == 0)
+            stats->rejected++;
+        latency_ns = ops[i].done_ns - start_ns;
+        for(b = 0; b < CONTROL_LATENCY_BUCKETS && latency_ns > control_latency_bounds_ns[b]; b++)
+            ;
+        stats->latency_buckets[b]++;
+        stats->latency_sum_ns += latency_ns;
+        stats->latency_count++;
+    }
+    pthread_mutex_unlock(&cp->stats_lock);
+}
+
+static int time_left_ms(uint64_t deadline_ns) {
+    uint64_t now = monotonic_ns();
+
+    if(now >= deadline_ns)
+        return 0;
+    return (int)((deadline_ns - now + 999999ULL) / 1000000ULL);
+}
+
+/* Returns 1 when connected, -1 on error and -2 when the deadline passed */
+static int control_pipe_connect(struct control_pipe *cp, uint32_t device_ip, uint64_t deadline_ns) {
+    struct sockaddr_in addr;
+    struct pollfd pfd;
+    socklen_t optlen;
+    int sock, err, one = 1;
+
+    control_pipe_close(cp);
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if(sock < 0)
+        return -1;
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(device_ip);
+    addr.sin_port = htons(HDHOMERUN_CONTROL_TCP_PORT);
+
+    if(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        if(errno != EINPROGRESS) {
+            close(sock);
+            return -1;
+        }
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        err = poll(&pfd, 1, time_left_ms(deadline_ns));
+        if(err <= 0) {
+            close(sock);
+            return err == 0 ? -2 : -1;
+        }
+        optlen = sizeof(err);
+        if(getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &optlen) != 0 || err != 0) {
+            close(sock);
+            return -1;
+        }
+    }
+
+    cp->sock = sock;
+    cp->connected = 1;
+    cp->device_ip = device_ip;
+    if(!cp->metrics.registered) {
+        char labels[EXPORTER_LABELS_MAX];
+
+        snprintf(labels, sizeof(labels), "ip=\"%u.%u.%u.%u\"", (device_ip >> 24) & 0xFF,
+                 (device_ip >> 16) & 0xFF, (device_ip >> 8) & 0xFF, device_ip & 0xFF);
+        exporter_register(&cp->metrics, EXPORTER_CONTROL, cp, control_pipe_sample, labels);
+    }
+    return 1;
+}
+
+/* Returns 0 if the request does not fit in one frame, as libhdhomerun refuses it too */
+static int control_write_request(struct hdhomerun_pkt_t *pkt, struct control_op *op, uint32_t lockkey) {
+    size_t name_len = strlen(op->name) + 1;
+    size_t value_len = op->value ? strlen(op->value) + 1 : 0;
+
+    hdhomerun_pkt_reset(pkt);
+    /* Tag and length for each item, plus the lock key */
+    if(name_len + 3 + (op->value ? value_len + 3 + 6 : 0) > (size_t)(pkt->limit - pkt->end))
+        return 0;
+    hdhomerun_pkt_write_u8(pkt, HDHOMERUN_TAG_GETSET_NAME);
+    hdhomerun_pkt_write_var_length(pkt, name_len);
+    hdhomerun_pkt_write_mem(pkt, (const void *)op->name, name_len);
+    if(op->value) {
+        hdhomerun_pkt_write_u8(pkt, HDHOMERUN_TAG_GETSET_VALUE);
+        hdhomerun_pkt_write_var_length(pkt, value_len);
+        hdhomerun_pkt_write_mem(pkt, (const void *)op->value, value_len);
+        if(lockkey != 0) {
+            hdhomerun_pkt_write_u8(pkt, HDHOMERUN_TAG_GETSET_LOCKKEY);
+            hdhomerun_pkt_write_var_length(pkt, 4);
+            hdhomerun_pkt_write_u32(pkt, lockkey);
+        }
+    }
+    hdhomerun_pkt_seal_frame(pkt, HDHOMERUN_TYPE_GETSET_REQ);
+    return 1;
+}
+
+/* Returns 1 if the frame was a well formed GETSET reply */
+static int control_parse_reply(struct hdhomerun_pkt_t *pkt, struct control_op *op) {
+    uint16_t type;
+    uint8_t tag;
+    size_t len;
+    uint8_t *next;
+
+    if(hdhomerun_pkt_open_frame(pkt, &type) != 1 || type != HDHOMERUN_TYPE_GETSET_RPY)
+        return 0;
+
+    op->result = 1;
+    op->reply[0] = '\0';
+    op->text = op->reply;
+    while(pkt->pos < pkt->end) {
+        next = hdhomerun_pkt_read_tlv(pkt, &tag, &len);
+        if(!next)
+            break;
+        if(tag == HDHOMERUN_TAG_GETSET_VALUE || tag == HDHOMERUN_TAG_ERROR_MESSAGE) {
+            /* Never hand back a truncated value */
+            if(len >= sizeof(op->reply))
+                return 0;
+            memcpy(op->reply, pkt->pos, len);
+            op->reply[len] = '\0';
+            if(tag == HDHOMERUN_TAG_ERROR_MESSAGE)
+                op->result = 0;
+        }
+        pkt->pos = next;
+    }
+    return 1;
+}
+
+/* *psent counts the bytes handed to the kernel, whatever the outcome */
+static int control_send_all(int sock, const uint8_t *data, size_t length, uint64_t deadline_ns, size_t *psent) {
+    struct pollfd pfd;
+    ssize_t sent;
+    int ready;
+
+    while(length > 0) {
+        sent = send(sock, data, length, MSG_NOSIGNAL);
+        if(sent > 0) {
+            data += sent;
+            length -= (size_t)sent;
+            *psent += (size_t)sent;
+            continue;
+        }
+        if(sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        ready = poll(&pfd, 1, time_left_ms(deadline_ns));
+        if(ready == 0)
+            return -2;
+        if(ready < 0 && errno != EINTR)
+            return -1;
+    }
+    return 1;
+}
+
+/*
+ *  Sends every op and reads the replies back in order; *psent counts request
+ *  bytes sent and *preceived the replies parsed.
+ */
+static int control_exchange(struct control_pipe *cp, uint32_t lockkey, struct control_op *ops, size_t count,
+                            uint64_t deadline_ns, size_t *psent, size_t *preceived) {
+    struct hdhomerun_pkt_t *pkt;
+    uint8_t *tx, *rx;
+    size_t tx_len = 0, tx_size = 0, rx_len = 0, frame_len, i;
+    struct pollfd pfd;
+    ssize_t got;
+    int rv = 1, ready;
+
+    *psent = 0;
+    *preceived = 0;
+    pkt = hdhomerun_pkt_create();
+    if(!pkt)
+        return -1;
+
+    for(i = 0; i < count; i++)
+        tx_size += strlen(ops[i].name) + (ops[i].value ? strlen(ops[i].value) : 0) + 32;
+    tx = malloc(tx_size);
+    rx = malloc(CONTROL_RX_BUFFER_SIZE);
+    if(!tx || !rx) {
+        rv = -1;
+        goto done;
+    }
+
+    for(i = 0; i < count; i++) {
+        ops[i].result = -1;
+        if(!control_write_request(pkt, &ops[i], lockkey)) {
+            rv = -1;
+            goto done;
+        }
+        if((size_t)(pkt->end - pkt->start) > tx_size - tx_len) {
+            rv = -1;
+            goto done;
+        }
+        memcpy(tx + tx_len, pkt->start, (size_t)(pkt->end - pkt->start));
+        tx_len += (size_t)(pkt->end - pkt->start);
+    }
+
+    rv = control_send_all(cp->sock, tx, tx_len, deadline_ns, psent);
+    if(rv != 1)
+        goto done;
+
+    while(*preceived < count) {
+        /* Hand each complete frame in the stream to libhdhomerun for CRC checking */
+        if(rx_len >= 4) {
+            frame_len = (((size_t)rx[2] << 8) | (size_t)rx[3]) + CONTROL_FRAME_OVERHEAD;
+            hdhomerun_pkt_reset(pkt);
+            if(frame_len > (size_t)(pkt->limit - pkt->start)) {
+                rv = -1;
+                goto done;
+            }
+            if(rx_len >= frame_len) {
+                hdhomerun_pkt_write_mem(pkt, rx, frame_len);
+                if(!control_parse_reply(pkt, &ops[*preceived])) {
+                    rv = -1;
+                    goto done;
+                }
+                ops[*preceived].done_ns = monotonic_ns();
+                (*preceived)++;
+                memmove(rx, rx + frame_len, rx_len - frame_len);
+                rx_len -= frame_len;
+                continue;
+            }
+        }
+
+        got = recv(cp->sock, rx + rx_len, CONTROL_RX_BUFFER_SIZE - rx_len, 0);
+        if(got > 0) {
+            rx_len += (size_t)got;
+            continue;
+        }
+        if(got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            rv = -1;
+            goto done;
+        }
+        pfd.fd = cp->sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        ready = poll(&pfd, 1, time_left_ms(deadline_ns));
+        if(ready == 0) {
+            rv = -2;
+            goto done;
+        }
+        if(ready < 0 && errno != EINTR) {
+            rv = -1;
+            goto done;
+        }
+    }
+
+done:
+    free(tx);
+    free(rx);
+    hdhomerun_pkt_destroy(pkt);
+    return rv;
+}
+
+/* Returns 0 if the device has closed an idle connection, or it is otherwise unusable */
+static int control_pipe_alive(struct control_pipe *cp) {
+    struct pollfd pfd;
+    uint8_t byte;
+
+    pfd.fd = cp->sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if(poll(&pfd, 1, 0) == 0)
+        return 1;
+    if(pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+        return 0;
+    /* Nothing is outstanding on an idle pipe, so readable means end of stream or stray data */
+    return recv(cp->sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/*
+ *  Runs a batch of get (value == NULL) and set requests against the device.
+ *  Returns 1 once every reply has arrived (each op->result is then 1 or 0,
+ *  with op->reply holding the value or the device's error message), -1 on a
+ *  communication error and -2 if timeout_ms expired first.
+ */
+int control_pipe_execute(struct control_pipe *cp, uint32_t device_ip, uint32_t lockkey,
+                         struct control_op *ops, size_t count, unsigned int timeout_ms) {
+    uint64_t start_ns = monotonic_ns();
+    uint64_t deadline_ns = start_ns + (uint64_t)timeout_ms * 1000000ULL;
+    size_t sent, received, i;
+    int reused, rv;
+
+    if(device_ip == 0)
+        return -1;
+    for(i = 0; i < count; i++) {
+        ops[i].result = -1;
+        ops[i].reply[0] = '\0';
+        ops[i].text = ops[i].reply;
+    }
+    if(cp->connected && (cp->device_ip != device_ip || !control_pipe_alive(cp)))
+        control_pipe_close(cp);
+
+    reused = cp->connected;
+    if(!reused) {
+        rv = control_pipe_connect(cp, device_ip, deadline_ns);
+        if(rv != 1) {
+            control_pipe_account(cp, device_ip, ops, count, start_ns, rv);
+            return rv;
+        }
+    }
+
+    rv = control_exchange(cp, lockkey, ops, count, deadline_ns, &sent, &received);
+    if(rv == -1 && reused && sent == 0) {
+        /*
+         *  The device may have dropped an idle connection (e.g. after a reboot).
+         *  Only a batch which never left is retried: once any of it was sent, a
+         *  set may already have been applied.
+         */
+        rv = control_pipe_connect(cp, device_ip, deadline_ns);
+        if(rv == 1)
+            rv = control_exchange(cp, lockkey, ops, count, deadline_ns, &sent, &received);
+    }
+    if(rv != 1)
+        control_pipe_close(cp);
+    control_pipe_account(cp, device_ip, ops, count, start_ns, rv);
+    return rv;
+}
+
+/*
+ *  Bounded control requests on behalf of a Device.  libhdhomerun's control
+ *  socket waits out its own multi-second timeout when a device stops
+ *  answering; a request with a timeout goes through the pipelined
+ *  connection instead, which gives up when the deadline passes.
+ */
+
+/*
+ *  Internal: one get (op->value == NULL) or set.  With timeout_ms the pipe is
+ *  used and the GIL is released while waiting, otherwise libhdhomerun is.
+ *  Returns 1 with op->text pointing at the value, 0 with op->text pointing at
+ *  the device's error message (possibly empty), -1 on a communication error
+ *  and -2 on timeout.  Without a timeout op->text is libhdhomerun's buffer,
+ *  so use it before the handle makes another request.
+ */
+int device_control_var(py_device_object *self, struct control_op *op, unsigned int timeout_ms) {
+    struct hdhomerun_device_t *hd;
+    char *value = NULL, *error = NULL;
+    uint64_t start_ns;
+    uint32_t device_ip;
+    int success;
+
+    if(timeout_ms == 0) {
+        start_ns = monotonic_ns();
+        if(op->value)
+            success = hdhomerun_device_set_var(device_hd(self), op->name, op->value, &value, &error);
+        else
+            success = hdhomerun_device_get_var(device_hd(self), op->name, &value, &error);
+        op->done_ns = monotonic_ns();
+        trace_device(self, op->value ? TRACE_SET_VAR : TRACE_GET_VAR, op->name, success, op->done_ns - start_ns);
+        op->result = (success == 1 || success == 0) ? success : -1;
+        op->text = (success == 1 && value) ? value : (success == 0 && error) ? error : "";
+        return success;
+    }
+
+    hd = device_hd_acquire(self);
+    device_ip = hdhomerun_device_get_device_ip(hd);
+    Py_BEGIN_ALLOW_THREADS
+    success = control_pipe_execute(device_pipe(self), device_ip, self->lockkey, op, 1, timeout_ms);
+    device_hd_release(self);
+    Py_END_ALLOW_THREADS
+    if(success == 1 && op->result != 1)
+        success = 0;
+    return success;
+}
+
+/* Internal: raises the exception for a failed control request; rejected is used when the device gave no reason */
+PyObject *device_control_error(int success, const char *rejected) {
+    if(success == -1)
+        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+    else if(success == -2)
+        PyErr_SetString(hdhomerun_timeout_error, DEVICE_ERR_TIMEOUT);
+    else if(success == 0)
+        PyErr_SetString(hdhomerun_device_error, rejected);
+    else
+        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
+    return NULL;
+}
+
+const char Device_DOC_set_control_timeout[] =
+    "Set the default timeout_ms for this Device's get and set methods.  A\n"
+    "request which gets no reply in time raises hdhomerun.TimeoutError, a\n"
+    "subclass of IOError.  0 (the default) leaves requests to libhdhomerun,\n"
+    "which only gives up after several seconds.";
+PyObject *py_device_set_control_timeout(py_device_object *self, PyObject *args, PyObject *kwds) {
+    unsigned int timeout_ms = 0;
+    char *kwlist[] = {"timeout_ms", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "I", kwlist, &timeout_ms))
+        return NULL;
+    self->control_timeout_ms = timeout_ms;
+    Py_RETURN_NONE;
+}
+
+const char Device_DOC_get_control_timeout[] = "Get the default timeout_ms for this Device's get and set methods.";
+PyObject *py_device_get_control_timeout(py_device_object *self) {
+    return PyLong_FromUnsignedLong((unsigned long)self->control_timeout_ms);
+}
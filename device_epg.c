@@ -0,0 +1,1237 @@
+/*
+ * device_epg.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  Program guide stage.  Sections are assembled on the ATSC PSIP base PID
+ *  (MGT, VCT and STT), on the EIT and ETT PIDs the MGT names, and on the DVB
+ *  EIT PID.  Each table section is identified by its table_id, extension
+ *  and section number; once its header is in, a section whose version was
+ *  already seen is skipped without being copied or checked, so a mux whose
+ *  guide is not changing costs little more than a PID lookup per packet.
+ *  New sections are CRC checked, parsed, and turned into compact records on
+ *  a queue for Python.  A change of transport_stream_id in the PAT (a
+ *  retune) starts over.
+ *
+ *  ATSC text is decoded to UTF-8 here; DVB text is passed on with the name
+ *  of its character table and decoded when Python collects it.
+ */
+
+#define EPG_MAX_PIDS 64
+#define EPG_SECTION_MAX 4096
+#define EPG_HEADER_SIZE 14          /* enough to identify any section we follow */
+#define EPG_STRING_MAX 16384
+#define EPG_QUEUE_LIMIT 16384
+#define EPG_VERSIONS_INITIAL 1024
+#define EPG_VERSIONS_MAX (1 << 20)
+
+#define EPG_PSIP_PID 0x1FFB
+#define EPG_DVB_EIT_PID 0x0012
+#define EPG_GPS_EPOCH 315964800     /* 1980-01-06T00:00:00Z as Unix time */
+#define EPG_GPS_UTC_OFFSET 18       /* leap seconds, used until an STT is seen */
+#define EPG_MJD_EPOCH 40587         /* 1970-01-01 as a Modified Julian Date */
+
+#define EPG_ROLE_PSIP       1
+#define EPG_ROLE_ATSC_EIT   2
+#define EPG_ROLE_ATSC_ETT   3
+#define EPG_ROLE_DVB_EIT    4
+
+#define EPG_RECORD_EVENT    1
+#define EPG_RECORD_TEXT     2
+#define EPG_RECORD_CHANNEL  3
+
+#define EPG_FLAG_DVB        0x01
+#define EPG_FLAG_FREE_CA    0x02
+#define EPG_FLAG_SCHEDULE   0x04    /* DVB schedule rather than present/following */
+#define EPG_FLAG_OTHER      0x08    /* DVB table for another transport stream */
+#define EPG_FLAG_HIDDEN     0x10
+#define EPG_FLAG_UNDECODED  0x20    /* ATSC text used a compression we do not decode */
+
+#define EPG_ENC_UTF8        0
+#define EPG_ENC_UTF16       1
+#define EPG_ENC_GB2312      2
+#define EPG_ENC_BIG5        3
+#define EPG_ENC_EUC_KR      4
+#define EPG_ENC_ISO8859     16      /* + part number */
+
+#define EPG_NO_DURATION 0xFFFFFFFF
+
+/* What goes on the queue: a fixed header followed by up to three strings */
+struct epg_record {
+    uint8_t type;
+    uint8_t table_id;
+    uint8_t version;
+    uint8_t status;             /* ETM_location, DVB running_status or VCT service_type */
+    uint8_t flags;
+    char language[3];
+    uint16_t pid;
+    uint16_t source_id;         /* ATSC source_id or DVB service_id */
+    uint16_t transport_stream_id;
+    uint16_t original_network_id;
+    uint16_t major;
+    uint16_t minor;
+    uint16_t program_number;
+    int32_t event_id;           /* -1 for a channel's own text */
+    uint32_t duration;          /* seconds, or EPG_NO_DURATION */
+    int64_t start;              /* Unix time, or -1 when undefined */
+    uint8_t encoding[3];        /* title, text, extended text */
+    uint16_t length[3];
+    uint8_t data[];
+};
+
+struct epg_assembler {
+    uint16_t pid;
+    uint8_t role;
+    int cc;                     /* -1 until the first packet */
+    int active;                 /* a section is being collected */
+    int checked;                /* its header has been looked at */
+    int skip;                   /* ... and it does not need collecting */
+    size_t have;
+    size_t total;
+    uint8_t buffer[EPG_SECTION_MAX];
+};
+
+struct epg_versions {
+    uint64_t *keys;             /* 0 marks an empty slot; table_id is never 0 here */
+    uint8_t *versions;
+    size_t size;
+    size_t count;
+};
+
+struct epg_counters {
+    unsigned long long sections;
+    unsigned long long duplicates;
+    unsigned long crc_errors;
+    unsigned long continuity_errors;
+    unsigned long events;
+    unsigned long texts;
+    unsigned long channels;
+    unsigned long undecoded;
+    unsigned long mux_changes;
+    int have_stt;
+    uint32_t stt_gps;
+    uint8_t gps_utc_offset;
+    int have_tsid;
+    uint16_t tsid;
+};
+
+struct epg_collector {
+    struct stream_stage stage;
+    pthread_mutex_t lock;
+
+    /* Only touched by the stage, except that lock protects the PIDs and roles */
+    uint8_t pid_slot[TS_PID_COUNT];     /* PID -> 1 + index into assemblers */
+    struct epg_assembler assemblers[EPG_MAX_PIDS];
+    struct epg_versions versions;
+    struct epg_counters counters;
+    struct epg_record *record;
+    size_t record_used;
+
+    struct event_queue queue;
+
+    /* Protected by lock */
+    struct epg_counters published;
+};
+
+typedef struct {
+    PyObject_HEAD
+    py_device_object *device;
+    struct epg_collector *epg;
+    int attached;
+} py_epg_collector_object;
+
+static uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static unsigned int bcd(uint8_t b) {
+    return (unsigned int)((b >> 4) * 10 + (b & 0x0F));
+}
+
+/*
+ *  Section versions
+ */
+
+static size_t epg_version_slot(const struct epg_versions *v, uint64_t key) {
+    size_t i = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (v->size - 1);
+
+    while(v->keys[i] != 0 && v->keys[i] != key)
+        i = (i + 1) & (v->size - 1);
+    return i;
+}
+
+static int epg_version_seen(const struct epg_versions *v, uint64_t key, uint8_t version) {
+    size_t i;
+
+    if(!v->keys)
+        return 0;
+    i = epg_version_slot(v, key);
+    return v->keys[i] == key && v->versions[i] == version;
+}
+
+static int epg_versions_resize(struct epg_versions *v, size_t size) {
+    struct epg_versions grown;
+    size_t i, j;
+
+    grown.keys = calloc(size, sizeof(*grown.keys));
+    grown.versions = calloc(size, sizeof(*grown.versions));
+    if(!grown.keys || !grown.versions) {
+        free(grown.keys);
+        free(grown.versions);
+        return -1;
+    }
+    grown.size = size;
+    grown.count = v->count;
+    for(i = 0; i < v->size; i++) {
+        if(v->keys[i] == 0)
+            continue;
+        j = epg_version_slot(&grown, v->keys[i]);
+        grown.keys[j] = v->keys[i];
+        grown.versions[j] = v->versions[i];
+    }
+    free(v->keys);
+    free(v->versions);
+    *v = grown;
+    return 0;
+}
+
+/* Without memory to grow into, sections are simply parsed again each time they come round */
+static void epg_version_store(struct epg_versions *v, uint64_t key, uint8_t version) {
+    size_t i;
+
+    if(!v->keys || v->count * 2 >= v->size) {
+        if(v->size >= EPG_VERSIONS_MAX || epg_versions_resize(v, v->size ? v->size * 2 : EPG_VERSIONS_INITIAL) != 0)
+            return;
+    }
+    i = epg_version_slot(v, key);
+    if(v->keys[i] == 0) {
+        v->keys[i] = key;
+        v->count++;
+    }
+    v->versions[i] = version;
+}
+
+static void epg_versions_clear(struct epg_versions *v) {
+    if(!v->keys)
+        return;
+    memset(v->keys, 0, v->size * sizeof(*v->keys));
+    v->count = 0;
+}
+
+/*
+ *  PIDs
+ */
+
+static void epg_assembler_reset(struct epg_assembler *a) {
+    a->cc = -1;
+    a->active = 0;
+}
+
+static void epg_follow(struct epg_collector *epg, uint16_t pid, uint8_t role) {
+    unsigned int i;
+
+    if(epg->pid_slot[pid])
+        return;
+    for(i = 0; i < EPG_MAX_PIDS; i++) {
+        if(epg->assemblers[i].role == 0)
+            break;
+    }
+    if(i == EPG_MAX_PIDS)
+        return;
+    pthread_mutex_lock(&epg->lock);
+    epg->assemblers[i].pid = pid;
+    epg->assemblers[i].role = role;
+    epg_assembler_reset(&epg->assemblers[i]);
+    epg->pid_slot[pid] = (uint8_t)(i + 1);
+    pthread_mutex_unlock(&epg->lock);
+}
+
+/* Forgets the EIT and ETT PIDs learned from an MGT */
+static void epg_forget_atsc_pids(struct epg_collector *epg) {
+    struct epg_assembler *a;
+    unsigned int i;
+
+    pthread_mutex_lock(&epg->lock);
+    for(i = 0; i < EPG_MAX_PIDS; i++) {
+        a = &epg->assemblers[i];
+        if(a->role != EPG_ROLE_ATSC_EIT && a->role != EPG_ROLE_ATSC_ETT)
+            continue;
+        epg->pid_slot[a->pid] = 0;
+        a->role = 0;
+    }
+    pthread_mutex_unlock(&epg->lock);
+}
+
+static void epg_reset(struct epg_collector *epg) {
+    unsigned int i;
+
+    epg_forget_atsc_pids(epg);
+    for(i = 0; i < EPG_MAX_PIDS; i++)
+        epg_assembler_reset(&epg->assemblers[i]);
+    epg_versions_clear(&epg->versions);
+    epg->counters.have_stt = 0;
+}
+
+/*
+ *  Records
+ */
+
+static void epg_record_begin(struct epg_collector *epg, uint8_t type, const uint8_t *section, uint16_t pid) {
+    struct epg_record *rec = epg->record;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->type = type;
+    rec->table_id = section[0];
+    rec->version = (section[5] >> 1) & 0x1F;
+    rec->pid = pid;
+    rec->event_id = -1;
+    rec->duration = EPG_NO_DURATION;
+    rec->start = -1;
+    epg->record_used = 0;
+}
+
+/* Appends to string n of the record being built, which must be the last one started */
+static void epg_record_append(struct epg_collector *epg, int n, const uint8_t *data, size_t length) {
+    struct epg_record *rec = epg->record;
+
+    if(length > EPG_STRING_MAX - epg->record_used)
+        length = EPG_STRING_MAX - epg->record_used;
+    if(length > (size_t)(UINT16_MAX - rec->length[n]))
+        length = (size_t)(UINT16_MAX - rec->length[n]);
+    memcpy(rec->data + epg->record_used, data, length);
+    epg->record_used += length;
+    rec->length[n] += (uint16_t)length;
+}
+
+static void epg_record_emit(struct epg_collector *epg) {
+    struct epg_record *rec = epg->record;
+
+    if(rec->flags & EPG_FLAG_UNDECODED)
+        epg->counters.undecoded++;
+    if(rec->type == EPG_RECORD_EVENT)
+        epg->counters.events++;
+    else if(rec->type == EPG_RECORD_TEXT)
+        epg->counters.texts++;
+    else
+        epg->counters.channels++;
+    event_queue_push(&epg->queue, rec, sizeof(*rec) + epg->record_used);
+}
+
+static size_t utf8_put(uint8_t *out, uint32_t cp) {
+    if(cp < 0x80) {
+        out[0] = (uint8_t)cp;
+        return 1;
+    } else if(cp < 0x800) {
+        out[0] = (uint8_t)(0xC0 | (cp >> 6));
+        out[1] = (uint8_t)(0x80 | (cp & 0x3F));
+        return 2;
+    } else if(cp < 0x10000) {
+        out[0] = (uint8_t)(0xE0 | (cp >> 12));
+        out[1] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (uint8_t)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (uint8_t)(0xF0 | (cp >> 18));
+    out[1] = (uint8_t)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (uint8_t)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+static void epg_record_codepoint(struct epg_collector *epg, int n, uint32_t cp) {
+    uint8_t utf8[4];
+
+    if(cp == 0)
+        return;
+    epg_record_append(epg, n, utf8, utf8_put(utf8, cp));
+}
+
+/*
+ *  Decodes the first string of an ATSC multiple_string_structure (A/65 6.10)
+ *  into string n as UTF-8.  Segments using the Huffman compression of Annex C
+ *  or SCSU are skipped and flagged.
+ */
+static void epg_atsc_string(struct epg_collector *epg, int n, const uint8_t *p, size_t length) {
+    struct epg_record *rec = epg->record;
+    unsigned int segments, compression, mode, count, i;
+    uint32_t cp, low;
+    size_t pos;
+
+    rec->encoding[n] = EPG_ENC_UTF8;
+    if(length < 5 || p[0] == 0)
+        return;
+    memcpy(rec->language, p + 1, 3);
+    segments = p[4];
+    for(pos = 5; segments > 0 && pos + 3 <= length; segments--) {
+        compression = p[pos];
+        mode = p[pos + 1];
+        count = p[pos + 2];
+        pos += 3;
+        if(pos + count > length)
+            break;
+        if(compression == 0 && mode <= 0x33) {
+            /* The mode selects the upper byte of each UTF-16 code unit */
+            for(i = 0; i < count; i++)
+                epg_record_codepoint(epg, n, (mode << 8) | p[pos + i]);
+        } else if(compression == 0 && mode == 0x3F) {
+            for(i = 0; i + 1 < count; i += 2) {
+                cp = ((uint32_t)p[pos + i] << 8) | p[pos + i + 1];
+                if(cp >= 0xD800 && cp < 0xDC00 && i + 3 < count) {
+                    low = ((uint32_t)p[pos + i + 2] << 8) | p[pos + i + 3];
+                    if(low >= 0xDC00 && low < 0xE000) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        i += 2;
+                    }
+                }
+                epg_record_codepoint(epg, n, cp);
+            }
+        } else {
+            rec->flags |= EPG_FLAG_UNDECODED;
+        }
+        pos += count;
+    }
+}
+
+/* Works out a DVB string's character table (EN 300 468 Annex A); returns the length of the selector */
+static size_t epg_dvb_charset(const uint8_t *p, size_t length, uint8_t *pencoding) {
+    unsigned int part;
+
+    /* The default table is ISO/IEC 6937, which Latin-1 matches for everything but accents */
+    *pencoding = EPG_ENC_ISO8859 + 1;
+    if(length == 0 || p[0] >= 0x20)
+        return 0;
+    switch(p[0]) {
+    case 0x10:
+        if(length < 3)
+            return length;
+        part = p[2];
+        if(part >= 1 && part <= 16 && part != 12)
+            *pencoding = (uint8_t)(EPG_ENC_ISO8859 + part);
+        return 3;
+    case 0x11:
+        *pencoding = EPG_ENC_UTF16;
+        return 1;
+    case 0x12:
+        *pencoding = EPG_ENC_EUC_KR;
+        return 1;
+    case 0x13:
+        *pencoding = EPG_ENC_GB2312;
+        return 1;
+    case 0x14:
+        *pencoding = EPG_ENC_BIG5;
+        return 1;
+    case 0x15:
+        *pencoding = EPG_ENC_UTF8;
+        return 1;
+    default:
+        /* 0x01 to 0x0B are ISO/IEC 8859-5 to 8859-15 */
+        if(p[0] <= 0x0B && p[0] != 0x08)
+            *pencoding = (uint8_t)(EPG_ENC_ISO8859 + 4 + p[0]);
+        return 1;
+    }
+}
+
+/* Appends a DVB string to string n; the first piece decides the character table */
+static void epg_dvb_string(struct epg_collector *epg, int n, const uint8_t *p, size_t length) {
+    struct epg_record *rec = epg->record;
+    uint8_t encoding, newline = '\n';
+    size_t skip, i, run;
+
+    skip = epg_dvb_charset(p, length, &encoding);
+    if(rec->length[n] == 0)
+        rec->encoding[n] = encoding;
+    p += skip;
+    length -= skip;
+    if(rec->encoding[n] < EPG_ENC_ISO8859) {
+        epg_record_append(epg, n, p, length);
+        return;
+    }
+    /* Single byte tables use 0x80 to 0x9F for emphasis and line breaks */
+    for(i = 0; i < length; i += run) {
+        if(p[i] >= 0x80 && p[i] <= 0x9F) {
+            if(p[i] == 0x8A)
+                epg_record_append(epg, n, &newline, 1);
+            run = 1;
+            continue;
+        }
+        for(run = 1; i + run < length && !(p[i + run] >= 0x80 && p[i + run] <= 0x9F); run++)
+            ;
+        epg_record_append(epg, n, p + i, run);
+    }
+}
+
+/*
+ *  Table parsers; sections arrive complete and CRC checked
+ */
+
+static void epg_atsc_mgt(struct epg_collector *epg, const uint8_t *s, size_t end) {
+    unsigned int tables, type;
+    uint16_t pid;
+    size_t pos;
+
+    epg_forget_atsc_pids(epg);
+    tables = ((unsigned int)s[9] << 8) | s[10];
+    for(pos = 11; tables > 0 && pos + 11 <= end; tables--) {
+        type = ((unsigned int)s[pos] << 8) | s[pos + 1];
+        pid = (uint16_t)(((s[pos + 2] & 0x1F) << 8) | s[pos + 3]);
+        if(type >= 0x0100 && type <= 0x017F)
+            epg_follow(epg, pid, EPG_ROLE_ATSC_EIT);
+        else if(type >= 0x0200 && type <= 0x027F)
+            epg_follow(epg, pid, EPG_ROLE_ATSC_ETT);
+        pos += 11 + (((size_t)(s[pos + 9] & 0x0F) << 8) | s[pos + 10]);
+    }
+}
+
+static void epg_atsc_vct(struct epg_collector *epg, const uint8_t *s, size_t end, uint16_t pid) {
+    struct epg_record *rec = epg->record;
+    unsigned int channels, i;
+    size_t pos;
+
+    channels = s[9];
+    for(pos = 10; channels > 0 && pos + 32 <= end; channels--) {
+        epg_record_begin(epg, EPG_RECORD_CHANNEL, s, pid);
+        rec->encoding[0] = EPG_ENC_UTF8;
+        /* short_name is seven UTF-16 code units, padded with NULs */
+        for(i = 0; i < 14; i += 2)
+            epg_record_codepoint(epg, 0, ((uint32_t)s[pos + i] << 8) | s[pos + i + 1]);
+        rec->major = (uint16_t)(((s[pos + 14] & 0x0F) << 6) | (s[pos + 15] >> 2));
+        rec->minor = (uint16_t)(((s[pos + 15] & 0x03) << 8) | s[pos + 16]);
+        rec->transport_stream_id = (uint16_t)((s[pos + 22] << 8) | s[pos + 23]);
+        rec->program_number = (uint16_t)((s[pos + 24] << 8) | s[pos + 25]);
+        if(s[pos + 26] & 0x10)
+            rec->flags |= EPG_FLAG_HIDDEN;
+        rec->status = s[pos + 27] & 0x3F;
+        rec->source_id = (uint16_t)((s[pos + 28] << 8) | s[pos + 29]);
+        epg_record_emit(epg);
+        pos += 32 + (((size_t)(s[pos + 30] & 0x03) << 8) | s[pos + 31]);
+    }
+}
+
+static void epg_atsc_stt(struct epg_collector *epg, const uint8_t *s, size_t end) {
+    if(end < 14)
+        return;
+    epg->counters.have_stt = 1;
+    epg->counters.stt_gps = get_be32(s + 9);
+    epg->counters.gps_utc_offset = s[13];
+}
+
+static int64_t epg_gps_to_unix(struct epg_collector *epg, uint32_t gps) {
+    unsigned int offset = epg->counters.have_stt ? epg->counters.gps_utc_offset : EPG_GPS_UTC_OFFSET;
+
+    return (int64_t)gps + EPG_GPS_EPOCH - offset;
+}
+
+static void epg_atsc_eit(struct epg_collector *epg, const uint8_t *s, size_t end, uint16_t pid) {
+    struct epg_record *rec = epg->record;
+    unsigned int events, title_length;
+    size_t pos;
+
+    events = s[9];
+    for(pos = 10; events > 0 && pos + 10 <= end; events--) {
+        epg_record_begin(epg, EPG_RECORD_EVENT, s, pid);
+        rec->source_id = (uint16_t)((s[3] << 8) | s[4]);
+        rec->event_id = ((s[pos] & 0x3F) << 8) | s[pos + 1];
+        rec->start = epg_gps_to_unix(epg, get_be32(s + pos + 2));
+        rec->status = (s[pos + 6] >> 4) & 0x03;
+        rec->duration = ((uint32_t)(s[pos + 6] & 0x0F) << 16) | ((uint32_t)s[pos + 7] << 8) | s[pos + 8];
+        title_length = s[pos + 9];
+        pos += 10;
+        if(pos + title_length + 2 > end)
+            break;
+        epg_atsc_string(epg, 0, s + pos, title_length);
+        pos += title_length;
+        pos += 2 + (((size_t)(s[pos] & 0x0F) << 8) | s[pos + 1]);
+        if(pos > end)
+            break;
+        epg_record_emit(epg);
+    }
+}
+
+static void epg_atsc_ett(struct epg_collector *epg, const uint8_t *s, size_t end, uint16_t pid) {
+    struct epg_record *rec = epg->record;
+    uint32_t etm_id;
+
+    if(end < 13)
+        return;
+    etm_id = get_be32(s + 9);
+    epg_record_begin(epg, EPG_RECORD_TEXT, s, pid);
+    rec->source_id = (uint16_t)(etm_id >> 16);
+    if((etm_id & 0x03) == 0x02)
+        rec->event_id = (int32_t)((etm_id >> 2) & 0x3FFF);
+    epg_atsc_string(epg, 1, s + 13, end - 13);
+    epg_record_emit(epg);
+}
+
+/* Converts a DVB 40 bit UTC time (16 bit MJD, then BCD hours, minutes and seconds) */
+static int64_t epg_dvb_time(const uint8_t *p) {
+    unsigned int mjd = ((unsigned int)p[0] << 8) | p[1];
+
+    if(mjd == 0xFFFF && p[2] == 0xFF && p[3] == 0xFF && p[4] == 0xFF)
+        return -1;
+    return ((int64_t)mjd - EPG_MJD_EPOCH) * 86400 + bcd(p[2]) * 3600 + bcd(p[3]) * 60 + bcd(p[4]);
+}
+
+static void epg_dvb_eit(struct epg_collector *epg, const uint8_t *s, size_t end, uint16_t pid) {
+    struct epg_record *rec = epg->record;
+    const uint8_t *d, *descriptors;
+    size_t pos, loop_length, i, name_length, items_length;
+
+    for(pos = 14; pos + 12 <= end; pos += 12 + loop_length) {
+        loop_length = ((size_t)(s[pos + 10] & 0x0F) << 8) | s[pos + 11];
+        if(pos + 12 + loop_length > end)
+            break;
+        epg_record_begin(epg, EPG_RECORD_EVENT, s, pid);
+        rec->flags = EPG_FLAG_DVB;
+        if(s[0] >= 0x50)
+            rec->flags |= EPG_FLAG_SCHEDULE;
+        if(s[0] == 0x4F || s[0] >= 0x60)
+            rec->flags |= EPG_FLAG_OTHER;
+        if(s[pos + 10] & 0x10)
+            rec->flags |= EPG_FLAG_FREE_CA;
+        rec->source_id = (uint16_t)((s[3] << 8) | s[4]);
+        rec->transport_stream_id = (uint16_t)((s[8] << 8) | s[9]);
+        rec->original_network_id = (uint16_t)((s[10] << 8) | s[11]);
+        rec->event_id = (s[pos] << 8) | s[pos + 1];
+        rec->start = epg_dvb_time(s + pos + 2);
+        if(s[pos + 7] != 0xFF || s[pos + 8] != 0xFF || s[pos + 9] != 0xFF)
+            rec->duration = bcd(s[pos + 7]) * 3600 + bcd(s[pos + 8]) * 60 + bcd(s[pos + 9]);
+        rec->status = s[pos + 10] >> 5;
+        descriptors = s + pos + 12;
+
+        /* The first short_event_descriptor gives the title and text, in that order */
+        for(i = 0; i + 2 <= loop_length; i += 2 + descriptors[i + 1]) {
+            d = descriptors + i;
+            if(i + 2 + d[1] > loop_length)
+                break;
+            if(d[0] != 0x4D || d[1] < 5)
+                continue;
+            memcpy(rec->language, d + 2, 3);
+            name_length = d[5];
+            if(6 + name_length > (size_t)d[1] + 2 - 1)
+                break;
+            epg_dvb_string(epg, 0, d + 6, name_length);
+            if(7 + name_length + d[6 + name_length] <= (size_t)d[1] + 2)
+                epg_dvb_string(epg, 1, d + 7 + name_length, d[6 + name_length]);
+            break;
+        }
+        /* ... and the extended_event_descriptors, in order, the long description */
+        for(i = 0; i + 2 <= loop_length; i += 2 + descriptors[i + 1]) {
+            d = descriptors + i;
+            if(i + 2 + d[1] > loop_length)
+                break;
+            if(d[0] != 0x4E || d[1] < 6)
+                continue;
+            items_length = d[6];
+            if(8 + items_length > (size_t)d[1] + 2)
+                continue;
+            if(8 + items_length + d[7 + items_length] <= (size_t)d[1] + 2)
+                epg_dvb_string(epg, 2, d + 8 + items_length, d[7 + items_length]);
+        }
+        epg_record_emit(epg);
+    }
+}
+
+/*
+ *  Section filtering and assembly
+ */
+
+/* Builds the identity of a section from its first bytes; returns 0 for sections we do not want */
+static uint64_t epg_section_key(const struct epg_assembler *a, const uint8_t *s, size_t length) {
+    uint64_t table_id = s[0], extension;
+
+    if(length < 8 || !(s[1] & 0x80) || !(s[5] & 0x01))
+        return 0;   /* short form, or not yet applicable */
+    extension = ((uint64_t)s[3] << 8) | s[4];
+
+    switch(a->role) {
+    case EPG_ROLE_PSIP:
+        if(table_id == 0xC7)
+            return (table_id << 56) | s[6];
+        if(table_id == 0xC8 || table_id == 0xC9)
+            return (table_id << 56) | (extension << 16) | s[6];
+        if(table_id == 0xCD)
+            return table_id << 56;
+        return 0;
+    case EPG_ROLE_ATSC_EIT:
+        if(table_id != 0xCB)
+            return 0;
+        return (table_id << 56) | ((uint64_t)a->pid << 32) | (extension << 16) | s[6];
+    case EPG_ROLE_ATSC_ETT:
+        if(table_id != 0xCC || length < 13)
+            return 0;
+        return (table_id << 56) | ((uint64_t)a->pid << 40) | ((uint64_t)get_be32(s + 9) << 8) | s[6];
+    case EPG_ROLE_DVB_EIT:
+        if(table_id < 0x4E || table_id > 0x6F || length < 14)
+            return 0;
+        return (table_id << 56) | (extension << 40) | ((uint64_t)s[8] << 32) | ((uint64_t)s[9] << 24) |
+               ((uint64_t)s[10] << 16) | ((uint64_t)s[11] << 8) | s[6];
+    }
+    return 0;
+}
+
+/* Decides from the header whether the section needs collecting at all */
+static int epg_section_wanted(struct epg_collector *epg, struct epg_assembler *a) {
+    uint64_t key = epg_section_key(a, a->buffer, a->have);
+
+    if(key == 0)
+        return 0;
+    /* The STT changes every second without changing version */
+    if(a->buffer[0] == 0xCD)
+        return 1;
+    if(epg_version_seen(&epg->versions, key, (a->buffer[5] >> 1) & 0x1F)) {
+        epg->counters.duplicates++;
+        return 0;
+    }
+    return 1;
+}
+
+static void epg_section(struct epg_collector *epg, struct epg_assembler *a) {
+    const uint8_t *s = a->buffer;
+    size_t end = a->total - 4;      /* the CRC follows the body */
+
+    if(crc32_mpeg2(s, a->total, 0xFFFFFFFF) != 0) {
+        epg->counters.crc_errors++;
+        return;
+    }
+    epg->counters.sections++;
+    if(s[0] != 0xCD)
+        epg_version_store(&epg->versions, epg_section_key(a, s, a->total), (s[5] >> 1) & 0x1F);
+
+    switch(s[0]) {
+    case 0xC7:
+        epg_atsc_mgt(epg, s, end);
+        break;
+    case 0xC8:
+    case 0xC9:
+        epg_atsc_vct(epg, s, end, a->pid);
+        break;
+    case 0xCB:
+        epg_atsc_eit(epg, s, end, a->pid);
+        break;
+    case 0xCC:
+        epg_atsc_ett(epg, s, end, a->pid);
+        break;
+    case 0xCD:
+        epg_atsc_stt(epg, s, end);
+        break;
+    default:
+        epg_dvb_eit(epg, s, end, a->pid);
+        break;
+    }
+}
+
+/* Feeds payload bytes to the section being collected; returns how many were used */
+static size_t epg_collect(struct epg_collector *epg, struct epg_assembler *a, const uint8_t *data, size_t length) {
+    size_t used = 0, target, n;
+
+    while(a->active && used < length) {
+        if(a->total == 0)
+            target = 3;
+        else if(!a->checked)
+            target = a->total < EPG_HEADER_SIZE ? a->total : EPG_HEADER_SIZE;
+        else
+            target = a->total;
+        n = target - a->have;
+        if(n > length - used)
+            n = length - used;
+        /* Once a section is known to be unwanted its bytes are only counted */
+        if(!a->skip)
+            memcpy(a->buffer + a->have, data + used, n);
+        a->have += n;
+        used += n;
+
+        if(a->have < target)
+            break;
+        if(a->total == 0) {
+            a->total = 3 + (((size_t)(a->buffer[1] & 0x0F) << 8) | a->buffer[2]);
+            if(a->total < 12 || a->total > EPG_SECTION_MAX) {
+                a->active = 0;
+                return length;
+            }
+            continue;
+        }
+        if(!a->checked) {
+            a->checked = 1;
+            a->skip = !epg_section_wanted(epg, a);
+        }
+        if(a->have == a->total) {
+            a->active = 0;
+            if(!a->skip)
+                epg_section(epg, a);
+        }
+    }
+    return used;
+}
+
+static void epg_section_begin(struct epg_assembler *a) {
+    a->active = 1;
+    a->checked = 0;
+    a->skip = 0;
+    a->have = 0;
+    a->total = 0;
+}
+
+static void epg_feed(struct epg_collector *epg, struct epg_assembler *a, const uint8_t *pkt) {
+    const uint8_t *payload;
+    size_t length, pointer, used;
+    int offset, cc = TS_CC(pkt);
+
+    offset = ts_payload_offset(pkt);
+    if(offset < 0)
+        return;
+    if(a->cc >= 0) {
+        if(cc == a->cc)
+            return;     /* a repeated packet */
+        if(cc != ((a->cc + 1) & 0x0F)) {
+            epg->counters.continuity_errors++;
+            a->active = 0;
+        }
+    }
+    a->cc = cc;
+    payload = pkt + offset;
+    length = (size_t)(TS_PACKET_SIZE - offset);
+
+    if(!TS_PUSI(pkt)) {
+        epg_collect(epg, a, payload, length);
+        return;
+    }
+    pointer = payload[0];
+    payload++;
+    length--;
+    if(pointer > length) {
+        a->active = 0;
+        return;
+    }
+    /* The bytes in front of the pointer finish the previous section */
+    epg_collect(epg, a, payload, pointer);
+    a->active = 0;
+    payload += pointer;
+    length -= pointer;
+    /* Any number of sections may follow, then 0xFF stuffing */
+    while(length > 0 && payload[0] != 0xFF) {
+        epg_section_begin(a);
+        used = epg_collect(epg, a, payload, length);
+        if(a->active)
+            break;
+        payload += used;
+        length -= used;
+    }
+}
+
+/* Starts over when the PAT names a different transport stream, i.e. after a retune */
+static void epg_check_mux(struct epg_collector *epg, const uint8_t *pkt) {
+    const uint8_t *section;
+    size_t length;
+    uint16_t tsid;
+
+    section = ts_section_start(pkt, &length);
+    if(!section || length < 5 || section[0] != 0x00)
+        return;
+    tsid = (uint16_t)((section[3] << 8) | section[4]);
+    if(epg->counters.have_tsid && tsid == epg->counters.tsid)
+        return;
+    if(ts_parse_pat(section, length, NULL, 0) < 0)
+        return;
+    if(epg->counters.have_tsid) {
+        epg->counters.mux_changes++;
+        epg_reset(epg);
+    }
+    epg->counters.have_tsid = 1;
+    epg->counters.tsid = tsid;
+}
+
+static void epg_process(struct stream_stage *stage, const uint8_t *data, size_t length, uint64_t arrival_ns) {
+    struct epg_collector *epg = (struct epg_collector *)stage;
+    const uint8_t *pkt;
+    uint16_t pid;
+    uint8_t slot;
+
+    for(pkt = data; pkt < data + length; pkt += TS_PACKET_SIZE) {
+        if(pkt[0] != TS_SYNC_BYTE || TS_TEI(pkt))
+            continue;
+        pid = TS_PID(pkt);
+        if(pid == 0x0000) {
+            if(TS_PUSI(pkt))
+                epg_check_mux(epg, pkt);
+            continue;
+        }
+        slot = epg->pid_slot[pid];
+        if(slot && TS_SCRAMBLING(pkt) == 0)
+            epg_feed(epg, &epg->assemblers[slot - 1], pkt);
+    }
+
+    pthread_mutex_lock(&epg->lock);
+    epg->published = epg->counters;
+    pthread_mutex_unlock(&epg->lock);
+}
+
+static void epg_collector_free(struct epg_collector *epg) {
+    event_queue_destroy(&epg->queue);
+    free(epg->versions.keys);
+    free(epg->versions.versions);
+    free(epg->record);
+    pthread_mutex_destroy(&epg->lock);
+    free(epg);
+}
+
+const char Device_DOC_collect_epg[] =
+    "Start collecting program guide data from this tuner's stream and return an\n"
+    "EpgCollector.\n\n"
+    "With atsc, the PSIP base PID and the EIT and ETT PIDs its MGT names are\n"
+    "followed; with dvb, the EIT PID.  Only sections with a version not seen\n"
+    "before are parsed, and each event, text and channel in them becomes a\n"
+    "record on the EpgCollector's queue, holding at most queue_limit records.\n"
+    "Like the other stream stages this runs natively on every packet the\n"
+    "Device receives, so guide data comes for free from any mux being\n"
+    "streamed.";
+
+PyObject *py_device_collect_epg(py_device_object *self, PyObject *args, PyObject *kwds) {
+    PyObject *atsc = Py_True, *dvb = Py_True;
+    unsigned int queue_limit = EPG_QUEUE_LIMIT;
+    char *kwlist[] = {"atsc", "dvb", "queue_limit", NULL};
+    py_epg_collector_object *collector;
+    struct epg_collector *epg;
+    int follow_atsc, follow_dvb;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|OOI", kwlist, &atsc, &dvb, &queue_limit))
+        return NULL;
+    follow_atsc = PyObject_IsTrue(atsc);
+    if(follow_atsc < 0)
+        return NULL;
+    follow_dvb = PyObject_IsTrue(dvb);
+    if(follow_dvb < 0)
+        return NULL;
+
+    epg = calloc(1, sizeof(*epg));
+    if(!epg)
+        return PyErr_NoMemory();
+    if(event_queue_init(&epg->queue, queue_limit) != 0) {
+        free(epg);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    pthread_mutex_init(&epg->lock, NULL);
+    epg->stage.process = epg_process;
+    epg->record = malloc(sizeof(*epg->record) + EPG_STRING_MAX);
+    if(!epg->record) {
+        epg_collector_free(epg);
+        return PyErr_NoMemory();
+    }
+    if(follow_atsc)
+        epg_follow(epg, EPG_PSIP_PID, EPG_ROLE_PSIP);
+    if(follow_dvb)
+        epg_follow(epg, EPG_DVB_EIT_PID, EPG_ROLE_DVB_EIT);
+
+    collector = PyObject_New(py_epg_collector_object, &hdhomerun_EpgCollector_type);
+    if(!collector) {
+        epg_collector_free(epg);
+        return NULL;
+    }
+    collector->epg = epg;
+    Py_INCREF(self);
+    collector->device = self;
+    collector->attached = 1;
+    stream_stages_attach(&self->stages, &epg->stage);
+    return (PyObject *)collector;
+}
+
+/*
+ *  EpgCollector methods
+ */
+
+static void py_epg_collector_detach(py_epg_collector_object *self) {
+    if(!self->attached)
+        return;
+    Py_BEGIN_ALLOW_THREADS
+    stream_stages_detach(&self->device->stages, &self->epg->stage);
+    Py_END_ALLOW_THREADS
+    self->attached = 0;
+}
+
+static void py_epg_collector_dealloc(py_epg_collector_object *self) {
+    py_epg_collector_detach(self);
+    epg_collector_free(self->epg);
+    Py_DECREF(self->device);
+    PyObject_Del(self);
+}
+
+/* Returns string n of a record as unicode, or None if it is empty */
+static PyObject *epg_record_string(const struct epg_record *rec, int n) {
+    char encoding[16];
+    size_t offset = 0;
+    int i;
+
+    for(i = 0; i < n; i++)
+        offset += rec->length[i];
+    if(rec->length[n] == 0)
+        Py_RETURN_NONE;
+    switch(rec->encoding[n]) {
+    case EPG_ENC_UTF8:      strcpy(encoding, "utf-8");      break;
+    case EPG_ENC_UTF16:     strcpy(encoding, "utf-16-be");  break;
+    case EPG_ENC_GB2312:    strcpy(encoding, "gb2312");     break;
+    case EPG_ENC_BIG5:      strcpy(encoding, "big5");       break;
+    case EPG_ENC_EUC_KR:    strcpy(encoding, "euc-kr");     break;
+    default:
+        snprintf(encoding, sizeof(encoding), "iso8859-%u", (unsigned int)(rec->encoding[n] - EPG_ENC_ISO8859));
+        break;
+    }
+    return PyUnicode_Decode((const char *)rec->data + offset, rec->length[n], encoding, "replace");
+}
+
+static PyObject *epg_record_language(const struct epg_record *rec) {
+    if(rec->language[0] == '\0')
+        Py_RETURN_NONE;
+    return PyString_FromStringAndSize(rec->language, 3);
+}
+
+static PyObject *epg_optional(int present, long value) {
+    if(!present)
+        Py_RETURN_NONE;
+    return PyInt_FromLong(value);
+}
+
+static PyObject *build_epg_record(const struct epg_record *rec) {
+    PyObject *title, *text, *extended, *language, *start, *duration, *event_id;
+    PyObject *rv = NULL;
+
+    title = epg_record_string(rec, 0);
+    text = epg_record_string(rec, 1);
+    extended = epg_record_string(rec, 2);
+    language = epg_record_language(rec);
+    if(rec->start >= 0) {
+        start = PyLong_FromLongLong(rec->start);
+    } else {
+        Py_INCREF(Py_None);
+        start = Py_None;
+    }
+    duration = epg_optional(rec->duration != EPG_NO_DURATION, (long)rec->duration);
+    event_id = epg_optional(rec->event_id >= 0, (long)rec->event_id);
+    if(!title || !text || !extended || !language || !start || !duration || !event_id)
+        goto done;
+
+    if(rec->type == EPG_RECORD_CHANNEL) {
+        rv = Py_BuildValue("{s:s,s:s,s:i,s:i,s:O,s:i,s:i,s:i,s:i,s:i,s:O,s:i}",
+                           "type", "channel", "standard", "atsc",
+                           "source_id", rec->source_id, "program_number", rec->program_number,
+                           "name", title, "major", rec->major, "minor", rec->minor,
+                           "transport_stream_id", rec->transport_stream_id,
+                           "service_type", rec->status, "table_id", rec->table_id,
+                           "hidden", (rec->flags & EPG_FLAG_HIDDEN) ? Py_True : Py_False,
+                           "version", rec->version);
+    } else if(rec->flags & EPG_FLAG_DVB) {
+        rv = Py_BuildValue("{s:s,s:s,s:i,s:i,s:i,s:O,s:O,s:O,s:O,s:O,s:O,s:O,s:i,s:O,s:O,s:O,s:i,s:i}",
+                           "type", "event", "standard", "dvb",
+                           "service_id", rec->source_id, "transport_stream_id", rec->transport_stream_id,
+                           "original_network_id", rec->original_network_id, "event_id", event_id,
+                           "start", start, "duration", duration, "title", title, "text", text,
+                           "extended_text", extended, "language", language,
+                           "running_status", rec->status,
+                           "free_ca", (rec->flags & EPG_FLAG_FREE_CA) ? Py_True : Py_False,
+                           "schedule", (rec->flags & EPG_FLAG_SCHEDULE) ? Py_True : Py_False,
+                           "actual", (rec->flags & EPG_FLAG_OTHER) ? Py_False : Py_True,
+                           "table_id", rec->table_id, "version", rec->version);
+    } else if(rec->type == EPG_RECORD_EVENT) {
+        rv = Py_BuildValue("{s:s,s:s,s:i,s:i,s:O,s:O,s:O,s:O,s:O,s:i,s:O,s:i,s:i}",
+                           "type", "event", "standard", "atsc",
+                           "pid", rec->pid, "source_id", rec->source_id, "event_id", event_id,
+                           "start", start, "duration", duration, "title", title, "language", language,
+                           "etm_location", rec->status,
+                           "undecoded", (rec->flags & EPG_FLAG_UNDECODED) ? Py_True : Py_False,
+                           "table_id", rec->table_id, "version", rec->version);
+    } else {
+        rv = Py_BuildValue("{s:s,s:s,s:i,s:i,s:O,s:O,s:O,s:O,s:i,s:i}",
+                           "type", "text", "standard", "atsc",
+                           "pid", rec->pid, "source_id", rec->source_id, "event_id", event_id,
+                           "text", text, "language", language,
+                           "undecoded", (rec->flags & EPG_FLAG_UNDECODED) ? Py_True : Py_False,
+                           "table_id", rec->table_id, "version", rec->version);
+    }
+
+done:
+    Py_XDECREF(title);
+    Py_XDECREF(text);
+    Py_XDECREF(extended);
+    Py_XDECREF(language);
+    Py_XDECREF(start);
+    Py_XDECREF(duration);
+    Py_XDECREF(event_id);
+    return rv;
+}
+
+PyDoc_STRVAR(EpgCollector_DOC_fileno,
+    "Return a file descriptor which is readable while guide records are queued.");
+
+static PyObject *py_epg_collector_fileno(py_epg_collector_object *self) {
+    return PyInt_FromLong((long)self->epg->queue.pipe_fd[0]);
+}
+
+PyDoc_STRVAR(EpgCollector_DOC_events,
+    "Return (and remove) the queued guide records as a list of dicts.  type is\n"
+    "'event' for an EIT event, 'text' for an ATSC ETT (whose source_id and\n"
+    "event_id name the event, or the channel when event_id is None) and\n"
+    "'channel' for an ATSC virtual channel, which maps source_id to a channel\n"
+    "number.  start is Unix time and duration is in seconds; either is None\n"
+    "when the broadcast leaves it undefined.  Strings are unicode.  DVB text\n"
+    "in the default character table (ISO/IEC 6937) is decoded as Latin-1, and\n"
+    "ATSC text using Huffman compression is left out with undecoded set.");
+
+static PyObject *py_epg_collector_events(py_epg_collector_object *self) {
+    PyObject *result, *event;
+    struct event_queue_item *item;
+
+    result = PyList_New(0);
+    if(!result)
+        return NULL;
+
+    while((item = event_queue_pop(&self->epg->queue)) != NULL) {
+        event = build_epg_record((struct epg_record *)item->data);
+        free(item);
+        if(!event) { Py_DECREF(result); return NULL; }
+        if(PyList_Append(result, event) != 0) { Py_DECREF(event); Py_DECREF(result); return NULL; }
+        Py_DECREF(event);
+    }
+    return result;
+}
+
+PyDoc_STRVAR(EpgCollector_DOC_stats,
+    "Return counters for the sections and records seen so far, the PIDs being\n"
+    "followed, and the ATSC system time (as Unix time) from the latest STT.");
+
+static PyObject *py_epg_collector_stats(py_epg_collector_object *self) {
+    struct epg_collector *epg = self->epg;
+    struct epg_counters c;
+    unsigned long dropped;
+    PyObject *pids, *pid, *system_time, *tsid;
+    unsigned int i;
+
+    pids = PyList_New(0);
+    if(!pids)
+        return NULL;
+    pthread_mutex_lock(&epg->lock);
+    c = epg->published;
+    for(i = 0; i < EPG_MAX_PIDS; i++) {
+        if(epg->assemblers[i].role == 0)
+            continue;
+        pid = PyInt_FromLong(epg->assemblers[i].pid);
+        if(!pid || PyList_Append(pids, pid) != 0) {
+            pthread_mutex_unlock(&epg->lock);
+            Py_XDECREF(pid);
+            Py_DECREF(pids);
+            return NULL;
+        }
+        Py_DECREF(pid);
+    }
+    pthread_mutex_unlock(&epg->lock);
+    pthread_mutex_lock(&epg->queue.lock);
+    dropped = epg->queue.dropped;
+    pthread_mutex_unlock(&epg->queue.lock);
+
+    if(c.have_stt) {
+        system_time = PyLong_FromLongLong((long long)c.stt_gps + EPG_GPS_EPOCH - c.gps_utc_offset);
+    } else {
+        Py_INCREF(Py_None);
+        system_time = Py_None;
+    }
+    tsid = epg_optional(c.have_tsid, c.tsid);
+    if(!system_time || !tsid) {
+        Py_XDECREF(system_time);
+        Py_XDECREF(tsid);
+        Py_DECREF(pids);
+        return NULL;
+    }
+    return Py_BuildValue("{s:K,s:K,s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:N,s:N,s:N,s:O}",
+                         "sections", c.sections,
+                         "duplicates", c.duplicates,
+                         "crc_errors", c.crc_errors,
+                         "continuity_errors", c.continuity_errors,
+                         "events", c.events,
+                         "texts", c.texts,
+                         "channels", c.channels,
+                         "undecoded", c.undecoded,
+                         "mux_changes", c.mux_changes,
+                         "dropped_events", dropped,
+                         "pids", pids,
+                         "transport_stream_id", tsid,
+                         "system_time", system_time,
+                         "active", self->attached ? Py_True : Py_False);
+}
+
+PyDoc_STRVAR(EpgCollector_DOC_stop,
+    "Stop collecting.  Records already queued remain available.");
+
+static PyObject *py_epg_collector_stop(py_epg_collector_object *self) {
+    py_epg_collector_detach(self);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef py_epg_collector_methods[] = {
+    {"fileno",                  (PyCFunction)py_epg_collector_fileno,           METH_NOARGS,                EpgCollector_DOC_fileno},
+    {"events",                  (PyCFunction)py_epg_collector_events,           METH_NOARGS,                EpgCollector_DOC_events},
+    {"stats",                   (PyCFunction)py_epg_collector_stats,            METH_NOARGS,                EpgCollector_DOC_stats},
+    {"stop",                    (PyCFunction)py_epg_collector_stop,             METH_NOARGS,                EpgCollector_DOC_stop},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_EpgCollector_type_doc,
+    "A native program guide collector, created by Device.collect_epg().");
+
+PyTypeObject hdhomerun_EpgCollector_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.EpgCollector",       /* tp_name */
+    sizeof(py_epg_collector_object), /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_epg_collector_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    hdhomerun_EpgCollector_type_doc, /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_epg_collector_methods,       /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    0,                              /* tp_new */
+    0,                              /* tp_free */
+};
@@ -0,0 +1,592 @@
+/*
+ * device_exporter.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ *  A Prometheus text-format exporter for the counters the library already
+ *  keeps natively: pipelined control latency (device_control.c), stream
+ *  receiver counters (stream_rx.c) and the tuner status Watchers poll
+ *  (device_watch.c).  Each of those registers an exporter_source while it is
+ *  alive.  The HTTP thread takes a snapshot of every source under the list
+ *  lock, then formats and sends it; none of this involves the interpreter.
+ *
+ *  The list lock comes before any owner's lock, and owners unregister before
+ *  they free themselves, so a source is never sampled after it is gone.
+ */
+
+#define EXPORTER_DEFAULT_PORT 9108
+#define EXPORTER_REQUEST_MAX 4096
+#define EXPORTER_CLIENTS_MAX 16
+#define EXPORTER_REQUEST_TIMEOUT_MS 2000    /* for a client to send its whole request */
+#define EXPORTER_SEND_TIMEOUT_MS 250        /* for a stalled client to take more of the response */
+
+struct exporter_family {
+    int kind;
+    int index;              /* into the values sample() fills in */
+    const char *name;
+    const char *type;
+    const char *help;
+};
+
+/* Control sources fill in these four, then the latency sum and count, then the buckets */
+#define CONTROL_VALUE_LATENCY_SUM 4
+#define CONTROL_VALUE_LATENCY_COUNT 5
+#define CONTROL_VALUE_LATENCY_BUCKETS 6
+
+static const struct exporter_family exporter_families[] = {
+    {EXPORTER_CONTROL, 0, "hdhomerun_control_requests_total", "counter", "Pipelined control requests sent."},
+    {EXPORTER_CONTROL, 1, "hdhomerun_control_rejected_total", "counter", "Pipelined control requests the device answered with an error."},
+    {EXPORTER_CONTROL, 2, "hdhomerun_control_failures_total", "counter", "Pipelined control batches lost to a communication error."},
+    {EXPORTER_CONTROL, 3, "hdhomerun_control_timeouts_total", "counter", "Pipelined control batches which timed out."},
+    {EXPORTER_CONTROL, CONTROL_VALUE_LATENCY_SUM, "hdhomerun_control_latency_seconds", "histogram", "Time from sending a batch to each reply."},
+    {EXPORTER_STREAM, 0, "hdhomerun_stream_packets_total", "counter", "TS packets received."},
+    {EXPORTER_STREAM, 1, "hdhomerun_stream_bytes_total", "counter", "Stream bytes received."},
+    {EXPORTER_STREAM, 2, "hdhomerun_stream_overflow_packets_total", "counter", "TS packets dropped because the ring was full."},
+    {EXPORTER_STREAM, 3, "hdhomerun_stream_network_errors_total", "counter", "Receive errors on the stream socket."},
+    {EXPORTER_STREAM, 4, "hdhomerun_stream_sync_errors_total", "counter", "TS packets without a sync byte."},
+    {EXPORTER_STREAM, 5, "hdhomerun_stream_transport_errors_total", "counter", "TS packets with the transport error flag set."},
+    {EXPORTER_STREAM, 6, "hdhomerun_stream_scrambled_packets_total", "counter", "Scrambled TS packets."},
+    {EXPORTER_STREAM, 7, "hdhomerun_stream_buffer_bytes", "gauge", "Bytes waiting in the receive ring."},
+    {EXPORTER_STREAM, 8, "hdhomerun_stream_buffer_high_water_bytes", "gauge", "Most bytes waiting in the receive ring."},
+    {EXPORTER_WATCH, 0, "hdhomerun_tuner_reachable", "gauge", "1 if the last status poll succeeded."},
+    {EXPORTER_WATCH, 1, "hdhomerun_tuner_signal_present", "gauge", "1 if the tuner reports a signal."},
+    {EXPORTER_WATCH, 2, "hdhomerun_tuner_locked", "gauge", "1 if the tuner is locked."},
+    {EXPORTER_WATCH, 3, "hdhomerun_tuner_signal_strength", "gauge", "Signal strength, percent."},
+    {EXPORTER_WATCH, 4, "hdhomerun_tuner_signal_to_noise_quality", "gauge", "Signal to noise quality, percent."},
+    {EXPORTER_WATCH, 5, "hdhomerun_tuner_symbol_error_quality", "gauge", "Symbol error quality, percent."},
+    {EXPORTER_WATCH, 6, "hdhomerun_tuner_raw_bits_per_second", "gauge", "Raw channel bit rate."},
+    {EXPORTER_WATCH, 7, "hdhomerun_tuner_packets_per_second", "gauge", "TS packet rate of the selected program."},
+    {EXPORTER_WATCH, 8, "hdhomerun_tuner_polls_total", "counter", "Status polls made by the Watcher."},
+    {EXPORTER_WATCH, 9, "hdhomerun_tuner_poll_errors_total", "counter", "Status polls which failed."},
+};
+
+struct exporter_snapshot {
+    int kind;
+    char labels[EXPORTER_LABELS_MAX];
+    double values[EXPORTER_VALUES_MAX];
+};
+
+struct exporter_buf {
+    char *data;
+    size_t length;
+    size_t size;
+    int failed;
+};
+
+/* A connection whose request is still arriving */
+struct exporter_client {
+    int fd;                 /* -1 for a free slot */
+    size_t length;
+    uint64_t deadline_ns;
+    char request[EXPORTER_REQUEST_MAX];
+};
+
+static struct {
+    pthread_mutex_t lock;   /* protects sources and scrapes */
+    struct exporter_source *sources;
+    size_t count;
+    unsigned long long scrapes;
+    /* Only touched with the GIL held */
+    int running;
+    int listen_fd;
+    int wake_fd[2];
+    pthread_t thread;
+    uint16_t port;
+} exporter = {PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, -1, {-1, -1}};
+
+/* Adds src to the exported set, or just updates its labels; may be called without the GIL */
+void exporter_register(struct exporter_source *src, int kind, void *owner, void (*sample)(void *, double *),
+                       const char *labels) {
+    pthread_mutex_lock(&exporter.lock);
+    src->kind = kind;
+    src->owner = owner;
+    src->sample = sample;
+    snprintf(src->labels, sizeof(src->labels), "%s", labels);
+    if(!src->registered) {
+        src->next = exporter.sources;
+        exporter.sources = src;
+        exporter.count++;
+        src->registered = 1;
+    }
+    pthread_mutex_unlock(&exporter.lock);
+}
+
+/* Must be called before the owner is freed; may be called without the GIL */
+void exporter_unregister(struct exporter_source *src) {
+    struct exporter_source **link;
+
+    if(!src->registered)
+        return;
+    pthread_mutex_lock(&exporter.lock);
+    for(link = &exporter.sources; *link; link = &(*link)->next) {
+        if(*link == src) {
+            *link = src->next;
+            exporter.count--;
+            break;
+        }
+    }
+    src->registered = 0;
+    src->next = NULL;
+    pthread_mutex_unlock(&exporter.lock);
+}
+
+/* Called from the atfork child handler: the exporter thread only exists in the parent */
+void exporter_after_fork(void) {
+    struct exporter_source *src, *next;
+
+    pthread_mutex_init(&exporter.lock, NULL);
+    /* Inherited owners may hold locks nobody will release; they register again when used */
+    for(src = exporter.sources; src; src = next) {
+        next = src->next;
+        src->next = NULL;
+        src->registered = 0;
+    }
+    exporter.sources = NULL;
+    exporter.count = 0;
+    if(!exporter.running)
+        return;
+    close(exporter.listen_fd);
+    close(exporter.wake_fd[0]);
+    close(exporter.wake_fd[1]);
+    exporter.listen_fd = -1;
+    exporter.wake_fd[0] = exporter.wake_fd[1] = -1;
+    exporter.running = 0;
+}
+
+static void exporter_printf(struct exporter_buf *buf, const char *fmt, ...) {
+    va_list ap;
+    char *grown;
+    int n;
+
+    if(buf->failed)
+        return;
+    for(;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(buf->data + buf->length, buf->size - buf->length, fmt, ap);
+        va_end(ap);
+        if(n < 0) {
+            buf->failed = 1;
+            return;
+        }
+        if((size_t)n < buf->size - buf->length) {
+            buf->length += (size_t)n;
+            return;
+        }
+        grown = realloc(buf->data, buf->size * 2 + (size_t)n);
+        if(!grown) {
+            buf->failed = 1;
+            return;
+        }
+        buf->data = grown;
+        buf->size = buf->size * 2 + (size_t)n;
+    }
+}
+
+static void exporter_format_histogram(struct exporter_buf *buf, const struct exporter_family *family,
+                                      const struct exporter_snapshot *snap) {
+    double cumulative = 0.0;
+    int i;
+
+    for(i = 0; i < CONTROL_LATENCY_BUCKETS; i++) {
+        cumulative += snap->values[CONTROL_VALUE_LATENCY_BUCKETS + i];
+        exporter_printf(buf, "%s_bucket{%s,le=\"%g\"} %.0f\n", family->name, snap->labels,
+                        (double)control_latency_bounds_ns[i] / 1e9, cumulative);
+    }
+    exporter_printf(buf, "%s_bucket{%s,le=\"+Inf\"} %.0f\n", family->name, snap->labels,
+                    snap->values[CONTROL_VALUE_LATENCY_COUNT]);
+    exporter_printf(buf, "%s_sum{%s} %.9f\n", family->name, snap->labels, snap->values[CONTROL_VALUE_LATENCY_SUM]);
+    exporter_printf(buf, "%s_count{%s} %.0f\n", family->name, snap->labels, snap->values[CONTROL_VALUE_LATENCY_COUNT]);
+}
+
+/* Formats every registered source; returns a malloc()ed buffer or NULL.  Never needs the GIL. */
+static char *exporter_collect(size_t *plength) {
+    struct exporter_source *src;
+    struct exporter_snapshot *snaps;
+    struct exporter_buf buf;
+    const struct exporter_family *family;
+    size_t count = 0, i, j, f;
+    unsigned long long scrapes;
+    int any;
+
+    pthread_mutex_lock(&exporter.lock);
+    snaps = calloc(exporter.count + 1, sizeof(*snaps));
+    if(!snaps) {
+        pthread_mutex_unlock(&exporter.lock);
+        return NULL;
+    }
+    for(src = exporter.sources; src; src = src->next) {
+        snaps[count].kind = src->kind;
+        memcpy(snaps[count].labels, src->labels, sizeof(snaps[count].labels));
+        src->sample(src->owner, snaps[count].values);
+        count++;
+    }
+    scrapes = exporter.scrapes;
+    pthread_mutex_unlock(&exporter.lock);
+
+    /* Every standalone Device has a pipe of its own; add up those talking to the same device */
+    for(i = 0; i < count; i++) {
+        if(snaps[i].kind != EXPORTER_CONTROL)
+            continue;
+        for(j = i + 1; j < count; j++) {
+            if(snaps[j].kind != EXPORTER_CONTROL || strcmp(snaps[i].labels, snaps[j].labels) != 0)
+                continue;
+            for(f = 0; f < EXPORTER_VALUES_MAX; f++)
+                snaps[i].values[f] += snaps[j].values[f];
+            snaps[j].kind = -1;
+        }
+    }
+
+    buf.size = 4096;
+    buf.length = 0;
+    buf.failed = 0;
+    buf.data = malloc(buf.size);
+    if(!buf.data) {
+        free(snaps);
+        return NULL;
+    }
+    buf.data[0] = '\0';
+
+    /* Samples of one family must be contiguous, so go family by family */
+    for(f = 0; f < sizeof(exporter_families) / sizeof(exporter_families[0]); f++) {
+        family = &exporter_families[f];
+        any = 0;
+        for(i = 0; i < count; i++) {
+            if(snaps[i].kind != family->kind)
+                continue;
+            if(!any) {
+                exporter_printf(&buf, "# HELP %s %s\n# TYPE %s %s\n", family->name, family->help,
+                                family->name, family->type);
+                any = 1;
+            }
+            if(strcmp(family->type, "histogram") == 0)
+                exporter_format_histogram(&buf, family, &snaps[i]);
+            else
+                exporter_printf(&buf, "%s{%s} %.17g\n", family->name, snaps[i].labels, snaps[i].values[family->index]);
+        }
+    }
+    exporter_printf(&buf, "# HELP hdhomerun_exporter_scrapes_total Scrapes served by this exporter.\n"
+                          "# TYPE hdhomerun_exporter_scrapes_total counter\n"
+                          "hdhomerun_exporter_scrapes_total %llu\n", scrapes);
+    free(snaps);
+    if(buf.failed) {
+        free(buf.data);
+        return NULL;
+    }
+    *plength = buf.length;
+    return buf.data;
+}
+
+static int exporter_wait(int fd, short events) {
+    struct pollfd pfd;
+    int ready;
+
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    do {
+        ready = poll(&pfd, 1, EXPORTER_SEND_TIMEOUT_MS);
+    } while(ready < 0 && errno == EINTR);
+    return ready > 0;
+}
+
+static void exporter_send(int fd, const char *data, size_t length) {
+    ssize_t sent;
+
+    while(length > 0) {
+        sent = send(fd, data, length, MSG_NOSIGNAL);
+        if(sent > 0) {
+            data += sent;
+            length -= (size_t)sent;
+        } else if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            if(!exporter_wait(fd, POLLOUT))
+                return;
+        } else {
+            return;
+        }
+    }
+}
+
+static void exporter_respond(int fd, const char *status, const char *content_type, const char *body, size_t length) {
+    char header[256];
+    int n;
+
+    n = snprintf(header, sizeof(header),
+                 "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+                 status, content_type, (unsigned long)length);
+    exporter_send(fd, header, (size_t)n);
+    exporter_send(fd, body, length);
+}
+
+/* Answers a complete request */
+static void exporter_serve(int fd, char *request) {
+    char *metrics, *path, *end;
+    size_t metrics_length;
+
+    if(strncmp(request, "GET ", 4) != 0) {
+        exporter_respond(fd, "405 Method Not Allowed", "text/plain", "GET only\n", 9);
+        return;
+    }
+    path = request + 4;
+    end = strpbrk(path, " ?\r\n");
+    if(end)
+        *end = '\0';
+    if(strcmp(path, "/metrics") != 0) {
+        exporter_respond(fd, "404 Not Found", "text/plain", "try /metrics\n", 13);
+        return;
+    }
+
+    pthread_mutex_lock(&exporter.lock);
+    exporter.scrapes++;
+    pthread_mutex_unlock(&exporter.lock);
+    metrics = exporter_collect(&metrics_length);
+    if(!metrics) {
+        exporter_respond(fd, "500 Internal Server Error", "text/plain", "out of memory\n", 14);
+        return;
+    }
+    exporter_respond(fd, "200 OK", "text/plain; version=0.0.4; charset=utf-8", metrics, metrics_length);
+    free(metrics);
+}
+
+static void exporter_client_close(struct exporter_client *client) {
+    close(client->fd);
+    client->fd = -1;
+}
+
+/* Reads what has arrived; serves and closes the connection once the request is complete */
+static void exporter_client_read(struct exporter_client *client) {
+    ssize_t got;
+
+    got = recv(client->fd, client->request + client->length, sizeof(client->request) - 1 - client->length, 0);
+    if(got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    if(got <= 0) {
+        exporter_client_close(client);
+        return;
+    }
+    client->length += (size_t)got;
+    client->request[client->length] = '\0';
+    if(client->length < sizeof(client->request) - 1 &&
+       !strstr(client->request, "\r\n\r\n") && !strstr(client->request, "\n\n"))
+        return;
+    exporter_serve(client->fd, client->request);
+    exporter_client_close(client);
+}
+
+static void exporter_accept(struct exporter_client *clients) {
+    int fd, i;
+
+    fd = accept(exporter.listen_fd, NULL, NULL);
+    if(fd < 0)
+        return;
+    for(i = 0; i < EXPORTER_CLIENTS_MAX && clients[i].fd >= 0; i++)
+        ;
+    if(i == EXPORTER_CLIENTS_MAX) {
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    clients[i].fd = fd;
+    clients[i].length = 0;
+    clients[i].request[0] = '\0';
+    clients[i].deadline_ns = monotonic_ns() + EXPORTER_REQUEST_TIMEOUT_MS * 1000000ULL;
+}
+
+/*
+ *  Waits on the listening socket and every connection at once, so a client
+ *  which is slow to send its request does not hold up the others.
+ */
+static void *exporter_thread(void *arg) {
+    struct exporter_client *clients;
+    struct pollfd pfds[2 + EXPORTER_CLIENTS_MAX];
+    int slots[EXPORTER_CLIENTS_MAX];
+    uint64_t now, next;
+    int i, n, timeout;
+
+    (void)arg;
+    clients = malloc(EXPORTER_CLIENTS_MAX * sizeof(*clients));
+    if(!clients)
+        return NULL;
+    for(i = 0; i < EXPORTER_CLIENTS_MAX; i++)
+        clients[i].fd = -1;
+    pfds[0].fd = exporter.listen_fd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = exporter.wake_fd[0];
+    pfds[1].events = POLLIN;
+    for(;;) {
+        n = 2;
+        next = 0;
+        for(i = 0; i < EXPORTER_CLIENTS_MAX; i++) {
+            if(clients[i].fd < 0)
+                continue;
+            pfds[n].fd = clients[i].fd;
+            pfds[n].events = POLLIN;
+            slots[n - 2] = i;
+            n++;
+            if(!next || clients[i].deadline_ns < next)
+                next = clients[i].deadline_ns;
+        }
+        timeout = -1;
+        if(next) {
+            now = monotonic_ns();
+            timeout = next > now ? (int)((next - now + 999999ULL) / 1000000ULL) : 0;
+        }
+        for(i = 0; i < n; i++)
+            pfds[i].revents = 0;
+        if(poll(pfds, (nfds_t)n, timeout) < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        if(pfds[1].revents)
+            break;
+
+        for(i = 2; i < n; i++) {
+            if(pfds[i].revents)
+                exporter_client_read(&clients[slots[i - 2]]);
+        }
+        now = monotonic_ns();
+        for(i = 0; i < EXPORTER_CLIENTS_MAX; i++) {
+            if(clients[i].fd >= 0 && now >= clients[i].deadline_ns)
+                exporter_client_close(&clients[i]);
+        }
+        if(pfds[0].revents & POLLIN)
+            exporter_accept(clients);
+    }
+    for(i = 0; i < EXPORTER_CLIENTS_MAX; i++) {
+        if(clients[i].fd >= 0)
+            exporter_client_close(&clients[i]);
+    }
+    free(clients);
+    return NULL;
+}
+
+const char hdhomerun_DOC_start_exporter[] =
+    "Serve the library's native metrics at http://address:port/metrics from a\n"
+    "background thread, in the Prometheus text format.  Exported are pipelined\n"
+    "control latency (tune(), FastZap), stream receiver counters (stream_start()\n"
+    "with any option) and the tuner status of running Watchers, labelled by\n"
+    "device and tuner.  Scrapes never take the GIL.  port=0 picks a free port.\n"
+    "Returns the port.";
+
+PyObject *py_hdhomerun_start_exporter(PyObject *module, PyObject *args, PyObject *kwds) {
+    unsigned int port = EXPORTER_DEFAULT_PORT;
+    const char *address = "127.0.0.1";
+    char *kwlist[] = {"port", "address", NULL};
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    int one = 1, fd;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|Is", kwlist, &port, &address))
+        return NULL;
+    if(port > 65535) {
+        PyErr_SetString(PyExc_ValueError, "port must be less than 65536");
+        return NULL;
+    }
+    if(exporter.running) {
+        PyErr_SetString(PyExc_RuntimeError, "the exporter is already running");
+        return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if(inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        PyErr_SetString(PyExc_ValueError, "address must be a dotted IPv4 address");
+        return NULL;
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return PyErr_SetFromErrno(PyExc_IOError);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0 ||
+       getsockname(fd, (struct sockaddr *)&addr, &addrlen) != 0) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        close(fd);
+        return NULL;
+    }
+    if(pipe(exporter.wake_fd) != 0) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        close(fd);
+        return NULL;
+    }
+    exporter.listen_fd = fd;
+    exporter.port = ntohs(addr.sin_port);
+    if(pthread_create(&exporter.thread, NULL, exporter_thread, NULL) != 0) {
+        close(exporter.wake_fd[0]);
+        close(exporter.wake_fd[1]);
+        close(fd);
+        exporter.listen_fd = -1;
+        PyErr_SetString(hdhomerun_device_error, "unable to start exporter thread");
+        return NULL;
+    }
+    exporter.running = 1;
+    return PyInt_FromLong(exporter.port);
+}
+
+const char hdhomerun_DOC_stop_exporter[] =
+    "Stop the metrics exporter, if it is running.";
+
+PyObject *py_hdhomerun_stop_exporter(PyObject *module) {
+    if(!exporter.running)
+        Py_RETURN_NONE;
+    if(write(exporter.wake_fd[1], "x", 1) != 1) {
+        /* The thread also stops once the pipe is closed */
+    }
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(exporter.thread, NULL);
+    Py_END_ALLOW_THREADS
+    close(exporter.listen_fd);
+    close(exporter.wake_fd[0]);
+    close(exporter.wake_fd[1]);
+    exporter.listen_fd = -1;
+    exporter.wake_fd[0] = exporter.wake_fd[1] = -1;
+    exporter.running = 0;
+    Py_RETURN_NONE;
+}
+
+const char hdhomerun_DOC_exporter_metrics[] =
+    "Return the text a scrape of /metrics would, whether or not the exporter\n"
+    "is running; e.g. for pushing to a gateway.";
+
+PyObject *py_hdhomerun_exporter_metrics(PyObject *module) {
+    char *metrics;
+    size_t length = 0;
+    PyObject *rv;
+
+    Py_BEGIN_ALLOW_THREADS
+    metrics = exporter_collect(&length);
+    Py_END_ALLOW_THREADS
+    if(!metrics)
+        return PyErr_NoMemory();
+    rv = PyString_FromStringAndSize(metrics, (Py_ssize_t)length);
+    free(metrics);
+    return rv;
+}
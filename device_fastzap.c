@@ -0,0 +1,650 @@
+/*
+ * device_fastzap.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  FastZap keeps spare tuners tuned to the channels the viewer is likely to
+ *  pick next.  A zap to one of those only has to move the stream target from
+ *  the live tuner to the spare, which the device does without waiting for the
+ *  demodulator to lock.
+ *
+ *  The tuner table is changed with the GIL released, so it is guarded by a
+ *  per-FastZap mutex.  The mutex is only ever waited for with the GIL
+ *  released; a thread holding it may take the GIL back.
+ */
+
+#define FASTZAP_CHANNEL_MAX 64
+
+/* The variables fastzap_set() writes, by bit in fastzap_tuner.written */
+static const char *fastzap_vars[] = {"channel", "vchannel", "target"};
+
+struct fastzap_tuner {
+    py_device_object *device;
+    char channel[FASTZAP_CHANNEL_MAX];
+    int took_lock;
+    unsigned int written;   /* fastzap_vars not yet dropped from the variable cache */
+};
+
+typedef struct {
+    PyObject_HEAD
+    pthread_mutex_t lock;
+    int lock_initialized;
+    int closed;
+    struct fastzap_tuner *tuners;
+    Py_ssize_t tuner_count;
+    Py_ssize_t active;
+    char target[FASTZAP_CHANNEL_MAX * 2];
+    int virtual_channel;
+    char **favorites;
+    Py_ssize_t favorite_count;
+    char **lineup;
+    Py_ssize_t lineup_count;
+
+    unsigned long hits;
+    unsigned long misses;
+    double hit_ms_total;
+    double miss_ms_total;
+    double hit_ms_max;
+    double miss_ms_max;
+} py_fastzap_object;
+
+static void free_string_list(char **list, Py_ssize_t count) {
+    Py_ssize_t i;
+
+    if(!list)
+        return;
+    for(i = 0; i < count; i++)
+        free(list[i]);
+    free(list);
+}
+
+static int copy_string_list(PyObject *obj, char ***plist, Py_ssize_t *pcount) {
+    PyObject *seq, *item;
+    Py_ssize_t i;
+
+    *plist = NULL;
+    *pcount = 0;
+    if(!obj || obj == Py_None)
+        return 0;
+
+    seq = PySequence_Fast(obj, "expected a sequence of strings");
+    if(!seq)
+        return -1;
+    *pcount = PySequence_Fast_GET_SIZE(seq);
+    *plist = calloc((size_t)(*pcount ? *pcount : 1), sizeof(char *));
+    if(!*plist) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return -1;
+    }
+    for(i = 0; i < *pcount; i++) {
+        item = PySequence_Fast_GET_ITEM(seq, i);
+        if(!PyString_Check(item)) {
+            PyErr_SetString(PyExc_TypeError, "expected a sequence of strings");
+            Py_DECREF(seq);
+            return -1;
+        }
+        (*plist)[i] = strdup(PyString_AS_STRING(item));
+        if(!(*plist)[i]) {
+            Py_DECREF(seq);
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+    Py_DECREF(seq);
+    return 0;
+}
+
+/* Finds the channel offset by delta: by position in the lineup if one was given, else numerically */
+static int fastzap_neighbour(py_fastzap_object *self, const char *channel, int delta, char *out, size_t out_size) {
+    Py_ssize_t i;
+    unsigned long major, minor;
+    char *end;
+
+    if(self->lineup_count > 0) {
+        for(i = 0; i < self->lineup_count; i++) {
+            if(strcmp(self->lineup[i], channel) == 0) {
+                i = (i + delta + self->lineup_count) % self->lineup_count;
+                snprintf(out, out_size, "%s", self->lineup[i]);
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    /* "702" steps to 703/701, "7.1" steps to 7.2/7.0 */
+    major = strtoul(channel, &end, 10);
+    if(end == channel)
+        return 0;
+    if(*end == '\0') {
+        if(delta < 0 && major == 0)
+            return 0;
+        snprintf(out, out_size, "%lu", major + delta);
+        return 1;
+    }
+    if((*end == '.' || *end == '-') && end[1] != '\0') {
+        minor = strtoul(end + 1, NULL, 10);
+        if(delta < 0 && minor == 0)
+            return 0;
+        snprintf(out, out_size, "%lu%c%lu", major, *end, minor + delta);
+        return 1;
+    }
+    return 0;
+}
+
+static int fastzap_is_tuned(py_fastzap_object *self, const char *channel) {
+    Py_ssize_t i;
+
+    for(i = 0; i < self->tuner_count; i++) {
+        if(strcmp(self->tuners[i].channel, channel) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static void fastzap_lock(py_fastzap_object *self) {
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    Py_END_ALLOW_THREADS
+}
+
+static int fastzap_set(struct fastzap_tuner *tuner, const char *var, const char *value, char *error, size_t error_size) {
+    struct control_op op;
+    char name[32];
+    size_t i;
+    int success;
+
+    snprintf(name, sizeof(name), "/tuner%u/%s", device_tuner(tuner->device), var);
+    for(i = 0; i < sizeof(fastzap_vars) / sizeof(fastzap_vars[0]); i++) {
+        if(strcmp(fastzap_vars[i], var) == 0)
+            tuner->written |= 1u << i;
+    }
+    memset(&op, 0, sizeof(op));
+    op.name = name;
+    op.value = value;
+    success = control_pipe_execute(device_pipe(tuner->device), hdhomerun_device_get_device_ip(device_hd_held(tuner->device)),
+                                   tuner->device->lockkey, &op, 1,
+                                   tuner->device->control_timeout_ms ? tuner->device->control_timeout_ms : CONTROL_DEFAULT_TIMEOUT_MS);
+    if(success == 1 && op.result != 1) {
+        snprintf(error, error_size, "%s: %s", name, op.reply);
+        return 0;
+    }
+    return success;
+}
+
+/* Internal: drops what fastzap_set() wrote from the variable caches; needs the GIL and self->lock */
+static void fastzap_invalidate(py_fastzap_object *self) {
+    char name[32];
+    Py_ssize_t i;
+    size_t v;
+
+    for(i = 0; i < self->tuner_count; i++) {
+        struct fastzap_tuner *tuner = &self->tuners[i];
+
+        for(v = 0; v < sizeof(fastzap_vars) / sizeof(fastzap_vars[0]); v++) {
+            if(!(tuner->written & (1u << v)))
+                continue;
+            snprintf(name, sizeof(name), "/tuner%u/%s", device_tuner(tuner->device), fastzap_vars[v]);
+            var_cache_invalidate(device_var_cache(tuner->device), name);
+        }
+        tuner->written = 0;
+    }
+}
+
+/*
+ *  Every tuner is held for the whole zap; tuners sharing a Connection share
+ *  one reservation.  Reservations are taken in address order so two FastZaps
+ *  over the same devices cannot deadlock; the GIL must be held.
+ */
+static void fastzap_acquire(py_fastzap_object *self) {
+    struct device_reservation *last = NULL, *next;
+    Py_ssize_t i, pick;
+
+    for(;;) {
+        next = NULL;
+        pick = -1;
+        for(i = 0; i < self->tuner_count; i++) {
+            struct device_reservation *res = device_reservation(self->tuners[i].device);
+
+            if((uintptr_t)res > (uintptr_t)last && (!next || (uintptr_t)res < (uintptr_t)next)) {
+                next = res;
+                pick = i;
+            }
+        }
+        if(pick < 0)
+            break;
+        device_hd_acquire(self->tuners[pick].device);
+        last = next;
+    }
+}
+
+static void fastzap_release(py_fastzap_object *self) {
+    Py_ssize_t i, j;
+
+    for(i = 0; i < self->tuner_count; i++) {
+        struct device_reservation *res = device_reservation(self->tuners[i].device);
+
+        for(j = 0; j < i && device_reservation(self->tuners[j].device) != res; j++);
+        if(j == i)
+            device_hd_release(self->tuners[i].device);
+    }
+}
+
+/*
+ *  Points idle spares at the channels most likely to be picked next: the
+ *  neighbours of the current channel, then the favorites.  The tuner which
+ *  was live before this zap keeps the previous channel, so flipping back is
+ *  always a hit.
+ */
+static void fastzap_pretune(py_fastzap_object *self, Py_ssize_t previous) {
+    char candidates[2 + 64][FASTZAP_CHANNEL_MAX];
+    char error[128];
+    const char *current = self->tuners[self->active].channel;
+    size_t candidate_count = 0, next = 0;
+    Py_ssize_t i;
+
+    if(fastzap_neighbour(self, current, 1, candidates[candidate_count], FASTZAP_CHANNEL_MAX))
+        candidate_count++;
+    if(fastzap_neighbour(self, current, -1, candidates[candidate_count], FASTZAP_CHANNEL_MAX))
+        candidate_count++;
+    for(i = 0; i < self->favorite_count && candidate_count < sizeof(candidates) / sizeof(candidates[0]); i++)
+        snprintf(candidates[candidate_count++], FASTZAP_CHANNEL_MAX, "%s", self->favorites[i]);
+
+    for(i = 0; i < self->tuner_count; i++) {
+        if(i == self->active || i == previous)
+            continue;
+        while(next < candidate_count && fastzap_is_tuned(self, candidates[next]))
+            next++;
+        if(next >= candidate_count)
+            break;
+        /* Best effort: a spare that fails to tune is simply a miss later on */
+        if(fastzap_set(&self->tuners[i], self->virtual_channel ? "vchannel" : "channel", candidates[next], error, sizeof(error)) == 1)
+            snprintf(self->tuners[i].channel, FASTZAP_CHANNEL_MAX, "%s", candidates[next]);
+        else
+            self->tuners[i].channel[0] = '\0';
+        next++;
+    }
+}
+
+static int py_fastzap_init(py_fastzap_object *self, PyObject *args, PyObject *kwds) {
+    PyObject *live, *spares, *favorites = NULL, *lineup = NULL, *vchannel_obj = NULL, *seq, *item;
+    char *target = NULL, *channel = NULL;
+    char *kwlist[] = {"live", "spares", "favorites", "lineup", "vchannel", "target", "channel", NULL};
+    char *ptarget;
+    Py_ssize_t i;
+    int success;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O!O|OOO!ss", kwlist, &hdhomerun_Device_type, &live, &spares,
+                                    &favorites, &lineup, &PyBool_Type, &vchannel_obj, &target, &channel))
+        return -1;
+    if(self->tuners) {
+        PyErr_SetString(PyExc_RuntimeError, "FastZap is already initialized");
+        return -1;
+    }
+    if(channel && strlen(channel) >= FASTZAP_CHANNEL_MAX) {
+        PyErr_SetString(PyExc_ValueError, "channel name too long");
+        return -1;
+    }
+    if(!self->lock_initialized) {
+        pthread_mutex_init(&self->lock, NULL);
+        self->lock_initialized = 1;
+    }
+    if(copy_string_list(favorites, &self->favorites, &self->favorite_count) != 0)
+        return -1;
+    if(copy_string_list(lineup, &self->lineup, &self->lineup_count) != 0)
+        return -1;
+    self->virtual_channel = vchannel_obj ? (vchannel_obj == Py_True) : 0;
+
+    seq = PySequence_Fast(spares, "spares must be a sequence of Device objects");
+    if(!seq)
+        return -1;
+    self->tuner_count = 1 + PySequence_Fast_GET_SIZE(seq);
+    self->tuners = calloc((size_t)self->tuner_count, sizeof(struct fastzap_tuner));
+    if(!self->tuners) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return -1;
+    }
+    Py_INCREF(live);
+    self->tuners[0].device = (py_device_object *)live;
+    if(channel)
+        snprintf(self->tuners[0].channel, FASTZAP_CHANNEL_MAX, "%s", channel);
+    for(i = 1; i < self->tuner_count; i++) {
+        item = PySequence_Fast_GET_ITEM(seq, i - 1);
+        if(!PyObject_TypeCheck(item, &hdhomerun_Device_type)) {
+            Py_DECREF(seq);
+            PyErr_SetString(PyExc_TypeError, "spares must be a sequence of Device objects");
+            return -1;
+        }
+        Py_INCREF(item);
+        self->tuners[i].device = (py_device_object *)item;
+    }
+    Py_DECREF(seq);
+    self->active = 0;
+
+    if(target) {
+        snprintf(self->target, sizeof(self->target), "%s", target);
+    } else {
+        success = hdhomerun_device_get_tuner_target(device_hd(self->tuners[0].device), &ptarget);
+        if(success == -1) {
+            PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+            return -1;
+        } else if(success != 1) {
+            PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
+            return -1;
+        }
+        snprintf(self->target, sizeof(self->target), "%s", ptarget);
+    }
+    if(strcmp(self->target, "none") == 0 || self->target[0] == '\0') {
+        PyErr_SetString(hdhomerun_device_error, "the live tuner has no stream target");
+        return -1;
+    }
+
+    /* Spares are driven without the viewer's involvement, so hold their locks */
+    for(i = 1; i < self->tuner_count; i++) {
+        if(self->tuners[i].device->locked)
+            continue;
+        item = py_device_tuner_lockkey_request(self->tuners[i].device);
+        if(!item)
+            return -1;
+        Py_DECREF(item);
+        self->tuners[i].took_lock = 1;
+    }
+
+    /* With the live channel known, the spares can start on its neighbours right away */
+    if(channel) {
+        fastzap_lock(self);
+        fastzap_acquire(self);
+        Py_BEGIN_ALLOW_THREADS
+        fastzap_pretune(self, -1);
+        fastzap_release(self);
+        Py_END_ALLOW_THREADS
+        fastzap_invalidate(self);
+        pthread_mutex_unlock(&self->lock);
+    }
+    return 0;
+}
+
+/* Internal: idles the spares and gives back the locks FastZap took; the GIL is released while talking to the device */
+static void fastzap_close(py_fastzap_object *self) {
+    char error[128];
+    Py_ssize_t i;
+    int *released;
+
+    if(self->closed || !self->tuners)
+        return;
+    self->closed = 1;
+    /* Locks are only taken once every tuner is filled in, so a failed __init__ has nothing to undo */
+    for(i = 0; i < self->tuner_count && !self->tuners[i].took_lock; i++);
+    if(i == self->tuner_count)
+        return;
+    released = calloc((size_t)self->tuner_count, sizeof(int));
+
+    fastzap_lock(self);
+    fastzap_acquire(self);
+    Py_BEGIN_ALLOW_THREADS
+    for(i = 0; i < self->tuner_count; i++) {
+        struct fastzap_tuner *tuner = &self->tuners[i];
+
+        if(i == self->active || !tuner->took_lock)
+            continue;
+        fastzap_set(tuner, "channel", "none", error, sizeof(error));
+        tuner->channel[0] = '\0';
+        if(hdhomerun_device_tuner_lockkey_release(device_hd_held(tuner->device)) == 1 && released)
+            released[i] = 1;
+    }
+    fastzap_release(self);
+    Py_END_ALLOW_THREADS
+    fastzap_invalidate(self);
+    pthread_mutex_unlock(&self->lock);
+
+    for(i = 0; i < self->tuner_count; i++) {
+        if(released && released[i]) {
+            self->tuners[i].device->lockkey = 0;
+            self->tuners[i].device->locked = 0;
+        }
+        self->tuners[i].took_lock = 0;
+    }
+    free(released);
+}
+
+static void py_fastzap_dealloc(py_fastzap_object *self) {
+    Py_ssize_t i;
+
+    fastzap_close(self);
+    for(i = 0; i < self->tuner_count; i++)
+        Py_XDECREF(self->tuners[i].device);
+    if(self->lock_initialized)
+        pthread_mutex_destroy(&self->lock);
+    free(self->tuners);
+    free_string_list(self->favorites, self->favorite_count);
+    free_string_list(self->lineup, self->lineup_count);
+    self->ob_type->tp_free((PyObject*)self);
+}
+
+PyDoc_STRVAR(FastZap_DOC_close,
+    "Stop using the spare tuners: they are tuned to 'none' and the locks FastZap\n"
+    "took on them are released.  The live tuner is left as it is.  Called\n"
+    "implicitly when the FastZap is deleted.");
+
+static PyObject *py_fastzap_close(py_fastzap_object *self) {
+    fastzap_close(self);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(FastZap_DOC_zap,
+    "Change the live channel.  If a spare tuner is already on the requested\n"
+    "channel the stream target is moved to it; otherwise the live tuner is\n"
+    "retuned and waited on for lock.  Returns a dict with 'hit', 'ms' and the\n"
+    "'tuner' now carrying the stream.");
+
+static PyObject *py_fastzap_zap(py_fastzap_object *self, PyObject *args, PyObject *kwds) {
+    char *channel = NULL;
+    char *kwlist[] = {"channel", NULL};
+    char error[CONTROL_REPLY_MAX + 64], scratch[CONTROL_REPLY_MAX + 64];
+    struct hdhomerun_tuner_status_t status;
+    struct fastzap_tuner *old, *new;
+    Py_ssize_t i, previous, hit = -1;
+    unsigned int tuner;
+    uint64_t start_ns;
+    double ms;
+    int success;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &channel))
+        return NULL;
+    if(strlen(channel) >= FASTZAP_CHANNEL_MAX) {
+        PyErr_SetString(PyExc_ValueError, "channel name too long");
+        return NULL;
+    }
+    if(!self->tuners || self->closed) {
+        PyErr_SetString(PyExc_ValueError, "FastZap is closed");
+        return NULL;
+    }
+
+    fastzap_lock(self);
+    previous = self->active;
+    for(i = 0; i < self->tuner_count; i++) {
+        if(i != self->active && strcmp(self->tuners[i].channel, channel) == 0) {
+            hit = i;
+            break;
+        }
+    }
+
+    error[0] = '\0';
+    fastzap_acquire(self);
+    start_ns = monotonic_ns();
+    Py_BEGIN_ALLOW_THREADS
+    old = &self->tuners[self->active];
+    if(hit >= 0) {
+        /* Stop the old multiplex first so the two never interleave at the target */
+        new = &self->tuners[hit];
+        success = fastzap_set(old, "target", "none", error, sizeof(error));
+        if(success == 1) {
+            success = fastzap_set(new, "target", self->target, error, sizeof(error));
+            if(success == 1)
+                self->active = hit;
+            else
+                fastzap_set(old, "target", self->target, scratch, sizeof(scratch));
+        }
+    } else {
+        success = fastzap_set(old, self->virtual_channel ? "vchannel" : "channel", channel, error, sizeof(error));
+        if(success == 1) {
+            snprintf(old->channel, FASTZAP_CHANNEL_MAX, "%s", channel);
+            success = hdhomerun_device_wait_for_lock(device_hd_held(old->device), &status);
+            if(success == 0)
+                snprintf(error, sizeof(error), "%s: no lock", channel);
+        }
+    }
+    ms = (double)(monotonic_ns() - start_ns) / 1000000.0;
+    if(success == 1)
+        fastzap_pretune(self, hit >= 0 ? previous : -1);
+    tuner = device_tuner(self->tuners[self->active].device);
+    fastzap_release(self);
+    Py_END_ALLOW_THREADS
+    fastzap_invalidate(self);
+    pthread_mutex_unlock(&self->lock);
+
+    if(success == -1) {
+        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+        return NULL;
+    } else if(success == -2) {
+        PyErr_SetString(hdhomerun_timeout_error, DEVICE_ERR_TIMEOUT);
+        return NULL;
+    } else if(success == 0) {
+        PyErr_SetString(hdhomerun_device_error, error[0] ? error : DEVICE_ERR_REJECTED_OP);
+        return NULL;
+    } else if(success != 1) {
+        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
+        return NULL;
+    }
+
+    if(hit >= 0) {
+        self->hits++;
+        self->hit_ms_total += ms;
+        if(ms > self->hit_ms_max)
+            self->hit_ms_max = ms;
+    } else {
+        self->misses++;
+        self->miss_ms_total += ms;
+        if(ms > self->miss_ms_max)
+            self->miss_ms_max = ms;
+    }
+
+    return Py_BuildValue("{s:O,s:d,s:I}", "hit", hit >= 0 ? Py_True : Py_False, "ms", ms, "tuner", tuner);
+}
+
+PyDoc_STRVAR(FastZap_DOC_stats,
+    "Return hit rate and zap time statistics.");
+
+static PyObject *py_fastzap_stats(py_fastzap_object *self) {
+    unsigned long total = self->hits + self->misses;
+
+    return Py_BuildValue("{s:k,s:k,s:d,s:d,s:d,s:d,s:d}",
+                         "hits", self->hits,
+                         "misses", self->misses,
+                         "hit_rate", total ? (double)self->hits / (double)total : 0.0,
+                         "hit_ms_avg", self->hits ? self->hit_ms_total / (double)self->hits : 0.0,
+                         "hit_ms_max", self->hit_ms_max,
+                         "miss_ms_avg", self->misses ? self->miss_ms_total / (double)self->misses : 0.0,
+                         "miss_ms_max", self->miss_ms_max);
+}
+
+PyDoc_STRVAR(FastZap_DOC_state,
+    "Return a list of (Device, channel, live) tuples describing every tuner.");
+
+static PyObject *py_fastzap_state(py_fastzap_object *self) {
+    PyObject *rv, *entry;
+    Py_ssize_t i;
+
+    rv = PyList_New(self->tuner_count);
+    if(!rv || !self->tuners)
+        return rv;
+    fastzap_lock(self);
+    for(i = 0; i < self->tuner_count; i++) {
+        entry = Py_BuildValue("(OsO)", (PyObject *)self->tuners[i].device, self->tuners[i].channel,
+                              i == self->active ? Py_True : Py_False);
+        if(!entry) { pthread_mutex_unlock(&self->lock); Py_DECREF(rv); return NULL; }
+        PyList_SET_ITEM(rv, i, entry);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return rv;
+}
+
+static PyMethodDef py_fastzap_methods[] = {
+    {"zap",                     (PyCFunction)py_fastzap_zap,                    METH_KEYWORDS,              FastZap_DOC_zap},
+    {"stats",                   (PyCFunction)py_fastzap_stats,                  METH_NOARGS,                FastZap_DOC_stats},
+    {"state",                   (PyCFunction)py_fastzap_state,                  METH_NOARGS,                FastZap_DOC_state},
+    {"close",                   (PyCFunction)py_fastzap_close,                  METH_NOARGS,                FastZap_DOC_close},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_FastZap_type_doc,
+    "FastZap(live, spares, favorites=None, lineup=None, vchannel=False, target=None, channel=None)\n\n"
+    "Channel change controller which keeps the spare Device tuners locked on\n"
+    "the channels most likely to be selected next.  The stream target is taken\n"
+    "from the live tuner unless given.  If lineup (an ordered channel list) is\n"
+    "given it defines which channels are adjacent.  channel names what the live\n"
+    "tuner is showing now, so its neighbours are pretuned at once and zapping\n"
+    "back to it is a hit.");
+
+PyTypeObject hdhomerun_FastZap_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.FastZap",            /* tp_name */
+    sizeof(py_fastzap_object),      /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_fastzap_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    hdhomerun_FastZap_type_doc,     /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_fastzap_methods,             /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    (initproc)py_fastzap_init,      /* tp_init */
+    (allocfunc)PyType_GenericAlloc, /* tp_alloc */
+    (newfunc)PyType_GenericNew,     /* tp_new */
+    (freefunc)PyObject_Del,         /* tp_free */
+};
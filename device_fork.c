@@ -0,0 +1,127 @@
+/*
+ * device_fork.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  After fork() the child holds copies of every socket the parent had open,
+ *  but none of its threads.  Talking on an inherited control socket
+ *  interleaves requests with the parent's; joining an inherited receiver or
+ *  watchdog thread waits forever; and a mutex one of them held at the time
+ *  of the fork stays locked.
+ *
+ *  The atfork child handler only bumps fork_generation.  Everything which
+ *  owns sockets or threads remembers the generation it was created in and,
+ *  on its next use in a later one, lets go of what it inherited instead of
+ *  cleaning it up: sockets are closed, threads are assumed gone, and the
+ *  libhdhomerun handle is replaced with a fresh one.  The memory belonging to
+ *  the parent's threads is left alone.
+ */
+
+static volatile unsigned long fork_generation = 0;
+
+static void fork_child(void) {
+    fork_generation++;
+    exporter_after_fork();
+}
+
+void fork_handlers_install(void) {
+    pthread_atfork(NULL, NULL, fork_child);
+}
+
+unsigned long fork_generation_current(void) {
+    return fork_generation;
+}
+
+/* Internal: a new handle for the same device and tuner; the inherited one is abandoned, not destroyed */
+struct hdhomerun_device_t *fork_replace_hd(struct hdhomerun_device_t *hd) {
+    struct hdhomerun_device_t *fresh;
+    struct hdhomerun_control_sock_t *cs;
+
+    fresh = hdhomerun_device_create(hdhomerun_device_get_device_id_requested(hd),
+                                    hdhomerun_device_get_device_ip_requested(hd),
+                                    hdhomerun_device_get_tuner(hd), NULL);
+    if(!fresh)
+        return hd;
+    /*
+     *  Close our copy of the control socket; the parent's stays connected.
+     *  The rest of the old handle is leaked: hdhomerun_device_destroy() would
+     *  join a video thread which only exists in the parent.
+     */
+    cs = hdhomerun_device_get_control_sock(hd);
+    if(cs)
+        hdhomerun_control_destroy(cs);
+    return fresh;
+}
+
+/* Internal: called before a Device touches its handle, sockets or stream; the GIL must be held */
+void device_fork_check(py_device_object *self) {
+    if(self->generation == fork_generation)
+        return;
+    self->generation = fork_generation;
+
+    if(self->conn) {
+        connection_fork_check(self->conn);
+        self->hd = self->conn->hd;
+    } else if(self->hd) {
+        self->hd = fork_replace_hd(self->hd);
+        hdhomerun_device_tuner_lockkey_use_value(self->hd, self->lockkey);
+        device_reservation_init(&self->reservation);
+    }
+    control_pipe_after_fork(&self->pipe);
+    /* stream_rx_destroy() notices the receiver was inherited and does not join it */
+    stream_rx_destroy(self->rx);
+    self->rx = NULL;
+    py_stream_group_leave(self);
+    /* The watchdog thread only exists in the parent; watchdog_stop() notices */
+    device_watchdog_stop(self);
+    /* The parent still owns the lock; keep presenting the key but never release it */
+    self->locked = 0;
+}
+
+const char Device_DOC_reduce[] =
+    "Pickle support: a Device is rebuilt from its device IP, device ID and\n"
+    "tuner, the same values clone() uses, so no discovery is needed.  A lock key\n"
+    "is carried along and presented by the copy, but the lock stays with the\n"
+    "original: the copy never releases it.  A Device opened on a Connection\n"
+    "becomes a standalone Device.";
+PyObject *py_device_reduce(py_device_object *self) {
+    uint32_t device_id, device_ip;
+    unsigned int tuner;
+
+    device_fork_check(self);
+    device_identity(self, &device_ip, &device_id, &tuner);
+    if(self->lockkey)
+        return Py_BuildValue("O(III)k", (PyObject *)self->ob_type, device_ip, device_id, tuner,
+                             (unsigned long)self->lockkey);
+    return Py_BuildValue("O(III)", (PyObject *)self->ob_type, device_ip, device_id, tuner);
+}
+
+const char Device_DOC_setstate[] = "Restore the lock key saved by __reduce__().";
+PyObject *py_device_setstate(py_device_object *self, PyObject *state) {
+    unsigned int lockkey;
+
+    if(!PyArg_Parse(state, "I", &lockkey))
+        return NULL;
+    self->lockkey = (uint32_t)lockkey;
+    hdhomerun_device_tuner_lockkey_use_value(device_hd(self), self->lockkey);
+    Py_RETURN_NONE;
+}
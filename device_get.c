@@ -29,7 +29,7 @@ const char Device_DOC_get_name[] = "Get the device name.";
 PyObject *py_device_get_name(py_device_object *self) {
     const char *name;
 
-    name = hdhomerun_device_get_name(self->hd);
+    name = hdhomerun_device_get_name(device_hd(self));
     return PyString_FromString(name);
 }
 
@@ -37,7 +37,7 @@ const char Device_DOC_get_device_id[] = "Get the device ID.";
 PyObject *py_device_get_device_id(py_device_object *self) {
     uint32_t device_id;
 
-    device_id = hdhomerun_device_get_device_id(self->hd);
+    device_id = hdhomerun_device_get_device_id(device_hd(self));
     return PyLong_FromUnsignedLong((unsigned long)device_id);
 }
 
@@ -45,7 +45,7 @@ const char Device_DOC_get_device_ip[] = "Get the device IP.";
 PyObject *py_device_get_device_ip(py_device_object *self) {
     uint32_t device_ip;
 
-    device_ip = hdhomerun_device_get_device_ip(self->hd);
+    device_ip = hdhomerun_device_get_device_ip(device_hd(self));
     return PyLong_FromUnsignedLong((unsigned long)device_ip);
 }
 
@@ -53,7 +53,7 @@ const char Device_DOC_get_device_id_requested[] = "Get the requested device ID."
 PyObject *py_device_get_device_id_requested(py_device_object *self) {
     uint32_t device_id;
 
-    device_id = hdhomerun_device_get_device_id_requested(self->hd);
+    device_id = hdhomerun_device_get_device_id_requested(device_hd(self));
     return PyLong_FromUnsignedLong((unsigned long)device_id);
 }
 
@@ -61,7 +61,7 @@ const char Device_DOC_get_device_ip_requested[] = "Get the requested device IP."
 PyObject *py_device_get_device_ip_requested(py_device_object *self) {
     uint32_t device_ip;
 
-    device_ip = hdhomerun_device_get_device_ip_requested(self->hd);
+    device_ip = hdhomerun_device_get_device_ip_requested(device_hd(self));
     return PyLong_FromUnsignedLong((unsigned long)device_ip);
 }
 
@@ -69,7 +69,7 @@ const char Device_DOC_get_tuner[] = "Get the tuner number that this Device objec
 PyObject *py_device_get_tuner(py_device_object *self) {
     unsigned int tuner_number;
 
-    tuner_number = hdhomerun_device_get_tuner(self->hd);
+    tuner_number = hdhomerun_device_get_tuner(device_hd(self));
     return PyLong_FromUnsignedLong((unsigned long)tuner_number);
 }
 
@@ -77,21 +77,46 @@ PyObject *py_device_get_tuner(py_device_object *self) {
  *  Functions which operate on a HDHomeRun device
  */
 
-const char Device_DOC_get_var[] = "Get a named control variable on the device.";
+/* Internal: the typed getters for string-valued tuner variables, e.g. /tuner0/channel */
+static PyObject *device_get_tuner_var(py_device_object *self, PyObject *args, PyObject *kwds, const char *name) {
+    unsigned int timeout_ms = self->control_timeout_ms;
+    char *kwlist[] = {"timeout_ms", NULL};
+    char *ret_value = NULL;
+    char *ret_error = (char *)DEVICE_ERR_REJECTED_OP;
+    char item[32];
+    int success;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &timeout_ms))
+        return NULL;
+
+    snprintf(item, sizeof(item), "/tuner%u/%s", hdhomerun_device_get_tuner(device_hd(self)), name);
+    success = device_get_var_cached(self, item, timeout_ms, &ret_value, &ret_error);
+    if(success != 1)
+        return device_control_error(success, ret_error);
+    return PyString_FromString(ret_value);
+}
+
+const char Device_DOC_get_var[] =
+    "Get a named control variable on the device.  timeout_ms, like that of the\n"
+    "typed getters, overrides set_control_timeout() for this call.";
 PyObject *py_device_get_var(py_device_object *self, PyObject *args, PyObject *kwds) {
     char *ret_value = NULL;
     char *ret_error = "the get operation was rejected by the device";
     char *item = NULL;
+    unsigned int timeout_ms = self->control_timeout_ms;
     int success;
-    char *kwlist[] = {"item", NULL};
+    char *kwlist[] = {"item", "timeout_ms", NULL};
 
-    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &item))
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|I", kwlist, &item, &timeout_ms))
         return NULL;
 
-    success = hdhomerun_device_get_var(self->hd, item, &ret_value, &ret_error);
+    success = device_get_var_cached(self, item, timeout_ms, &ret_value, &ret_error);
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
         return NULL;
+    } else if(success == -2) {
+        PyErr_SetString(hdhomerun_timeout_error, DEVICE_ERR_TIMEOUT);
+        return NULL;
     } else if(success == 0) {
         PyErr_SetString(hdhomerun_device_error, ret_error);
         return NULL;
@@ -104,15 +129,30 @@ PyObject *py_device_get_var(py_device_object *self, PyObject *args, PyObject *kw
 }
 
 const char Device_DOC_get_tuner_status[] = "Get the tuner's status";
-PyObject *py_device_get_tuner_status(py_device_object *self) {
+PyObject *py_device_get_tuner_status(py_device_object *self, PyObject *args, PyObject *kwds) {
     int success;
-    char *pstatus_str;
+    char item[32];
+    unsigned int timeout_ms = self->control_timeout_ms;
+    char *kwlist[] = {"timeout_ms", NULL};
+    struct control_op op;
     struct hdhomerun_tuner_status_t status;
 
-    success = hdhomerun_device_get_tuner_status(self->hd, &pstatus_str, &status);
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &timeout_ms))
+        return NULL;
+
+    /* Fetched like any other variable so timeout_ms applies, then parsed the way libhdhomerun does it */
+    snprintf(item, sizeof(item), "/tuner%u/status", device_tuner(self));
+    memset(&op, 0, sizeof(op));
+    op.name = item;
+    success = device_control_var(self, &op, timeout_ms);
+    if(success == 1)
+        parse_tuner_status(op.text, &status);
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
         return NULL;
+    } else if(success == -2) {
+        PyErr_SetString(hdhomerun_timeout_error, DEVICE_ERR_TIMEOUT);
+        return NULL;
     } else if(success == 0) {
         PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
         return NULL;
@@ -122,7 +162,7 @@ PyObject *py_device_get_tuner_status(py_device_object *self) {
     }
 
     /*
-     *  pstatus_str is a string that represents a subset of the structure contents,
+     *  The reply is a string that represents a subset of the structure contents,
      *  which might look like this:
      *    ch=qam:549000000 lock=qam256 ss=100 snq=91 seq=100 bps=13215648 pps=0
      *  We can ignore it here since we return the complete contents of the struct as a dict.
@@ -130,27 +170,69 @@ PyObject *py_device_get_tuner_status(py_device_object *self) {
     return build_tuner_status_dict(&status);
 }
 
+/* Internal: fetches item like any other variable so timeout_ms applies, see device_control_var() */
+static int device_get_uncached(py_device_object *self, const char *item, unsigned int timeout_ms, struct control_op *op) {
+    memset(op, 0, sizeof(*op));
+    op->name = item;
+    return device_control_var(self, op, timeout_ms);
+}
+
+/* Internal: parses a plotsample reply the way libhdhomerun does, keeping only space terminated samples */
+static PyObject *build_plotsample_list(const char *text) {
+    PyObject *sample_list, *sample;
+    const char *end;
+    unsigned int raw;
+    uint16_t real, imag;
+
+    sample_list = PyList_New(0);
+    if(!sample_list)
+        return NULL;
+    while((end = strchr(text, ' ')) != NULL) {
+        if(sscanf(text, "%x", &raw) != 1)
+            break;
+        real = (raw >> 12) & 0x0FFF;
+        if(real & 0x0800)
+            real |= 0xF000;
+        imag = raw & 0x0FFF;
+        if(imag & 0x0800)
+            imag |= 0xF000;
+        sample = PyComplex_FromDoubles((double)(int16_t)real, (double)(int16_t)imag);
+        if(sample == NULL) {
+            Py_DECREF(sample_list);
+            return NULL;
+        }
+        if(PyList_Append(sample_list, sample) != 0) {
+            Py_DECREF(sample);
+            Py_DECREF(sample_list);
+            return NULL;
+        }
+        Py_DECREF(sample);
+        text = end + 1;
+    }
+    return sample_list;
+}
+
 const char Device_DOC_get_tuner_vstatus[] = "Get the tuner's vstatus";
-PyObject *py_device_get_tuner_vstatus(py_device_object *self) {
+PyObject *py_device_get_tuner_vstatus(py_device_object *self, PyObject *args, PyObject *kwds) {
     PyObject *rv, *dv;
     int success;
-    char *pvstatus_str;
+    char item[32];
+    unsigned int timeout_ms = self->control_timeout_ms;
+    char *kwlist[] = {"timeout_ms", NULL};
+    struct control_op op;
     struct hdhomerun_tuner_vstatus_t vstatus;
 
-    success = hdhomerun_device_get_tuner_vstatus(self->hd, &pvstatus_str, &vstatus);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &timeout_ms))
         return NULL;
-    }
+
+    snprintf(item, sizeof(item), "/tuner%u/vstatus", device_tuner(self));
+    success = device_get_uncached(self, item, timeout_ms, &op);
+    if(success != 1)
+        return device_control_error(success, DEVICE_ERR_REJECTED_OP);
+    parse_tuner_vstatus(op.text, &vstatus);
 
     /*
-     *  pvstatus_str is a string that represents a subset of the structure contents,
+     *  The reply is a string that represents a subset of the structure contents,
      *  which might look like this:
      *    vch=702 name=KTVUD auth=unspecified cci=none
      *  We can ignore it here since we return the complete contents of the struct as a dict.
@@ -202,293 +284,136 @@ PyObject *py_device_get_tuner_vstatus(py_device_object *self) {
 }
 
 const char Device_DOC_get_tuner_streaminfo[] = "Get the tuner's stream info";
-PyObject *py_device_get_tuner_streaminfo(py_device_object *self) {
-    int success;
-    char *pstreaminfo = NULL;
-
-    success = hdhomerun_device_get_tuner_streaminfo(self->hd, &pstreaminfo);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
-
-    return PyString_FromString(pstreaminfo);
+PyObject *py_device_get_tuner_streaminfo(py_device_object *self, PyObject *args, PyObject *kwds) {
+    return device_get_tuner_var(self, args, kwds, "streaminfo");
 }
 
 const char Device_DOC_get_tuner_channel[] = "Get the tuner's channel";
-PyObject *py_device_get_tuner_channel(py_device_object *self) {
-    int success;
-    char *pchannel = NULL;
-
-    success = hdhomerun_device_get_tuner_channel(self->hd, &pchannel);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
-
-    return PyString_FromString(pchannel);
+PyObject *py_device_get_tuner_channel(py_device_object *self, PyObject *args, PyObject *kwds) {
+    return device_get_tuner_var(self, args, kwds, "channel");
 }
 
 const char Device_DOC_get_tuner_vchannel[] = "Get the tuner's vchannel";
-PyObject *py_device_get_tuner_vchannel(py_device_object *self) {
-    int success;
-    char *pvchannel = NULL;
-
-    success = hdhomerun_device_get_tuner_vchannel(self->hd, &pvchannel);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
-
-    return PyString_FromString(pvchannel);
+PyObject *py_device_get_tuner_vchannel(py_device_object *self, PyObject *args, PyObject *kwds) {
+    return device_get_tuner_var(self, args, kwds, "vchannel");
 }
 
 const char Device_DOC_get_tuner_channelmap[] = "Get the tuner's channel map";
-PyObject *py_device_get_tuner_channelmap(py_device_object *self) {
-    int success;
-    char *pchannelmap = NULL;
-
-    success = hdhomerun_device_get_tuner_channelmap(self->hd, &pchannelmap);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
-
-    return PyString_FromString(pchannelmap);
+PyObject *py_device_get_tuner_channelmap(py_device_object *self, PyObject *args, PyObject *kwds) {
+    return device_get_tuner_var(self, args, kwds, "channelmap");
 }
 
 const char Device_DOC_get_tuner_filter[] = "Get the tuner's filter";
-PyObject *py_device_get_tuner_filter(py_device_object *self) {
-    int success;
-    char *pfilter = NULL;
-
-    success = hdhomerun_device_get_tuner_filter(self->hd, &pfilter);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
-
-    return PyString_FromString(pfilter);
+PyObject *py_device_get_tuner_filter(py_device_object *self, PyObject *args, PyObject *kwds) {
+    return device_get_tuner_var(self, args, kwds, "filter");
 }
 
 const char Device_DOC_get_tuner_program[] = "Get the tuner's program";
-PyObject *py_device_get_tuner_program(py_device_object *self) {
-    int success;
-    char *pprogram = NULL;
-
-    success = hdhomerun_device_get_tuner_program(self->hd, &pprogram);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
-
-    return PyString_FromString(pprogram);
+PyObject *py_device_get_tuner_program(py_device_object *self, PyObject *args, PyObject *kwds) {
+    return device_get_tuner_var(self, args, kwds, "program");
 }
 
 const char Device_DOC_get_tuner_target[] = "Get the tuner's target";
-PyObject *py_device_get_tuner_target(py_device_object *self) {
-    int success;
-    char *ptarget = NULL;
-
-    success = hdhomerun_device_get_tuner_target(self->hd, &ptarget);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
-
-    return PyString_FromString(ptarget);
+PyObject *py_device_get_tuner_target(py_device_object *self, PyObject *args, PyObject *kwds) {
+    return device_get_tuner_var(self, args, kwds, "target");
 }
 
 
 const char Device_DOC_get_tuner_plotsample[] = "Get the tuner's plot sample";
-PyObject *py_device_get_tuner_plotsample(py_device_object *self) {
-    int success, i;
-    size_t pcount;
-    struct hdhomerun_plotsample_t *psamples = NULL;
-    PyObject *sample_list, *sample;
+PyObject *py_device_get_tuner_plotsample(py_device_object *self, PyObject *args, PyObject *kwds) {
+    int success;
+    char item[32];
+    unsigned int timeout_ms = self->control_timeout_ms;
+    char *kwlist[] = {"timeout_ms", NULL};
+    struct control_op op;
 
-    success = hdhomerun_device_get_tuner_plotsample(self->hd, &psamples, &pcount);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &timeout_ms))
         return NULL;
-    }
 
-    sample_list = PyList_New((Py_ssize_t)pcount);
-    if(!sample_list)
-        return NULL;
-    if(pcount == 0)
-        return sample_list;
-    for(i=0; i<pcount; i++) {
-        sample = PyComplex_FromDoubles((double)psamples[i].real, (double)psamples[i].imag);
-        if(sample == NULL) {
-            Py_DECREF(sample_list);
-            return NULL;
-        }
-        if(PyList_SetItem(sample_list, (Py_ssize_t)i, sample) != 0) {
-            Py_DECREF(sample_list);
-            return NULL;
-        }
-    }
-    return sample_list;
+    snprintf(item, sizeof(item), "/tuner%u/plotsample", device_tuner(self));
+    success = device_get_uncached(self, item, timeout_ms, &op);
+    if(success != 1)
+        return device_control_error(success, DEVICE_ERR_REJECTED_OP);
+    return build_plotsample_list(op.text);
 }
 
 const char Device_DOC_get_tuner_lockkey_owner[] = "Get the tuner's lock owner";
-PyObject *py_device_get_tuner_lockkey_owner(py_device_object *self) {
-    int success;
-    char *powner = NULL;
-
-    success = hdhomerun_device_get_tuner_lockkey_owner(self->hd, &powner);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
-
-    return PyString_FromString(powner);
+PyObject *py_device_get_tuner_lockkey_owner(py_device_object *self, PyObject *args, PyObject *kwds) {
+    return device_get_tuner_var(self, args, kwds, "lockkey");
 }
 
 const char Device_DOC_get_oob_status[] = "Get the device's OOB status";
-PyObject *py_device_get_oob_status(py_device_object *self) {
+PyObject *py_device_get_oob_status(py_device_object *self, PyObject *args, PyObject *kwds) {
     int success;
-    char *pstatus_str;
+    unsigned int timeout_ms = self->control_timeout_ms;
+    char *kwlist[] = {"timeout_ms", NULL};
+    struct control_op op;
     struct hdhomerun_tuner_status_t status;
 
-    success = hdhomerun_device_get_oob_status(self->hd, &pstatus_str, &status);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &timeout_ms))
         return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
 
+    success = device_get_uncached(self, "/oob/status", timeout_ms, &op);
+    if(success != 1)
+        return device_control_error(success, DEVICE_ERR_REJECTED_OP);
+    parse_tuner_status(op.text, &status);
     return build_tuner_status_dict(&status);
 }
 
 const char Device_DOC_get_oob_plotsample[] = "Get the OOB plot sample";
-PyObject *py_device_get_oob_plotsample(py_device_object *self) {
-    int success, i;
-    size_t pcount;
-    struct hdhomerun_plotsample_t *psamples = NULL;
-    PyObject *sample_list, *sample;
+PyObject *py_device_get_oob_plotsample(py_device_object *self, PyObject *args, PyObject *kwds) {
+    int success;
+    unsigned int timeout_ms = self->control_timeout_ms;
+    char *kwlist[] = {"timeout_ms", NULL};
+    struct control_op op;
 
-    success = hdhomerun_device_get_oob_plotsample(self->hd, &psamples, &pcount);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &timeout_ms))
         return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
 
-    sample_list = PyList_New((Py_ssize_t)pcount);
-    if(!sample_list)
-        return NULL;
-    if(pcount == 0)
-        return sample_list;
-    for(i=0; i<pcount; i++) {
-        sample = PyComplex_FromDoubles((double)psamples[i].real, (double)psamples[i].imag);
-        if(sample == NULL) {
-            Py_DECREF(sample_list);
-            return NULL;
-        }
-        if(PyList_SetItem(sample_list, (Py_ssize_t)i, sample) != 0) {
-            Py_DECREF(sample_list);
-            return NULL;
-        }
-    }
-    return sample_list;
+    success = device_get_uncached(self, "/oob/plotsample", timeout_ms, &op);
+    if(success != 1)
+        return device_control_error(success, DEVICE_ERR_REJECTED_OP);
+    return build_plotsample_list(op.text);
 }
 
 const char Device_DOC_get_ir_target[] = "Get the device's IR target";
-PyObject *py_device_get_ir_target(py_device_object *self) {
+PyObject *py_device_get_ir_target(py_device_object *self, PyObject *args, PyObject *kwds) {
     int success;
-    char *ptarget = NULL;
+    unsigned int timeout_ms = self->control_timeout_ms;
+    char *kwlist[] = {"timeout_ms", NULL};
+    struct control_op op;
 
-    success = hdhomerun_device_get_ir_target(self->hd, &ptarget);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &timeout_ms))
         return NULL;
-    }
 
-    return PyString_FromString(ptarget);
+    success = device_get_uncached(self, "/ir/target", timeout_ms, &op);
+    if(success != 1)
+        return device_control_error(success, DEVICE_ERR_REJECTED_OP);
+    return PyString_FromString(op.text);
 }
 
 const char Device_DOC_get_version[] = "Get the device's firmware version";
-PyObject *py_device_get_version(py_device_object *self) {
+PyObject *py_device_get_version(py_device_object *self, PyObject *args, PyObject *kwds) {
     int success;
     uint32_t version_num;
     char *pversion_str = NULL;
+    char *ret_error;
+    unsigned int timeout_ms = self->control_timeout_ms;
+    char *kwlist[] = {"timeout_ms", NULL};
 
-    success = hdhomerun_device_get_version(self->hd, &pversion_str, &version_num);
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &timeout_ms))
+        return NULL;
+
+    /* Same as hdhomerun_device_get_version(), but served from the variable cache */
+    success = device_get_var_cached(self, "/sys/version", timeout_ms, &pversion_str, &ret_error);
+    if(success == 1)
+        version_num = (uint32_t)strtoul(pversion_str, NULL, 10);
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
         return NULL;
+    } else if(success == -2) {
+        PyErr_SetString(hdhomerun_timeout_error, DEVICE_ERR_TIMEOUT);
+        return NULL;
     } else if(success == 0) {
         PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
         return NULL;
@@ -503,24 +428,24 @@ PyObject *py_device_get_version(py_device_object *self) {
 const char Device_DOC_get_supported[] = "Get supported";
 PyObject *py_device_get_supported(py_device_object *self, PyObject *args, PyObject *kwds) {
     int success;
-    char *pstr = NULL;
+    char *features = NULL;
+    char *ret_error = (char *)DEVICE_ERR_REJECTED_OP;
     char *prefix = NULL;
-    char *kwlist[] = {"prefix", NULL};
-
-    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &prefix))
-        return NULL;
-
-    success = hdhomerun_device_get_supported(self->hd, prefix, &pstr);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success != 1) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
-
-    return PyString_FromString(pstr);
+    const char *start, *end;
+    unsigned int timeout_ms = self->control_timeout_ms;
+    char *kwlist[] = {"prefix", "timeout_ms", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|I", kwlist, &prefix, &timeout_ms))
+        return NULL;
+
+    /* Same as hdhomerun_device_get_supported(), but served from the variable cache */
+    success = device_get_var_cached(self, "/sys/features", timeout_ms, &features, &ret_error);
+    if(success != 1)
+        return device_control_error(success, ret_error);
+    start = strstr(features, prefix);
+    if(!start)
+        return device_control_error(0, DEVICE_ERR_REJECTED_OP);
+    start += strlen(prefix);
+    end = strchr(start, '\n');
+    return PyString_FromStringAndSize(start, end ? (Py_ssize_t)(end - start) : (Py_ssize_t)strlen(start));
 }
@@ -0,0 +1,188 @@
+/*
+ * device_info.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  A DeviceInfo is a discovery result and nothing more: four integers, no
+ *  libhdhomerun handle and no sockets.  It is immutable, so it is filled in
+ *  by tp_new rather than tp_init, and can be hashed and compared.  open()
+ *  creates the Device when one is actually needed.
+ */
+
+typedef struct {
+    PyObject_HEAD
+    unsigned int device_ip;
+    unsigned int device_id;
+    unsigned int device_type;
+    unsigned int tuner_count;
+} py_device_info_object;
+
+PyObject *device_info_from_discover(const struct hdhomerun_discover_device_t *result) {
+    py_device_info_object *info;
+
+    info = PyObject_New(py_device_info_object, &hdhomerun_DeviceInfo_type);
+    if(!info)
+        return NULL;
+    info->device_ip = result->ip_addr;
+    info->device_id = result->device_id;
+    info->device_type = result->device_type;
+    info->tuner_count = result->tuner_count;
+    return (PyObject *)info;
+}
+
+static PyObject *py_device_info_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+    unsigned int device_ip = 0, device_id = 0;
+    unsigned int device_type = HDHOMERUN_DEVICE_TYPE_TUNER, tuner_count = 0;
+    char *kwlist[] = {"device_ip", "device_id", "device_type", "tuner_count", NULL};
+    py_device_info_object *info;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "II|II", kwlist, &device_ip, &device_id, &device_type, &tuner_count))
+        return NULL;
+    info = (py_device_info_object *)type->tp_alloc(type, 0);
+    if(!info)
+        return NULL;
+    info->device_ip = device_ip;
+    info->device_id = device_id;
+    info->device_type = device_type;
+    info->tuner_count = tuner_count;
+    return (PyObject *)info;
+}
+
+static void py_device_info_dealloc(py_device_info_object *self) {
+    self->ob_type->tp_free((PyObject*)self);
+}
+
+static PyObject *py_device_info_repr(py_device_info_object *self) {
+    char repr[80];
+
+    /* PyString_FromFormat has no width or hex conversions */
+    snprintf(repr, sizeof(repr), "<hdhomerun.DeviceInfo %08X at %u.%u.%u.%u, %u tuners>", self->device_id,
+             (self->device_ip >> 24) & 0xFF, (self->device_ip >> 16) & 0xFF,
+             (self->device_ip >> 8) & 0xFF, self->device_ip & 0xFF, self->tuner_count);
+    return PyString_FromString(repr);
+}
+
+static long py_device_info_hash(py_device_info_object *self) {
+    long hash;
+
+    hash = (long)(((unsigned long)self->device_id << 1) ^ self->device_ip);
+    return hash == -1 ? -2 : hash;
+}
+
+static PyObject *py_device_info_richcompare(PyObject *a, PyObject *b, int op) {
+    py_device_info_object *x = (py_device_info_object *)a, *y = (py_device_info_object *)b;
+    int equal;
+
+    if(!PyObject_TypeCheck(a, &hdhomerun_DeviceInfo_type) || !PyObject_TypeCheck(b, &hdhomerun_DeviceInfo_type) ||
+       (op != Py_EQ && op != Py_NE)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    equal = x->device_ip == y->device_ip && x->device_id == y->device_id &&
+            x->device_type == y->device_type && x->tuner_count == y->tuner_count;
+    return PyBool_FromLong(op == Py_EQ ? equal : !equal);
+}
+
+PyDoc_STRVAR(DeviceInfo_DOC_open,
+    "Create a Device for the given tuner of this device.");
+
+static PyObject *py_device_info_open(py_device_info_object *self, PyObject *args, PyObject *kwds) {
+    unsigned int tuner = 0;
+    char *kwlist[] = {"tuner", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &tuner))
+        return NULL;
+    if(self->tuner_count && tuner >= self->tuner_count) {
+        PyErr_Format(PyExc_ValueError, "tuner must be less than %u", self->tuner_count);
+        return NULL;
+    }
+    return PyObject_CallFunction((PyObject *)&hdhomerun_Device_type, "III", self->device_ip, self->device_id, tuner);
+}
+
+PyDoc_STRVAR(DeviceInfo_DOC_reduce,
+    "Pickle support: a DeviceInfo is rebuilt from its four fields.");
+
+static PyObject *py_device_info_reduce(py_device_info_object *self) {
+    return Py_BuildValue("O(IIII)", (PyObject *)self->ob_type, self->device_ip, self->device_id,
+                         self->device_type, self->tuner_count);
+}
+
+static PyMethodDef py_device_info_methods[] = {
+    {"open",                    (PyCFunction)py_device_info_open,               METH_KEYWORDS,              DeviceInfo_DOC_open},
+    {"__reduce__",              (PyCFunction)py_device_info_reduce,             METH_NOARGS,                DeviceInfo_DOC_reduce},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+static PyMemberDef py_device_info_members[] = {
+    {"device_ip",   T_UINT, offsetof(py_device_info_object, device_ip),   READONLY, "The device's IP address."},
+    {"device_id",   T_UINT, offsetof(py_device_info_object, device_id),   READONLY, "The device ID."},
+    {"device_type", T_UINT, offsetof(py_device_info_object, device_type), READONLY, "The device type reported by discovery."},
+    {"tuner_count", T_UINT, offsetof(py_device_info_object, tuner_count), READONLY, "The number of tuners, 0 if not reported."},
+    {NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_DeviceInfo_type_doc,
+    "DeviceInfo(device_ip, device_id, device_type=1, tuner_count=0)\n\n"
+    "An immutable discovery record, returned by Device.discover(info=True).");
+
+PyTypeObject hdhomerun_DeviceInfo_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.DeviceInfo",         /* tp_name */
+    sizeof(py_device_info_object),  /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_device_info_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    (reprfunc)py_device_info_repr,  /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    (hashfunc)py_device_info_hash,  /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    hdhomerun_DeviceInfo_type_doc,  /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    py_device_info_richcompare,     /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_device_info_methods,         /* tp_methods */
+    py_device_info_members,         /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    (allocfunc)PyType_GenericAlloc, /* tp_alloc */
+    (newfunc)py_device_info_new,    /* tp_new */
+    (freefunc)PyObject_Del,         /* tp_free */
+};
@@ -0,0 +1,529 @@
+/*
+ * device_pcr.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  PCR analysis stage.  For each PCR PID it measures the PCR interval, the
+ *  mux bitrate implied by the bytes received between PCRs, the PCR accuracy
+ *  against that bitrate, the PCR jitter and drift against monotonic_ns(),
+ *  and (once the PAT and PMT have been seen) the program's own bitrate.
+ *  Results accumulate over a window and are published as a whole, so Python
+ *  always reads a consistent summary.
+ */
+
+#define PCR_MAX_PIDS 32
+#define PCR_MAX_PMTS 32
+#define PCR_MAX_STREAMS 32
+#define PCR_WRAP (((uint64_t)1 << 33) * 300)
+#define PCR_TICKS_TO_NS(t) ((double)(t) * 1000.0 / 27.0)
+#define PCR_REPETITION_NS 40000000.0        /* ISO/IEC 13818-1 maximum PCR interval */
+#define PCR_DISCONTINUITY_NS 100000000.0    /* beyond this the PCR is treated as restarted */
+
+struct pcr_window {
+    unsigned long pcrs;
+    double interval_min_ns;
+    double interval_max_ns;
+    double interval_sum_ns;
+    double offset_min_ns;
+    double offset_max_ns;
+    double accuracy_max_ns;
+    uint64_t mux_bytes;
+    uint64_t program_bytes;
+    uint64_t ticks;
+};
+
+struct pcr_pid_state {
+    uint16_t pid;
+    int program;                /* -1 until the PMT naming this PCR PID is seen */
+
+    /* Only touched by the stage */
+    uint64_t program_bytes;     /* total bytes on the program's PIDs */
+    int anchored;
+    uint64_t last_pcr;
+    uint64_t last_arrival_ns;
+    uint64_t last_mux_bytes;
+    uint64_t last_program_bytes;
+    double last_bitrate;
+    uint64_t base_arrival_ns;
+    uint64_t elapsed_ticks;
+    uint64_t window_start_ns;
+    struct pcr_window acc;
+    unsigned long discontinuities;
+    unsigned long repetition_errors;
+
+    /* Protected by the analyzer lock, as are pid and program */
+    int published;
+    struct pcr_window summary;
+    double summary_ms;
+    double drift_ppm;
+    unsigned long summary_discontinuities;
+    unsigned long summary_repetition_errors;
+};
+
+struct pcr_analyzer {
+    struct stream_stage stage;
+    pthread_mutex_t lock;
+    uint64_t window_ns;
+    int auto_pids;
+    unsigned int pid_count;
+    struct pcr_pid_state pids[PCR_MAX_PIDS];
+    uint64_t mux_bytes;
+    uint16_t pmt_pids[PCR_MAX_PMTS];
+    int pmt_count;
+    uint8_t member[TS_PID_COUNT];       /* PID -> 1 + index into pids of the program it belongs to */
+    uint8_t pmt_version[TS_PID_COUNT];  /* PMT PID -> 1 + version_number the membership was built from */
+};
+
+typedef struct {
+    PyObject_HEAD
+    py_device_object *device;
+    struct pcr_analyzer *pa;
+    int attached;
+} py_pcr_analyzer_object;
+
+static struct pcr_pid_state *pcr_find(struct pcr_analyzer *pa, uint16_t pid, int create) {
+    unsigned int i;
+
+    for(i = 0; i < pa->pid_count; i++) {
+        if(pa->pids[i].pid == pid)
+            return &pa->pids[i];
+    }
+    if(!create || !pa->auto_pids || pa->pid_count >= PCR_MAX_PIDS)
+        return NULL;
+    pthread_mutex_lock(&pa->lock);
+    pa->pids[pa->pid_count].pid = pid;
+    pa->pids[pa->pid_count].program = -1;
+    pa->pid_count++;
+    pthread_mutex_unlock(&pa->lock);
+    return &pa->pids[pa->pid_count - 1];
+}
+
+static void pcr_window_reset(struct pcr_window *w) {
+    memset(w, 0, sizeof(*w));
+}
+
+static void pcr_anchor(struct pcr_pid_state *ps, uint64_t pcr, uint64_t arrival_ns, uint64_t mux_bytes) {
+    ps->anchored = 1;
+    ps->last_pcr = pcr;
+    ps->last_arrival_ns = arrival_ns;
+    ps->last_mux_bytes = mux_bytes;
+    ps->last_program_bytes = ps->program_bytes;
+    ps->last_bitrate = 0.0;
+    ps->base_arrival_ns = arrival_ns;
+    ps->elapsed_ticks = 0;
+    if(ps->window_start_ns == 0)
+        ps->window_start_ns = arrival_ns;
+}
+
+static void pcr_publish(struct pcr_analyzer *pa, struct pcr_pid_state *ps, uint64_t arrival_ns) {
+    double elapsed_ns = (double)(arrival_ns - ps->base_arrival_ns);
+
+    pthread_mutex_lock(&pa->lock);
+    ps->published = 1;
+    ps->summary = ps->acc;
+    ps->summary_ms = (double)(arrival_ns - ps->window_start_ns) / 1000000.0;
+    if(elapsed_ns > 0.0)
+        ps->drift_ppm = (PCR_TICKS_TO_NS(ps->elapsed_ticks) - elapsed_ns) / elapsed_ns * 1000000.0;
+    ps->summary_discontinuities = ps->discontinuities;
+    ps->summary_repetition_errors = ps->repetition_errors;
+    pthread_mutex_unlock(&pa->lock);
+
+    pcr_window_reset(&ps->acc);
+    ps->window_start_ns = arrival_ns;
+}
+
+static void pcr_sample(struct pcr_analyzer *pa, struct pcr_pid_state *ps, uint64_t pcr, int discontinuity,
+                       uint64_t arrival_ns) {
+    struct pcr_window *w = &ps->acc;
+    uint64_t ticks, bytes, program_bytes;
+    double interval_ns, expected, error_ns, offset_ns;
+
+    if(!ps->anchored) {
+        pcr_anchor(ps, pcr, arrival_ns, pa->mux_bytes);
+        return;
+    }
+    ticks = (pcr + PCR_WRAP - ps->last_pcr) % PCR_WRAP;
+    interval_ns = PCR_TICKS_TO_NS(ticks);
+    if(discontinuity || ticks == 0 || interval_ns > PCR_DISCONTINUITY_NS) {
+        ps->discontinuities++;
+        pcr_anchor(ps, pcr, arrival_ns, pa->mux_bytes);
+        return;
+    }
+    if(interval_ns > PCR_REPETITION_NS)
+        ps->repetition_errors++;
+
+    bytes = pa->mux_bytes - ps->last_mux_bytes;
+    program_bytes = ps->program_bytes - ps->last_program_bytes;
+
+    /* Accuracy: how far the PCR is from where a constant rate mux would have put it */
+    if(ps->last_bitrate > 0.0) {
+        expected = (double)bytes * 8.0 * 27000000.0 / ps->last_bitrate;
+        error_ns = PCR_TICKS_TO_NS(expected > (double)ticks ? expected - (double)ticks : (double)ticks - expected);
+        if(error_ns > w->accuracy_max_ns)
+            w->accuracy_max_ns = error_ns;
+    }
+    ps->last_bitrate = (double)bytes * 8.0 * 27000000.0 / (double)ticks;
+
+    /* Jitter: spread of the PCR clock against the local clock over the window */
+    ps->elapsed_ticks += ticks;
+    offset_ns = PCR_TICKS_TO_NS(ps->elapsed_ticks) - (double)(arrival_ns - ps->base_arrival_ns);
+
+    if(w->pcrs == 0 || interval_ns < w->interval_min_ns)
+        w->interval_min_ns = interval_ns;
+    if(interval_ns > w->interval_max_ns)
+        w->interval_max_ns = interval_ns;
+    if(w->pcrs == 0 || offset_ns < w->offset_min_ns)
+        w->offset_min_ns = offset_ns;
+    if(w->pcrs == 0 || offset_ns > w->offset_max_ns)
+        w->offset_max_ns = offset_ns;
+    w->interval_sum_ns += interval_ns;
+    w->mux_bytes += bytes;
+    w->program_bytes += program_bytes;
+    w->ticks += ticks;
+    w->pcrs++;
+
+    ps->last_pcr = pcr;
+    ps->last_arrival_ns = arrival_ns;
+    ps->last_mux_bytes = pa->mux_bytes;
+    ps->last_program_bytes = ps->program_bytes;
+
+    if(arrival_ns - ps->window_start_ns >= pa->window_ns)
+        pcr_publish(pa, ps, arrival_ns);
+}
+
+static void pcr_learn_pmt(struct pcr_analyzer *pa, const uint8_t *section, size_t length, uint16_t pmt_pid) {
+    uint16_t es_pids[PCR_MAX_STREAMS];
+    uint8_t stream_types[PCR_MAX_STREAMS];
+    uint16_t program, pcr_pid;
+    struct pcr_pid_state *ps;
+    uint8_t version, old;
+    int count, i;
+
+    count = ts_parse_pmt(section, length, &program, &pcr_pid, es_pids, stream_types, PCR_MAX_STREAMS);
+    if(count < 0 || pcr_pid == 0x1FFF)
+        return;
+    version = (uint8_t)(1 + ((section[5] >> 1) & 0x1F));
+    if(pa->pmt_version[pmt_pid] == version)
+        return;
+
+    /*
+     *  A new version may drop streams or move the PCR, so forget what the old
+     *  one said.  Programs sharing the same PCR PID lose theirs too and are
+     *  relearned from their next PMT.
+     */
+    old = pa->member[pmt_pid];
+    if(old) {
+        for(i = 0; i < TS_PID_COUNT; i++) {
+            if(pa->member[i] == old) {
+                pa->member[i] = 0;
+                pa->pmt_version[i] = 0;
+            }
+        }
+    }
+    pa->pmt_version[pmt_pid] = version;
+
+    ps = pcr_find(pa, pcr_pid, 1);
+    if(!ps)
+        return;
+    pthread_mutex_lock(&pa->lock);
+    ps->program = program;
+    pthread_mutex_unlock(&pa->lock);
+    pa->member[pmt_pid] = (uint8_t)(1 + (ps - pa->pids));
+    pa->member[pcr_pid] = (uint8_t)(1 + (ps - pa->pids));
+    for(i = 0; i < count; i++)
+        pa->member[es_pids[i]] = (uint8_t)(1 + (ps - pa->pids));
+}
+
+static void pcr_process(struct stream_stage *stage, const uint8_t *data, size_t length, uint64_t arrival_ns) {
+    struct pcr_analyzer *pa = (struct pcr_analyzer *)stage;
+    struct pcr_pid_state *ps;
+    const uint8_t *pkt, *section;
+    size_t section_length;
+    uint64_t pcr;
+    uint16_t pid;
+    int discontinuity, i;
+
+    for(pkt = data; pkt < data + length; pkt += TS_PACKET_SIZE) {
+        if(pkt[0] != TS_SYNC_BYTE || TS_TEI(pkt))
+            continue;
+        pid = TS_PID(pkt);
+        pa->mux_bytes += TS_PACKET_SIZE;
+        if(pa->member[pid])
+            pa->pids[pa->member[pid] - 1].program_bytes += TS_PACKET_SIZE;
+
+        if(pid == 0x0000) {
+            section = ts_section_start(pkt, &section_length);
+            if(section) {
+                i = ts_parse_pat(section, section_length, pa->pmt_pids, PCR_MAX_PMTS);
+                if(i >= 0)
+                    pa->pmt_count = i;
+            }
+        } else if(TS_PUSI(pkt)) {
+            for(i = 0; i < pa->pmt_count; i++) {
+                if(pa->pmt_pids[i] == pid) {
+                    section = ts_section_start(pkt, &section_length);
+                    if(section)
+                        pcr_learn_pmt(pa, section, section_length, pid);
+                    break;
+                }
+            }
+        }
+
+        if(ts_get_pcr(pkt, &pcr, &discontinuity)) {
+            ps = pcr_find(pa, pid, 1);
+            if(ps)
+                pcr_sample(pa, ps, pcr, discontinuity, arrival_ns);
+        }
+    }
+}
+
+const char Device_DOC_analyze_pcr[] =
+    "Start analyzing the PCRs in this tuner's stream and return a PcrAnalyzer.\n\n"
+    "pids selects the PCR PIDs to follow; by default every PID carrying a PCR\n"
+    "is followed (up to 32).  Summaries are published every window_ms\n"
+    "milliseconds of stream.  The analysis runs natively on every packet the\n"
+    "Device receives: on the receiver thread when stream_start() was given\n"
+    "native receiver options, otherwise as stream_recv() returns data.";
+
+PyObject *py_device_analyze_pcr(py_device_object *self, PyObject *args, PyObject *kwds) {
+    PyObject *pids = NULL, *seq, *item;
+    unsigned int window_ms = 1000;
+    char *kwlist[] = {"pids", "window_ms", NULL};
+    py_pcr_analyzer_object *analyzer;
+    struct pcr_analyzer *pa;
+    Py_ssize_t i, count;
+    long pid;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|OI", kwlist, &pids, &window_ms))
+        return NULL;
+    if(window_ms == 0) {
+        PyErr_SetString(PyExc_ValueError, "window_ms must be positive");
+        return NULL;
+    }
+
+    pa = calloc(1, sizeof(*pa));
+    if(!pa)
+        return PyErr_NoMemory();
+    pa->stage.process = pcr_process;
+    pa->window_ns = (uint64_t)window_ms * 1000000ULL;
+    pa->auto_pids = (!pids || pids == Py_None);
+    if(!pa->auto_pids) {
+        seq = PySequence_Fast(pids, "pids must be a sequence of integers");
+        if(!seq) {
+            free(pa);
+            return NULL;
+        }
+        count = PySequence_Fast_GET_SIZE(seq);
+        if(count > PCR_MAX_PIDS) {
+            Py_DECREF(seq);
+            free(pa);
+            PyErr_Format(PyExc_ValueError, "at most %d PIDs can be analyzed", PCR_MAX_PIDS);
+            return NULL;
+        }
+        for(i = 0; i < count; i++) {
+            item = PySequence_Fast_GET_ITEM(seq, i);
+            pid = PyInt_AsLong(item);
+            if(pid == -1 && PyErr_Occurred()) {
+                Py_DECREF(seq);
+                free(pa);
+                return NULL;
+            }
+            if(pid < 0 || pid > 0x1FFE) {
+                Py_DECREF(seq);
+                free(pa);
+                PyErr_SetString(PyExc_ValueError, "invalid PID");
+                return NULL;
+            }
+            pa->pids[pa->pid_count].pid = (uint16_t)pid;
+            pa->pids[pa->pid_count].program = -1;
+            pa->pid_count++;
+        }
+        Py_DECREF(seq);
+    }
+    pthread_mutex_init(&pa->lock, NULL);
+
+    analyzer = PyObject_New(py_pcr_analyzer_object, &hdhomerun_PcrAnalyzer_type);
+    if(!analyzer) {
+        pthread_mutex_destroy(&pa->lock);
+        free(pa);
+        return NULL;
+    }
+    Py_INCREF(self);
+    analyzer->device = self;
+    analyzer->pa = pa;
+    analyzer->attached = 1;
+    stream_stages_attach(&self->stages, &pa->stage);
+    return (PyObject *)analyzer;
+}
+
+/*
+ *  PcrAnalyzer methods
+ */
+
+static void py_pcr_analyzer_detach(py_pcr_analyzer_object *self) {
+    if(!self->attached)
+        return;
+    Py_BEGIN_ALLOW_THREADS
+    stream_stages_detach(&self->device->stages, &self->pa->stage);
+    Py_END_ALLOW_THREADS
+    self->attached = 0;
+}
+
+static void py_pcr_analyzer_dealloc(py_pcr_analyzer_object *self) {
+    py_pcr_analyzer_detach(self);
+    pthread_mutex_destroy(&self->pa->lock);
+    free(self->pa);
+    Py_DECREF(self->device);
+    PyObject_Del(self);
+}
+
+PyDoc_STRVAR(PcrAnalyzer_DOC_stats,
+    "Return the latest published summary for each PCR PID as a dict keyed by\n"
+    "PID.  Times are in milliseconds and bitrates in bits per second;\n"
+    "program_bitrate is None until the program's PMT has been seen.  jitter_ms\n"
+    "is the peak-to-peak PCR offset against the local clock over the window,\n"
+    "accuracy_ns the largest PCR error implied by the measured bitrate, and\n"
+    "drift_ppm the PCR clock's rate error since the last discontinuity.");
+
+static PyObject *py_pcr_analyzer_stats(py_pcr_analyzer_object *self) {
+    struct pcr_analyzer *pa = self->pa;
+    struct pcr_pid_state ps;
+    PyObject *rv, *dv, *key, *program, *program_bitrate;
+    double seconds;
+    unsigned int i, count;
+
+    rv = PyDict_New();
+    if(!rv)
+        return NULL;
+
+    pthread_mutex_lock(&pa->lock);
+    count = pa->pid_count;
+    pthread_mutex_unlock(&pa->lock);
+
+    for(i = 0; i < count; i++) {
+        /* Only the published fields; the stage updates the rest without the lock */
+        pthread_mutex_lock(&pa->lock);
+        ps.pid = pa->pids[i].pid;
+        ps.program = pa->pids[i].program;
+        ps.published = pa->pids[i].published;
+        ps.summary = pa->pids[i].summary;
+        ps.summary_ms = pa->pids[i].summary_ms;
+        ps.drift_ppm = pa->pids[i].drift_ppm;
+        ps.summary_discontinuities = pa->pids[i].summary_discontinuities;
+        ps.summary_repetition_errors = pa->pids[i].summary_repetition_errors;
+        pthread_mutex_unlock(&pa->lock);
+        if(!ps.published || ps.summary.pcrs == 0)
+            continue;
+
+        seconds = PCR_TICKS_TO_NS(ps.summary.ticks) / 1000000000.0;
+        if(ps.program >= 0) {
+            program = PyInt_FromLong(ps.program);
+            program_bitrate = PyFloat_FromDouble(seconds > 0.0 ? (double)ps.summary.program_bytes * 8.0 / seconds : 0.0);
+        } else {
+            Py_INCREF(Py_None);
+            program = Py_None;
+            Py_INCREF(Py_None);
+            program_bitrate = Py_None;
+        }
+        dv = Py_BuildValue("{s:N,s:d,s:k,s:d,s:d,s:d,s:d,s:d,s:d,s:N,s:d,s:k,s:k}",
+                           "program", program,
+                           "window_ms", ps.summary_ms,
+                           "pcr_count", ps.summary.pcrs,
+                           "interval_ms_min", ps.summary.interval_min_ns / 1000000.0,
+                           "interval_ms_avg", ps.summary.interval_sum_ns / (double)ps.summary.pcrs / 1000000.0,
+                           "interval_ms_max", ps.summary.interval_max_ns / 1000000.0,
+                           "jitter_ms", (ps.summary.offset_max_ns - ps.summary.offset_min_ns) / 1000000.0,
+                           "accuracy_ns", ps.summary.accuracy_max_ns,
+                           "mux_bitrate", seconds > 0.0 ? (double)ps.summary.mux_bytes * 8.0 / seconds : 0.0,
+                           "program_bitrate", program_bitrate,
+                           "drift_ppm", ps.drift_ppm,
+                           "discontinuities", ps.summary_discontinuities,
+                           "repetition_errors", ps.summary_repetition_errors);
+        if(!dv) { Py_DECREF(rv); return NULL; }
+        key = PyInt_FromLong(ps.pid);
+        if(!key) { Py_DECREF(dv); Py_DECREF(rv); return NULL; }
+        if(PyDict_SetItem(rv, key, dv) != 0) { Py_DECREF(key); Py_DECREF(dv); Py_DECREF(rv); return NULL; }
+        Py_DECREF(key);
+        Py_DECREF(dv);
+    }
+    return rv;
+}
+
+PyDoc_STRVAR(PcrAnalyzer_DOC_stop,
+    "Stop analyzing.  The last published summaries remain available.");
+
+static PyObject *py_pcr_analyzer_stop(py_pcr_analyzer_object *self) {
+    py_pcr_analyzer_detach(self);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef py_pcr_analyzer_methods[] = {
+    {"stats",                   (PyCFunction)py_pcr_analyzer_stats,             METH_NOARGS,                PcrAnalyzer_DOC_stats},
+    {"stop",                    (PyCFunction)py_pcr_analyzer_stop,              METH_NOARGS,                PcrAnalyzer_DOC_stop},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_PcrAnalyzer_type_doc,
+    "A native PCR timing analyzer, created by Device.analyze_pcr().");
+
+PyTypeObject hdhomerun_PcrAnalyzer_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.PcrAnalyzer",        /* tp_name */
+    sizeof(py_pcr_analyzer_object), /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_pcr_analyzer_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    hdhomerun_PcrAnalyzer_type_doc, /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_pcr_analyzer_methods,        /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    0,                              /* tp_new */
+    0,                              /* tp_free */
+};
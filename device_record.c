@@ -0,0 +1,469 @@
+/*
+ * device_record.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ *  Recording stage.  Packets are collected into chunks which a writer thread
+ *  appends to the .ts, and a record is added to the .tsidx sidecar for every
+ *  PAT and random access point, plus a time reference at least once a
+ *  second.  Stream time follows the first PCR PID seen.  A chunk carries the
+ *  index records for its own packets and the writer only writes them once
+ *  the chunk's data is written, so a reader never sees an offset beyond the
+ *  .ts.  Up to RECORD_CHUNKS_MAX chunks may wait for the disk before the
+ *  stage has to wait too.
+ */
+
+#define RECORD_CHUNK_SIZE (VIDEO_DATA_PACKET_SIZE * 512)
+#define RECORD_CHUNK_RECORDS (RECORD_CHUNK_SIZE / TS_PACKET_SIZE)   /* at most one record per packet */
+#define RECORD_CHUNKS_MAX 8
+#define RECORD_TIME_INTERVAL 27000000ULL    /* one second in 27MHz ticks */
+#define RECORD_PCR_JUMP 27000000ULL         /* larger PCR steps are discontinuities */
+#define RECORD_PCR_WRAP (((uint64_t)1 << 33) * 300)
+
+struct record_chunk {
+    struct write_job job;
+    size_t used;
+    size_t index_used;
+    uint8_t index[RECORD_CHUNK_RECORDS * TSIDX_RECORD_SIZE];
+    uint8_t data[RECORD_CHUNK_SIZE];
+};
+
+struct recorder {
+    struct stream_stage stage;
+    pthread_mutex_t lock;
+    int fd;
+    int index_fd;
+    struct write_queue writer;
+    struct record_chunk *chunk; /* being filled by the stage */
+
+    uint64_t offset;            /* bytes accepted, including those not yet written */
+    uint64_t wall_base_ns;
+    uint64_t mono_base_ns;
+    int pcr_pid;                /* -1 until the first PCR */
+    uint64_t last_pcr;
+    uint64_t last_pcr_arrival_ns;
+    uint64_t time;
+    uint64_t last_record_time;
+    int pending_discontinuity;
+
+    /* Protected by lock */
+    unsigned long long packets;
+    unsigned long long records;
+    int error;                  /* errno of the first failed write, after which recording stops */
+};
+
+typedef struct {
+    PyObject_HEAD
+    py_device_object *device;
+    struct recorder *rec;
+    int attached;
+    char *path;
+    char *index_path;
+} py_recorder_object;
+
+/* Runs on the writer thread: the data first, then the index records pointing into it */
+static void recorder_write_chunk(void *owner, struct write_job *job, int discard) {
+    struct recorder *rec = (struct recorder *)owner;
+    struct record_chunk *chunk = (struct record_chunk *)job;
+    int error;
+
+    pthread_mutex_lock(&rec->lock);
+    error = rec->error;
+    pthread_mutex_unlock(&rec->lock);
+    if(!discard && !error) {
+        error = write_all(rec->fd, chunk->data, chunk->used);
+        if(!error && chunk->index_used > 0)
+            error = write_all(rec->index_fd, chunk->index, chunk->index_used);
+        if(error) {
+            pthread_mutex_lock(&rec->lock);
+            rec->error = error;
+            pthread_mutex_unlock(&rec->lock);
+        }
+    }
+    free(chunk);
+}
+
+/* Hands the chunk being filled to the writer */
+static void recorder_submit(struct recorder *rec) {
+    if(!rec->chunk)
+        return;
+    if(rec->chunk->used > 0)
+        write_queue_push(&rec->writer, &rec->chunk->job);
+    else
+        free(rec->chunk);
+    rec->chunk = NULL;
+}
+
+/* Returns 0 when there is a chunk with room for a packet, or -1 once recording has stopped */
+static int recorder_reserve(struct recorder *rec) {
+    int error;
+
+    if(rec->chunk && rec->chunk->used + TS_PACKET_SIZE <= RECORD_CHUNK_SIZE)
+        return 0;
+    recorder_submit(rec);
+
+    pthread_mutex_lock(&rec->lock);
+    error = rec->error;
+    pthread_mutex_unlock(&rec->lock);
+    if(error)
+        return -1;
+    rec->chunk = malloc(sizeof(*rec->chunk));
+    if(!rec->chunk) {
+        pthread_mutex_lock(&rec->lock);
+        rec->error = ENOMEM;
+        pthread_mutex_unlock(&rec->lock);
+        return -1;
+    }
+    rec->chunk->used = 0;
+    rec->chunk->index_used = 0;
+    return 0;
+}
+
+static void recorder_add_record(struct recorder *rec, uint64_t offset, uint16_t pid, uint8_t flags, uint64_t arrival_ns) {
+    struct record_chunk *chunk = rec->chunk;
+    struct tsidx_record record;
+
+    if(rec->index_fd < 0)
+        return;
+    if(rec->pending_discontinuity) {
+        flags |= TSIDX_FLAG_DISCONTINUITY;
+        rec->pending_discontinuity = 0;
+    }
+    record.offset = offset;
+    record.time = rec->time;
+    record.wallclock_ns = rec->wall_base_ns + (arrival_ns > rec->mono_base_ns ? arrival_ns - rec->mono_base_ns : 0);
+    record.pid = pid;
+    record.flags = flags;
+    tsidx_encode_record(chunk->index + chunk->index_used, &record);
+    chunk->index_used += TSIDX_RECORD_SIZE;
+    rec->last_record_time = rec->time;
+
+    pthread_mutex_lock(&rec->lock);
+    rec->records++;
+    pthread_mutex_unlock(&rec->lock);
+}
+
+/* Advances stream time from a PCR; returns 1 if the PCR restarted */
+static int recorder_clock(struct recorder *rec, uint64_t pcr, int discontinuity, uint64_t arrival_ns) {
+    uint64_t ticks;
+
+    ticks = (pcr + RECORD_PCR_WRAP - rec->last_pcr) % RECORD_PCR_WRAP;
+    if(discontinuity || ticks > RECORD_PCR_JUMP) {
+        /* Bridge the jump with the local clock so that stream time stays continuous */
+        rec->time += (arrival_ns - rec->last_pcr_arrival_ns) * 27 / 1000;
+        rec->pending_discontinuity = 1;
+    } else {
+        rec->time += ticks;
+    }
+    rec->last_pcr = pcr;
+    rec->last_pcr_arrival_ns = arrival_ns;
+    return rec->pending_discontinuity;
+}
+
+static void recorder_process(struct stream_stage *stage, const uint8_t *data, size_t length, uint64_t arrival_ns) {
+    struct recorder *rec = (struct recorder *)stage;
+    const uint8_t *pkt;
+    unsigned long long accepted = 0;
+    uint64_t pcr;
+    uint16_t pid;
+    uint8_t flags;
+    int discontinuity;
+
+    for(pkt = data; pkt < data + length; pkt += TS_PACKET_SIZE) {
+        if(recorder_reserve(rec) != 0)
+            break;
+        pid = TS_PID(pkt);
+        flags = 0;
+
+        if(ts_get_pcr(pkt, &pcr, &discontinuity)) {
+            if(rec->pcr_pid < 0) {
+                rec->pcr_pid = pid;
+                rec->last_pcr = pcr;
+                rec->last_pcr_arrival_ns = arrival_ns;
+            } else if(rec->pcr_pid == pid && recorder_clock(rec, pcr, discontinuity, arrival_ns)) {
+                flags |= TSIDX_FLAG_TIME;
+            }
+        }
+        if(pid == 0x0000 && TS_PUSI(pkt))
+            flags |= TSIDX_FLAG_PAT;
+        if(TS_HAS_ADAPTATION(pkt) && pkt[4] > 0 && (pkt[5] & 0x40))
+            flags |= TSIDX_FLAG_RAP;
+        if(rec->pcr_pid >= 0 && rec->time - rec->last_record_time >= RECORD_TIME_INTERVAL)
+            flags |= TSIDX_FLAG_TIME;
+        if(flags)
+            recorder_add_record(rec, rec->offset, pid, flags, arrival_ns);
+
+        memcpy(rec->chunk->data + rec->chunk->used, pkt, TS_PACKET_SIZE);
+        rec->chunk->used += TS_PACKET_SIZE;
+        rec->offset += TS_PACKET_SIZE;
+        accepted++;
+    }
+    if(rec->chunk && rec->chunk->used == RECORD_CHUNK_SIZE)
+        recorder_submit(rec);
+
+    pthread_mutex_lock(&rec->lock);
+    rec->packets += accepted;
+    pthread_mutex_unlock(&rec->lock);
+}
+
+/* Writes out everything accepted so far and stops the writer; the stage must be detached */
+static void recorder_finish(struct recorder *rec) {
+    recorder_submit(rec);
+    write_queue_stop(&rec->writer);
+}
+
+static void recorder_free(struct recorder *rec) {
+    recorder_finish(rec);
+    if(rec->fd >= 0)
+        close(rec->fd);
+    if(rec->index_fd >= 0)
+        close(rec->index_fd);
+    pthread_mutex_destroy(&rec->lock);
+    free(rec);
+}
+
+const char Device_DOC_record[] =
+    "Start recording this tuner's stream to path and return a Recorder.\n\n"
+    "Unless index is False, a .tsidx index is written alongside (path with .ts\n"
+    "replaced by .tsidx, or index itself if it is a string) which maps stream\n"
+    "and wall clock time and random access points to byte offsets; read it\n"
+    "with hdhomerun.TsIndex.  Packets are collected natively as the Device\n"
+    "receives them, like the other stream stages, and written by a thread of\n"
+    "the Recorder's own.";
+
+PyObject *py_device_record(py_device_object *self, PyObject *args, PyObject *kwds) {
+    char *path = NULL, *index_path = NULL, *dot;
+    PyObject *index = NULL;
+    char *kwlist[] = {"path", "index", NULL};
+    py_recorder_object *recorder;
+    struct recorder *rec;
+    uint8_t header[TSIDX_HEADER_SIZE];
+    int want_index, error;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|O", kwlist, &path, &index))
+        return NULL;
+
+    if(index && PyString_Check(index)) {
+        index_path = strdup(PyString_AS_STRING(index));
+        if(!index_path)
+            return PyErr_NoMemory();
+    } else {
+        want_index = index ? PyObject_IsTrue(index) : 1;
+        if(want_index < 0)
+            return NULL;
+        if(want_index) {
+            index_path = malloc(strlen(path) + sizeof(".tsidx"));
+            if(!index_path)
+                return PyErr_NoMemory();
+            strcpy(index_path, path);
+            dot = strrchr(index_path, '.');
+            if(dot && strcmp(dot, ".ts") == 0)
+                *dot = '\0';
+            strcat(index_path, ".tsidx");
+        }
+    }
+
+    rec = calloc(1, sizeof(*rec));
+    if(!rec) {
+        free(index_path);
+        return PyErr_NoMemory();
+    }
+    pthread_mutex_init(&rec->lock, NULL);
+    rec->stage.process = recorder_process;
+    rec->fd = -1;
+    rec->index_fd = -1;
+    rec->pcr_pid = -1;
+    rec->wall_base_ns = (uint64_t)(wallclock_time() * 1000000000.0);
+    rec->mono_base_ns = monotonic_ns();
+
+    rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(rec->fd < 0) {
+        recorder_free(rec);
+        free(index_path);
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    }
+    if(index_path) {
+        rec->index_fd = open(index_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if(rec->index_fd < 0) {
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, index_path);
+            recorder_free(rec);
+            free(index_path);
+            return NULL;
+        }
+        tsidx_encode_header(header, rec->wall_base_ns);
+        error = write_all(rec->index_fd, header, sizeof(header));
+        if(error) {
+            errno = error;
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, index_path);
+            recorder_free(rec);
+            free(index_path);
+            return NULL;
+        }
+    }
+    error = write_queue_start(&rec->writer, RECORD_CHUNKS_MAX, recorder_write_chunk, rec);
+    if(error) {
+        errno = error;
+        PyErr_SetFromErrno(PyExc_OSError);
+        recorder_free(rec);
+        free(index_path);
+        return NULL;
+    }
+
+    recorder = PyObject_New(py_recorder_object, &hdhomerun_Recorder_type);
+    if(!recorder) {
+        recorder_free(rec);
+        free(index_path);
+        return NULL;
+    }
+    recorder->path = strdup(path);
+    recorder->index_path = index_path;
+    recorder->rec = rec;
+    recorder->attached = 0;
+    Py_INCREF(self);
+    recorder->device = self;
+    if(!recorder->path) {
+        Py_DECREF(recorder);
+        return PyErr_NoMemory();
+    }
+    recorder->attached = 1;
+    stream_stages_attach(&self->stages, &rec->stage);
+    return (PyObject *)recorder;
+}
+
+/*
+ *  Recorder methods
+ */
+
+static void py_recorder_detach(py_recorder_object *self) {
+    if(!self->attached)
+        return;
+    Py_BEGIN_ALLOW_THREADS
+    stream_stages_detach(&self->device->stages, &self->rec->stage);
+    recorder_finish(self->rec);
+    Py_END_ALLOW_THREADS
+    self->attached = 0;
+}
+
+static void py_recorder_dealloc(py_recorder_object *self) {
+    py_recorder_detach(self);
+    recorder_free(self->rec);
+    free(self->path);
+    free(self->index_path);
+    Py_DECREF(self->device);
+    PyObject_Del(self);
+}
+
+PyDoc_STRVAR(Recorder_DOC_stats,
+    "Return the packets and index records recorded so far.  If a write has\n"
+    "failed, recording has stopped and 'error' holds the error message.");
+
+static PyObject *py_recorder_stats(py_recorder_object *self) {
+    unsigned long long packets, records;
+    int error;
+
+    pthread_mutex_lock(&self->rec->lock);
+    packets = self->rec->packets;
+    records = self->rec->records;
+    error = self->rec->error;
+    pthread_mutex_unlock(&self->rec->lock);
+
+    return Py_BuildValue("{s:s,s:z,s:K,s:K,s:K,s:z,s:O}",
+                         "path", self->path,
+                         "index_path", self->index_path,
+                         "packets", packets,
+                         "bytes", packets * TS_PACKET_SIZE,
+                         "index_records", records,
+                         "error", error ? strerror(error) : NULL,
+                         "recording", self->attached ? Py_True : Py_False);
+}
+
+PyDoc_STRVAR(Recorder_DOC_stop,
+    "Stop recording and flush everything buffered to disk.");
+
+static PyObject *py_recorder_stop(py_recorder_object *self) {
+    int error;
+
+    py_recorder_detach(self);
+    pthread_mutex_lock(&self->rec->lock);
+    error = self->rec->error;
+    pthread_mutex_unlock(&self->rec->lock);
+    if(error) {
+        errno = error;
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, self->path);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef py_recorder_methods[] = {
+    {"stats",                   (PyCFunction)py_recorder_stats,                 METH_NOARGS,                Recorder_DOC_stats},
+    {"stop",                    (PyCFunction)py_recorder_stop,                  METH_NOARGS,                Recorder_DOC_stop},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_Recorder_type_doc,
+    "A native stream recorder, created by Device.record().");
+
+PyTypeObject hdhomerun_Recorder_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.Recorder",           /* tp_name */
+    sizeof(py_recorder_object),     /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_recorder_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    hdhomerun_Recorder_type_doc,    /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_recorder_methods,            /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    0,                              /* tp_new */
+    0,                              /* tp_free */
+};
@@ -0,0 +1,900 @@
+/*
+ * device_registry.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ *  A Registry remembers the devices a service uses in the file format
+ *  described in device_common.h, so that startup can build Device objects
+ *  and seed the capability cache without waiting for discovery or asking
+ *  each device for its firmware.  Loading maps the file and decodes the
+ *  fixed records in place.  Worker threads then revalidate every entry in
+ *  the background with one get_version each, re-reading the capabilities
+ *  of devices whose firmware changed and marking those which do not answer
+ *  as failed; failed entries are left out of devices() and save().
+ */
+
+#define REGISTRY_DEFAULT_THREADS 8
+#define REGISTRY_MAX_THREADS 64
+
+enum registry_state {
+    REGISTRY_UNVERIFIED,
+    REGISTRY_VALID,
+    REGISTRY_UPDATED,       /* answered with new firmware, capabilities re-read */
+    REGISTRY_FAILED
+};
+
+static const char * const registry_state_names[] = {"unverified", "valid", "updated", "failed"};
+
+struct registry_entry {
+    uint32_t device_id;
+    uint32_t device_ip;
+    uint32_t device_type;
+    uint32_t tuner_count;
+    uint32_t version_num;
+    uint64_t validated_ns;  /* wall clock of the last successful contact, 0 if never */
+    char model[32];
+    char version_str[32];
+    char *supported;
+    int state;
+};
+
+typedef struct {
+    PyObject_HEAD
+    char *path;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct registry_entry *entries;     /* protected by lock */
+    size_t count;
+    size_t capacity;
+
+    pthread_t *workers;
+    unsigned int worker_count;
+    unsigned int active;    /* workers still running, protected by lock */
+    size_t next;            /* next entry to revalidate, protected by lock */
+    volatile int stopping;
+    unsigned long generation;   /* of the workers, see device_fork.c */
+} py_registry_object;
+
+static uint64_t wallclock_ns(void) {
+    return (uint64_t)(wallclock_time() * 1000000000.0);
+}
+
+static struct registry_entry *registry_find(py_registry_object *self, uint32_t device_id) {
+    size_t i;
+
+    for(i = 0; i < self->count; i++) {
+        if(self->entries[i].device_id == device_id)
+            return &self->entries[i];
+    }
+    return NULL;
+}
+
+/* Returns the entry for device_id, appending an empty one if there is none; called with lock held */
+static struct registry_entry *registry_slot(py_registry_object *self, uint32_t device_id) {
+    struct registry_entry *entry, *grown;
+    size_t capacity;
+
+    entry = registry_find(self, device_id);
+    if(entry)
+        return entry;
+    if(self->count == self->capacity) {
+        capacity = self->capacity ? self->capacity * 2 : 16;
+        grown = realloc(self->entries, capacity * sizeof(*grown));
+        if(!grown)
+            return NULL;
+        self->entries = grown;
+        self->capacity = capacity;
+    }
+    entry = &self->entries[self->count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->device_id = device_id;
+    return entry;
+}
+
+static char *registry_strndup(const char *text, size_t length) {
+    char *copy;
+
+    copy = malloc(length + 1);
+    if(!copy)
+        return NULL;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+/* Decodes a mapped registry file; returns 0, -1 with errno set, or -2 if it is not a registry */
+static int registry_decode(py_registry_object *self, const uint8_t *map, size_t size) {
+    struct registry_entry *entry;
+    const uint8_t *record;
+    uint32_t count, offset, length, i;
+
+    if(size < REGISTRY_HEADER_SIZE || memcmp(map, REGISTRY_MAGIC, 8) != 0 ||
+       get_le32(map + 8) != REGISTRY_VERSION || get_le32(map + 12) != REGISTRY_RECORD_SIZE)
+        return -2;
+    count = get_le32(map + 16);
+    if(count > (size - REGISTRY_HEADER_SIZE) / REGISTRY_RECORD_SIZE)
+        return -2;
+
+    for(i = 0; i < count; i++) {
+        record = map + REGISTRY_HEADER_SIZE + (size_t)i * REGISTRY_RECORD_SIZE;
+        offset = get_le32(record + 20);
+        length = get_le32(record + 24);
+        if(offset > size || length > size - offset)
+            return -2;
+        entry = registry_slot(self, get_le32(record));
+        if(!entry) {
+            errno = ENOMEM;
+            return -1;
+        }
+        entry->device_ip = get_le32(record + 4);
+        entry->device_type = get_le32(record + 8);
+        entry->tuner_count = get_le32(record + 12);
+        entry->version_num = get_le32(record + 16);
+        entry->validated_ns = get_le64(record + 32);
+        memcpy(entry->model, record + 40, sizeof(entry->model) - 1);
+        memcpy(entry->version_str, record + 72, sizeof(entry->version_str) - 1);
+        free(entry->supported);
+        entry->supported = registry_strndup((const char *)map + offset, length);
+        if(!entry->supported) {
+            errno = ENOMEM;
+            return -1;
+        }
+        entry->state = REGISTRY_UNVERIFIED;
+    }
+    return 0;
+}
+
+/* Returns 0, -1 with errno set, or -2 if it is not a registry; a missing or empty file is an empty registry */
+static int registry_load(py_registry_object *self) {
+    struct stat st;
+    uint8_t *map;
+    int fd, result;
+
+    fd = open(self->path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return errno == ENOENT ? 0 : -1;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if(st.st_size == 0) {
+        /* e.g. created ahead of the first save() */
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+    result = registry_decode(self, map, (size_t)st.st_size);
+    munmap(map, (size_t)st.st_size);
+    return result;
+}
+
+/* Internal: puts an entry's capabilities in the process-wide cache; called with the GIL held, sets an exception on failure */
+static int registry_seed(struct registry_entry *entry) {
+    if(!entry->supported || !entry->supported[0])
+        return 0;
+    if(!capability_insert(entry->device_id, entry->version_num, entry->version_str, entry->tuner_count,
+                          entry->supported, strlen(entry->supported), 1))
+        return -1;
+    return 0;
+}
+
+/*
+ *  Revalidation
+ */
+
+struct registry_probe {
+    uint32_t version_num;
+    char version_str[32];
+    char model[32];
+    unsigned int tuner_count;
+    char *supported;
+};
+
+/* Returns the new state of the entry; probe is filled in for REGISTRY_UPDATED */
+static int registry_check(uint32_t device_id, uint32_t device_ip, uint32_t version_num, struct registry_probe *probe) {
+    struct hdhomerun_device_t *hd;
+    char *str, *error;
+    int state = REGISTRY_FAILED;
+
+    hd = hdhomerun_device_create(device_id, device_ip, 0, NULL);
+    if(!hd)
+        return REGISTRY_FAILED;
+    if(hdhomerun_device_get_version(hd, &str, &probe->version_num) != 1)
+        goto out;
+    if(probe->version_num == version_num) {
+        state = REGISTRY_VALID;
+        goto out;
+    }
+
+    /* New firmware; the capabilities may have changed with it */
+    strncpy(probe->version_str, str, sizeof(probe->version_str) - 1);
+    if(capability_count_tuners(hd, &probe->tuner_count) != 1)
+        goto out;
+    if(hdhomerun_device_get_var(hd, "/sys/model", &str, &error) == 1)
+        strncpy(probe->model, str, sizeof(probe->model) - 1);
+    if(hdhomerun_device_get_supported(hd, NULL, &str) != 1)
+        goto out;
+    probe->supported = strdup(str);
+    if(probe->supported)
+        state = REGISTRY_UPDATED;
+out:
+    hdhomerun_device_destroy(hd);
+    return state;
+}
+
+static void *registry_worker(void *arg) {
+    py_registry_object *self = arg;
+    struct registry_entry *entry;
+    struct registry_probe probe;
+    PyGILState_STATE gstate;
+    uint32_t device_id, device_ip, version_num;
+    int state;
+
+    pthread_mutex_lock(&self->lock);
+    while(!self->stopping && self->next < self->count) {
+        entry = &self->entries[self->next++];
+        device_id = entry->device_id;
+        device_ip = entry->device_ip;
+        version_num = entry->version_num;
+        pthread_mutex_unlock(&self->lock);
+
+        memset(&probe, 0, sizeof(probe));
+        state = registry_check(device_id, device_ip, version_num, &probe);
+
+        pthread_mutex_lock(&self->lock);
+        /* Entries may have been added or removed meanwhile */
+        entry = registry_find(self, device_id);
+        if(entry && entry->device_ip == device_ip && entry->state == REGISTRY_UNVERIFIED) {
+            entry->state = state;
+            if(state != REGISTRY_FAILED)
+                entry->validated_ns = wallclock_ns();
+            if(state == REGISTRY_UPDATED) {
+                entry->version_num = probe.version_num;
+                memcpy(entry->version_str, probe.version_str, sizeof(entry->version_str));
+                memcpy(entry->model, probe.model, sizeof(entry->model));
+                entry->tuner_count = probe.tuner_count;
+                free(entry->supported);
+                entry->supported = probe.supported;
+                probe.supported = NULL;
+
+                /* The capability cache belongs to the interpreter */
+                pthread_mutex_unlock(&self->lock);
+                gstate = PyGILState_Ensure();
+                pthread_mutex_lock(&self->lock);
+                entry = registry_find(self, device_id);
+                if(entry && registry_seed(entry) != 0)
+                    PyErr_Clear();
+                PyGILState_Release(gstate);
+            }
+        }
+        free(probe.supported);
+    }
+    if(--self->active == 0)
+        pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+    return NULL;
+}
+
+/* Forgets workers started before fork(): they only exist in the parent and may have held the lock */
+static void registry_fork_check(py_registry_object *self) {
+    if(!self->workers || self->generation == fork_generation_current())
+        return;
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    free(self->workers);
+    self->workers = NULL;
+    self->worker_count = 0;
+    self->active = 0;
+}
+
+/* Must be called with the GIL held; it is dropped while waiting for the workers */
+static void registry_join(py_registry_object *self, int stop) {
+    unsigned int i;
+
+    registry_fork_check(self);
+    if(!self->workers)
+        return;
+    self->stopping = stop;
+    Py_BEGIN_ALLOW_THREADS
+    for(i = 0; i < self->worker_count; i++)
+        pthread_join(self->workers[i], NULL);
+    Py_END_ALLOW_THREADS
+    free(self->workers);
+    self->workers = NULL;
+    self->worker_count = 0;
+    self->stopping = 0;
+}
+
+/* Starts revalidating every entry unless that is already under way; called with the GIL held */
+static int registry_revalidate(py_registry_object *self, unsigned int threads) {
+    unsigned int i;
+    size_t j;
+
+    pthread_mutex_lock(&self->lock);
+    if(self->active > 0) {
+        pthread_mutex_unlock(&self->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&self->lock);
+    /* Reap the previous round, which has finished */
+    registry_join(self, 0);
+
+    pthread_mutex_lock(&self->lock);
+    for(j = 0; j < self->count; j++)
+        self->entries[j].state = REGISTRY_UNVERIFIED;
+    self->next = 0;
+    if(threads > self->count)
+        threads = (unsigned int)self->count;
+    pthread_mutex_unlock(&self->lock);
+    if(threads == 0)
+        return 0;
+
+    self->workers = calloc(threads, sizeof(*self->workers));
+    self->generation = fork_generation_current();
+    if(!self->workers) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for(i = 0; i < threads; i++) {
+        pthread_mutex_lock(&self->lock);
+        self->active++;
+        pthread_mutex_unlock(&self->lock);
+        if(pthread_create(&self->workers[i], NULL, registry_worker, self) != 0) {
+            pthread_mutex_lock(&self->lock);
+            self->active--;
+            pthread_mutex_unlock(&self->lock);
+            break;
+        }
+        self->worker_count++;
+    }
+    if(self->worker_count == 0) {
+        free(self->workers);
+        self->workers = NULL;
+        PyErr_SetString(hdhomerun_device_error, "unable to start registry threads");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ *  Registry methods
+ */
+
+static int py_registry_init(py_registry_object *self, PyObject *args, PyObject *kwds) {
+    char *path = NULL;
+    PyObject *revalidate_obj = NULL;
+    unsigned int threads = REGISTRY_DEFAULT_THREADS;
+    char *kwlist[] = {"path", "revalidate", "threads", NULL};
+    size_t i;
+    int result;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|O!I", kwlist, &path, &PyBool_Type, &revalidate_obj, &threads))
+        return -1;
+    if(self->path) {
+        PyErr_SetString(PyExc_RuntimeError, "Registry is already open");
+        return -1;
+    }
+    if(threads < 1 || threads > REGISTRY_MAX_THREADS) {
+        PyErr_Format(PyExc_ValueError, "threads must be between 1 and %d", REGISTRY_MAX_THREADS);
+        return -1;
+    }
+    self->path = strdup(path);
+    if(!self->path) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->cond, NULL);
+
+    result = registry_load(self);
+    if(result == -1) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        return -1;
+    } else if(result == -2) {
+        PyErr_SetString(hdhomerun_device_error, "not a device registry file");
+        return -1;
+    }
+    for(i = 0; i < self->count; i++) {
+        if(registry_seed(&self->entries[i]) != 0)
+            return -1;
+    }
+
+    if(revalidate_obj != Py_False)
+        return registry_revalidate(self, threads);
+    return 0;
+}
+
+static void py_registry_dealloc(py_registry_object *self) {
+    size_t i;
+
+    if(self->path) {
+        registry_join(self, 1);
+        for(i = 0; i < self->count; i++)
+            free(self->entries[i].supported);
+        free(self->entries);
+        pthread_cond_destroy(&self->cond);
+        pthread_mutex_destroy(&self->lock);
+        free(self->path);
+    }
+    self->ob_type->tp_free((PyObject*)self);
+}
+
+static int py_registry_check_open(py_registry_object *self) {
+    if(!self->path) {
+        PyErr_SetString(PyExc_ValueError, "Registry is not initialized");
+        return -1;
+    }
+    registry_fork_check(self);
+    return 0;
+}
+
+static Py_ssize_t py_registry_length(py_registry_object *self) {
+    Py_ssize_t count;
+
+    if(py_registry_check_open(self) != 0)
+        return -1;
+    pthread_mutex_lock(&self->lock);
+    count = (Py_ssize_t)self->count;
+    pthread_mutex_unlock(&self->lock);
+    return count;
+}
+
+static PyObject *build_registry_entry_dict(struct registry_entry *entry) {
+    PyObject *validated, *rv;
+
+    if(entry->validated_ns) {
+        validated = PyFloat_FromDouble((double)entry->validated_ns / 1e9);
+        if(!validated)
+            return NULL;
+    } else {
+        validated = Py_None;
+        Py_INCREF(validated);
+    }
+    rv = Py_BuildValue("{s:k,s:k,s:k,s:k,s:s,s:s,s:k,s:O,s:s}",
+                       "device_id", (unsigned long)entry->device_id,
+                       "device_ip", (unsigned long)entry->device_ip,
+                       "device_type", (unsigned long)entry->device_type,
+                       "tuner_count", (unsigned long)entry->tuner_count,
+                       "model", entry->model,
+                       "version", entry->version_str,
+                       "version_num", (unsigned long)entry->version_num,
+                       "validated", validated,
+                       "state", registry_state_names[entry->state]);
+    Py_DECREF(validated);
+    return rv;
+}
+
+PyDoc_STRVAR(Registry_DOC_entries,
+    "Return every entry as a dict, including its revalidation state:\n"
+    "'unverified' until checked, then 'valid', 'updated' (new firmware, whose\n"
+    "capabilities were re-read) or 'failed'.");
+
+static PyObject *py_registry_entries(py_registry_object *self) {
+    struct registry_entry *entries;
+    PyObject *result, *item;
+    size_t i, count;
+
+    if(py_registry_check_open(self) != 0)
+        return NULL;
+
+    /* The dicts are built outside the lock, from a snapshot */
+    pthread_mutex_lock(&self->lock);
+    count = self->count;
+    entries = malloc((count + 1) * sizeof(*entries));
+    if(entries)
+        memcpy(entries, self->entries, count * sizeof(*entries));
+    pthread_mutex_unlock(&self->lock);
+    if(!entries)
+        return PyErr_NoMemory();
+
+    result = PyList_New((Py_ssize_t)count);
+    for(i = 0; result && i < count; i++) {
+        item = build_registry_entry_dict(&entries[i]);
+        if(!item) {
+            Py_CLEAR(result);
+            break;
+        }
+        PyList_SET_ITEM(result, (Py_ssize_t)i, item);
+    }
+    free(entries);
+    return result;
+}
+
+PyDoc_STRVAR(Registry_DOC_devices,
+    "Return a Device for the given tuner of every entry that has not failed\n"
+    "revalidation.  Nothing is sent to the devices.");
+
+static PyObject *py_registry_devices(py_registry_object *self, PyObject *args, PyObject *kwds) {
+    unsigned int tuner = 0;
+    char *kwlist[] = {"tuner", NULL};
+    PyObject *result, *device;
+    uint32_t *ids, *ips;
+    size_t i, count = 0;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &tuner))
+        return NULL;
+    if(py_registry_check_open(self) != 0)
+        return NULL;
+
+    /* Devices are constructed outside the lock, from a snapshot */
+    pthread_mutex_lock(&self->lock);
+    ids = malloc((self->count + 1) * sizeof(*ids));
+    ips = malloc((self->count + 1) * sizeof(*ips));
+    if(ids && ips) {
+        for(i = 0; i < self->count; i++) {
+            if(self->entries[i].state == REGISTRY_FAILED)
+                continue;
+            ids[count] = self->entries[i].device_id;
+            ips[count] = self->entries[i].device_ip;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+    if(!ids || !ips) {
+        free(ids);
+        free(ips);
+        return PyErr_NoMemory();
+    }
+
+    result = PyList_New((Py_ssize_t)count);
+    for(i = 0; result && i < count; i++) {
+        device = PyObject_CallFunction((PyObject *)&hdhomerun_Device_type, "III", ips[i], ids[i], tuner);
+        if(!device) {
+            Py_CLEAR(result);
+            break;
+        }
+        PyList_SET_ITEM(result, (Py_ssize_t)i, device);
+    }
+    free(ids);
+    free(ips);
+    return result;
+}
+
+PyDoc_STRVAR(Registry_DOC_add,
+    "Add a Device to the registry, or refresh its entry.  The firmware version,\n"
+    "model and capabilities are read from the device (through the capability\n"
+    "cache when the firmware is unchanged).");
+
+static PyObject *py_registry_add(py_registry_object *self, PyObject *args, PyObject *kwds) {
+    py_device_object *device = NULL;
+    char *kwlist[] = {"device", NULL};
+    struct capability_entry *caps;
+    struct registry_entry *entry;
+    char model[32];
+    char *value, *error;
+    char *supported;
+    int success;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O!", kwlist, &hdhomerun_Device_type, &device))
+        return NULL;
+    if(py_registry_check_open(self) != 0)
+        return NULL;
+
+    caps = capability_lookup(device, 1);
+    if(!caps)
+        return NULL;
+    memset(model, 0, sizeof(model));
+    success = hdhomerun_device_get_var(device_hd(device), "/sys/model", &value, &error);
+    if(success == -1) {
+        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+        return NULL;
+    } else if(success == 1) {
+        strncpy(model, value, sizeof(model) - 1);
+    }
+    supported = strdup(caps->supported);
+    if(!supported)
+        return PyErr_NoMemory();
+
+    pthread_mutex_lock(&self->lock);
+    entry = registry_slot(self, hdhomerun_device_get_device_id(device_hd(device)));
+    if(!entry) {
+        pthread_mutex_unlock(&self->lock);
+        free(supported);
+        return PyErr_NoMemory();
+    }
+    entry->device_ip = hdhomerun_device_get_device_ip(device_hd(device));
+    entry->device_type = HDHOMERUN_DEVICE_TYPE_TUNER;
+    entry->tuner_count = caps->tuner_count;
+    entry->version_num = caps->version_num;
+    memset(entry->version_str, 0, sizeof(entry->version_str));
+    strncpy(entry->version_str, caps->version_str, sizeof(entry->version_str) - 1);
+    memcpy(entry->model, model, sizeof(entry->model));
+    free(entry->supported);
+    entry->supported = supported;
+    entry->validated_ns = wallclock_ns();
+    entry->state = REGISTRY_VALID;
+    pthread_mutex_unlock(&self->lock);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(Registry_DOC_remove,
+    "Remove the entry for a device ID.  Returns True if there was one.");
+
+static PyObject *py_registry_remove(py_registry_object *self, PyObject *args, PyObject *kwds) {
+    unsigned int device_id;
+    char *kwlist[] = {"device_id", NULL};
+    struct registry_entry *entry;
+    size_t i;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "I", kwlist, &device_id))
+        return NULL;
+    if(py_registry_check_open(self) != 0)
+        return NULL;
+
+    pthread_mutex_lock(&self->lock);
+    entry = registry_find(self, (uint32_t)device_id);
+    if(entry) {
+        i = (size_t)(entry - self->entries);
+        free(entry->supported);
+        memmove(entry, entry + 1, (self->count - i - 1) * sizeof(*entry));
+        self->count--;
+        /* Keep a revalidation in progress from skipping the entry that moved down */
+        if(self->next > i)
+            self->next--;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return PyBool_FromLong(entry != NULL);
+}
+
+PyDoc_STRVAR(Registry_DOC_revalidate,
+    "Check every entry again in the background, unless a check is already\n"
+    "running.  Use wait() to block until it has finished.");
+
+static PyObject *py_registry_revalidate(py_registry_object *self, PyObject *args, PyObject *kwds) {
+    unsigned int threads = REGISTRY_DEFAULT_THREADS;
+    char *kwlist[] = {"threads", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &threads))
+        return NULL;
+    if(py_registry_check_open(self) != 0)
+        return NULL;
+    if(threads < 1 || threads > REGISTRY_MAX_THREADS) {
+        PyErr_Format(PyExc_ValueError, "threads must be between 1 and %d", REGISTRY_MAX_THREADS);
+        return NULL;
+    }
+    if(registry_revalidate(self, threads) != 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(Registry_DOC_wait,
+    "Wait up to timeout seconds (forever if None) for revalidation to finish.\n"
+    "Returns True if it has.");
+
+static PyObject *py_registry_wait(py_registry_object *self, PyObject *args, PyObject *kwds) {
+    PyObject *timeout_obj = Py_None;
+    char *kwlist[] = {"timeout", NULL};
+    struct timespec deadline;
+    double timeout = 0.0;
+    uint64_t due_ns;
+    int done;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &timeout_obj))
+        return NULL;
+    if(py_registry_check_open(self) != 0)
+        return NULL;
+    if(timeout_obj != Py_None) {
+        timeout = PyFloat_AsDouble(timeout_obj);
+        if(timeout == -1.0 && PyErr_Occurred())
+            return NULL;
+        if(timeout < 0.0)
+            timeout = 0.0;
+    }
+
+    due_ns = (uint64_t)(wallclock_time() * 1e9 + timeout * 1e9);
+    deadline.tv_sec = (time_t)(due_ns / 1000000000ULL);
+    deadline.tv_nsec = (long)(due_ns % 1000000000ULL);
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    while(self->active > 0) {
+        if(timeout_obj == Py_None)
+            pthread_cond_wait(&self->cond, &self->lock);
+        else if(pthread_cond_timedwait(&self->cond, &self->lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    done = (self->active == 0);
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(done);
+}
+
+/* Builds the file image of every entry that has not failed; called with lock held */
+static uint8_t *registry_encode(py_registry_object *self, size_t *psize, uint32_t *pcount) {
+    size_t i, size, text = 0, offset, length;
+    struct registry_entry *entry;
+    uint32_t count = 0;
+    uint8_t *image, *record;
+
+    for(i = 0; i < self->count; i++) {
+        if(self->entries[i].state == REGISTRY_FAILED)
+            continue;
+        count++;
+        if(self->entries[i].supported)
+            text += strlen(self->entries[i].supported);
+    }
+    size = REGISTRY_HEADER_SIZE + (size_t)count * REGISTRY_RECORD_SIZE + text;
+    image = calloc(1, size);
+    if(!image)
+        return NULL;
+
+    memcpy(image, REGISTRY_MAGIC, 8);
+    put_le32(image + 8, REGISTRY_VERSION);
+    put_le32(image + 12, REGISTRY_RECORD_SIZE);
+    put_le32(image + 16, count);
+    put_le64(image + 24, wallclock_ns());
+
+    record = image + REGISTRY_HEADER_SIZE;
+    offset = REGISTRY_HEADER_SIZE + (size_t)count * REGISTRY_RECORD_SIZE;
+    for(i = 0; i < self->count; i++) {
+        entry = &self->entries[i];
+        if(entry->state == REGISTRY_FAILED)
+            continue;
+        length = entry->supported ? strlen(entry->supported) : 0;
+        put_le32(record, entry->device_id);
+        put_le32(record + 4, entry->device_ip);
+        put_le32(record + 8, entry->device_type);
+        put_le32(record + 12, entry->tuner_count);
+        put_le32(record + 16, entry->version_num);
+        put_le32(record + 20, (uint32_t)offset);
+        put_le32(record + 24, (uint32_t)length);
+        put_le64(record + 32, entry->validated_ns);
+        memcpy(record + 40, entry->model, strnlen(entry->model, sizeof(entry->model) - 1));
+        memcpy(record + 72, entry->version_str, strnlen(entry->version_str, sizeof(entry->version_str) - 1));
+        memcpy(image + offset, entry->supported, length);
+        offset += length;
+        record += REGISTRY_RECORD_SIZE;
+    }
+    *psize = size;
+    *pcount = count;
+    return image;
+}
+
+PyDoc_STRVAR(Registry_DOC_save,
+    "Write every entry that has not failed to path (by default the file the\n"
+    "Registry was opened from).  The file is replaced atomically.  Returns the\n"
+    "number of entries written.");
+
+static PyObject *py_registry_save(py_registry_object *self, PyObject *args, PyObject *kwds) {
+    char *path = NULL;
+    char *kwlist[] = {"path", NULL};
+    char *temp;
+    uint8_t *image;
+    size_t size;
+    uint32_t count;
+    int fd, error = 0;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|z", kwlist, &path))
+        return NULL;
+    if(py_registry_check_open(self) != 0)
+        return NULL;
+    if(!path)
+        path = self->path;
+
+    pthread_mutex_lock(&self->lock);
+    image = registry_encode(self, &size, &count);
+    pthread_mutex_unlock(&self->lock);
+    if(!image)
+        return PyErr_NoMemory();
+    temp = malloc(strlen(path) + 5);
+    if(!temp) {
+        free(image);
+        return PyErr_NoMemory();
+    }
+    sprintf(temp, "%s.tmp", path);
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        error = errno;
+    } else {
+        error = write_all(fd, image, size);
+        if(!error && fsync(fd) != 0)
+            error = errno;
+        if(close(fd) != 0 && !error)
+            error = errno;
+        if(!error && rename(temp, path) != 0)
+            error = errno;
+        if(error)
+            unlink(temp);
+    }
+    Py_END_ALLOW_THREADS
+    free(image);
+    free(temp);
+    if(error) {
+        errno = error;
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    }
+    return PyInt_FromLong((long)count);
+}
+
+static PySequenceMethods py_registry_as_sequence = {
+    (lenfunc)py_registry_length,    /* sq_length */
+};
+
+static PyMethodDef py_registry_methods[] = {
+    {"entries",                 (PyCFunction)py_registry_entries,               METH_NOARGS,                Registry_DOC_entries},
+    {"devices",                 (PyCFunction)py_registry_devices,               METH_KEYWORDS,              Registry_DOC_devices},
+    {"add",                     (PyCFunction)py_registry_add,                   METH_KEYWORDS,              Registry_DOC_add},
+    {"remove",                  (PyCFunction)py_registry_remove,                METH_KEYWORDS,              Registry_DOC_remove},
+    {"revalidate",              (PyCFunction)py_registry_revalidate,            METH_KEYWORDS,              Registry_DOC_revalidate},
+    {"wait",                    (PyCFunction)py_registry_wait,                  METH_KEYWORDS,              Registry_DOC_wait},
+    {"save",                    (PyCFunction)py_registry_save,                  METH_KEYWORDS,              Registry_DOC_save},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_Registry_type_doc,
+    "Registry(path, revalidate=True, threads=8)\n\n"
+    "A persistent list of known devices with their model, tuner count,\n"
+    "firmware and capabilities.  Opening it seeds the capability cache and,\n"
+    "unless revalidate=False, starts checking every entry in the background on\n"
+    "up to threads connections at once.  A missing file is an empty registry.");
+
+PyTypeObject hdhomerun_Registry_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.Registry",           /* tp_name */
+    sizeof(py_registry_object),     /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_registry_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    &py_registry_as_sequence,       /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    hdhomerun_Registry_type_doc,    /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_registry_methods,            /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    (initproc)py_registry_init,     /* tp_init */
+    (allocfunc)PyType_GenericAlloc, /* tp_alloc */
+    (newfunc)PyType_GenericNew,     /* tp_new */
+    (freefunc)PyObject_Del,         /* tp_free */
+};
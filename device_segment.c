@@ -0,0 +1,649 @@
+/*
+ * device_segment.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+/*
+ *  Segmenting stage.  Packets collect in memory until the stream time since
+ *  the segment began reaches the target duration, and the segment is then
+ *  cut in front of the next random access point and handed to a writer
+ *  thread, which writes it out with a single write().  Segments which do not
+ *  begin with a PAT get copies of the last PAT and PMT put in front, so that
+ *  each one decodes on its own; the continuity counters on those two PIDs
+ *  are renumbered so the copies do not break them.  A description of every
+ *  segment is queued for Python once it has been written.  Up to
+ *  SEGMENT_WRITES_MAX segments may wait for the disk before the stage has to
+ *  wait too.
+ */
+
+#define SEGMENT_INITIAL_SIZE (VIDEO_DATA_PACKET_SIZE * 1024)
+#define SEGMENT_MAX_SIZE (128 * 1024 * 1024)
+#define SEGMENT_QUEUE_LIMIT 1024
+#define SEGMENT_WRITES_MAX 4
+#define SEGMENT_PCR_JUMP 27000000ULL         /* larger PCR steps are discontinuities */
+#define SEGMENT_PCR_WRAP (((uint64_t)1 << 33) * 300)
+
+struct segment_event {
+    unsigned long sequence;
+    uint64_t duration;          /* 27MHz ticks */
+    size_t bytes;
+    int have_pcr;
+    uint64_t pcr_start;
+    uint64_t pcr_end;
+    int rap;
+    int discontinuity;
+    int final;
+    double wallclock;
+    int error;
+    char path[];
+};
+
+struct segment_job {
+    struct write_job job;
+    uint8_t *buffer;
+    struct segment_event *event;    /* bytes is the length of buffer */
+};
+
+struct segmenter {
+    struct stream_stage stage;
+    pthread_mutex_t lock;
+    char *template;
+    uint64_t target;            /* 27MHz ticks */
+    uint64_t limit;
+
+    uint8_t *buffer;
+    size_t used;
+    size_t size;
+
+    uint8_t pat[TS_PACKET_SIZE];
+    uint8_t pmt[TS_PACKET_SIZE];
+    int have_pat;
+    int have_pmt;
+    int pmt_pid;                /* -1 until a PAT names one */
+    uint8_t pat_cc;             /* next continuity counter written on PID 0 */
+    uint8_t pmt_cc;             /* and on pmt_pid */
+
+    int pcr_pid;                /* -1 until the first PCR */
+    uint64_t last_pcr;
+    uint64_t last_pcr_arrival_ns;
+    uint64_t time;              /* continuous stream time, bridged over discontinuities */
+    int pending_discontinuity;  /* the PCR jumped; flags the segment the next packet goes into */
+
+    int started;                /* a segment is being collected */
+    uint64_t start_time;
+    double start_wallclock;
+    int start_rap;
+    int seg_have_pcr;
+    uint64_t seg_pcr_start;
+    uint64_t seg_pcr_end;
+    int seg_discontinuity;
+
+    struct event_queue queue;
+    struct write_queue writer;
+
+    /* Protected by lock */
+    unsigned long sequence;
+    unsigned long segments;
+    unsigned long long bytes;
+    unsigned long long skipped;
+    unsigned long errors;
+};
+
+typedef struct {
+    PyObject_HEAD
+    py_device_object *device;
+    struct segmenter *seg;
+    int attached;
+} py_segmenter_object;
+
+/* Accepts exactly one %d conversion (with optional zero flag and width) plus %% escapes */
+static int segment_template_valid(const char *template) {
+    const char *p;
+    int conversions = 0;
+
+    for(p = template; *p; p++) {
+        if(*p != '%')
+            continue;
+        p++;
+        if(*p == '%')
+            continue;
+        while(*p >= '0' && *p <= '9')
+            p++;
+        if(*p != 'd')
+            return 0;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+static void segment_clock(struct segmenter *seg, uint64_t pcr, int discontinuity, uint64_t arrival_ns) {
+    uint64_t ticks;
+
+    ticks = (pcr + SEGMENT_PCR_WRAP - seg->last_pcr) % SEGMENT_PCR_WRAP;
+    if(discontinuity || ticks > SEGMENT_PCR_JUMP) {
+        seg->time += (arrival_ns - seg->last_pcr_arrival_ns) * 27 / 1000;
+        seg->pending_discontinuity = 1;
+    } else {
+        seg->time += ticks;
+    }
+    seg->last_pcr = pcr;
+    seg->last_pcr_arrival_ns = arrival_ns;
+}
+
+/* Remembers the current PAT and first PMT when each fits in a single packet */
+static void segment_learn_tables(struct segmenter *seg, const uint8_t *pkt, uint16_t pid) {
+    const uint8_t *section;
+    size_t length;
+    uint16_t pmt_pid;
+
+    section = ts_section_start(pkt, &length);
+    if(!section)
+        return;
+    if(pid == 0x0000) {
+        if(ts_parse_pat(section, length, &pmt_pid, 1) < 1)
+            return;
+        if(seg->pmt_pid != pmt_pid)
+            seg->have_pmt = 0;
+        seg->pmt_pid = pmt_pid;
+        memcpy(seg->pat, pkt, TS_PACKET_SIZE);
+        seg->have_pat = 1;
+    } else if(pid == seg->pmt_pid && section[0] == 0x02) {
+        if((((size_t)(section[1] & 0x0F) << 8) | section[2]) + 3 > length)
+            return;
+        memcpy(seg->pmt, pkt, TS_PACKET_SIZE);
+        seg->have_pmt = 1;
+    }
+}
+
+static int segment_append(struct segmenter *seg, const uint8_t *pkt) {
+    uint8_t *buffer, *cc = NULL;
+    size_t size;
+    uint16_t pid = TS_PID(pkt);
+
+    if(seg->used + TS_PACKET_SIZE > seg->size) {
+        size = seg->size * 2;
+        if(size > SEGMENT_MAX_SIZE)
+            size = SEGMENT_MAX_SIZE;
+        if(seg->used + TS_PACKET_SIZE > size)
+            return -1;
+        buffer = realloc(seg->buffer, size);
+        if(!buffer)
+            return -1;
+        seg->buffer = buffer;
+        seg->size = size;
+    }
+    memcpy(seg->buffer + seg->used, pkt, TS_PACKET_SIZE);
+
+    /* Injected tables repeat packets already sent, so the output counts on its own */
+    if(pid == 0x0000)
+        cc = &seg->pat_cc;
+    else if(pid == seg->pmt_pid)
+        cc = &seg->pmt_cc;
+    if(cc && (pkt[3] & 0x10)) {
+        seg->buffer[seg->used + 3] = (uint8_t)((pkt[3] & 0xF0) | *cc);
+        *cc = (uint8_t)((*cc + 1) & 0x0F);
+    }
+    seg->used += TS_PACKET_SIZE;
+    return 0;
+}
+
+static void segment_begin(struct segmenter *seg, const uint8_t *pkt, int rap) {
+    seg->started = 1;
+    seg->used = 0;
+    seg->start_time = seg->time;
+    seg->start_wallclock = wallclock_time();
+    seg->start_rap = rap;
+    seg->seg_have_pcr = 0;
+    seg->seg_discontinuity = 0;
+    if(TS_PID(pkt) != 0x0000 && seg->have_pat && seg->have_pmt) {
+        segment_append(seg, seg->pat);
+        segment_append(seg, seg->pmt);
+    }
+}
+
+/* Queues the description of a segment for Python and counts it */
+static void segment_report(struct segmenter *seg, struct segment_event *ev) {
+    event_queue_push(&seg->queue, ev, sizeof(*ev) + strlen(ev->path) + 1);
+
+    pthread_mutex_lock(&seg->lock);
+    if(ev->error) {
+        seg->errors++;
+    } else {
+        seg->segments++;
+        seg->bytes += ev->bytes;
+    }
+    pthread_mutex_unlock(&seg->lock);
+}
+
+/* Runs on the writer thread */
+static void segment_write(void *owner, struct write_job *job, int discard) {
+    struct segmenter *seg = (struct segmenter *)owner;
+    struct segment_job *sj = (struct segment_job *)job;
+    struct segment_event *ev = sj->event;
+    int fd;
+
+    if(!discard) {
+        fd = open(ev->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if(fd < 0) {
+            ev->error = errno;
+        } else {
+            ev->error = write_all(fd, sj->buffer, ev->bytes);
+            if(close(fd) != 0 && !ev->error)
+                ev->error = errno;
+        }
+        segment_report(seg, ev);
+    }
+    free(ev);
+    free(sj->buffer);
+    free(sj);
+}
+
+/* Hands the collected segment to the writer, which queues its description once it is written */
+static void segment_cut(struct segmenter *seg, int final) {
+    struct segment_event *ev;
+    struct segment_job *sj = NULL;
+    char path[PATH_MAX];
+    unsigned long sequence;
+    size_t length;
+    int error = 0;
+
+    if(!seg->started || seg->used == 0)
+        return;
+
+    pthread_mutex_lock(&seg->lock);
+    sequence = seg->sequence++;
+    pthread_mutex_unlock(&seg->lock);
+
+    if(snprintf(path, sizeof(path), seg->template, (int)sequence) >= (int)sizeof(path))
+        error = ENAMETOOLONG;
+
+    length = strlen(path) + 1;
+    ev = malloc(sizeof(*ev) + length);
+    if(ev) {
+        ev->sequence = sequence;
+        ev->duration = seg->time - seg->start_time;
+        ev->bytes = seg->used;
+        ev->have_pcr = seg->seg_have_pcr;
+        ev->pcr_start = seg->seg_pcr_start;
+        ev->pcr_end = seg->seg_pcr_end;
+        ev->rap = seg->start_rap;
+        ev->discontinuity = seg->seg_discontinuity;
+        ev->final = final;
+        ev->wallclock = seg->start_wallclock;
+        ev->error = error;
+        memcpy(ev->path, path, length);
+    }
+
+    /* The buffer goes with the job; the next segment starts in one of the same size */
+    if(ev && !error) {
+        sj = malloc(sizeof(*sj));
+        if(sj) {
+            sj->buffer = seg->buffer;
+            sj->event = ev;
+            seg->buffer = malloc(seg->size);
+            if(!seg->buffer) {
+                seg->buffer = sj->buffer;
+                free(sj);
+                sj = NULL;
+            }
+        }
+        if(!sj)
+            ev->error = ENOMEM;
+    }
+    if(sj) {
+        write_queue_push(&seg->writer, &sj->job);
+    } else if(ev) {
+        segment_report(seg, ev);
+        free(ev);
+    } else {
+        pthread_mutex_lock(&seg->lock);
+        seg->errors++;
+        pthread_mutex_unlock(&seg->lock);
+    }
+
+    seg->started = 0;
+    seg->used = 0;
+}
+
+static void segmenter_process(struct stream_stage *stage, const uint8_t *data, size_t length, uint64_t arrival_ns) {
+    struct segmenter *seg = (struct segmenter *)stage;
+    const uint8_t *pkt;
+    unsigned long skipped = 0;
+    uint64_t pcr;
+    uint16_t pid;
+    int discontinuity, rap;
+
+    for(pkt = data; pkt < data + length; pkt += TS_PACKET_SIZE) {
+        pid = TS_PID(pkt);
+        rap = TS_HAS_ADAPTATION(pkt) && pkt[4] > 0 && (pkt[5] & 0x40);
+
+        if(pid == 0x0000 || pid == seg->pmt_pid)
+            segment_learn_tables(seg, pkt, pid);
+
+        if(ts_get_pcr(pkt, &pcr, &discontinuity)) {
+            if(seg->pcr_pid < 0) {
+                seg->pcr_pid = pid;
+                seg->last_pcr = pcr;
+                seg->last_pcr_arrival_ns = arrival_ns;
+            } else if(seg->pcr_pid == pid) {
+                segment_clock(seg, pcr, discontinuity, arrival_ns);
+            }
+        }
+
+        if(seg->started) {
+            /* Cut in front of a random access point once the target is reached, or anywhere past the limit */
+            if(seg->time - seg->start_time >= (rap ? seg->target : seg->limit))
+                segment_cut(seg, 0);
+        } else if(!rap && !(seg->pcr_pid >= 0 && seg->time >= seg->limit)) {
+            /* Wait for a random access point unless the stream is not flagging them */
+            skipped++;
+            continue;
+        }
+        if(!seg->started)
+            segment_begin(seg, pkt, rap);
+
+        if(segment_append(seg, pkt) != 0) {
+            segment_cut(seg, 0);
+            segment_begin(seg, pkt, rap);
+            segment_append(seg, pkt);
+        }
+        /* Set after any cut, so the flag lands on the segment holding the packet after the jump */
+        if(seg->pending_discontinuity) {
+            seg->seg_discontinuity = 1;
+            seg->pending_discontinuity = 0;
+        }
+        if(pid == seg->pcr_pid && ts_get_pcr(pkt, &pcr, &discontinuity)) {
+            if(!seg->seg_have_pcr)
+                seg->seg_pcr_start = pcr;
+            seg->seg_pcr_end = pcr;
+            seg->seg_have_pcr = 1;
+        }
+    }
+
+    if(skipped) {
+        pthread_mutex_lock(&seg->lock);
+        seg->skipped += skipped;
+        pthread_mutex_unlock(&seg->lock);
+    }
+}
+
+static void segmenter_free(struct segmenter *seg) {
+    write_queue_stop(&seg->writer);
+    event_queue_destroy(&seg->queue);
+    free(seg->buffer);
+    free(seg->template);
+    pthread_mutex_destroy(&seg->lock);
+    free(seg);
+}
+
+const char Device_DOC_segment[] =
+    "Cut this tuner's stream into segment files and return a Segmenter.\n\n"
+    "template names the files and must contain a single %d (e.g.\n"
+    "'/srv/live/seg%05d.ts'), which is replaced by the sequence number\n"
+    "starting at sequence.  A segment is cut at the first random access point\n"
+    "after target_duration seconds of stream time, or anywhere once\n"
+    "max_duration (default twice the target) has passed.  Each segment is\n"
+    "written with a single write by a thread of the Segmenter's own and then\n"
+    "described by an event on the Segmenter's queue.";
+
+PyObject *py_device_segment(py_device_object *self, PyObject *args, PyObject *kwds) {
+    char *template = NULL;
+    double target = 6.0, limit = 0.0;
+    unsigned long sequence = 0;
+    char *kwlist[] = {"template", "target_duration", "max_duration", "sequence", NULL};
+    py_segmenter_object *segmenter;
+    struct segmenter *seg;
+    int error;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|ddk", kwlist, &template, &target, &limit, &sequence))
+        return NULL;
+    if(!segment_template_valid(template)) {
+        PyErr_SetString(PyExc_ValueError, "template must contain exactly one %d conversion");
+        return NULL;
+    }
+    if(limit == 0.0)
+        limit = target * 2;
+    if(target <= 0.0 || limit < target) {
+        PyErr_SetString(PyExc_ValueError, "target_duration must be positive and no larger than max_duration");
+        return NULL;
+    }
+
+    seg = calloc(1, sizeof(*seg));
+    if(!seg)
+        return PyErr_NoMemory();
+    if(event_queue_init(&seg->queue, SEGMENT_QUEUE_LIMIT) != 0) {
+        free(seg);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    pthread_mutex_init(&seg->lock, NULL);
+    seg->stage.process = segmenter_process;
+    seg->target = (uint64_t)(target * 27000000.0);
+    seg->limit = (uint64_t)(limit * 27000000.0);
+    seg->pmt_pid = -1;
+    seg->pcr_pid = -1;
+    seg->sequence = sequence;
+    seg->size = SEGMENT_INITIAL_SIZE;
+    seg->buffer = malloc(seg->size);
+    seg->template = strdup(template);
+    if(!seg->buffer || !seg->template) {
+        segmenter_free(seg);
+        return PyErr_NoMemory();
+    }
+    error = write_queue_start(&seg->writer, SEGMENT_WRITES_MAX, segment_write, seg);
+    if(error) {
+        segmenter_free(seg);
+        errno = error;
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+
+    segmenter = PyObject_New(py_segmenter_object, &hdhomerun_Segmenter_type);
+    if(!segmenter) {
+        segmenter_free(seg);
+        return NULL;
+    }
+    segmenter->seg = seg;
+    Py_INCREF(self);
+    segmenter->device = self;
+    segmenter->attached = 1;
+    stream_stages_attach(&self->stages, &seg->stage);
+    return (PyObject *)segmenter;
+}
+
+/*
+ *  Segmenter methods
+ */
+
+static void py_segmenter_detach(py_segmenter_object *self) {
+    if(!self->attached)
+        return;
+    Py_BEGIN_ALLOW_THREADS
+    stream_stages_detach(&self->device->stages, &self->seg->stage);
+    segment_cut(self->seg, 1);
+    write_queue_stop(&self->seg->writer);
+    Py_END_ALLOW_THREADS
+    self->attached = 0;
+}
+
+static void py_segmenter_dealloc(py_segmenter_object *self) {
+    py_segmenter_detach(self);
+    segmenter_free(self->seg);
+    Py_DECREF(self->device);
+    PyObject_Del(self);
+}
+
+static PyObject *build_segment_event(struct segment_event *ev) {
+    PyObject *pcr_start, *pcr_end, *rv;
+
+    if(ev->have_pcr) {
+        pcr_start = PyLong_FromUnsignedLongLong(ev->pcr_start);
+        pcr_end = PyLong_FromUnsignedLongLong(ev->pcr_end);
+    } else {
+        Py_INCREF(Py_None);
+        pcr_start = Py_None;
+        Py_INCREF(Py_None);
+        pcr_end = Py_None;
+    }
+    if(!pcr_start || !pcr_end) {
+        Py_XDECREF(pcr_start);
+        Py_XDECREF(pcr_end);
+        return NULL;
+    }
+    rv = Py_BuildValue("{s:k,s:s,s:d,s:n,s:N,s:N,s:O,s:O,s:O,s:d,s:z}",
+                       "sequence", ev->sequence,
+                       "path", ev->path,
+                       "duration", (double)ev->duration / 27000000.0,
+                       "bytes", (Py_ssize_t)ev->bytes,
+                       "pcr_start", pcr_start,
+                       "pcr_end", pcr_end,
+                       "rap", ev->rap ? Py_True : Py_False,
+                       "discontinuity", ev->discontinuity ? Py_True : Py_False,
+                       "final", ev->final ? Py_True : Py_False,
+                       "wallclock", ev->wallclock,
+                       "error", ev->error ? strerror(ev->error) : NULL);
+    return rv;
+}
+
+PyDoc_STRVAR(Segmenter_DOC_fileno,
+    "Return a file descriptor which is readable while segment events are queued.");
+
+static PyObject *py_segmenter_fileno(py_segmenter_object *self) {
+    return PyInt_FromLong((long)self->seg->queue.pipe_fd[0]);
+}
+
+PyDoc_STRVAR(Segmenter_DOC_events,
+    "Return (and remove) the descriptions of all completed segments as a\n"
+    "list of dicts.  pcr_start and pcr_end are the first and last 27MHz PCR\n"
+    "values in the segment (None without a PCR); error is set if the segment\n"
+    "could not be written.");
+
+static PyObject *py_segmenter_events(py_segmenter_object *self) {
+    PyObject *result, *event;
+    struct event_queue_item *item;
+
+    result = PyList_New(0);
+    if(!result)
+        return NULL;
+
+    while((item = event_queue_pop(&self->seg->queue)) != NULL) {
+        event = build_segment_event((struct segment_event *)item->data);
+        free(item);
+        if(!event) { Py_DECREF(result); return NULL; }
+        if(PyList_Append(result, event) != 0) { Py_DECREF(event); Py_DECREF(result); return NULL; }
+        Py_DECREF(event);
+    }
+    return result;
+}
+
+PyDoc_STRVAR(Segmenter_DOC_stats,
+    "Return counters for the segments written so far.");
+
+static PyObject *py_segmenter_stats(py_segmenter_object *self) {
+    struct segmenter *seg = self->seg;
+    unsigned long sequence, segments, errors, dropped;
+    unsigned long long bytes, skipped;
+
+    pthread_mutex_lock(&seg->lock);
+    sequence = seg->sequence;
+    segments = seg->segments;
+    errors = seg->errors;
+    bytes = seg->bytes;
+    skipped = seg->skipped;
+    pthread_mutex_unlock(&seg->lock);
+    pthread_mutex_lock(&seg->queue.lock);
+    dropped = seg->queue.dropped;
+    pthread_mutex_unlock(&seg->queue.lock);
+
+    return Py_BuildValue("{s:k,s:k,s:K,s:k,s:K,s:k,s:O}",
+                         "sequence", sequence,
+                         "segments", segments,
+                         "bytes", bytes,
+                         "errors", errors,
+                         "skipped_packets", skipped,
+                         "dropped_events", dropped,
+                         "active", self->attached ? Py_True : Py_False);
+}
+
+PyDoc_STRVAR(Segmenter_DOC_stop,
+    "Stop segmenting.  Whatever has been collected is written out as a final,\n"
+    "possibly short, segment.");
+
+static PyObject *py_segmenter_stop(py_segmenter_object *self) {
+    py_segmenter_detach(self);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef py_segmenter_methods[] = {
+    {"fileno",                  (PyCFunction)py_segmenter_fileno,               METH_NOARGS,                Segmenter_DOC_fileno},
+    {"events",                  (PyCFunction)py_segmenter_events,               METH_NOARGS,                Segmenter_DOC_events},
+    {"stats",                   (PyCFunction)py_segmenter_stats,                METH_NOARGS,                Segmenter_DOC_stats},
+    {"stop",                    (PyCFunction)py_segmenter_stop,                 METH_NOARGS,                Segmenter_DOC_stop},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_Segmenter_type_doc,
+    "A native stream segmenter, created by Device.segment().");
+
+PyTypeObject hdhomerun_Segmenter_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.Segmenter",          /* tp_name */
+    sizeof(py_segmenter_object),    /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_segmenter_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    hdhomerun_Segmenter_type_doc,   /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_segmenter_methods,           /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    0,                              /* tp_new */
+    0,                              /* tp_free */
+};
@@ -34,8 +34,14 @@ PyObject *py_device_set_device(py_device_object *self, PyObject *args, PyObject
 
     if(!PyArg_ParseTupleAndKeywords(args, kwds, "II", kwlist, &device_id, &device_ip))
         return NULL;
+    if(self->conn) {
+        PyErr_SetString(PyExc_ValueError, "a Device on a Connection cannot be pointed at another device");
+        return NULL;
+    }
 
-    success = hdhomerun_device_set_device(self->hd, (uint32_t)device_id, (uint32_t)device_ip);
+    capability_forget_version(hdhomerun_device_get_device_id(device_hd(self)));
+    var_cache_clear(device_var_cache(self));
+    success = hdhomerun_device_set_device(device_hd(self), (uint32_t)device_id, (uint32_t)device_ip);
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
         return NULL;
@@ -59,8 +65,12 @@ PyObject *py_device_set_multicast(py_device_object *self, PyObject *args, PyObje
 
     if(!PyArg_ParseTupleAndKeywords(args, kwds, "II", kwlist, &multicast_ip, &multicast_port))
         return NULL;
+    if(self->conn) {
+        PyErr_SetString(PyExc_ValueError, "a Device on a Connection cannot be pointed at another device");
+        return NULL;
+    }
 
-    success = hdhomerun_device_set_multicast(self->hd, (uint32_t)multicast_ip, (uint16_t)multicast_port);
+    success = hdhomerun_device_set_multicast(device_hd(self), (uint32_t)multicast_ip, (uint16_t)multicast_port);
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
         return NULL;
@@ -84,7 +94,7 @@ PyObject *py_device_set_tuner(py_device_object *self, PyObject *args, PyObject *
     if(!PyArg_ParseTupleAndKeywords(args, kwds, "I", kwlist, &tuner))
         return NULL;
 
-    success = hdhomerun_device_set_tuner(self->hd, tuner);
+    success = hdhomerun_device_set_tuner(device_hd(self), tuner);
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
         return NULL;
@@ -92,6 +102,7 @@ PyObject *py_device_set_tuner(py_device_object *self, PyObject *args, PyObject *
         PyErr_SetString(hdhomerun_device_error, "failed to set tuner number");
         return NULL;
     } else if(success == 1) {
+        self->tuner = tuner;
         Py_RETURN_NONE;
     } else {
         PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
@@ -101,6 +112,7 @@ PyObject *py_device_set_tuner(py_device_object *self, PyObject *args, PyObject *
 
 const char Device_DOC_set_tuner_from_str[] = "Set the tuner which this object references.";
 PyObject *py_device_set_tuner_from_str(py_device_object *self, PyObject *args, PyObject *kwds) {
+    struct hdhomerun_device_t *hd;
     const char *tuner = NULL;
     char *kwlist[] = {"tuner", NULL};
     int success;
@@ -108,7 +120,8 @@ PyObject *py_device_set_tuner_from_str(py_device_object *self, PyObject *args, P
     if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &tuner))
         return NULL;
 
-    success = hdhomerun_device_set_tuner_from_str(self->hd, tuner);
+    hd = device_hd(self);
+    success = hdhomerun_device_set_tuner_from_str(hd, tuner);
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
         return NULL;
@@ -116,6 +129,7 @@ PyObject *py_device_set_tuner_from_str(py_device_object *self, PyObject *args, P
         PyErr_SetString(hdhomerun_device_error, "failed to set tuner from string");
         return NULL;
     } else if(success == 1) {
+        self->tuner = hdhomerun_device_get_tuner(hd);
         Py_RETURN_NONE;
     } else {
         PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
@@ -127,23 +141,57 @@ PyObject *py_device_set_tuner_from_str(py_device_object *self, PyObject *args, P
  *  Functions which operate on a HDHomeRun device
  */
 
-const char Device_DOC_set_var[] = "Set a named control variable on the device.";
+/* Internal: the typed setters for tuner variables, e.g. /tuner0/channel; name is also the keyword */
+static PyObject *device_set_tuner_var(py_device_object *self, PyObject *args, PyObject *kwds, const char *name) {
+    unsigned int timeout_ms = self->control_timeout_ms;
+    char *kwlist[] = {(char *)name, "timeout_ms", NULL};
+    struct control_op op;
+    char *value;
+    char item[32];
+    int success;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|I", kwlist, &value, &timeout_ms))
+        return NULL;
+
+    snprintf(item, sizeof(item), "/tuner%u/%s", hdhomerun_device_get_tuner(device_hd(self)), name);
+    var_cache_invalidate(device_var_cache(self), item);
+    memset(&op, 0, sizeof(op));
+    op.name = item;
+    op.value = value;
+    success = device_control_var(self, &op, timeout_ms);
+    if(success != 1)
+        return device_control_error(success, op.text[0] ? op.text : DEVICE_ERR_REJECTED_OP);
+    Py_RETURN_NONE;
+}
+
+const char Device_DOC_set_var[] =
+    "Set a named control variable on the device.  timeout_ms, like that of the\n"
+    "typed setters, overrides set_control_timeout() for this call.";
 PyObject *py_device_set_var(py_device_object *self, PyObject *args, PyObject *kwds) {
     char *ret_error = "the set operation was rejected by the device";
     char *item = NULL;
     char *value = NULL;
+    unsigned int timeout_ms = self->control_timeout_ms;
+    struct control_op op;
     int success;
-    char *kwlist[] = {"item", "value", NULL};
+    char *kwlist[] = {"item", "value", "timeout_ms", NULL};
 
-    if(!PyArg_ParseTupleAndKeywords(args, kwds, "ss", kwlist, &item, &value))
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "ss|I", kwlist, &item, &value, &timeout_ms))
         return NULL;
 
-    success = hdhomerun_device_set_var(self->hd, item, value, NULL, &ret_error);
+    var_cache_invalidate(device_var_cache(self), item);
+    memset(&op, 0, sizeof(op));
+    op.name = item;
+    op.value = value;
+    success = device_control_var(self, &op, timeout_ms);
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
         return NULL;
+    } else if(success == -2) {
+        PyErr_SetString(hdhomerun_timeout_error, DEVICE_ERR_TIMEOUT);
+        return NULL;
     } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, ret_error);
+        PyErr_SetString(hdhomerun_device_error, op.text[0] ? op.text : ret_error);
         return NULL;
     } else if(success == 1) {
         Py_RETURN_NONE;
@@ -155,96 +203,20 @@ PyObject *py_device_set_var(py_device_object *self, PyObject *args, PyObject *kw
 
 const char Device_DOC_set_tuner_channel[] = "Set the channel which the tuner operators on.";
 PyObject *py_device_set_tuner_channel(py_device_object *self, PyObject *args, PyObject *kwds) {
-    int success;
-    char *channel;
-    char *kwlist[] = {"channel", NULL};
-
-    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &channel))
-        return NULL;
-
-    success = hdhomerun_device_set_tuner_channel(self->hd, (const char *)channel);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success == 1) {
-        Py_RETURN_NONE;
-    } else {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
+    return device_set_tuner_var(self, args, kwds, "channel");
 }
 
 const char Device_DOC_set_tuner_vchannel[] = "Set the virtual channel which the tuner operators on.";
 PyObject *py_device_set_tuner_vchannel(py_device_object *self, PyObject *args, PyObject *kwds) {
-    int success;
-    char *vchannel;
-    char *kwlist[] = {"vchannel", NULL};
-
-    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &vchannel))
-        return NULL;
-
-    success = hdhomerun_device_set_tuner_channel(self->hd, (const char *)vchannel);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success == 1) {
-        Py_RETURN_NONE;
-    } else {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
+    return device_set_tuner_var(self, args, kwds, "vchannel");
 }
 
 const char Device_DOC_set_tuner_channelmap[] = "Set the tuner's channel map.";
 PyObject *py_device_set_tuner_channelmap(py_device_object *self, PyObject *args, PyObject *kwds) {
-    int success;
-    char *channelmap;
-    char *kwlist[] = {"channelmap", NULL};
-
-    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &channelmap))
-        return NULL;
-
-    success = hdhomerun_device_set_tuner_channelmap(self->hd, (const char *)channelmap);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success == 1) {
-        Py_RETURN_NONE;
-    } else {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
+    return device_set_tuner_var(self, args, kwds, "channelmap");
 }
 
 const char Device_DOC_set_tuner_filter[] = "Set the tuner's filter.";
 PyObject *py_device_set_tuner_filter(py_device_object *self, PyObject *args, PyObject *kwds) {
-    int success;
-    char *filter;
-    char *kwlist[] = {"filter", NULL};
-
-    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &filter))
-        return NULL;
-
-    success = hdhomerun_device_set_tuner_filter(self->hd, (const char *)filter);
-    if(success == -1) {
-        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
-        return NULL;
-    } else if(success == 0) {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
-        return NULL;
-    } else if(success == 1) {
-        Py_RETURN_NONE;
-    } else {
-        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
-        return NULL;
-    }
+    return device_set_tuner_var(self, args, kwds, "filter");
 }
@@ -0,0 +1,289 @@
+/*
+ * device_trace.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ *  An always-on flight recorder: the last TRACE_RING_SIZE control requests,
+ *  stream transitions and lock changes, kept as fixed-size binary records in
+ *  one process-wide ring.
+ *
+ *  Writers claim a slot with an atomic increment and never wait, whichever
+ *  thread they run on and whether or not they hold the GIL.  Each slot holds
+ *  the sequence number of the record in it, cleared while the record is being
+ *  written; readers copy a slot and keep it only if that number is the one
+ *  they expected both before and after the copy, so a record overwritten
+ *  mid-read is dropped instead of returned torn.
+ */
+
+#define TRACE_RING_SIZE 4096    /* a power of two */
+#define TRACE_ITEM_MAX 28
+#define TRACE_FILE_MAGIC "HDHRTRC1"
+
+struct trace_record {
+    uint64_t seq;           /* index + 1 once written, 0 while being written */
+    uint64_t time_ns;       /* monotonic_ns() */
+    uint32_t device_id;
+    uint32_t device_ip;
+    uint32_t duration_us;
+    int32_t result;
+    uint16_t event;
+    uint8_t tuner;
+    uint8_t reserved;
+    char item[TRACE_ITEM_MAX];
+};
+
+struct trace_file_header {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t count;
+    uint64_t monotonic_ns;  /* the two clocks at the time of the dump */
+    uint64_t wallclock_ns;
+};
+
+static struct trace_record trace_ring[TRACE_RING_SIZE];
+static uint64_t trace_next = 0;
+
+static const char *trace_event_names[] = {
+    NULL,
+    "control_get",
+    "control_set",
+    "get_var",
+    "set_var",
+    "stream_start",
+    "stream_stop",
+    "stream_empty",
+    "stream_resume",
+    "lockkey_request",
+    "lockkey_force",
+    "lockkey_release",
+    "tuner_lock",
+};
+
+/* Internal: appends an event; never blocks, and may be called from any thread without the GIL */
+void trace_event(int event, uint32_t device_id, uint32_t device_ip, unsigned int tuner,
+                 const char *item, int result, uint64_t duration_ns) {
+    uint64_t index = __atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED);
+    struct trace_record *rec = &trace_ring[index & (TRACE_RING_SIZE - 1)];
+    uint64_t duration_us = duration_ns / 1000ULL;
+
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->time_ns = monotonic_ns();
+    rec->device_id = device_id;
+    rec->device_ip = device_ip;
+    rec->duration_us = duration_us > UINT32_MAX ? UINT32_MAX : (uint32_t)duration_us;
+    rec->result = result;
+    rec->event = (uint16_t)event;
+    rec->tuner = tuner > TRACE_NO_TUNER ? TRACE_NO_TUNER : (uint8_t)tuner;
+    rec->reserved = 0;
+    strncpy(rec->item, item ? item : "", sizeof(rec->item));
+    __atomic_store_n(&rec->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+/* Internal: trace_event() for a request made through a Device; must not cause any I/O */
+void trace_device(py_device_object *self, int event, const char *item, int result, uint64_t duration_ns) {
+    struct hdhomerun_device_t *hd = self->conn ? self->conn->hd : self->hd;
+
+    trace_event(event, hdhomerun_device_get_device_id_requested(hd), hdhomerun_device_get_device_ip_requested(hd),
+                device_tuner(self), item, result, duration_ns);
+}
+
+/* Copies out the records still in the ring, oldest first; returns how many */
+static size_t trace_snapshot(struct trace_record *out) {
+    uint64_t next, index;
+    const struct trace_record *rec;
+    size_t count = 0;
+
+    next = __atomic_load_n(&trace_next, __ATOMIC_ACQUIRE);
+    index = next > TRACE_RING_SIZE ? next - TRACE_RING_SIZE : 0;
+    for(; index < next; index++) {
+        rec = &trace_ring[index & (TRACE_RING_SIZE - 1)];
+        if(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != index + 1)
+            continue;
+        memcpy(&out[count], rec, sizeof(*rec));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) != index + 1)
+            continue;
+        count++;
+    }
+    return count;
+}
+
+static uint64_t trace_wallclock_ns(void) {
+    return (uint64_t)(wallclock_time() * 1e9);
+}
+
+static PyObject *trace_build_list(const struct trace_record *records, size_t count,
+                                  uint64_t monotonic_now, uint64_t wallclock_now) {
+    const struct trace_record *rec;
+    char item[TRACE_ITEM_MAX + 1];
+    PyObject *rv, *ev, *tuner;
+    const char *name;
+    double when;
+    size_t i;
+
+    rv = PyList_New((Py_ssize_t)count);
+    if(!rv)
+        return NULL;
+    for(i = 0; i < count; i++) {
+        rec = &records[i];
+        name = rec->event < sizeof(trace_event_names) / sizeof(trace_event_names[0]) ?
+               trace_event_names[rec->event] : NULL;
+        memcpy(item, rec->item, TRACE_ITEM_MAX);
+        item[TRACE_ITEM_MAX] = '\0';
+        when = ((double)wallclock_now - (double)(monotonic_now - rec->time_ns)) / 1e9;
+        if(rec->tuner == TRACE_NO_TUNER) {
+            Py_INCREF(Py_None);
+            tuner = Py_None;
+        } else {
+            tuner = PyInt_FromLong(rec->tuner);
+        }
+        ev = Py_BuildValue("{s:K,s:d,s:s,s:k,s:k,s:N,s:s,s:i,s:d}",
+                           "seq", (unsigned long long)rec->seq, "time", when,
+                           "event", name ? name : "unknown",
+                           "device_id", (unsigned long)rec->device_id, "device_ip", (unsigned long)rec->device_ip,
+                           "tuner", tuner, "item", item, "result", (int)rec->result,
+                           "duration_ms", (double)rec->duration_us / 1000.0);
+        if(!ev) {
+            Py_DECREF(rv);
+            return NULL;
+        }
+        PyList_SET_ITEM(rv, (Py_ssize_t)i, ev);
+    }
+    return rv;
+}
+
+/* Reads a dump written by trace_dump(); returns the records or NULL with errno set */
+static struct trace_record *trace_load(const char *filename, size_t *pcount, struct trace_file_header *header) {
+    struct trace_record *records;
+    FILE *fp;
+
+    fp = fopen(filename, "rb");
+    if(!fp)
+        return NULL;
+    if(fread(header, sizeof(*header), 1, fp) != 1 || memcmp(header->magic, TRACE_FILE_MAGIC, 8) != 0 ||
+       header->record_size != sizeof(struct trace_record) || header->count > TRACE_RING_SIZE) {
+        fclose(fp);
+        errno = EINVAL;
+        return NULL;
+    }
+    records = calloc(header->count + 1, sizeof(*records));
+    if(!records) {
+        fclose(fp);
+        errno = ENOMEM;
+        return NULL;
+    }
+    if(fread(records, sizeof(*records), header->count, fp) != header->count) {
+        free(records);
+        fclose(fp);
+        errno = EINVAL;
+        return NULL;
+    }
+    fclose(fp);
+    *pcount = header->count;
+    return records;
+}
+
+const char hdhomerun_DOC_trace_events[] =
+    "Return the events in the trace ring, oldest first, as dicts with the\n"
+    "event name, time (as time.time()), device_id, device_ip, tuner (None when\n"
+    "not known), item, result and duration_ms.  Control requests carry the\n"
+    "libhdhomerun result code (1 accepted, 0 rejected, -1 communication error,\n"
+    "-2 timeout).  With filename, decode a dump written by trace_dump() instead.";
+
+PyObject *py_hdhomerun_trace_events(PyObject *module, PyObject *args, PyObject *kwds) {
+    char *filename = NULL;
+    char *kwlist[] = {"filename", NULL};
+    struct trace_file_header header;
+    struct trace_record *records;
+    size_t count = 0;
+    PyObject *rv;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|z", kwlist, &filename))
+        return NULL;
+
+    if(filename) {
+        records = trace_load(filename, &count, &header);
+        if(!records)
+            return PyErr_SetFromErrnoWithFilename(PyExc_IOError, filename);
+    } else {
+        records = malloc(TRACE_RING_SIZE * sizeof(*records));
+        if(!records)
+            return PyErr_NoMemory();
+        header.monotonic_ns = monotonic_ns();
+        header.wallclock_ns = trace_wallclock_ns();
+        count = trace_snapshot(records);
+    }
+    rv = trace_build_list(records, count, header.monotonic_ns, header.wallclock_ns);
+    free(records);
+    return rv;
+}
+
+const char hdhomerun_DOC_trace_dump[] =
+    "Write the trace ring to a binary file, e.g. from an except block or\n"
+    "sys.excepthook, for decoding later with trace_events(filename).  Only\n"
+    "open() and write() are used, without the GIL.  Returns the number of\n"
+    "events written.";
+
+PyObject *py_hdhomerun_trace_dump(PyObject *module, PyObject *args, PyObject *kwds) {
+    char *filename = NULL;
+    char *kwlist[] = {"filename", NULL};
+    struct trace_file_header header;
+    struct trace_record *records;
+    size_t count = 0;
+    int fd, err = 0;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &filename))
+        return NULL;
+
+    records = malloc(TRACE_RING_SIZE * sizeof(*records));
+    if(!records)
+        return PyErr_NoMemory();
+    Py_BEGIN_ALLOW_THREADS
+    count = trace_snapshot(records);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_FILE_MAGIC, 8);
+    header.record_size = sizeof(struct trace_record);
+    header.count = (uint32_t)count;
+    header.monotonic_ns = monotonic_ns();
+    header.wallclock_ns = trace_wallclock_ns();
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        err = errno;
+    } else {
+        err = write_all(fd, (const uint8_t *)&header, sizeof(header));
+        if(!err)
+            err = write_all(fd, (const uint8_t *)records, count * sizeof(*records));
+        if(close(fd) != 0 && !err)
+            err = errno;
+    }
+    Py_END_ALLOW_THREADS
+    free(records);
+    if(err) {
+        errno = err;
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, filename);
+    }
+    return PyInt_FromSize_t(count);
+}
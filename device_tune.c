@@ -0,0 +1,167 @@
+/*
+ * device_tune.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+#define TUNE_MAX_OPS 6
+
+static double elapsed_ms(uint64_t from_ns, uint64_t to_ns) {
+    return (double)(to_ns - from_ns) / 1000000.0;
+}
+
+const char Device_DOC_tune[] =
+    "Change channel in one operation.\n\n"
+    "The channelmap, channel or vchannel, program, filter and target settings\n"
+    "which are given are written to the device back to back and acknowledged\n"
+    "together, then (if wait_lock is True) the tuner is waited on for lock.  The\n"
+    "GIL is released throughout.  Returns a dict holding the final tuner status\n"
+    "(None if wait_lock is False) and the milliseconds at which each phase\n"
+    "completed.";
+PyObject *py_device_tune(py_device_object *self, PyObject *args, PyObject *kwds) {
+    char *channel = NULL, *vchannel = NULL, *channelmap = NULL;
+    char *program = NULL, *filter = NULL, *target = NULL;
+    PyObject *wait_obj = NULL;
+    unsigned int timeout_ms = self->control_timeout_ms ? self->control_timeout_ms : CONTROL_DEFAULT_TIMEOUT_MS;
+    char *kwlist[] = {"channel", "vchannel", "channelmap", "program", "filter", "target", "wait_lock", "timeout_ms", NULL};
+    struct control_op ops[TUNE_MAX_OPS];
+    const char *phases[TUNE_MAX_OPS];
+    char names[TUNE_MAX_OPS][32];
+    struct hdhomerun_tuner_status_t status;
+    struct hdhomerun_device_t *hd;
+    unsigned int tuner;
+    uint32_t device_ip;
+    uint64_t start_ns, written_ns = 0, lock_ns = 0;
+    size_t count = 0, i;
+    int wait_lock = 1;
+    int success, lock_success = 1;
+    PyObject *rv, *timings, *dv;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|zzzzzzO!I", kwlist, &channel, &vchannel, &channelmap,
+                                    &program, &filter, &target, &PyBool_Type, &wait_obj, &timeout_ms))
+        return NULL;
+    if(wait_obj)
+        wait_lock = (wait_obj == Py_True);
+    if(channel && vchannel) {
+        PyErr_SetString(PyExc_ValueError, "channel and vchannel are mutually exclusive");
+        return NULL;
+    }
+
+    tuner = device_tuner(self);
+    memset(ops, 0, sizeof(ops));
+
+#define TUNE_ADD(var) \
+    if(var) { \
+        snprintf(names[count], sizeof(names[count]), "/tuner%u/" #var, tuner); \
+        ops[count].name = names[count]; \
+        ops[count].value = var; \
+        phases[count] = #var; \
+        count++; \
+    }
+
+    /* The order matters: the channel is interpreted through the channel map */
+    TUNE_ADD(channelmap)
+    TUNE_ADD(channel)
+    TUNE_ADD(vchannel)
+    TUNE_ADD(program)
+    TUNE_ADD(filter)
+    TUNE_ADD(target)
+#undef TUNE_ADD
+
+    hd = device_hd_acquire(self);
+    device_ip = hdhomerun_device_get_device_ip(hd);
+    start_ns = monotonic_ns();
+
+    Py_BEGIN_ALLOW_THREADS
+    success = 1;
+    if(count > 0)
+        success = control_pipe_execute(device_pipe(self), device_ip, self->lockkey, ops, count, timeout_ms);
+    written_ns = monotonic_ns();
+    for(i = 0; i < count && success == 1; i++) {
+        if(ops[i].result != 1)
+            success = 0;
+    }
+    if(success == 1 && wait_lock) {
+        lock_success = hdhomerun_device_wait_for_lock(hd, &status);
+        lock_ns = monotonic_ns();
+    }
+    device_hd_release(self);
+    Py_END_ALLOW_THREADS
+
+    /* Even a failed request may have written some of the items */
+    for(i = 0; i < count; i++)
+        var_cache_invalidate(device_var_cache(self), names[i]);
+
+    if(success == -1) {
+        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+        return NULL;
+    } else if(success == -2) {
+        PyErr_SetString(hdhomerun_timeout_error, DEVICE_ERR_TIMEOUT);
+        return NULL;
+    } else if(success == 0) {
+        for(i = 0; i < count; i++) {
+            if(ops[i].result != 1)
+                break;
+        }
+        PyErr_Format(hdhomerun_device_error, "%s: %s", ops[i].name, ops[i].reply[0] ? ops[i].reply : DEVICE_ERR_REJECTED_OP);
+        return NULL;
+    }
+
+    if(lock_success == -1) {
+        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+        return NULL;
+    } else if(lock_success == 0) {
+        PyErr_SetString(hdhomerun_device_error, "the device did not report lock status");
+        return NULL;
+    } else if(lock_success != 1) {
+        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
+        return NULL;
+    }
+
+    timings = PyDict_New();
+    if(!timings) return NULL;
+    for(i = 0; i < count; i++) {
+        dv = PyFloat_FromDouble(elapsed_ms(start_ns, ops[i].done_ns));
+        if(!dv) { Py_DECREF(timings); return NULL; }
+        if(PyDict_SetItemString(timings, phases[i], dv) != 0) { Py_DECREF(dv); Py_DECREF(timings); return NULL; }
+        Py_DECREF(dv);
+    }
+    if(wait_lock) {
+        dv = PyFloat_FromDouble(elapsed_ms(written_ns, lock_ns));
+        if(!dv) { Py_DECREF(timings); return NULL; }
+        if(PyDict_SetItemString(timings, "lock", dv) != 0) { Py_DECREF(dv); Py_DECREF(timings); return NULL; }
+        Py_DECREF(dv);
+    }
+    dv = PyFloat_FromDouble(elapsed_ms(start_ns, wait_lock ? lock_ns : written_ns));
+    if(!dv) { Py_DECREF(timings); return NULL; }
+    if(PyDict_SetItemString(timings, "total", dv) != 0) { Py_DECREF(dv); Py_DECREF(timings); return NULL; }
+    Py_DECREF(dv);
+
+    if(wait_lock) {
+        dv = build_tuner_status_dict(&status);
+        if(!dv) { Py_DECREF(timings); return NULL; }
+    } else {
+        Py_INCREF(Py_None);
+        dv = Py_None;
+    }
+
+    rv = Py_BuildValue("{s:N,s:N}", "status", dv, "timings", timings);
+    return rv;
+}
@@ -25,22 +25,50 @@ PyDoc_STRVAR(hdhomerun_module_doc,
     "Python bindings for the SiliconDust hdhomerun library");
 
 PyObject *hdhomerun_device_error = NULL;
+PyObject *hdhomerun_timeout_error = NULL;
 
 int py_device_init(py_device_object *self, PyObject *args, PyObject *kwds) {
     unsigned int device_id = HDHOMERUN_DEVICE_ID_WILDCARD;
     unsigned int device_ip = 0;
     unsigned int tuner = 0;
-    char *kwlist[] = {"device_ip", "device_id", "tuner", NULL};
+    PyObject *connection = NULL;
+    char *kwlist[] = {"device_ip", "device_id", "tuner", "connection", NULL};
     int success;
 
-    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|III", kwlist, &device_ip, &device_id, &tuner))
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|IIIO!", kwlist, &device_ip, &device_id, &tuner,
+                                    &hdhomerun_Connection_type, &connection))
         return -1;
 
-    if(device_ip == 0 && device_id == HDHOMERUN_DEVICE_ID_WILDCARD) {
+    if(!connection && device_ip == 0 && device_id == HDHOMERUN_DEVICE_ID_WILDCARD) {
         PyErr_SetString(hdhomerun_device_error, "Insufficient information provided to initialize instance");
         return -1;
     }
 
+    control_pipe_init(&self->pipe);
+    stream_stages_init(&self->stages);
+    if(var_cache_init(&self->vcache) != 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->locked = 0;
+    self->lockkey = 0;
+    self->rx = NULL;
+    self->stream_group = NULL;
+    self->watchdog = NULL;
+    device_reservation_init(&self->reservation);
+    self->generation = fork_generation_current();
+
+    if(connection) {
+        /* The shared handle is only pointed at our tuner when we use it */
+        if(device_connection_attach(self, connection, tuner) != 0)
+            return -1;
+        if(hdhomerun_device_set_tuner(device_hd(self), tuner) != 1) {
+            PyErr_SetString(hdhomerun_device_error, "failed to set tuner number");
+            return -1;
+        }
+        return 0;
+    }
+
     self->hd = hdhomerun_device_create(device_id, device_ip, 0, NULL);
     if(!self->hd) {
         PyErr_SetString(hdhomerun_device_error, "Failed to initialize Device object");
@@ -57,18 +85,31 @@ int py_device_init(py_device_object *self, PyObject *args, PyObject *kwds) {
         PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
         return -1;
     }
-    self->locked = 0;
     return 0;
 }
 
 void py_device_dealloc(py_device_object *self) {
+    device_fork_check(self);
     if(self->locked != 0) {
         /* Try to unlock the tuner, ignore errors */
-        hdhomerun_device_tuner_lockkey_release(self->hd);
+        hdhomerun_device_tuner_lockkey_release(device_hd(self));
         self->locked = 0;
     }
-    hdhomerun_device_destroy(self->hd);
+    device_watchdog_stop(self);
+    if(self->rx) {
+        stream_rx_destroy(self->rx);
+        self->rx = NULL;
+        py_stream_group_leave(self);
+    }
+    if(self->conn)
+        device_connection_detach(self);
+    else
+        hdhomerun_device_destroy(self->hd);
     self->hd = NULL;
+    var_cache_free(&self->vcache);
+    control_pipe_release(&self->pipe);
+    stream_stages_destroy(&self->stages);
+    device_reservation_destroy(&self->reservation);
     self->ob_type->tp_free((PyObject*)self);
 }
 
@@ -81,18 +122,21 @@ uint32_t parse_ip_addr(const char *str) {
 }
 
 PyDoc_STRVAR(Device_DOC_discover,
-    "Locates all HDHomeRun(s) on your network and returns a list of Device objects.");
+    "Locates all HDHomeRun(s) on your network and returns a list of Device objects.\n\n"
+    "With info=True the list holds DeviceInfo records instead, which carry the\n"
+    "ID, IP, type and tuner count without opening a libhdhomerun handle.");
 
 PyObject *py_device_discover(PyObject *cls, PyObject *args, PyObject *kwds) {
     PyObject *result = NULL;
     PyObject *tuner = NULL;
+    PyObject *info_obj = NULL;
     char *target_ip_str = NULL;
     uint32_t target_ip = 0;
     int count = 0, i;
-    char *kwlist[] = {"target_ip", NULL};
+    char *kwlist[] = {"target_ip", "info", NULL};
     struct hdhomerun_discover_device_t result_list[64];
 
-    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|s", kwlist, &target_ip_str))
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|zO!", kwlist, &target_ip_str, &PyBool_Type, &info_obj))
         return NULL;
 
     if(target_ip_str) {
@@ -117,7 +161,10 @@ PyObject *py_device_discover(PyObject *cls, PyObject *args, PyObject *kwds) {
 
     if(count > 0) {
         for(i=0; i<count; i++) {
-            tuner = PyObject_CallFunction(cls, "II", result_list[i].ip_addr, result_list[i].device_id);
+            if(info_obj == Py_True)
+                tuner = device_info_from_discover(&result_list[i]);
+            else
+                tuner = PyObject_CallFunction(cls, "II", result_list[i].ip_addr, result_list[i].device_id);
             if(tuner == NULL) { Py_DECREF(result); return NULL; }
             if(PyList_SetItem(result, i, tuner) != 0) { Py_DECREF(result); return NULL; }
         }
@@ -152,9 +199,12 @@ PyObject *py_device_upgrade(py_device_object *self, PyObject *args, PyObject *kw
         PyErr_SetString(PyExc_IOError, "unable to open firmware file");
         return NULL;
     }
-    success = hdhomerun_device_upgrade(self->hd, fp);
+    success = hdhomerun_device_upgrade(device_hd(self), fp);
     fclose(fp);
     fp = NULL;
+    /* Even a failed upload may have left the device running something else */
+    capability_forget_version(hdhomerun_device_get_device_id(device_hd(self)));
+    var_cache_clear(device_var_cache(self));
     if(success == -1) {
         PyErr_SetString(hdhomerun_device_error, "error sending upgrade file to hdhomerun device");
         return NULL;
@@ -167,7 +217,7 @@ PyObject *py_device_upgrade(py_device_object *self, PyObject *args, PyObject *kw
         /* Wait for the device to come back online */
         msleep_minimum(10000);
         while (1) {
-            if(hdhomerun_device_get_version(self->hd, &version_str, NULL) >= 0)
+            if(hdhomerun_device_get_version(device_hd(self), &version_str, NULL) >= 0)
                 break;
             count++;
             if (count > 30) {
@@ -185,9 +235,23 @@ PyDoc_STRVAR(Device_DOC_tuner_lockkey_request,
 
 PyObject *py_device_tuner_lockkey_request(py_device_object *self) {
     char *ret_error = "the device rejected the lock request";
+    char item[32], value[16];
+    uint32_t lockkey;
+    uint64_t start_ns;
     int success;
 
-    success = hdhomerun_device_tuner_lockkey_request(self->hd, &ret_error);
+    /*
+     *  Equivalent to hdhomerun_device_tuner_lockkey_request(), except that the
+     *  key is chosen here so that the pipelined control path can present it.
+     */
+    do {
+        lockkey = random_get32();
+    } while(lockkey == 0);
+    snprintf(item, sizeof(item), "/tuner%u/lockkey", hdhomerun_device_get_tuner(device_hd(self)));
+    snprintf(value, sizeof(value), "%u", (unsigned int)lockkey);
+    start_ns = monotonic_ns();
+    success = hdhomerun_device_set_var(device_hd(self), item, value, NULL, &ret_error);
+    trace_device(self, TRACE_LOCKKEY_REQUEST, item, success, monotonic_ns() - start_ns);
 
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
@@ -196,6 +260,8 @@ PyObject *py_device_tuner_lockkey_request(py_device_object *self) {
         PyErr_SetString(hdhomerun_device_error, ret_error);
         return NULL;
     } else if(success == 1) {
+        hdhomerun_device_tuner_lockkey_use_value(device_hd(self), lockkey);
+        self->lockkey = lockkey;
         self->locked = 1;
     } else {
         PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
@@ -208,9 +274,11 @@ PyDoc_STRVAR(Device_DOC_tuner_lockkey_force,
     "Locks a tuner.");
 
 PyObject *py_device_tuner_lockkey_force(py_device_object *self) {
+    uint64_t start_ns = monotonic_ns();
     int success;
 
-    success = hdhomerun_device_tuner_lockkey_force(self->hd);
+    success = hdhomerun_device_tuner_lockkey_force(device_hd(self));
+    trace_device(self, TRACE_LOCKKEY_FORCE, "lockkey", success, monotonic_ns() - start_ns);
 
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
@@ -219,6 +287,8 @@ PyObject *py_device_tuner_lockkey_force(py_device_object *self) {
         PyErr_SetString(hdhomerun_device_error, "the device rejected the forced lock request");
         return NULL;
     } else if(success == 1) {
+        /* libhdhomerun forgets its key after a forced lock */
+        self->lockkey = 0;
         self->locked = 1;
     } else {
         PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
@@ -231,9 +301,11 @@ PyDoc_STRVAR(Device_DOC_tuner_lockkey_release,
     "Unlocks a tuner.");
 
 PyObject *py_device_tuner_lockkey_release(py_device_object *self) {
+    uint64_t start_ns = monotonic_ns();
     int success;
 
-    success = hdhomerun_device_tuner_lockkey_release(self->hd);
+    success = hdhomerun_device_tuner_lockkey_release(device_hd(self));
+    trace_device(self, TRACE_LOCKKEY_RELEASE, "lockkey", success, monotonic_ns() - start_ns);
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
         return NULL;
@@ -241,6 +313,7 @@ PyObject *py_device_tuner_lockkey_release(py_device_object *self) {
         PyErr_SetString(hdhomerun_device_error, "the device rejected the unlock request");
         return NULL;
     } else if(success == 1) {
+        self->lockkey = 0;
         self->locked = 0;
     } else {
         PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
@@ -250,12 +323,150 @@ PyObject *py_device_tuner_lockkey_release(py_device_object *self) {
 }
 
 PyDoc_STRVAR(Device_DOC_stream_start,
-    "Tell the device to start streaming data.");
+    "Tell the device to start streaming data.\n\n"
+    "By default the stream is received by libhdhomerun.  Setting any of the\n"
+    "receiver options (a non-zero size or count, True for a flag, a group or a\n"
+    "replay file) switches to a native receiver which reads up to batch\n"
+    "datagrams per system call into a ring of buffer_size bytes.  The ring can\n"
+    "be backed by huge pages and/or locked into memory, and the socket's\n"
+    "receive buffer (rcvbuf, bytes) and busy polling (busy_poll, microseconds)\n"
+    "can be tuned.  Options the system refuses fall back silently;\n"
+    "get_stream_stats() reports what was obtained.  timestamps=True records\n"
+    "the kernel arrival time of every datagram for jitter analysis.  With\n"
+    "group=StreamGroup the socket is serviced by the group's threads rather\n"
+    "than a thread of its own.\n\n"
+    "replay=path plays a captured .ts file into the native receiver instead\n"
+    "of asking the device to stream, so the stages and stream_recv() can be\n"
+    "exercised without a tuner.  Datagrams are released at speed times real\n"
+    "time as given by the PCR, or as fast as they are consumed with speed=0.\n"
+    "loss drops each datagram with that probability and jitter delays each by\n"
+    "up to that many microseconds, both drawn from seed so runs repeat; with\n"
+    "loop=True the file restarts at its end.");
+
+/* Internal: lets the metrics exporter see the receiver's counters */
+static void device_stream_export(py_device_object *self) {
+    char labels[EXPORTER_LABELS_MAX];
+    uint32_t device_id, device_ip;
+    unsigned int tuner;
 
-PyObject *py_device_stream_start(py_device_object *self) {
-    int success;
+    device_identity(self, &device_ip, &device_id, &tuner);
+    snprintf(labels, sizeof(labels), "device=\"%08X\",tuner=\"%u\"", device_id, tuner);
+    stream_rx_export(self->rx, labels);
+}
 
-    success = hdhomerun_device_stream_start(self->hd);
+/* Internal: drops the native receiver once nothing running without the GIL (tune, measure_zap) uses it */
+static void device_stream_destroy(py_device_object *self) {
+    struct stream_rx *rx;
+
+    device_hd_acquire(self);
+    rx = self->rx;
+    self->rx = NULL;
+    if(rx) {
+        Py_BEGIN_ALLOW_THREADS
+        stream_rx_destroy(rx);
+        Py_END_ALLOW_THREADS
+        py_stream_group_leave(self);
+    }
+    device_hd_release(self);
+}
+
+PyObject *py_device_stream_start(py_device_object *self, PyObject *args, PyObject *kwds) {
+    struct stream_rx_config config;
+    PyObject *hugepages_obj = NULL, *mlock_obj = NULL;
+    unsigned int buffer_size = 0, batch = 0;
+    PyObject *timestamps_obj = NULL, *group_obj = NULL;
+    int rcvbuf = 0, busy_poll = 0;
+    struct stream_replay_config replay;
+    PyObject *loop_obj = NULL;
+    char *kwlist[] = {"buffer_size", "hugepages", "mlock", "batch", "rcvbuf", "busy_poll", "timestamps", "group",
+                      "replay", "speed", "loss", "jitter", "loop", "seed", NULL};
+    char target[64];
+    uint32_t local_ip;
+    int success, native;
+
+    memset(&replay, 0, sizeof(replay));
+    replay.speed = 1.0;
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|IO!O!IiiO!O!zddIO!K", kwlist, &buffer_size, &PyBool_Type, &hugepages_obj,
+                                    &PyBool_Type, &mlock_obj, &batch, &rcvbuf, &busy_poll,
+                                    &PyBool_Type, &timestamps_obj, &hdhomerun_StreamGroup_type, &group_obj,
+                                    &replay.path, &replay.speed, &replay.loss, &replay.jitter_us,
+                                    &PyBool_Type, &loop_obj, &replay.seed))
+        return NULL;
+    replay.loop = (loop_obj == Py_True);
+    if(replay.path && (group_obj || timestamps_obj == Py_True)) {
+        PyErr_SetString(PyExc_ValueError, "group and timestamps do not apply to replay");
+        return NULL;
+    }
+    if(replay.speed < 0.0 || replay.loss < 0.0 || replay.loss > 1.0) {
+        PyErr_SetString(PyExc_ValueError, "speed must not be negative and loss must be between 0 and 1");
+        return NULL;
+    }
+
+    device_fork_check(self);
+    device_watchdog_stop(self);
+    device_stream_destroy(self);
+
+    /*
+     *  Whether an option was passed does not matter, only whether it asks for
+     *  something libhdhomerun cannot do.  libhdhomerun keeps one video socket
+     *  per handle, so shared handles always use the native receiver.
+     */
+    native = self->conn || buffer_size || hugepages_obj == Py_True || mlock_obj == Py_True || batch ||
+             rcvbuf || busy_poll || timestamps_obj == Py_True || group_obj || replay.path;
+    if(!native) {
+        success = hdhomerun_device_stream_start(device_hd(self));
+    } else {
+        config.buffer_size = buffer_size ? buffer_size : VIDEO_DATA_BUFFER_SIZE_1S * 2;
+        config.hugepages = (hugepages_obj == Py_True);
+        config.mlock = (mlock_obj == Py_True);
+        config.batch = batch ? batch : 64;
+        config.rcvbuf = rcvbuf;
+        config.busy_poll_us = busy_poll;
+        config.timestamps = (timestamps_obj == Py_True);
+        config.stages = &self->stages;
+        config.group = NULL;
+        config.replay = NULL;
+        if(replay.path) {
+            /* Played back locally; the device is not involved */
+            config.replay = &replay;
+            self->rx = stream_rx_create(&config);
+            if(!self->rx)
+                return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)replay.path);
+            device_stream_export(self);
+            self->empty_recvs = 0;
+            trace_device(self, TRACE_STREAM_START, "replay", 1, 0);
+            Py_RETURN_NONE;
+        }
+        if(group_obj) {
+            config.group = py_stream_group_join(group_obj, self);
+            if(!config.group)
+                return NULL;
+        }
+        local_ip = hdhomerun_device_get_local_machine_addr(device_hd(self));
+        if(local_ip == 0) {
+            py_stream_group_leave(self);
+            PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+            return NULL;
+        }
+        self->rx = stream_rx_create(&config);
+        if(!self->rx) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            py_stream_group_leave(self);
+            return NULL;
+        }
+        snprintf(target, sizeof(target), "udp://%u.%u.%u.%u:%u",
+                 (unsigned int)(local_ip >> 24) & 0xFF, (unsigned int)(local_ip >> 16) & 0xFF,
+                 (unsigned int)(local_ip >> 8) & 0xFF, (unsigned int)(local_ip >> 0) & 0xFF,
+                 (unsigned int)self->rx->port);
+        success = hdhomerun_device_set_tuner_target(device_hd(self), target);
+        if(success != 1) {
+            device_stream_destroy(self);
+        } else {
+            device_stream_export(self);
+        }
+    }
+    self->empty_recvs = 0;
+    trace_device(self, TRACE_STREAM_START, self->rx ? target : "libhdhomerun", success, 0);
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
         return NULL;
@@ -270,7 +481,8 @@ PyObject *py_device_stream_start(py_device_object *self) {
 }
 
 PyDoc_STRVAR(Device_DOC_stream_recv,
-    "Receive stream data.");
+    "Receive stream data.  max_size is rounded down to whole 1316 byte\n"
+    "datagrams, so it must be at least that large.");
 
 PyObject *py_device_stream_recv(py_device_object *self, PyObject *args, PyObject *kwds) {
     uint8_t *ptr;
@@ -280,8 +492,13 @@ PyObject *py_device_stream_recv(py_device_object *self, PyObject *args, PyObject
 
     if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &max_size))
         return NULL;
+    if(max_size < VIDEO_DATA_PACKET_SIZE) {
+        PyErr_Format(PyExc_ValueError, "max_size must be at least %d", VIDEO_DATA_PACKET_SIZE);
+        return NULL;
+    }
 
-    ptr = hdhomerun_device_stream_recv(self->hd, (size_t)max_size, &actual_size);
+    device_fork_check(self);
+    ptr = device_stream_recv(self, (size_t)max_size, &actual_size);
     if(!ptr) {
         Py_RETURN_NONE;
     }
@@ -293,7 +510,8 @@ PyDoc_STRVAR(Device_DOC_stream_flush,
     "Undocumented.");
 
 PyObject *py_device_stream_flush(py_device_object *self) {
-    hdhomerun_device_stream_flush(self->hd);
+    device_fork_check(self);
+    device_stream_flush(self);
     Py_RETURN_NONE;
 }
 
@@ -301,10 +519,130 @@ PyDoc_STRVAR(Device_DOC_stream_stop,
     "Tell the device to stop streaming data.");
 
 PyObject *py_device_stream_stop(py_device_object *self) {
-    hdhomerun_device_stream_stop(self->hd);
+    device_fork_check(self);
+    device_watchdog_stop(self);
+    if(self->rx) {
+        /* Ignore errors, as hdhomerun_device_stream_stop does */
+        if(!self->rx->replay)
+            hdhomerun_device_set_tuner_target(device_hd(self), "none");
+        device_stream_destroy(self);
+    } else {
+        hdhomerun_device_stream_stop(device_hd(self));
+    }
+    trace_device(self, TRACE_STREAM_STOP, NULL, 1, 0);
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(Device_DOC_get_stream_stats,
+    "Return receive statistics for the current stream.  With the native\n"
+    "receiver these include the buffer size, its current occupancy and the\n"
+    "high-water mark in bytes (reset=True restarts the high-water mark from\n"
+    "the current occupancy), the number of receive system calls made, and\n"
+    "counts of packets with a bad sync byte, the transport error indicator set\n"
+    "or a scrambled payload.\n\n"
+    "If the stream was started with timestamps=True, 'timing' holds the\n"
+    "inter-arrival jitter estimate and log2 histograms (bucket i counts values\n"
+    "from 2**i up to 2**(i+1)) of inter-arrival times, burst sizes, gaps\n"
+    "between bursts and kernel-to-receiver latency.  reset=True also clears\n"
+    "the histograms.  For replay, 'replay' holds the injected losses, the\n"
+    "number of times the file looped and whether playback has finished.");
+
+static PyObject *build_histogram(const unsigned long long *buckets) {
+    PyObject *rv, *dv;
+    int i, last = -1;
+
+    /* Trailing empty buckets are omitted */
+    for(i = 0; i < STREAM_RX_HISTOGRAM_BUCKETS; i++) {
+        if(buckets[i])
+            last = i;
+    }
+    rv = PyList_New(last + 1);
+    if(!rv)
+        return NULL;
+    for(i = 0; i <= last; i++) {
+        dv = PyLong_FromUnsignedLongLong(buckets[i]);
+        if(!dv) { Py_DECREF(rv); return NULL; }
+        PyList_SET_ITEM(rv, i, dv);
+    }
+    return rv;
+}
+
+static PyObject *build_timing_dict(const struct stream_rx_timing *timing) {
+    return Py_BuildValue("{s:d,s:d,s:K,s:N,s:N,s:N,s:N}",
+                         "jitter_us", timing->jitter_ns / 1000.0,
+                         "max_gap_us", (double)timing->max_gap_ns / 1000.0,
+                         "missing", timing->missing,
+                         "interarrival_us", build_histogram(timing->interarrival),
+                         "burst_packets", build_histogram(timing->bursts),
+                         "gap_us", build_histogram(timing->gaps),
+                         "latency_us", build_histogram(timing->latency));
+}
+
+PyObject *py_device_get_stream_stats(py_device_object *self, PyObject *args, PyObject *kwds) {
+    struct hdhomerun_video_stats_t video_stats;
+    struct stream_rx_stats stats;
+    PyObject *reset_obj = NULL, *timing, *replay;
+    char *kwlist[] = {"reset", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|O!", kwlist, &PyBool_Type, &reset_obj))
+        return NULL;
+
+    if(!self->rx) {
+        hdhomerun_device_get_video_stats(device_hd(self), &video_stats);
+        return Py_BuildValue("{s:s,s:I,s:I,s:I,s:I,s:I}",
+                             "receiver", "library",
+                             "packets", video_stats.packet_count,
+                             "network_errors", video_stats.network_error_count,
+                             "transport_errors", video_stats.transport_error_count,
+                             "sequence_errors", video_stats.sequence_error_count,
+                             "overflow_errors", video_stats.overflow_error_count);
+    }
+
+    stream_rx_get_stats(self->rx, &stats, reset_obj == Py_True);
+    if(stats.timing.enabled) {
+        timing = build_timing_dict(&stats.timing);
+        if(!timing)
+            return NULL;
+    } else {
+        Py_INCREF(Py_None);
+        timing = Py_None;
+    }
+    if(stats.replay) {
+        replay = Py_BuildValue("{s:K,s:k,s:O}",
+                               "dropped", stats.replay_dropped,
+                               "loops", stats.replay_loops,
+                               "finished", stats.replay_finished ? Py_True : Py_False);
+        if(!replay) {
+            Py_DECREF(timing);
+            return NULL;
+        }
+    } else {
+        Py_INCREF(Py_None);
+        replay = Py_None;
+    }
+    return Py_BuildValue("{s:s,s:n,s:n,s:n,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:d,s:I,s:i,s:i,s:O,s:O,s:N,s:N}",
+                         "receiver", stats.replay ? "replay" : self->rx->group ? "group" : "native",
+                         "buffer_size", (Py_ssize_t)stats.buffer_size,
+                         "occupancy", (Py_ssize_t)stats.occupancy,
+                         "high_water", (Py_ssize_t)stats.high_water,
+                         "packets", stats.packets,
+                         "bytes", stats.bytes,
+                         "network_errors", stats.network_errors,
+                         "overflow_errors", stats.overflow_packets,
+                         "sync_errors", stats.scan.sync_errors,
+                         "transport_errors", stats.scan.transport_errors,
+                         "scrambled", stats.scan.scrambled,
+                         "syscalls", stats.syscalls,
+                         "packets_per_syscall", stats.syscalls ? (double)stats.packets / (double)stats.syscalls : 0.0,
+                         "batch", stats.batch,
+                         "rcvbuf", stats.rcvbuf,
+                         "busy_poll", stats.busy_poll_us,
+                         "hugepages", stats.hugepages ? Py_True : Py_False,
+                         "mlock", stats.locked ? Py_True : Py_False,
+                         "timing", timing,
+                         "replay", replay);
+}
+
 PyDoc_STRVAR(Device_DOC_wait_for_lock,
     "Wait for tuner lock after channel change.");
 
@@ -312,7 +650,7 @@ PyObject *py_device_wait_for_lock(py_device_object *self) {
     int success;
     struct hdhomerun_tuner_status_t status;
 
-    success = hdhomerun_device_wait_for_lock(self->hd, &status);
+    success = hdhomerun_device_wait_for_lock(device_hd(self), &status);
     if(success == -1) {
         PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
         return NULL;
@@ -344,22 +682,31 @@ PyMethodDef py_device_methods[] = {
     {"get_device_ip_requested", (PyCFunction)py_device_get_device_ip_requested, METH_NOARGS,                Device_DOC_get_device_ip_requested},
     {"get_tuner",               (PyCFunction)py_device_get_tuner,               METH_NOARGS,                Device_DOC_get_tuner},
     {"get_var",                 (PyCFunction)py_device_get_var,                 METH_KEYWORDS,              Device_DOC_get_var},
-    {"get_tuner_status",        (PyCFunction)py_device_get_tuner_status,        METH_NOARGS,                Device_DOC_get_tuner_status},
-    {"get_tuner_vstatus",       (PyCFunction)py_device_get_tuner_vstatus,       METH_NOARGS,                Device_DOC_get_tuner_vstatus},
-    {"get_tuner_streaminfo",    (PyCFunction)py_device_get_tuner_streaminfo,    METH_NOARGS,                Device_DOC_get_tuner_streaminfo},
-    {"get_tuner_channel",       (PyCFunction)py_device_get_tuner_channel,       METH_NOARGS,                Device_DOC_get_tuner_channel},
-    {"get_tuner_vchannel",      (PyCFunction)py_device_get_tuner_vchannel,      METH_NOARGS,                Device_DOC_get_tuner_vchannel},
-    {"get_tuner_channelmap",    (PyCFunction)py_device_get_tuner_channelmap,    METH_NOARGS,                Device_DOC_get_tuner_channelmap},
-    {"get_tuner_filter",        (PyCFunction)py_device_get_tuner_filter,        METH_NOARGS,                Device_DOC_get_tuner_filter},
-    {"get_tuner_program",       (PyCFunction)py_device_get_tuner_program,       METH_NOARGS,                Device_DOC_get_tuner_program},
-    {"get_tuner_target",        (PyCFunction)py_device_get_tuner_target,        METH_NOARGS,                Device_DOC_get_tuner_target},
-    {"get_tuner_plotsample",    (PyCFunction)py_device_get_tuner_plotsample,    METH_NOARGS,                Device_DOC_get_tuner_plotsample},
-    {"get_tuner_lockkey_owner", (PyCFunction)py_device_get_tuner_lockkey_owner, METH_NOARGS,                Device_DOC_get_tuner_lockkey_owner},
-    {"get_oob_status",          (PyCFunction)py_device_get_oob_status,          METH_NOARGS,                Device_DOC_get_oob_status},
-    {"get_oob_plotsample",      (PyCFunction)py_device_get_oob_plotsample,      METH_NOARGS,                Device_DOC_get_oob_plotsample},
-    {"get_ir_target",           (PyCFunction)py_device_get_ir_target,           METH_NOARGS,                Device_DOC_get_ir_target},
-    {"get_version",             (PyCFunction)py_device_get_version,             METH_NOARGS,                Device_DOC_get_version},
+    {"get_tuner_status",        (PyCFunction)py_device_get_tuner_status,        METH_KEYWORDS,              Device_DOC_get_tuner_status},
+    {"get_tuner_vstatus",       (PyCFunction)py_device_get_tuner_vstatus,       METH_KEYWORDS,              Device_DOC_get_tuner_vstatus},
+    {"get_tuner_streaminfo",    (PyCFunction)py_device_get_tuner_streaminfo,    METH_KEYWORDS,              Device_DOC_get_tuner_streaminfo},
+    {"get_tuner_channel",       (PyCFunction)py_device_get_tuner_channel,       METH_KEYWORDS,              Device_DOC_get_tuner_channel},
+    {"get_tuner_vchannel",      (PyCFunction)py_device_get_tuner_vchannel,      METH_KEYWORDS,              Device_DOC_get_tuner_vchannel},
+    {"get_tuner_channelmap",    (PyCFunction)py_device_get_tuner_channelmap,    METH_KEYWORDS,              Device_DOC_get_tuner_channelmap},
+    {"get_tuner_filter",        (PyCFunction)py_device_get_tuner_filter,        METH_KEYWORDS,              Device_DOC_get_tuner_filter},
+    {"get_tuner_program",       (PyCFunction)py_device_get_tuner_program,       METH_KEYWORDS,              Device_DOC_get_tuner_program},
+    {"get_tuner_target",        (PyCFunction)py_device_get_tuner_target,        METH_KEYWORDS,              Device_DOC_get_tuner_target},
+    {"get_tuner_plotsample",    (PyCFunction)py_device_get_tuner_plotsample,    METH_KEYWORDS,              Device_DOC_get_tuner_plotsample},
+    {"get_tuner_lockkey_owner", (PyCFunction)py_device_get_tuner_lockkey_owner, METH_KEYWORDS,              Device_DOC_get_tuner_lockkey_owner},
+    {"get_oob_status",          (PyCFunction)py_device_get_oob_status,          METH_KEYWORDS,              Device_DOC_get_oob_status},
+    {"get_oob_plotsample",      (PyCFunction)py_device_get_oob_plotsample,      METH_KEYWORDS,              Device_DOC_get_oob_plotsample},
+    {"get_ir_target",           (PyCFunction)py_device_get_ir_target,           METH_KEYWORDS,              Device_DOC_get_ir_target},
+    {"get_version",             (PyCFunction)py_device_get_version,             METH_KEYWORDS,              Device_DOC_get_version},
     {"get_supported",           (PyCFunction)py_device_get_supported,           METH_KEYWORDS,              Device_DOC_get_supported},
+    /* Cached capability model, defined in device_capability.c */
+    {"get_capabilities",        (PyCFunction)py_device_get_capabilities,        METH_KEYWORDS,              Device_DOC_get_capabilities},
+    /* Control variable cache, defined in device_varcache.c */
+    {"set_var_cache_policy",    (PyCFunction)py_device_set_var_cache_policy,    METH_KEYWORDS,              Device_DOC_set_var_cache_policy},
+    {"get_var_cache_stats",     (PyCFunction)py_device_get_var_cache_stats,     METH_NOARGS,                Device_DOC_get_var_cache_stats},
+    {"clear_var_cache",         (PyCFunction)py_device_clear_var_cache,         METH_NOARGS,                Device_DOC_clear_var_cache},
+    /* Control timeouts, defined in device_control.c */
+    {"set_control_timeout",     (PyCFunction)py_device_set_control_timeout,     METH_KEYWORDS,              Device_DOC_set_control_timeout},
+    {"get_control_timeout",     (PyCFunction)py_device_get_control_timeout,     METH_NOARGS,                Device_DOC_get_control_timeout},
     /* Set operations, defined in device_set.c */
     {"set_device",              (PyCFunction)py_device_set_device,              METH_KEYWORDS,              Device_DOC_set_device},
     {"set_multicast",           (PyCFunction)py_device_set_multicast,           METH_KEYWORDS,              Device_DOC_set_multicast},
@@ -375,11 +722,27 @@ PyMethodDef py_device_methods[] = {
     {"tuner_lockkey_request",   (PyCFunction)py_device_tuner_lockkey_request,   METH_NOARGS,                Device_DOC_tuner_lockkey_request},
     {"tuner_lockkey_force",     (PyCFunction)py_device_tuner_lockkey_force,     METH_NOARGS,                Device_DOC_tuner_lockkey_force},
     {"tuner_lockkey_release",   (PyCFunction)py_device_tuner_lockkey_release,   METH_NOARGS,                Device_DOC_tuner_lockkey_release},
-    {"stream_start",            (PyCFunction)py_device_stream_start,            METH_NOARGS,                Device_DOC_stream_start},
+    {"stream_start",            (PyCFunction)py_device_stream_start,            METH_KEYWORDS,              Device_DOC_stream_start},
     {"stream_recv",             (PyCFunction)py_device_stream_recv,             METH_KEYWORDS,              Device_DOC_stream_recv},
     {"stream_flush",            (PyCFunction)py_device_stream_flush,            METH_NOARGS,                Device_DOC_stream_flush},
     {"stream_stop",             (PyCFunction)py_device_stream_stop,             METH_NOARGS,                Device_DOC_stream_stop},
+    {"get_stream_stats",        (PyCFunction)py_device_get_stream_stats,        METH_KEYWORDS,              Device_DOC_get_stream_stats},
+    {"stream_watchdog",         (PyCFunction)py_device_stream_watchdog,         METH_KEYWORDS,              Device_DOC_stream_watchdog},
     {"wait_for_lock",           (PyCFunction)py_device_wait_for_lock,           METH_NOARGS,                Device_DOC_wait_for_lock},
+    /* Pipelined channel change, defined in device_tune.c */
+    {"tune",                    (PyCFunction)py_device_tune,                    METH_KEYWORDS,              Device_DOC_tune},
+    /* Channel change profiler, defined in device_zap.c */
+    {"measure_zap",             (PyCFunction)py_device_measure_zap,             METH_KEYWORDS,              Device_DOC_measure_zap},
+    /* Background status watcher, defined in device_watch.c */
+    {"watch",                   (PyCFunction)py_device_watch,                   METH_KEYWORDS,              Device_DOC_watch},
+    /* Pickle support, defined in device_fork.c */
+    {"__reduce__",              (PyCFunction)py_device_reduce,                  METH_NOARGS,                Device_DOC_reduce},
+    {"__setstate__",            (PyCFunction)py_device_setstate,                METH_O,                     Device_DOC_setstate},
+    /* Native stream stages */
+    {"analyze_pcr",             (PyCFunction)py_device_analyze_pcr,             METH_KEYWORDS,              Device_DOC_analyze_pcr},
+    {"record",                  (PyCFunction)py_device_record,                  METH_KEYWORDS,              Device_DOC_record},
+    {"segment",                 (PyCFunction)py_device_segment,                 METH_KEYWORDS,              Device_DOC_segment},
+    {"collect_epg",             (PyCFunction)py_device_collect_epg,             METH_KEYWORDS,              Device_DOC_collect_epg},
     {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
 };
 
@@ -433,14 +796,25 @@ PyTypeObject hdhomerun_Device_type = {
     (freefunc)PyObject_Del,         /* tp_free */
 };
 
+/* Internal: the values clone() and pickling rebuild a Device from */
+void device_identity(py_device_object *self, uint32_t *pdevice_ip, uint32_t *pdevice_id, unsigned int *ptuner) {
+    struct hdhomerun_device_t *hd = device_hd(self);
+
+    *pdevice_id = hdhomerun_device_get_device_id(hd);
+    *pdevice_ip = hdhomerun_device_get_device_ip(hd);
+    *ptuner = device_tuner(self);
+}
+
 PyObject *py_device_clone(py_device_object *self) {
     PyObject *arg_list, *copied_obj;
     uint32_t device_id, device_ip;
     unsigned int tuner;
 
-    device_id = hdhomerun_device_get_device_id(self->hd);
-    device_ip = hdhomerun_device_get_device_ip(self->hd);
-    tuner = hdhomerun_device_get_tuner(self->hd);
+    device_identity(self, &device_ip, &device_id, &tuner);
+    if(self->conn) {
+        /* A clone of a shared handle shares the same connection */
+        return PyObject_CallMethod(self->connection, "open", "I", tuner);
+    }
     arg_list = Py_BuildValue("(III)", device_ip, device_id, tuner);
     if(arg_list == NULL) {
         return NULL;
@@ -450,8 +824,27 @@ PyObject *py_device_clone(py_device_object *self) {
     return copied_obj;
 }
 
-/* module methods (none for now) */
+/* module methods */
 PyMethodDef hdhomerun_methods[] = {
+    /* Capability cache persistence, defined in device_capability.c */
+    {"save_capabilities",       (PyCFunction)py_hdhomerun_save_capabilities,    METH_KEYWORDS,              hdhomerun_DOC_save_capabilities},
+    {"load_capabilities",       (PyCFunction)py_hdhomerun_load_capabilities,    METH_KEYWORDS,              hdhomerun_DOC_load_capabilities},
+    {"clear_capabilities",      (PyCFunction)py_hdhomerun_clear_capabilities,   METH_NOARGS,                hdhomerun_DOC_clear_capabilities},
+    /* Stream kernels, defined in ts_simd.c */
+    {"ts_check",                (PyCFunction)py_hdhomerun_ts_check,             METH_KEYWORDS,              hdhomerun_DOC_ts_check},
+    {"ts_find_sync",            (PyCFunction)py_hdhomerun_ts_find_sync,         METH_KEYWORDS,              hdhomerun_DOC_ts_find_sync},
+    {"ts_realign",              (PyCFunction)py_hdhomerun_ts_realign,           METH_KEYWORDS,              hdhomerun_DOC_ts_realign},
+    {"crc32_mpeg2",             (PyCFunction)py_hdhomerun_crc32_mpeg2,          METH_KEYWORDS,              hdhomerun_DOC_crc32_mpeg2},
+    {"simd_level",              (PyCFunction)py_hdhomerun_simd_level,           METH_NOARGS,                hdhomerun_DOC_simd_level},
+    /* Packet header tables, defined in ts_table.c */
+    {"parse_packets",           (PyCFunction)py_hdhomerun_parse_packets,        METH_KEYWORDS,              hdhomerun_DOC_parse_packets},
+    /* Event trace, defined in device_trace.c */
+    {"trace_events",            (PyCFunction)py_hdhomerun_trace_events,         METH_KEYWORDS,              hdhomerun_DOC_trace_events},
+    {"trace_dump",              (PyCFunction)py_hdhomerun_trace_dump,           METH_KEYWORDS,              hdhomerun_DOC_trace_dump},
+    /* Metrics exporter, defined in device_exporter.c */
+    {"start_exporter",          (PyCFunction)py_hdhomerun_start_exporter,       METH_KEYWORDS,              hdhomerun_DOC_start_exporter},
+    {"stop_exporter",           (PyCFunction)py_hdhomerun_stop_exporter,        METH_NOARGS,                hdhomerun_DOC_stop_exporter},
+    {"exporter_metrics",        (PyCFunction)py_hdhomerun_exporter_metrics,     METH_NOARGS,                hdhomerun_DOC_exporter_metrics},
     {NULL}  /* Sentinel */
 };
 
@@ -462,6 +855,15 @@ PyMODINIT_FUNC inithdhomerun(void) {
     if(!m)
         return;
 
+    /* Native worker threads call back into the interpreter */
+    PyEval_InitThreads();
+
+    /* Let go of inherited sockets and threads in a forked child */
+    fork_handlers_install();
+
+    /* Select the stream kernels for this CPU */
+    ts_simd_init();
+
     /* Finalize the Device type object */
     if (PyType_Ready(&hdhomerun_Device_type) < 0)
         return;
@@ -469,9 +871,113 @@ PyMODINIT_FUNC inithdhomerun(void) {
     if(PyModule_AddObject(m, "Device", (PyObject *)&hdhomerun_Device_type) < 0)
         return;
 
+    /* Finalize the DeviceInfo type object */
+    if (PyType_Ready(&hdhomerun_DeviceInfo_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_DeviceInfo_type);
+    if(PyModule_AddObject(m, "DeviceInfo", (PyObject *)&hdhomerun_DeviceInfo_type) < 0)
+        return;
+
+    /* Finalize the Connection type object */
+    if (PyType_Ready(&hdhomerun_Connection_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_Connection_type);
+    if(PyModule_AddObject(m, "Connection", (PyObject *)&hdhomerun_Connection_type) < 0)
+        return;
+
+    /* Finalize the Watcher type object */
+    if (PyType_Ready(&hdhomerun_Watcher_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_Watcher_type);
+    if(PyModule_AddObject(m, "Watcher", (PyObject *)&hdhomerun_Watcher_type) < 0)
+        return;
+
+    /* Finalize the FastZap type object */
+    if (PyType_Ready(&hdhomerun_FastZap_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_FastZap_type);
+    if(PyModule_AddObject(m, "FastZap", (PyObject *)&hdhomerun_FastZap_type) < 0)
+        return;
+
+    /* Finalize the PcrAnalyzer type object */
+    if (PyType_Ready(&hdhomerun_PcrAnalyzer_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_PcrAnalyzer_type);
+    if(PyModule_AddObject(m, "PcrAnalyzer", (PyObject *)&hdhomerun_PcrAnalyzer_type) < 0)
+        return;
+
+    /* Finalize the StreamGroup type object */
+    if (PyType_Ready(&hdhomerun_StreamGroup_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_StreamGroup_type);
+    if(PyModule_AddObject(m, "StreamGroup", (PyObject *)&hdhomerun_StreamGroup_type) < 0)
+        return;
+
+    /* Finalize the StreamWatchdog type object */
+    if (PyType_Ready(&hdhomerun_StreamWatchdog_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_StreamWatchdog_type);
+    if(PyModule_AddObject(m, "StreamWatchdog", (PyObject *)&hdhomerun_StreamWatchdog_type) < 0)
+        return;
+
+    /* Finalize the Recorder type object */
+    if (PyType_Ready(&hdhomerun_Recorder_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_Recorder_type);
+    if(PyModule_AddObject(m, "Recorder", (PyObject *)&hdhomerun_Recorder_type) < 0)
+        return;
+
+    /* Finalize the Segmenter type object */
+    if (PyType_Ready(&hdhomerun_Segmenter_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_Segmenter_type);
+    if(PyModule_AddObject(m, "Segmenter", (PyObject *)&hdhomerun_Segmenter_type) < 0)
+        return;
+
+    /* Finalize the EpgCollector type object */
+    if (PyType_Ready(&hdhomerun_EpgCollector_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_EpgCollector_type);
+    if(PyModule_AddObject(m, "EpgCollector", (PyObject *)&hdhomerun_EpgCollector_type) < 0)
+        return;
+
+    /* Finalize the Registry type object */
+    if (PyType_Ready(&hdhomerun_Registry_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_Registry_type);
+    if(PyModule_AddObject(m, "Registry", (PyObject *)&hdhomerun_Registry_type) < 0)
+        return;
+
+    /* Finalize the TsIndex type object */
+    if (PyType_Ready(&hdhomerun_TsIndex_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_TsIndex_type);
+    if(PyModule_AddObject(m, "TsIndex", (PyObject *)&hdhomerun_TsIndex_type) < 0)
+        return;
+
+    /* Finalize the PacketTable and PacketIndex type objects */
+    if (PyType_Ready(&hdhomerun_PacketTable_type) < 0)
+        return;
+    if(ts_table_add_constants() != 0)
+        return;
+    Py_INCREF(&hdhomerun_PacketTable_type);
+    if(PyModule_AddObject(m, "PacketTable", (PyObject *)&hdhomerun_PacketTable_type) < 0)
+        return;
+    if (PyType_Ready(&hdhomerun_PacketIndex_type) < 0)
+        return;
+    Py_INCREF(&hdhomerun_PacketIndex_type);
+    if(PyModule_AddObject(m, "PacketIndex", (PyObject *)&hdhomerun_PacketIndex_type) < 0)
+        return;
+
     /* Initialize the DeviceError exception class */
     hdhomerun_device_error = PyErr_NewException("hdhomerun.DeviceError", PyExc_Exception, NULL);
     Py_INCREF(hdhomerun_device_error);
     if(PyModule_AddObject(m, "DeviceError", hdhomerun_device_error) < 0)
         return;
+
+    /* Initialize the TimeoutError exception class; an IOError, as communication errors are */
+    hdhomerun_timeout_error = PyErr_NewException("hdhomerun.TimeoutError", PyExc_IOError, NULL);
+    Py_INCREF(hdhomerun_timeout_error);
+    if(PyModule_AddObject(m, "TimeoutError", hdhomerun_timeout_error) < 0)
+        return;
 }
@@ -0,0 +1,289 @@
+/*
+ * device_varcache.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  Read-through cache for control variables which rarely change.  Only items
+ *  matching a policy are cached; a policy pattern matches any item it is a
+ *  prefix of on a path component boundary, with '*' standing for any run of
+ *  characters other than '/'.  Policies added later take precedence over
+ *  earlier ones.  Devices opened on a Connection share its cache, since they
+ *  talk to the same physical device.
+ */
+
+static const struct {
+    const char *pattern;
+    long ttl_ms;
+} default_policies[] = {
+    {"/sys/model",          VAR_CACHE_TTL_FOREVER},
+    {"/sys/hwmodel",        VAR_CACHE_TTL_FOREVER},
+    {"/sys/version",        VAR_CACHE_TTL_FOREVER},
+    {"/sys/features",       VAR_CACHE_TTL_FOREVER},
+    {"/tuner*/channelmap",  60000},
+};
+
+/* "/tuner1" matches "/tuner1" and "/tuner1/channel", but not "/tuner10/channel" */
+static int pattern_match(const char *pattern, const char *item) {
+    const char *start = pattern;
+
+    while(*pattern) {
+        if(*pattern == '*') {
+            pattern++;
+            while(*item && *item != '/' && *item != *pattern)
+                item++;
+            continue;
+        }
+        if(*pattern != *item)
+            return 0;
+        pattern++;
+        item++;
+    }
+    return *item == '\0' || *item == '/' || (pattern > start && pattern[-1] == '/');
+}
+
+static struct var_cache_policy *policy_find(struct var_cache *vc, const char *item) {
+    struct var_cache_policy *policy;
+
+    for(policy = vc->policies; policy; policy = policy->next) {
+        if(pattern_match(policy->pattern, item))
+            return policy;
+    }
+    return NULL;
+}
+
+static int policy_add(struct var_cache *vc, const char *pattern, long ttl_ms) {
+    struct var_cache_policy *policy, **pp;
+
+    /* Replace an identical pattern instead of shadowing it */
+    for(pp = &vc->policies; *pp; pp = &(*pp)->next) {
+        if(strcmp((*pp)->pattern, pattern) == 0) {
+            policy = *pp;
+            *pp = policy->next;
+            free(policy->pattern);
+            free(policy);
+            break;
+        }
+    }
+
+    policy = calloc(1, sizeof(*policy));
+    if(!policy)
+        return -1;
+    policy->pattern = strdup(pattern);
+    if(!policy->pattern) {
+        free(policy);
+        return -1;
+    }
+    policy->ttl_ms = ttl_ms;
+    policy->next = vc->policies;
+    vc->policies = policy;
+    return 0;
+}
+
+static void entry_free(struct var_cache_entry *entry) {
+    free(entry->item);
+    free(entry->value);
+    free(entry);
+}
+
+int var_cache_init(struct var_cache *vc) {
+    size_t i;
+
+    memset(vc, 0, sizeof(*vc));
+    for(i = 0; i < sizeof(default_policies) / sizeof(default_policies[0]); i++) {
+        if(policy_add(vc, default_policies[i].pattern, default_policies[i].ttl_ms) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+void var_cache_free(struct var_cache *vc) {
+    struct var_cache_policy *policy;
+
+    var_cache_clear(vc);
+    while((policy = vc->policies) != NULL) {
+        vc->policies = policy->next;
+        free(policy->pattern);
+        free(policy);
+    }
+    free(vc->reply);
+    vc->reply = NULL;
+}
+
+void var_cache_clear(struct var_cache *vc) {
+    struct var_cache_entry *entry;
+
+    while((entry = vc->entries) != NULL) {
+        vc->entries = entry->next;
+        entry_free(entry);
+        vc->invalidations++;
+    }
+}
+
+/* Drops every entry whose item matches pattern */
+void var_cache_invalidate(struct var_cache *vc, const char *pattern) {
+    struct var_cache_entry *entry, **pp;
+
+    pp = &vc->entries;
+    while((entry = *pp) != NULL) {
+        if(pattern_match(pattern, entry->item)) {
+            *pp = entry->next;
+            entry_free(entry);
+            vc->invalidations++;
+        } else {
+            pp = &entry->next;
+        }
+    }
+}
+
+/*
+ *  Same contract as hdhomerun_device_get_var(); *pvalue and *perror stay valid
+ *  until the next cache operation.  A miss is fetched with device_control_var(),
+ *  so timeout_ms bounds it and -2 is returned when it expires.
+ */
+int device_get_var_cached(py_device_object *self, const char *item, unsigned int timeout_ms, char **pvalue, char **perror) {
+    struct var_cache *vc = device_var_cache(self);
+    struct var_cache_policy *policy;
+    struct var_cache_entry *entry, **pp;
+    struct control_op op;
+    uint64_t now = monotonic_ns();
+    long ttl_ms = 0;
+    int success;
+
+    /* The request drops the GIL, which lets the policy list change under us */
+    policy = policy_find(vc, item);
+    if(policy)
+        ttl_ms = policy->ttl_ms;
+    if(ttl_ms == 0)
+        policy = NULL;
+
+    for(pp = &vc->entries; policy && (entry = *pp) != NULL; pp = &entry->next) {
+        if(strcmp(entry->item, item) != 0)
+            continue;
+        if(entry->expires_ns == 0 || entry->expires_ns > now) {
+            vc->hits++;
+            *pvalue = entry->value;
+            return 1;
+        }
+        *pp = entry->next;
+        entry_free(entry);
+        break;
+    }
+    if(policy)
+        vc->misses++;
+
+    memset(&op, 0, sizeof(op));
+    op.name = item;
+    success = device_control_var(self, &op, timeout_ms);
+    if(success != 1 && success != 0)
+        return success;
+
+    /* The reply belongs to op or the handle; keep a copy for the caller */
+    free(vc->reply);
+    vc->reply = strdup(op.text);
+    if(!vc->reply)
+        return -1;
+    if(success == 0) {
+        if(vc->reply[0])
+            *perror = vc->reply;
+        return 0;
+    }
+    *pvalue = vc->reply;
+    if(ttl_ms == 0)
+        return 1;
+
+    /* Another thread may have cached the item while the GIL was released */
+    for(entry = vc->entries; entry; entry = entry->next) {
+        if(strcmp(entry->item, item) == 0)
+            break;
+    }
+    if(entry) {
+        char *value = strdup(vc->reply);
+        if(!value)
+            return 1;
+        free(entry->value);
+        entry->value = value;
+        entry->expires_ns = ttl_ms < 0 ? 0 : now + (uint64_t)ttl_ms * 1000000ULL;
+        *pvalue = entry->value;
+        return 1;
+    }
+
+    /* Caching is an optimization; if it fails, hand back the uncached reply */
+    entry = calloc(1, sizeof(*entry));
+    if(!entry)
+        return 1;
+    entry->item = strdup(item);
+    entry->value = strdup(vc->reply);
+    if(!entry->item || !entry->value) {
+        entry_free(entry);
+        return 1;
+    }
+    entry->expires_ns = ttl_ms < 0 ? 0 : now + (uint64_t)ttl_ms * 1000000ULL;
+    entry->next = vc->entries;
+    vc->entries = entry;
+    *pvalue = entry->value;
+    return 1;
+}
+
+const char Device_DOC_set_var_cache_policy[] =
+    "Cache control variables matching prefix for ttl_ms milliseconds.\n"
+    "'*' in the prefix matches within one path component.  A ttl_ms of -1 caches\n"
+    "until invalidated, 0 disables caching for matching items.  Devices opened on\n"
+    "the same Connection share one cache and its policies.";
+PyObject *py_device_set_var_cache_policy(py_device_object *self, PyObject *args, PyObject *kwds) {
+    char *prefix = NULL;
+    long ttl_ms = 0;
+    char *kwlist[] = {"prefix", "ttl_ms", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "sl", kwlist, &prefix, &ttl_ms))
+        return NULL;
+    if(ttl_ms < VAR_CACHE_TTL_FOREVER) {
+        PyErr_SetString(PyExc_ValueError, "ttl_ms must be -1 or greater");
+        return NULL;
+    }
+
+    if(policy_add(device_var_cache(self), prefix, ttl_ms) != 0)
+        return PyErr_NoMemory();
+    var_cache_invalidate(device_var_cache(self), prefix);
+    Py_RETURN_NONE;
+}
+
+const char Device_DOC_get_var_cache_stats[] = "Get the control variable cache's hit/miss counters.";
+PyObject *py_device_get_var_cache_stats(py_device_object *self) {
+    struct var_cache *vc = device_var_cache(self);
+    struct var_cache_entry *entry;
+    unsigned long entries = 0;
+
+    for(entry = vc->entries; entry; entry = entry->next)
+        entries++;
+
+    return Py_BuildValue("{s:k,s:k,s:k,s:k}",
+                         "hits", vc->hits,
+                         "misses", vc->misses,
+                         "invalidations", vc->invalidations,
+                         "entries", entries);
+}
+
+const char Device_DOC_clear_var_cache[] = "Discard all cached control variables.";
+PyObject *py_device_clear_var_cache(py_device_object *self) {
+    var_cache_clear(device_var_cache(self));
+    Py_RETURN_NONE;
+}
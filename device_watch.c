@@ -0,0 +1,580 @@
+/*
+ * device_watch.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <errno.h>
+#include <sys/time.h>
+
+/*
+ *  A Watcher polls a tuner from a native thread and only hands control back
+ *  to Python when something it was asked to watch has changed.  The thread
+ *  owns a private hdhomerun_device_t, since libhdhomerun handles are not safe
+ *  to share with the Device object that the caller keeps using.
+ */
+
+#define WATCH_QUEUE_LIMIT 1024
+
+struct watch_event {
+    double timestamp;
+    const char *field;
+    int numeric;
+    long old_num;
+    long new_num;
+    char old_str[64];
+    char new_str[64];
+};
+
+struct watch_sample {
+    int valid;
+    int reachable;
+    struct hdhomerun_tuner_status_t status;
+    struct hdhomerun_tuner_vstatus_t vstatus;
+    char lockkey_owner[64];
+};
+
+struct watch_state {
+    struct hdhomerun_device_t *hd;
+    unsigned int interval_ms;
+    unsigned int signal_strength_delta;
+    unsigned int snq_delta;
+    unsigned int seq_delta;
+    int want_vstatus;
+    int want_lockkey;
+    int use_callback;
+    PyObject *callback;         /* only touched with the GIL held; cleared by tp_clear */
+    struct event_queue queue;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+    int terminate;
+    int free_on_exit;           /* the Watcher went away on the watcher thread itself */
+    unsigned long generation;   /* see device_fork.c */
+    struct exporter_source metrics;
+
+    /* Protected by lock */
+    struct watch_sample current;
+    unsigned long polls;
+    unsigned long errors;
+    unsigned long events;
+};
+
+typedef struct {
+    PyObject_HEAD
+    struct watch_state *ws;
+} py_watcher_object;
+
+static PyObject *build_watch_event(struct watch_event *ev) {
+    if(ev->numeric)
+        return Py_BuildValue("{s:d,s:s,s:l,s:l}", "time", ev->timestamp, "field", ev->field,
+                             "old", ev->old_num, "new", ev->new_num);
+    return Py_BuildValue("{s:d,s:s,s:s,s:s}", "time", ev->timestamp, "field", ev->field,
+                         "old", ev->old_str, "new", ev->new_str);
+}
+
+static void watch_emit(struct watch_state *ws, struct watch_event *ev) {
+    PyGILState_STATE gstate;
+    PyObject *callback, *event, *result;
+
+    pthread_mutex_lock(&ws->lock);
+    ws->events++;
+    pthread_mutex_unlock(&ws->lock);
+
+    if(!ws->use_callback) {
+        event_queue_push(&ws->queue, ev, sizeof(*ev));
+        return;
+    }
+
+    gstate = PyGILState_Ensure();
+    /* The callback may drop the last reference to the Watcher, and with it ws->callback */
+    callback = ws->callback;
+    Py_XINCREF(callback);
+    if(callback) {
+        event = build_watch_event(ev);
+        if(event) {
+            result = PyObject_CallFunctionObjArgs(callback, event, NULL);
+            Py_DECREF(event);
+            Py_XDECREF(result);
+        }
+        if(PyErr_Occurred())
+            PyErr_WriteUnraisable(callback);
+        Py_DECREF(callback);
+    }
+    PyGILState_Release(gstate);
+}
+
+static void watch_compare_str(struct watch_state *ws, const char *field, const char *old_value, const char *new_value, double now) {
+    struct watch_event ev;
+
+    if(strcmp(old_value, new_value) == 0)
+        return;
+    memset(&ev, 0, sizeof(ev));
+    ev.timestamp = now;
+    ev.field = field;
+    strncpy(ev.old_str, old_value, sizeof(ev.old_str) - 1);
+    strncpy(ev.new_str, new_value, sizeof(ev.new_str) - 1);
+    watch_emit(ws, &ev);
+}
+
+/* A delta of zero disables the field; returns 1 if the change was reported */
+static int watch_compare_num(struct watch_state *ws, const char *field, long old_value, long new_value, unsigned int delta, double now) {
+    struct watch_event ev;
+    long diff = new_value - old_value;
+
+    if(delta == 0 || (diff < 0 ? -diff : diff) < (long)delta)
+        return 0;
+    memset(&ev, 0, sizeof(ev));
+    ev.timestamp = now;
+    ev.field = field;
+    ev.numeric = 1;
+    ev.old_num = old_value;
+    ev.new_num = new_value;
+    watch_emit(ws, &ev);
+    return 1;
+}
+
+static void watch_poll(struct watch_state *ws, struct watch_sample *sample) {
+    char *str = NULL;
+
+    memset(sample, 0, sizeof(*sample));
+    sample->valid = 1;
+    if(hdhomerun_device_get_tuner_status(ws->hd, &str, &sample->status) != 1)
+        return;
+    if(ws->want_vstatus && hdhomerun_device_get_tuner_vstatus(ws->hd, &str, &sample->vstatus) != 1)
+        return;
+    if(ws->want_lockkey) {
+        if(hdhomerun_device_get_tuner_lockkey_owner(ws->hd, &str) != 1)
+            return;
+        strncpy(sample->lockkey_owner, str, sizeof(sample->lockkey_owner) - 1);
+    }
+    sample->reachable = 1;
+}
+
+/*
+ *  Compares a fresh sample against the last reported one.  Numeric fields are
+ *  only reported once they have moved by at least the configured delta, so
+ *  the reference value for them is only advanced when an event fires.
+ */
+static void watch_diff(struct watch_state *ws, struct watch_sample *ref, struct watch_sample *sample) {
+    double now = wallclock_time();
+
+    if(ref->reachable != sample->reachable) {
+        watch_compare_num(ws, "reachable", ref->reachable, sample->reachable, 1, now);
+        ref->reachable = sample->reachable;
+    }
+    if(!sample->reachable)
+        return;
+
+    watch_compare_str(ws, "channel", ref->status.channel, sample->status.channel, now);
+    if(strcmp(ref->status.lock_str, sample->status.lock_str) != 0)
+        trace_event(TRACE_TUNER_LOCK, hdhomerun_device_get_device_id_requested(ws->hd),
+                    hdhomerun_device_get_device_ip_requested(ws->hd), hdhomerun_device_get_tuner(ws->hd),
+                    sample->status.lock_str, sample->status.lock_supported, 0);
+    watch_compare_str(ws, "lock_str", ref->status.lock_str, sample->status.lock_str, now);
+    watch_compare_num(ws, "signal_present", ref->status.signal_present, sample->status.signal_present, 1, now);
+    if(watch_compare_num(ws, "signal_strength", ref->status.signal_strength, sample->status.signal_strength, ws->signal_strength_delta, now))
+        ref->status.signal_strength = sample->status.signal_strength;
+    if(watch_compare_num(ws, "signal_to_noise_quality", ref->status.signal_to_noise_quality, sample->status.signal_to_noise_quality, ws->snq_delta, now))
+        ref->status.signal_to_noise_quality = sample->status.signal_to_noise_quality;
+    if(watch_compare_num(ws, "symbol_error_quality", ref->status.symbol_error_quality, sample->status.symbol_error_quality, ws->seq_delta, now))
+        ref->status.symbol_error_quality = sample->status.symbol_error_quality;
+    memcpy(ref->status.channel, sample->status.channel, sizeof(ref->status.channel));
+    memcpy(ref->status.lock_str, sample->status.lock_str, sizeof(ref->status.lock_str));
+    ref->status.signal_present = sample->status.signal_present;
+
+    if(ws->want_vstatus) {
+        watch_compare_str(ws, "vchannel", ref->vstatus.vchannel, sample->vstatus.vchannel, now);
+        watch_compare_str(ws, "cci", ref->vstatus.cci, sample->vstatus.cci, now);
+        ref->vstatus = sample->vstatus;
+    }
+    if(ws->want_lockkey) {
+        watch_compare_str(ws, "lockkey_owner", ref->lockkey_owner, sample->lockkey_owner, now);
+        memcpy(ref->lockkey_owner, sample->lockkey_owner, sizeof(ref->lockkey_owner));
+    }
+}
+
+/* Frees what the thread and the Watcher share; no Python state is touched */
+static void watch_release(struct watch_state *ws) {
+    if(ws->hd)
+        hdhomerun_device_destroy(ws->hd);
+    event_queue_destroy(&ws->queue);
+    /* A thread which only exists in the parent may still be waiting on these */
+    if(ws->generation == fork_generation_current()) {
+        pthread_cond_destroy(&ws->cond);
+        pthread_mutex_destroy(&ws->lock);
+    }
+    free(ws);
+}
+
+static void *watch_thread(void *arg) {
+    struct watch_state *ws = (struct watch_state *)arg;
+    struct watch_sample ref, sample;
+    struct timespec deadline;
+    struct timeval now;
+    uint64_t ns;
+
+    memset(&ref, 0, sizeof(ref));
+    while(1) {
+        watch_poll(ws, &sample);
+        if(!sample.reachable) {
+            /* Keep the last good values so the next successful poll is compared against them */
+            sample.status = ref.status;
+            sample.vstatus = ref.vstatus;
+            memcpy(sample.lockkey_owner, ref.lockkey_owner, sizeof(sample.lockkey_owner));
+        }
+
+        if(!ref.valid) {
+            /* The first sample is the baseline, not an event */
+            ref = sample;
+        } else {
+            watch_diff(ws, &ref, &sample);
+        }
+
+        pthread_mutex_lock(&ws->lock);
+        ws->current = sample;
+        ws->polls++;
+        if(!sample.reachable)
+            ws->errors++;
+
+        gettimeofday(&now, NULL);
+        ns = (uint64_t)now.tv_usec * 1000ULL + (uint64_t)ws->interval_ms * 1000000ULL;
+        deadline.tv_sec = now.tv_sec + (time_t)(ns / 1000000000ULL);
+        deadline.tv_nsec = (long)(ns % 1000000000ULL);
+        while(!ws->terminate) {
+            if(pthread_cond_timedwait(&ws->cond, &ws->lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+        if(ws->terminate) {
+            pthread_mutex_unlock(&ws->lock);
+            break;
+        }
+        pthread_mutex_unlock(&ws->lock);
+    }
+    /* Only this thread sets free_on_exit, see watch_free() */
+    if(ws->free_on_exit)
+        watch_release(ws);
+    return NULL;
+}
+
+static void watch_sample_metrics(void *owner, double *values) {
+    struct watch_state *ws = owner;
+    const struct hdhomerun_tuner_status_t *status = &ws->current.status;
+
+    pthread_mutex_lock(&ws->lock);
+    values[0] = ws->current.reachable;
+    values[1] = status->signal_present;
+    values[2] = status->lock_supported;
+    values[3] = status->signal_strength;
+    values[4] = status->signal_to_noise_quality;
+    values[5] = status->symbol_error_quality;
+    values[6] = status->raw_bits_per_second;
+    values[7] = status->packets_per_second;
+    values[8] = ws->polls;
+    values[9] = ws->errors;
+    pthread_mutex_unlock(&ws->lock);
+}
+
+/* Must be called with the GIL held; it is dropped while waiting for the thread */
+static void watch_stop(struct watch_state *ws) {
+    exporter_unregister(&ws->metrics);
+    if(!ws->running)
+        return;
+    if(ws->generation != fork_generation_current()) {
+        /* Forked since: the thread only exists in the parent */
+        ws->running = 0;
+        return;
+    }
+    pthread_mutex_lock(&ws->lock);
+    ws->terminate = 1;
+    pthread_cond_signal(&ws->cond);
+    pthread_mutex_unlock(&ws->lock);
+    /* From a callback: the thread stops once it returns, and is joined later from elsewhere */
+    if(pthread_equal(pthread_self(), ws->thread))
+        return;
+
+    /* The thread may be waiting for the GIL to deliver a callback */
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(ws->thread, NULL);
+    Py_END_ALLOW_THREADS
+    ws->running = 0;
+}
+
+/* Must be called with the GIL held */
+static void watch_free(struct watch_state *ws) {
+    watch_stop(ws);
+    Py_CLEAR(ws->callback);
+    if(ws->running && pthread_equal(pthread_self(), ws->thread)) {
+        /*
+         *  The last reference went away inside a callback, on the watcher
+         *  thread: it cannot join itself, so it frees the state on its way out.
+         */
+        ws->free_on_exit = 1;
+        pthread_detach(ws->thread);
+        return;
+    }
+    watch_release(ws);
+}
+
+const char Device_DOC_watch[] =
+    "Start a background watcher for this tuner and return a Watcher object.\n\n"
+    "The tuner is polled natively every interval_ms milliseconds.  Changes to the\n"
+    "channel, lock, signal presence, vchannel, CCI and lockkey owner are always\n"
+    "reported; signal_strength, snq and seq are only reported once they move by at\n"
+    "least the given delta (0 disables them).  Events are passed to callback from\n"
+    "the watcher thread if one is given, otherwise they are queued on the Watcher.";
+
+PyObject *py_device_watch(py_device_object *self, PyObject *args, PyObject *kwds) {
+    unsigned int interval_ms = 1000;
+    unsigned int ss_delta = 0, snq_delta = 0, seq_delta = 0;
+    PyObject *callback = NULL;
+    PyObject *vstatus_obj = NULL, *lockkey_obj = NULL;
+    char *kwlist[] = {"interval_ms", "callback", "signal_strength", "snq", "seq", "vstatus", "lockkey", NULL};
+    struct watch_state *ws;
+    py_watcher_object *watcher;
+    char labels[EXPORTER_LABELS_MAX];
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|IOIIIO!O!", kwlist, &interval_ms, &callback,
+                                    &ss_delta, &snq_delta, &seq_delta,
+                                    &PyBool_Type, &vstatus_obj, &PyBool_Type, &lockkey_obj))
+        return NULL;
+
+    if(interval_ms == 0) {
+        PyErr_SetString(PyExc_ValueError, "interval_ms must be positive");
+        return NULL;
+    }
+    if(callback == Py_None)
+        callback = NULL;
+    if(callback && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable");
+        return NULL;
+    }
+
+    ws = calloc(1, sizeof(*ws));
+    if(!ws)
+        return PyErr_NoMemory();
+    ws->generation = fork_generation_current();
+    ws->interval_ms = interval_ms;
+    ws->signal_strength_delta = ss_delta;
+    ws->snq_delta = snq_delta;
+    ws->seq_delta = seq_delta;
+    ws->want_vstatus = vstatus_obj ? (vstatus_obj == Py_True) : 1;
+    ws->want_lockkey = lockkey_obj ? (lockkey_obj == Py_True) : 1;
+    pthread_mutex_init(&ws->lock, NULL);
+    pthread_cond_init(&ws->cond, NULL);
+    if(event_queue_init(&ws->queue, WATCH_QUEUE_LIMIT) != 0) {
+        pthread_cond_destroy(&ws->cond);
+        pthread_mutex_destroy(&ws->lock);
+        free(ws);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    Py_XINCREF(callback);
+    ws->callback = callback;
+    ws->use_callback = (callback != NULL);
+
+    ws->hd = hdhomerun_device_create(hdhomerun_device_get_device_id(device_hd(self)),
+                                     hdhomerun_device_get_device_ip(device_hd(self)),
+                                     hdhomerun_device_get_tuner(device_hd(self)), NULL);
+    if(!ws->hd) {
+        watch_free(ws);
+        PyErr_SetString(hdhomerun_device_error, "Failed to initialize Device object");
+        return NULL;
+    }
+
+    watcher = PyObject_GC_New(py_watcher_object, &hdhomerun_Watcher_type);
+    if(!watcher) {
+        watch_free(ws);
+        return NULL;
+    }
+    watcher->ws = ws;
+
+    if(pthread_create(&ws->thread, NULL, watch_thread, ws) != 0) {
+        Py_DECREF(watcher);
+        PyErr_SetString(hdhomerun_device_error, "unable to start watcher thread");
+        return NULL;
+    }
+    ws->running = 1;
+    PyObject_GC_Track((PyObject *)watcher);
+    snprintf(labels, sizeof(labels), "device=\"%08X\",tuner=\"%u\"",
+             hdhomerun_device_get_device_id(ws->hd), hdhomerun_device_get_tuner(ws->hd));
+    exporter_register(&ws->metrics, EXPORTER_WATCH, ws, watch_sample_metrics, labels);
+
+    return (PyObject *)watcher;
+}
+
+/*
+ *  Watcher methods
+ */
+
+static void py_watcher_dealloc(py_watcher_object *self) {
+    PyObject_GC_UnTrack((PyObject *)self);
+    if(self->ws)
+        watch_free(self->ws);
+    self->ws = NULL;
+    PyObject_GC_Del(self);
+}
+
+/* A callback which refers back to its Watcher makes a cycle */
+static int py_watcher_traverse(py_watcher_object *self, visitproc visit, void *arg) {
+    if(self->ws)
+        Py_VISIT(self->ws->callback);
+    return 0;
+}
+
+static int py_watcher_clear(py_watcher_object *self) {
+    if(self->ws)
+        Py_CLEAR(self->ws->callback);
+    return 0;
+}
+
+PyDoc_STRVAR(Watcher_DOC_fileno,
+    "Return a file descriptor which is readable while events are queued.");
+
+static PyObject *py_watcher_fileno(py_watcher_object *self) {
+    return PyInt_FromLong((long)self->ws->queue.pipe_fd[0]);
+}
+
+PyDoc_STRVAR(Watcher_DOC_events,
+    "Return (and remove) all queued events as a list of dicts.");
+
+static PyObject *py_watcher_events(py_watcher_object *self) {
+    PyObject *result, *event;
+    struct event_queue_item *item;
+
+    result = PyList_New(0);
+    if(!result)
+        return NULL;
+
+    while((item = event_queue_pop(&self->ws->queue)) != NULL) {
+        event = build_watch_event((struct watch_event *)item->data);
+        free(item);
+        if(!event) { Py_DECREF(result); return NULL; }
+        if(PyList_Append(result, event) != 0) { Py_DECREF(event); Py_DECREF(result); return NULL; }
+        Py_DECREF(event);
+    }
+    return result;
+}
+
+PyDoc_STRVAR(Watcher_DOC_status,
+    "Return the most recently polled tuner status without contacting the device.");
+
+static PyObject *py_watcher_status(py_watcher_object *self) {
+    struct watch_state *ws = self->ws;
+    struct watch_sample sample;
+    unsigned long polls, errors, events, dropped;
+    PyObject *rv, *dv;
+
+    pthread_mutex_lock(&ws->lock);
+    sample = ws->current;
+    polls = ws->polls;
+    errors = ws->errors;
+    events = ws->events;
+    pthread_mutex_unlock(&ws->lock);
+    pthread_mutex_lock(&ws->queue.lock);
+    dropped = ws->queue.dropped;
+    pthread_mutex_unlock(&ws->queue.lock);
+
+    if(!sample.valid)
+        Py_RETURN_NONE;
+
+    rv = build_tuner_status_dict(&sample.status);
+    if(!rv) return NULL;
+
+    dv = Py_BuildValue("{s:O,s:k,s:k,s:k,s:k}", "reachable", sample.reachable ? Py_True : Py_False,
+                       "polls", polls, "errors", errors, "events", events, "dropped", dropped);
+    if(!dv || PyDict_Update(rv, dv) != 0) { Py_XDECREF(dv); Py_DECREF(rv); return NULL; }
+    Py_DECREF(dv);
+
+    if(ws->want_vstatus) {
+        dv = Py_BuildValue("{s:s,s:s}", "vchannel", sample.vstatus.vchannel, "cci", sample.vstatus.cci);
+        if(!dv || PyDict_Update(rv, dv) != 0) { Py_XDECREF(dv); Py_DECREF(rv); return NULL; }
+        Py_DECREF(dv);
+    }
+    if(ws->want_lockkey) {
+        dv = PyString_FromString(sample.lockkey_owner);
+        if(!dv) { Py_DECREF(rv); return NULL; }
+        if(PyDict_SetItemString(rv, "lockkey_owner", dv) != 0) { Py_DECREF(dv); Py_DECREF(rv); return NULL; }
+        Py_DECREF(dv);
+    }
+    return rv;
+}
+
+PyDoc_STRVAR(Watcher_DOC_stop,
+    "Stop polling.  Queued events remain available through events().");
+
+static PyObject *py_watcher_stop(py_watcher_object *self) {
+    watch_stop(self->ws);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef py_watcher_methods[] = {
+    {"fileno",                  (PyCFunction)py_watcher_fileno,                 METH_NOARGS,                Watcher_DOC_fileno},
+    {"events",                  (PyCFunction)py_watcher_events,                 METH_NOARGS,                Watcher_DOC_events},
+    {"status",                  (PyCFunction)py_watcher_status,                 METH_NOARGS,                Watcher_DOC_status},
+    {"stop",                    (PyCFunction)py_watcher_stop,                   METH_NOARGS,                Watcher_DOC_stop},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_Watcher_type_doc,
+    "A background tuner status watcher, created by Device.watch().");
+
+PyTypeObject hdhomerun_Watcher_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.Watcher",            /* tp_name */
+    sizeof(py_watcher_object),      /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_watcher_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    hdhomerun_Watcher_type_doc,     /* tp_doc */
+    (traverseproc)py_watcher_traverse, /* tp_traverse */
+    (inquiry)py_watcher_clear,      /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_watcher_methods,             /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    0,                              /* tp_new */
+    0,                              /* tp_free */
+};
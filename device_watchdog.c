@@ -0,0 +1,688 @@
+/*
+ * device_watchdog.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <errno.h>
+#include <time.h>
+
+/*
+ *  A StreamWatchdog watches the packet count of a streaming Device from a
+ *  native thread.  When no data has arrived for timeout_ms, or a status poll
+ *  finds the tuner has lost lock, it stops the stream, re-tunes to the
+ *  channel and program saved when it was started and points the stream back
+ *  at the receiver, retrying with exponential backoff until data flows
+ *  again.  The receiver itself is left alone, so stream_recv() simply picks
+ *  up where it left off.  As with the Watcher, the thread works through a
+ *  private hdhomerun_device_t.
+ */
+
+#define WATCHDOG_QUEUE_LIMIT 1024
+#define WATCHDOG_MIN_TICK_MS 5
+#define WATCHDOG_MAX_TICK_MS 100
+
+struct watchdog_event {
+    double timestamp;
+    const char *event;
+    unsigned long attempt;
+    double idle_ms;         /* since data was last seen */
+    double recovery_ms;     /* recovered only: since the outage was detected */
+    char error[64];
+};
+
+struct stream_watchdog {
+    struct hdhomerun_device_t *hd;
+    struct stream_rx *rx;   /* exactly one of rx and vs is set */
+    struct hdhomerun_video_sock_t *vs;
+    unsigned int timeout_ms;
+    unsigned int status_ms;
+    unsigned int min_backoff_ms;
+    unsigned int max_backoff_ms;
+    char channel[64];
+    char vchannel[32];
+    char program[32];
+    char target[64];
+    PyObject *callback;
+    struct event_queue queue;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+    int terminate;
+    unsigned long generation;   /* see device_fork.c */
+
+    /* Protected by lock */
+    int stalled;
+    uint64_t last_data_ns;
+    unsigned long stalls;
+    unsigned long lock_losses;
+    unsigned long restarts;
+    unsigned long restart_failures;
+    unsigned long recoveries;
+    uint64_t last_recovery_ns;
+    uint64_t max_recovery_ns;
+};
+
+typedef struct {
+    PyObject_HEAD
+    py_device_object *device;   /* borrowed; set while the Device runs this watchdog */
+    struct stream_watchdog *wd;
+} py_watchdog_object;
+
+static PyObject *build_watchdog_event(struct watchdog_event *ev) {
+    PyObject *recovery, *error, *rv;
+
+    if(ev->recovery_ms >= 0.0) {
+        recovery = PyFloat_FromDouble(ev->recovery_ms);
+    } else {
+        recovery = Py_None;
+        Py_INCREF(recovery);
+    }
+    if(ev->error[0]) {
+        error = PyString_FromString(ev->error);
+    } else {
+        error = Py_None;
+        Py_INCREF(error);
+    }
+    if(!recovery || !error) {
+        Py_XDECREF(recovery);
+        Py_XDECREF(error);
+        return NULL;
+    }
+    rv = Py_BuildValue("{s:d,s:s,s:k,s:d,s:O,s:O}", "time", ev->timestamp, "event", ev->event,
+                       "attempt", ev->attempt, "idle_ms", ev->idle_ms, "recovery_ms", recovery, "error", error);
+    Py_DECREF(recovery);
+    Py_DECREF(error);
+    return rv;
+}
+
+static void watchdog_emit(struct stream_watchdog *wd, const char *name, unsigned long attempt,
+                          uint64_t idle_ns, int64_t recovery_ns, const char *error) {
+    struct watchdog_event ev;
+    PyGILState_STATE gstate;
+    PyObject *event, *result;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.timestamp = wallclock_time();
+    ev.event = name;
+    ev.attempt = attempt;
+    ev.idle_ms = (double)idle_ns / 1e6;
+    ev.recovery_ms = recovery_ns < 0 ? -1.0 : (double)recovery_ns / 1e6;
+    if(error)
+        strncpy(ev.error, error, sizeof(ev.error) - 1);
+
+    if(!wd->callback) {
+        event_queue_push(&wd->queue, &ev, sizeof(ev));
+        return;
+    }
+
+    gstate = PyGILState_Ensure();
+    event = build_watchdog_event(&ev);
+    if(event) {
+        result = PyObject_CallFunctionObjArgs(wd->callback, event, NULL);
+        Py_DECREF(event);
+        Py_XDECREF(result);
+    }
+    if(PyErr_Occurred())
+        PyErr_WriteUnraisable(wd->callback);
+    PyGILState_Release(gstate);
+}
+
+/* A counter which moves whenever stream data arrives */
+static unsigned long long watchdog_progress(struct stream_watchdog *wd) {
+    struct hdhomerun_video_stats_t stats;
+    unsigned long long packets;
+
+    if(wd->rx) {
+        pthread_mutex_lock(&wd->rx->lock);
+        packets = wd->rx->packets;
+        pthread_mutex_unlock(&wd->rx->lock);
+        return packets;
+    }
+    hdhomerun_video_get_stats(wd->vs, &stats);
+    return stats.packet_count;
+}
+
+/* Returns 1 if the tuner reports no lock, 0 if it is locked or could not be asked */
+static int watchdog_lock_lost(struct stream_watchdog *wd) {
+    struct hdhomerun_tuner_status_t status;
+    char *str;
+
+    if(hdhomerun_device_get_tuner_status(wd->hd, &str, &status) != 1)
+        return 0;
+    return !status.signal_present || strcmp(status.lock_str, "none") == 0;
+}
+
+/* Internal: stop, re-tune and restart; fills error and returns 0 on failure */
+static int watchdog_restart(struct stream_watchdog *wd, char *error, size_t error_size) {
+    int success;
+
+    /* The device may have rebooted, so nothing it held can be assumed */
+    success = hdhomerun_device_set_tuner_target(wd->hd, "none");
+    if(success != 1) {
+        snprintf(error, error_size, "stop: %s", success == -1 ? "no reply" : "rejected");
+        return 0;
+    }
+    if(wd->vchannel[0]) {
+        success = hdhomerun_device_set_tuner_vchannel(wd->hd, wd->vchannel);
+    } else if(wd->channel[0]) {
+        success = hdhomerun_device_set_tuner_channel(wd->hd, wd->channel);
+    }
+    if(success != 1) {
+        snprintf(error, error_size, "tune: %s", success == -1 ? "no reply" : "rejected");
+        return 0;
+    }
+    if(wd->program[0]) {
+        success = hdhomerun_device_set_tuner_program(wd->hd, wd->program);
+        if(success != 1) {
+            snprintf(error, error_size, "program: %s", success == -1 ? "no reply" : "rejected");
+            return 0;
+        }
+    }
+    success = hdhomerun_device_set_tuner_target(wd->hd, wd->target);
+    if(success != 1) {
+        snprintf(error, error_size, "start: %s", success == -1 ? "no reply" : "rejected");
+        return 0;
+    }
+    return 1;
+}
+
+/* Returns 1 if the watchdog was told to terminate while waiting */
+static int watchdog_wait(struct stream_watchdog *wd, uint64_t due_ns) {
+    struct timespec deadline;
+    int terminate;
+
+    deadline.tv_sec = (time_t)(due_ns / 1000000000ULL);
+    deadline.tv_nsec = (long)(due_ns % 1000000000ULL);
+    pthread_mutex_lock(&wd->lock);
+    while(!wd->terminate) {
+        if(pthread_cond_timedwait(&wd->cond, &wd->lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    terminate = wd->terminate;
+    pthread_mutex_unlock(&wd->lock);
+    return terminate;
+}
+
+static void *watchdog_thread(void *arg) {
+    struct stream_watchdog *wd = (struct stream_watchdog *)arg;
+    unsigned long long count, progress;
+    uint64_t now, tick_ns, last_data, detected = 0, next_status, next_restart = 0, backoff_ns = 0;
+    unsigned long attempt = 0;
+    int stalled = 0, restarted;
+    char error[64];
+
+    tick_ns = (uint64_t)wd->timeout_ms * 1000000ULL / 4;
+    if(tick_ns < WATCHDOG_MIN_TICK_MS * 1000000ULL)
+        tick_ns = WATCHDOG_MIN_TICK_MS * 1000000ULL;
+    if(tick_ns > WATCHDOG_MAX_TICK_MS * 1000000ULL)
+        tick_ns = WATCHDOG_MAX_TICK_MS * 1000000ULL;
+
+    count = watchdog_progress(wd);
+    last_data = monotonic_ns();
+    next_status = last_data + (uint64_t)wd->status_ms * 1000000ULL;
+    while(!watchdog_wait(wd, monotonic_ns() + tick_ns)) {
+        progress = watchdog_progress(wd);
+        now = monotonic_ns();
+
+        if(progress != count) {
+            count = progress;
+            if(stalled) {
+                pthread_mutex_lock(&wd->lock);
+                wd->stalled = stalled = 0;
+                wd->recoveries++;
+                wd->last_recovery_ns = now - detected;
+                if(wd->last_recovery_ns > wd->max_recovery_ns)
+                    wd->max_recovery_ns = wd->last_recovery_ns;
+                pthread_mutex_unlock(&wd->lock);
+                watchdog_emit(wd, "recovered", attempt, now - last_data, (int64_t)(now - detected), NULL);
+            }
+            last_data = now;
+            pthread_mutex_lock(&wd->lock);
+            wd->last_data_ns = now;
+            pthread_mutex_unlock(&wd->lock);
+            continue;
+        }
+
+        if(!stalled) {
+            if(now - last_data >= (uint64_t)wd->timeout_ms * 1000000ULL) {
+                pthread_mutex_lock(&wd->lock);
+                wd->stalls++;
+                pthread_mutex_unlock(&wd->lock);
+                watchdog_emit(wd, "stall", 0, now - last_data, -1, NULL);
+            } else if(wd->status_ms && now >= next_status) {
+                next_status = now + (uint64_t)wd->status_ms * 1000000ULL;
+                if(!watchdog_lock_lost(wd))
+                    continue;
+                pthread_mutex_lock(&wd->lock);
+                wd->lock_losses++;
+                pthread_mutex_unlock(&wd->lock);
+                watchdog_emit(wd, "lock_lost", 0, now - last_data, -1, NULL);
+            } else {
+                continue;
+            }
+            pthread_mutex_lock(&wd->lock);
+            wd->stalled = stalled = 1;
+            pthread_mutex_unlock(&wd->lock);
+            detected = now;
+            attempt = 0;
+            backoff_ns = (uint64_t)wd->min_backoff_ms * 1000000ULL;
+            next_restart = now;
+        }
+        if(now < next_restart)
+            continue;
+
+        attempt++;
+        error[0] = '\0';
+        restarted = watchdog_restart(wd, error, sizeof(error));
+        pthread_mutex_lock(&wd->lock);
+        wd->restarts++;
+        if(!restarted)
+            wd->restart_failures++;
+        pthread_mutex_unlock(&wd->lock);
+        now = monotonic_ns();
+        watchdog_emit(wd, restarted ? "restart" : "restart_failed", attempt, now - last_data, -1, restarted ? NULL : error);
+
+        /* Only data sent after the restart counts as a recovery */
+        count = watchdog_progress(wd);
+        next_restart = now + backoff_ns;
+        backoff_ns *= 2;
+        if(backoff_ns > (uint64_t)wd->max_backoff_ms * 1000000ULL)
+            backoff_ns = (uint64_t)wd->max_backoff_ms * 1000000ULL;
+    }
+    return NULL;
+}
+
+/* Must be called with the GIL held; it is dropped while waiting for the thread */
+static void watchdog_stop(struct stream_watchdog *wd) {
+    if(!wd->running)
+        return;
+    if(wd->generation != fork_generation_current()) {
+        /* Forked since: the thread only exists in the parent */
+        wd->running = 0;
+        return;
+    }
+    pthread_mutex_lock(&wd->lock);
+    wd->terminate = 1;
+    pthread_cond_signal(&wd->cond);
+    pthread_mutex_unlock(&wd->lock);
+
+    /* The thread may be waiting for the GIL to deliver a callback */
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(wd->thread, NULL);
+    Py_END_ALLOW_THREADS
+    wd->running = 0;
+}
+
+static void watchdog_free(struct stream_watchdog *wd) {
+    watchdog_stop(wd);
+    if(wd->hd)
+        hdhomerun_device_destroy(wd->hd);
+    Py_XDECREF(wd->callback);
+    event_queue_destroy(&wd->queue);
+    /* A thread which only exists in the parent may still be waiting on these */
+    if(wd->generation == fork_generation_current()) {
+        pthread_cond_destroy(&wd->cond);
+        pthread_mutex_destroy(&wd->lock);
+    }
+    free(wd);
+}
+
+/* Called before the Device's stream is stopped or replaced, with the GIL held */
+void device_watchdog_stop(py_device_object *self) {
+    py_watchdog_object *watchdog = (py_watchdog_object *)self->watchdog;
+
+    if(!watchdog)
+        return;
+    self->watchdog = NULL;
+    watchdog_stop(watchdog->wd);
+    watchdog->device = NULL;
+    Py_DECREF(watchdog);
+}
+
+/* Internal: copy a tuner setting, treating "none" as unset */
+static int watchdog_save(struct hdhomerun_device_t *hd, int (*get)(struct hdhomerun_device_t *, char **),
+                         char *value, size_t size) {
+    char *str;
+    int success;
+
+    success = get(hd, &str);
+    if(success != 1)
+        return success;
+    if(strcmp(str, "none") != 0 && strcmp(str, "0") != 0)
+        strncpy(value, str, size - 1);
+    return 1;
+}
+
+const char Device_DOC_stream_watchdog[] =
+    "Watch the running stream from a native thread and restart it when it stalls.\n\n"
+    "If no data arrives for timeout_ms milliseconds, or a tuner status poll\n"
+    "every status_ms milliseconds (0 disables it) finds no lock, the stream is\n"
+    "stopped, re-tuned to the channel (or vchannel) and program it had when the\n"
+    "watchdog was started, and pointed back at the receiver.  Restarts repeat\n"
+    "until data flows again, backing off from min_backoff_ms up to\n"
+    "max_backoff_ms.  Events are passed to callback from the watchdog thread if\n"
+    "one is given, otherwise they are queued on the StreamWatchdog.  The\n"
+    "Device keeps the watchdog running until stream_stop() or the next\n"
+    "stream_start(); the returned StreamWatchdog is only a handle to it.";
+
+PyObject *py_device_stream_watchdog(py_device_object *self, PyObject *args, PyObject *kwds) {
+    unsigned int timeout_ms = 500, status_ms = 1000, min_backoff_ms = 100, max_backoff_ms = 5000;
+    PyObject *callback = NULL;
+    char *kwlist[] = {"timeout_ms", "status_ms", "min_backoff_ms", "max_backoff_ms", "callback", NULL};
+    struct stream_watchdog *wd;
+    py_watchdog_object *watchdog;
+    pthread_condattr_t attr;
+    char *target;
+    int success;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|IIIIO", kwlist, &timeout_ms, &status_ms,
+                                    &min_backoff_ms, &max_backoff_ms, &callback))
+        return NULL;
+
+    if(timeout_ms == 0 || min_backoff_ms == 0 || max_backoff_ms < min_backoff_ms) {
+        PyErr_SetString(PyExc_ValueError, "timeout_ms and min_backoff_ms must be positive and no greater than max_backoff_ms");
+        return NULL;
+    }
+    if(callback == Py_None)
+        callback = NULL;
+    if(callback && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable");
+        return NULL;
+    }
+    if(self->rx && self->rx->replay) {
+        PyErr_SetString(PyExc_ValueError, "replayed streams cannot stall");
+        return NULL;
+    }
+
+    /* The stream is restarted exactly as the device has it now */
+    success = hdhomerun_device_get_tuner_target(device_hd(self), &target);
+    if(success == -1) {
+        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+        return NULL;
+    } else if(success == 0) {
+        PyErr_SetString(hdhomerun_device_error, "the device refused to report the stream target");
+        return NULL;
+    } else if(success != 1) {
+        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
+        return NULL;
+    }
+    if(strcmp(target, "none") == 0) {
+        PyErr_SetString(PyExc_ValueError, "the tuner is not streaming");
+        return NULL;
+    }
+
+    wd = calloc(1, sizeof(*wd));
+    if(!wd)
+        return PyErr_NoMemory();
+    wd->generation = fork_generation_current();
+    strncpy(wd->target, target, sizeof(wd->target) - 1);
+    wd->timeout_ms = timeout_ms;
+    wd->status_ms = status_ms;
+    wd->min_backoff_ms = min_backoff_ms;
+    wd->max_backoff_ms = max_backoff_ms;
+    pthread_mutex_init(&wd->lock, NULL);
+    /* Deadlines come from monotonic_ns() */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wd->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if(event_queue_init(&wd->queue, WATCHDOG_QUEUE_LIMIT) != 0) {
+        pthread_cond_destroy(&wd->cond);
+        pthread_mutex_destroy(&wd->lock);
+        free(wd);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    Py_XINCREF(callback);
+    wd->callback = callback;
+
+    /* Older firmware has no vchannel; the physical channel is used instead */
+    watchdog_save(device_hd(self), hdhomerun_device_get_tuner_vchannel, wd->vchannel, sizeof(wd->vchannel));
+    success = watchdog_save(device_hd(self), hdhomerun_device_get_tuner_channel, wd->channel, sizeof(wd->channel));
+    if(success == 1)
+        success = watchdog_save(device_hd(self), hdhomerun_device_get_tuner_program, wd->program, sizeof(wd->program));
+    if(success != 1) {
+        watchdog_free(wd);
+        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+        return NULL;
+    }
+
+    if(self->rx) {
+        wd->rx = self->rx;
+    } else {
+        wd->vs = hdhomerun_device_get_video_sock(device_hd(self));
+        if(!wd->vs) {
+            watchdog_free(wd);
+            PyErr_SetString(hdhomerun_device_error, "unable to find the stream socket");
+            return NULL;
+        }
+    }
+
+    wd->hd = hdhomerun_device_create(hdhomerun_device_get_device_id(device_hd(self)),
+                                     hdhomerun_device_get_device_ip(device_hd(self)),
+                                     hdhomerun_device_get_tuner(device_hd(self)), NULL);
+    if(!wd->hd) {
+        watchdog_free(wd);
+        PyErr_SetString(hdhomerun_device_error, "Failed to initialize Device object");
+        return NULL;
+    }
+    if(self->locked)
+        hdhomerun_device_tuner_lockkey_use_value(wd->hd, self->lockkey);
+
+    watchdog = PyObject_GC_New(py_watchdog_object, &hdhomerun_StreamWatchdog_type);
+    if(!watchdog) {
+        watchdog_free(wd);
+        return NULL;
+    }
+    watchdog->wd = wd;
+    watchdog->device = NULL;
+
+    /* One watchdog per stream */
+    device_watchdog_stop(self);
+    wd->last_data_ns = monotonic_ns();
+    if(pthread_create(&wd->thread, NULL, watchdog_thread, wd) != 0) {
+        Py_DECREF(watchdog);
+        PyErr_SetString(hdhomerun_device_error, "unable to start watchdog thread");
+        return NULL;
+    }
+    wd->running = 1;
+    PyObject_GC_Track((PyObject *)watchdog);
+
+    /* The Device holds the watchdog, so dropping the handle does not stop it */
+    Py_INCREF(watchdog);
+    watchdog->device = self;
+    self->watchdog = (PyObject *)watchdog;
+    return (PyObject *)watchdog;
+}
+
+/*
+ *  StreamWatchdog methods
+ */
+
+static void py_watchdog_dealloc(py_watchdog_object *self) {
+    PyObject_GC_UnTrack((PyObject *)self);
+    /* A Device running the watchdog holds a reference, so the thread has stopped by now */
+    if(self->wd)
+        watchdog_free(self->wd);
+    self->wd = NULL;
+    PyObject_GC_Del(self);
+}
+
+/* A callback which refers back to its StreamWatchdog makes a cycle */
+static int py_watchdog_traverse(py_watchdog_object *self, visitproc visit, void *arg) {
+    if(self->wd)
+        Py_VISIT(self->wd->callback);
+    return 0;
+}
+
+static int py_watchdog_clear(py_watchdog_object *self) {
+    /* Only a stopped watchdog is unreachable; a running thread may still call back */
+    if(self->wd && !self->wd->running)
+        Py_CLEAR(self->wd->callback);
+    return 0;
+}
+
+PyDoc_STRVAR(StreamWatchdog_DOC_fileno,
+    "Return a file descriptor which is readable while events are queued.");
+
+static PyObject *py_watchdog_fileno(py_watchdog_object *self) {
+    return PyInt_FromLong((long)self->wd->queue.pipe_fd[0]);
+}
+
+PyDoc_STRVAR(StreamWatchdog_DOC_events,
+    "Return (and remove) all queued events as a list of dicts.  Each has the\n"
+    "event name (stall, lock_lost, restart, restart_failed or recovered), the\n"
+    "restart attempt, idle_ms since data was last seen, recovery_ms from the\n"
+    "stall to the first new data for recovered events and an error for failed\n"
+    "restarts.");
+
+static PyObject *py_watchdog_events(py_watchdog_object *self) {
+    PyObject *result, *event;
+    struct event_queue_item *item;
+
+    result = PyList_New(0);
+    if(!result)
+        return NULL;
+
+    while((item = event_queue_pop(&self->wd->queue)) != NULL) {
+        event = build_watchdog_event((struct watchdog_event *)item->data);
+        free(item);
+        if(!event) { Py_DECREF(result); return NULL; }
+        if(PyList_Append(result, event) != 0) { Py_DECREF(event); Py_DECREF(result); return NULL; }
+        Py_DECREF(event);
+    }
+    return result;
+}
+
+PyDoc_STRVAR(StreamWatchdog_DOC_stats,
+    "Return the watchdog's state and counters.  Recovery times are in\n"
+    "milliseconds and None until the first recovery.");
+
+static PyObject *py_watchdog_stats(py_watchdog_object *self) {
+    struct stream_watchdog *wd = self->wd;
+    unsigned long stalls, lock_losses, restarts, restart_failures, recoveries;
+    uint64_t last_data, last_recovery, max_recovery;
+    PyObject *last_obj, *max_obj, *rv;
+    const char *state;
+
+    pthread_mutex_lock(&wd->lock);
+    state = !wd->running ? "stopped" : wd->stalled ? "stalled" : "streaming";
+    stalls = wd->stalls;
+    lock_losses = wd->lock_losses;
+    restarts = wd->restarts;
+    restart_failures = wd->restart_failures;
+    recoveries = wd->recoveries;
+    last_data = wd->last_data_ns;
+    last_recovery = wd->last_recovery_ns;
+    max_recovery = wd->max_recovery_ns;
+    pthread_mutex_unlock(&wd->lock);
+
+    if(recoveries) {
+        last_obj = PyFloat_FromDouble((double)last_recovery / 1e6);
+        max_obj = PyFloat_FromDouble((double)max_recovery / 1e6);
+    } else {
+        last_obj = Py_None;
+        max_obj = Py_None;
+        Py_INCREF(last_obj);
+        Py_INCREF(max_obj);
+    }
+    if(!last_obj || !max_obj) {
+        Py_XDECREF(last_obj);
+        Py_XDECREF(max_obj);
+        return NULL;
+    }
+    rv = Py_BuildValue("{s:s,s:d,s:k,s:k,s:k,s:k,s:k,s:O,s:O,s:k}", "state", state,
+                       "idle_ms", (double)(monotonic_ns() - last_data) / 1e6,
+                       "stalls", stalls, "lock_losses", lock_losses, "restarts", restarts,
+                       "restart_failures", restart_failures, "recoveries", recoveries,
+                       "last_recovery_ms", last_obj, "max_recovery_ms", max_obj,
+                       "dropped_events", wd->queue.dropped);
+    Py_DECREF(last_obj);
+    Py_DECREF(max_obj);
+    return rv;
+}
+
+PyDoc_STRVAR(StreamWatchdog_DOC_stop,
+    "Stop watching the stream.  Queued events remain available through events().");
+
+static PyObject *py_watchdog_stop(py_watchdog_object *self) {
+    if(self->device)
+        device_watchdog_stop(self->device);
+    else
+        watchdog_stop(self->wd);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef py_watchdog_methods[] = {
+    {"fileno",                  (PyCFunction)py_watchdog_fileno,                METH_NOARGS,                StreamWatchdog_DOC_fileno},
+    {"events",                  (PyCFunction)py_watchdog_events,                METH_NOARGS,                StreamWatchdog_DOC_events},
+    {"stats",                   (PyCFunction)py_watchdog_stats,                 METH_NOARGS,                StreamWatchdog_DOC_stats},
+    {"stop",                    (PyCFunction)py_watchdog_stop,                  METH_NOARGS,                StreamWatchdog_DOC_stop},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_StreamWatchdog_type_doc,
+    "A handle to a stream stall watchdog, created by Device.stream_watchdog().\n"
+    "The watchdog keeps running without it; events() and stats() remain\n"
+    "available after it stops.");
+
+PyTypeObject hdhomerun_StreamWatchdog_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.StreamWatchdog",     /* tp_name */
+    sizeof(py_watchdog_object),     /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_watchdog_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    hdhomerun_StreamWatchdog_type_doc, /* tp_doc */
+    (traverseproc)py_watchdog_traverse, /* tp_traverse */
+    (inquiry)py_watchdog_clear,     /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_watchdog_methods,            /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    0,                              /* tp_new */
+    0,                              /* tp_free */
+};
@@ -0,0 +1,341 @@
+/*
+ * device_zap.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  Channel change latency profiler.  Each zap is split into the phases below,
+ *  all timed from the moment the channel change request is sent.
+ */
+
+enum zap_phase {
+    ZAP_CONTROL = 0,    /* set_tuner_channel/vchannel acknowledged */
+    ZAP_SIGNAL,         /* status reports signal present */
+    ZAP_LOCK,           /* status reports lock */
+    ZAP_FIRST_PACKET,   /* first TS packet received */
+    ZAP_PAT,            /* first PAT section received */
+    ZAP_PMT,            /* first PMT section received */
+    ZAP_PHASES
+};
+
+static const char *zap_phase_names[ZAP_PHASES] = {
+    "control", "signal", "lock", "first_packet", "pat", "pmt"
+};
+
+#define ZAP_MAX_PMT_PIDS 32
+#define ZAP_NOT_REACHED UINT64_MAX
+
+struct zap_trial {
+    uint64_t phase_ns[ZAP_PHASES];  /* relative to the request, ZAP_NOT_REACHED if missing */
+    int lock_unsupported;           /* the tuner reported a lock it cannot demodulate */
+};
+
+static void zap_scan_packets(const uint8_t *data, size_t length, uint64_t elapsed_ns, struct zap_trial *trial,
+                             uint16_t *pmt_pids, int *pmt_count) {
+    const uint8_t *pkt, *section;
+    size_t section_length;
+    uint16_t pid;
+    int i;
+
+    for(pkt = data; pkt + TS_PACKET_SIZE <= data + length; pkt += TS_PACKET_SIZE) {
+        if(pkt[0] != TS_SYNC_BYTE)
+            continue;
+        if(trial->phase_ns[ZAP_FIRST_PACKET] == ZAP_NOT_REACHED)
+            trial->phase_ns[ZAP_FIRST_PACKET] = elapsed_ns;
+
+        section = ts_section_start(pkt, &section_length);
+        if(!section)
+            continue;
+        pid = TS_PID(pkt);
+        if(pid == 0 && trial->phase_ns[ZAP_PAT] == ZAP_NOT_REACHED) {
+            *pmt_count = ts_parse_pat(section, section_length, pmt_pids, ZAP_MAX_PMT_PIDS);
+            if(*pmt_count >= 0)
+                trial->phase_ns[ZAP_PAT] = elapsed_ns;
+            continue;
+        }
+        if(trial->phase_ns[ZAP_PAT] == ZAP_NOT_REACHED || trial->phase_ns[ZAP_PMT] != ZAP_NOT_REACHED)
+            continue;
+        for(i = 0; i < *pmt_count; i++) {
+            if(pmt_pids[i] == pid && section[0] == 0x02) {
+                trial->phase_ns[ZAP_PMT] = elapsed_ns;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ *  Returns 1 on completion (even if some phases were not reached), or a
+ *  libhdhomerun error code.  Called without the GIL; the caller has already
+ *  run device_fork_check().
+ */
+static int zap_run_trial(py_device_object *self, struct hdhomerun_device_t *hd, const char *channel, int virtual_channel,
+                         unsigned int timeout_ms, unsigned int poll_ms, struct zap_trial *trial) {
+    struct hdhomerun_tuner_status_t status;
+    uint16_t pmt_pids[ZAP_MAX_PMT_PIDS];
+    int pmt_count = 0;
+    uint64_t start_ns, elapsed_ns, timeout_ns = (uint64_t)timeout_ms * 1000000ULL;
+    char *status_str;
+    uint8_t *data;
+    size_t length;
+    int success, i;
+
+    for(i = 0; i < ZAP_PHASES; i++)
+        trial->phase_ns[i] = ZAP_NOT_REACHED;
+    trial->lock_unsupported = 0;
+
+    start_ns = monotonic_ns();
+    if(virtual_channel)
+        success = hdhomerun_device_set_tuner_vchannel(hd, channel);
+    else
+        success = hdhomerun_device_set_tuner_channel(hd, channel);
+    if(success != 1)
+        return success;
+    trial->phase_ns[ZAP_CONTROL] = monotonic_ns() - start_ns;
+    /* Anything buffered so far belongs to the previous channel */
+    device_stream_flush(self);
+
+    while(trial->phase_ns[ZAP_PMT] == ZAP_NOT_REACHED) {
+        elapsed_ns = monotonic_ns() - start_ns;
+        if(elapsed_ns > timeout_ns)
+            break;
+
+        if(trial->phase_ns[ZAP_LOCK] == ZAP_NOT_REACHED && !trial->lock_unsupported) {
+            success = hdhomerun_device_get_tuner_status(hd, &status_str, &status);
+            if(success != 1)
+                return success;
+            elapsed_ns = monotonic_ns() - start_ns;
+            if(status.signal_present && trial->phase_ns[ZAP_SIGNAL] == ZAP_NOT_REACHED)
+                trial->phase_ns[ZAP_SIGNAL] = elapsed_ns;
+            if(status.lock_supported) {
+                if(trial->phase_ns[ZAP_SIGNAL] == ZAP_NOT_REACHED)
+                    trial->phase_ns[ZAP_SIGNAL] = elapsed_ns;
+                trial->phase_ns[ZAP_LOCK] = elapsed_ns;
+            } else if(status.lock_unsupported) {
+                /* Lock will never be reported; keep timing whatever still arrives */
+                trial->lock_unsupported = 1;
+            }
+        }
+
+        data = device_stream_recv(self, VIDEO_DATA_BUFFER_SIZE_1S, &length);
+        if(data) {
+            zap_scan_packets(data, length, monotonic_ns() - start_ns, trial, pmt_pids, &pmt_count);
+            continue;
+        }
+        msleep_minimum(poll_ms);
+    }
+    return 1;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Nearest-rank percentile of a sorted array, in milliseconds */
+static double percentile_ms(const uint64_t *sorted, size_t count, unsigned int pct) {
+    size_t rank = (count * pct + 99) / 100;
+
+    if(rank == 0)
+        rank = 1;
+    return (double)sorted[rank - 1] / 1000000.0;
+}
+
+static PyObject *build_percentile_dict(uint64_t *samples, size_t count) {
+    qsort(samples, count, sizeof(uint64_t), compare_u64);
+    return Py_BuildValue("{s:n,s:d,s:d,s:d,s:d,s:d}",
+                         "count", (Py_ssize_t)count,
+                         "min", percentile_ms(samples, count, 0),
+                         "p50", percentile_ms(samples, count, 50),
+                         "p90", percentile_ms(samples, count, 90),
+                         "p99", percentile_ms(samples, count, 99),
+                         "max", percentile_ms(samples, count, 100));
+}
+
+static PyObject *build_zap_table(struct zap_trial *trials, unsigned int repeats, unsigned int failures,
+                                 unsigned int unsupported) {
+    PyObject *rv, *dv;
+    uint64_t *samples;
+    size_t count;
+    unsigned int r;
+    int phase;
+
+    samples = malloc(sizeof(uint64_t) * (repeats ? repeats : 1));
+    if(!samples)
+        return PyErr_NoMemory();
+
+    rv = Py_BuildValue("{s:I,s:I,s:I}", "trials", repeats, "failures", failures, "lock_unsupported", unsupported);
+    if(!rv) { free(samples); return NULL; }
+
+    for(phase = 0; phase < ZAP_PHASES; phase++) {
+        count = 0;
+        for(r = 0; r < repeats; r++) {
+            if(trials[r].phase_ns[phase] != ZAP_NOT_REACHED)
+                samples[count++] = trials[r].phase_ns[phase];
+        }
+        if(count == 0) {
+            Py_INCREF(Py_None);
+            dv = Py_None;
+        } else {
+            dv = build_percentile_dict(samples, count);
+            if(!dv) { free(samples); Py_DECREF(rv); return NULL; }
+        }
+        if(PyDict_SetItemString(rv, zap_phase_names[phase], dv) != 0) {
+            Py_DECREF(dv); free(samples); Py_DECREF(rv); return NULL;
+        }
+        Py_DECREF(dv);
+    }
+    free(samples);
+    return rv;
+}
+
+const char Device_DOC_measure_zap[] =
+    "Measure channel change latency.\n\n"
+    "Tunes to each of the given channels in turn, repeats times, and times the\n"
+    "control acknowledgement, signal present, lock, first TS packet, first PAT\n"
+    "and first PMT phases with a monotonic clock.  Streaming is started for the\n"
+    "measurement and stopped afterwards.  Returns a dict mapping each channel to\n"
+    "per-phase percentile tables (in milliseconds); phases not reached within\n"
+    "timeout_ms are counted as failures.  Trials where the tuner reported a lock\n"
+    "it cannot demodulate are counted under lock_unsupported instead, with the\n"
+    "phases they did reach still included.  Works against any device reachable\n"
+    "by the Device object, including a local emulator.";
+PyObject *py_device_measure_zap(py_device_object *self, PyObject *args, PyObject *kwds) {
+    PyObject *channels_obj, *seq, *item, *rv = NULL, *table;
+    struct hdhomerun_device_t *hd;
+    unsigned int repeats = 5, timeout_ms = 5000, poll_ms = 10;
+    PyObject *vchannel_obj = NULL;
+    char *kwlist[] = {"channels", "repeats", "vchannel", "timeout_ms", "poll_ms", NULL};
+    char **channels = NULL;
+    struct zap_trial *trials = NULL;
+    unsigned int *failures = NULL, *unsupported = NULL;
+    Py_ssize_t count = 0, c;
+    unsigned int r;
+    int virtual_channel = 0;
+    int success = 1, phase;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|IO!II", kwlist, &channels_obj, &repeats,
+                                    &PyBool_Type, &vchannel_obj, &timeout_ms, &poll_ms))
+        return NULL;
+    if(vchannel_obj)
+        virtual_channel = (vchannel_obj == Py_True);
+    if(self->conn && !self->rx) {
+        PyErr_SetString(PyExc_ValueError, "a Device on a Connection must call stream_start() first");
+        return NULL;
+    }
+
+    seq = PySequence_Fast(channels_obj, "channels must be a sequence of strings");
+    if(!seq)
+        return NULL;
+    count = PySequence_Fast_GET_SIZE(seq);
+    if(count == 0 || repeats == 0) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "at least one channel and one repeat are required");
+        return NULL;
+    }
+
+    /* Copy everything needed while the GIL is released */
+    channels = calloc((size_t)count, sizeof(char *));
+    trials = calloc((size_t)count * repeats, sizeof(struct zap_trial));
+    failures = calloc((size_t)count, sizeof(unsigned int));
+    unsupported = calloc((size_t)count, sizeof(unsigned int));
+    if(!channels || !trials || !failures || !unsupported) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    for(c = 0; c < count; c++) {
+        item = PySequence_Fast_GET_ITEM(seq, c);
+        if(!PyString_Check(item)) {
+            PyErr_SetString(PyExc_TypeError, "channels must be a sequence of strings");
+            goto done;
+        }
+        channels[c] = strdup(PyString_AS_STRING(item));
+        if(!channels[c]) {
+            PyErr_NoMemory();
+            goto done;
+        }
+    }
+
+    /* This also runs the fork check device_stream_recv() relies on */
+    hd = device_hd_acquire(self);
+    Py_BEGIN_ALLOW_THREADS
+    /* Use the native receiver if stream_start set one up, else the library's */
+    success = self->rx ? 1 : hdhomerun_device_stream_start(hd);
+    /* Interleave the channels so that every trial is a real channel change */
+    for(r = 0; r < repeats && success == 1; r++) {
+        for(c = 0; c < count && success == 1; c++) {
+            struct zap_trial *trial = &trials[(size_t)c * repeats + r];
+
+            success = zap_run_trial(self, hd, channels[c], virtual_channel, timeout_ms, poll_ms, trial);
+            if(trial->lock_unsupported) {
+                unsupported[c]++;
+                continue;
+            }
+            for(phase = 0; phase < ZAP_PHASES; phase++) {
+                if(trial->phase_ns[phase] == ZAP_NOT_REACHED) {
+                    failures[c]++;
+                    break;
+                }
+            }
+        }
+    }
+    if(!self->rx)
+        hdhomerun_device_stream_stop(hd);
+    device_hd_release(self);
+    Py_END_ALLOW_THREADS
+
+    if(success == -1) {
+        PyErr_SetString(PyExc_IOError, DEVICE_ERR_COMMUNICATION);
+        goto done;
+    } else if(success == 0) {
+        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_REJECTED_OP);
+        goto done;
+    } else if(success != 1) {
+        PyErr_SetString(hdhomerun_device_error, DEVICE_ERR_UNDOCUMENTED);
+        goto done;
+    }
+
+    rv = PyDict_New();
+    if(!rv)
+        goto done;
+    for(c = 0; c < count; c++) {
+        table = build_zap_table(&trials[(size_t)c * repeats], repeats, failures[c], unsupported[c]);
+        if(!table || PyDict_SetItem(rv, PySequence_Fast_GET_ITEM(seq, c), table) != 0) {
+            Py_XDECREF(table);
+            Py_CLEAR(rv);
+            goto done;
+        }
+        Py_DECREF(table);
+    }
+
+done:
+    if(channels) {
+        for(c = 0; c < count; c++)
+            free(channels[c]);
+    }
+    free(channels);
+    free(trials);
+    free(failures);
+    free(unsupported);
+    Py_DECREF(seq);
+    return rv;
+}
@@ -0,0 +1,118 @@
+/*
+ * event_queue.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ *  None of these functions touch Python state, so they may be called from
+ *  native threads which do not hold the GIL.
+ */
+
+int event_queue_init(struct event_queue *q, size_t limit) {
+    memset(q, 0, sizeof(*q));
+    q->limit = limit;
+    if(pipe(q->pipe_fd) != 0)
+        return -1;
+    fcntl(q->pipe_fd[0], F_SETFL, fcntl(q->pipe_fd[0], F_GETFL) | O_NONBLOCK);
+    fcntl(q->pipe_fd[1], F_SETFL, fcntl(q->pipe_fd[1], F_GETFL) | O_NONBLOCK);
+    fcntl(q->pipe_fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(q->pipe_fd[1], F_SETFD, FD_CLOEXEC);
+    pthread_mutex_init(&q->lock, NULL);
+    return 0;
+}
+
+void event_queue_destroy(struct event_queue *q) {
+    struct event_queue_item *item;
+
+    while((item = q->head) != NULL) {
+        q->head = item->next;
+        free(item);
+    }
+    q->tail = NULL;
+    q->count = 0;
+    close(q->pipe_fd[0]);
+    close(q->pipe_fd[1]);
+    pthread_mutex_destroy(&q->lock);
+}
+
+/* Returns 1 if the item was queued, 0 if an older item was dropped to make room, -1 on allocation failure */
+int event_queue_push(struct event_queue *q, const void *data, size_t length) {
+    struct event_queue_item *item, *old = NULL;
+    int rv = 1;
+
+    item = malloc(sizeof(*item) + length);
+    if(!item)
+        return -1;
+    item->next = NULL;
+    item->length = length;
+    memcpy(item->data, data, length);
+
+    pthread_mutex_lock(&q->lock);
+    if(q->limit > 0 && q->count >= q->limit) {
+        /* Keep the newest events; a slow consumer mostly cares about the current state */
+        old = q->head;
+        q->head = old->next;
+        if(!q->head)
+            q->tail = NULL;
+        q->count--;
+        q->dropped++;
+        rv = 0;
+    }
+    if(q->tail)
+        q->tail->next = item;
+    else
+        q->head = item;
+    q->tail = item;
+    q->count++;
+    if(!q->signalled) {
+        if(write(q->pipe_fd[1], "!", 1) == 1)
+            q->signalled = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    free(old);
+    return rv;
+}
+
+/* Returns the oldest item (which the caller must free()) or NULL if the queue is empty */
+struct event_queue_item *event_queue_pop(struct event_queue *q) {
+    struct event_queue_item *item;
+    char scratch[16];
+
+    pthread_mutex_lock(&q->lock);
+    item = q->head;
+    if(item) {
+        q->head = item->next;
+        if(!q->head)
+            q->tail = NULL;
+        q->count--;
+    }
+    if(!q->head && q->signalled) {
+        while(read(q->pipe_fd[0], scratch, sizeof(scratch)) > 0)
+            ;
+        q->signalled = 0;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return item;
+}
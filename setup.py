@@ -7,7 +7,35 @@ source_files = [
     'device_common.c',
     'device_get.c',
     'device_type.c',
+    'device_info.c',
+    'device_connection.c',
+    'device_fork.c',
     'device_set.c',
+    'device_capability.c',
+    'device_registry.c',
+    'device_varcache.c',
+    'device_control.c',
+    'device_tune.c',
+    'device_zap.c',
+    'device_watch.c',
+    'device_watchdog.c',
+    'device_exporter.c',
+    'device_trace.c',
+    'device_fastzap.c',
+    'event_queue.c',
+    'write_queue.c',
+    'stream_rx.c',
+    'stream_group.c',
+    'stream_replay.c',
+    'stream_stage.c',
+    'device_pcr.c',
+    'device_record.c',
+    'device_segment.c',
+    'device_epg.c',
+    'ts_util.c',
+    'ts_simd.c',
+    'ts_index.c',
+    'ts_table.c',
 ]
 
 module = Extension(
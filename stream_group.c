@@ -0,0 +1,543 @@
+/*
+ * stream_group.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+/*
+ *  A StreamGroup services the native receivers of many tuners from a few
+ *  epoll threads instead of one thread per tuner.  Members are spread over
+ *  the threads by count; each datagram still lands in its own tuner's ring,
+ *  and the group's pipe becomes readable whenever one of them receives data
+ *  so that Python can wait on all of them at once.
+ */
+
+#define STREAM_GROUP_POLL_MS 100
+#define STREAM_GROUP_EVENTS 64
+#define STREAM_GROUP_MAX_THREADS 64
+
+typedef struct {
+    PyObject_HEAD
+    struct stream_group *group;     /* NULL once closed */
+    PyObject *devices;              /* the member Devices; each leaves when its receiver goes */
+} py_stream_group_object;
+
+static void stream_group_signal(struct stream_group *group) {
+    pthread_mutex_lock(&group->lock);
+    if(!group->signalled) {
+        if(write(group->pipe_fd[1], "!", 1) == 1)
+            group->signalled = 1;
+    }
+    pthread_mutex_unlock(&group->lock);
+}
+
+static void *stream_group_thread(void *arg) {
+    struct stream_group_thread *t = arg;
+    struct epoll_event events[STREAM_GROUP_EVENTS];
+    struct stream_rx *rx;
+    int count, i, received;
+
+    while(!t->group->stopping) {
+        count = epoll_wait(t->epoll_fd, events, STREAM_GROUP_EVENTS, STREAM_GROUP_POLL_MS);
+        if(count <= 0)
+            continue;
+
+        received = 0;
+        pthread_mutex_lock(&t->lock);
+        t->wakeups++;
+        for(i = 0; i < count; i++) {
+            /* The slot may have been emptied (or reused) since epoll_wait returned */
+            if(events[i].data.u32 >= t->capacity)
+                continue;
+            rx = t->members[events[i].data.u32];
+            if(!rx)
+                continue;
+            t->services++;
+            switch(stream_rx_service(rx)) {
+            case -1:
+                /* The socket is broken; stop waking up for it */
+                epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL, rx->sock, NULL);
+                break;
+            case 0:
+                break;
+            default:
+                received = 1;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&t->lock);
+
+        if(received)
+            stream_group_signal(t->group);
+    }
+    return NULL;
+}
+
+static void stream_group_destroy(struct stream_group *group) {
+    unsigned int i;
+
+    group->stopping = 1;
+    for(i = 0; i < group->thread_count; i++) {
+        /* After fork() the threads only exist in the parent */
+        if(group->threads[i].running && group->generation == fork_generation_current())
+            pthread_join(group->threads[i].thread, NULL);
+        if(group->threads[i].epoll_fd >= 0)
+            close(group->threads[i].epoll_fd);
+        free(group->threads[i].members);
+        pthread_mutex_destroy(&group->threads[i].lock);
+    }
+    free(group->threads);
+    close(group->pipe_fd[0]);
+    close(group->pipe_fd[1]);
+    pthread_mutex_destroy(&group->lock);
+    free(group);
+}
+
+/* Returns NULL with errno set on failure */
+static struct stream_group *stream_group_create(unsigned int thread_count) {
+    struct stream_group *group;
+    struct stream_group_thread *t;
+    unsigned int i;
+    int error;
+
+    group = calloc(1, sizeof(*group));
+    if(!group)
+        return NULL;
+    if(pipe(group->pipe_fd) != 0) {
+        free(group);
+        return NULL;
+    }
+    fcntl(group->pipe_fd[0], F_SETFL, fcntl(group->pipe_fd[0], F_GETFL) | O_NONBLOCK);
+    fcntl(group->pipe_fd[1], F_SETFL, fcntl(group->pipe_fd[1], F_GETFL) | O_NONBLOCK);
+    fcntl(group->pipe_fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(group->pipe_fd[1], F_SETFD, FD_CLOEXEC);
+    pthread_mutex_init(&group->lock, NULL);
+    group->generation = fork_generation_current();
+
+    group->threads = calloc(thread_count, sizeof(struct stream_group_thread));
+    if(!group->threads) {
+        stream_group_destroy(group);
+        return NULL;
+    }
+    group->thread_count = thread_count;
+    for(i = 0; i < thread_count; i++) {
+        t = &group->threads[i];
+        t->group = group;
+        pthread_mutex_init(&t->lock, NULL);
+        t->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    }
+    for(i = 0; i < thread_count; i++) {
+        t = &group->threads[i];
+        if(t->epoll_fd < 0) {
+            error = errno;
+            stream_group_destroy(group);
+            errno = error;
+            return NULL;
+        }
+    }
+    for(i = 0; i < thread_count; i++) {
+        t = &group->threads[i];
+        /* pthread_create() returns the error instead of setting errno */
+        error = pthread_create(&t->thread, NULL, stream_group_thread, t);
+        if(error != 0) {
+            stream_group_destroy(group);
+            errno = error;
+            return NULL;
+        }
+        t->running = 1;
+    }
+    return group;
+}
+
+/* Hands the receiver to the least loaded thread; returns -1 with errno set on failure */
+int stream_group_add(struct stream_group *group, struct stream_rx *rx) {
+    struct stream_group_thread *t = &group->threads[0];
+    struct stream_rx **members;
+    struct epoll_event event;
+    unsigned int i, slot, capacity;
+
+    for(i = 1; i < group->thread_count; i++) {
+        if(group->threads[i].count < t->count)
+            t = &group->threads[i];
+    }
+
+    pthread_mutex_lock(&t->lock);
+    for(slot = 0; slot < t->capacity && t->members[slot]; slot++)
+        ;
+    if(slot == t->capacity) {
+        capacity = t->capacity ? t->capacity * 2 : 16;
+        members = realloc(t->members, capacity * sizeof(*members));
+        if(!members) {
+            pthread_mutex_unlock(&t->lock);
+            errno = ENOMEM;
+            return -1;
+        }
+        memset(members + t->capacity, 0, (capacity - t->capacity) * sizeof(*members));
+        t->members = members;
+        t->capacity = capacity;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = slot;
+    if(epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, rx->sock, &event) != 0) {
+        pthread_mutex_unlock(&t->lock);
+        return -1;
+    }
+    t->members[slot] = rx;
+    t->count++;
+    rx->group = group;
+    rx->group_thread = (unsigned int)(t - group->threads);
+    rx->group_slot = slot;
+    pthread_mutex_unlock(&t->lock);
+    return 0;
+}
+
+/* Once this returns the group's threads will not touch the receiver again */
+void stream_group_remove(struct stream_group *group, struct stream_rx *rx) {
+    struct stream_group_thread *t = &group->threads[rx->group_thread];
+
+    pthread_mutex_lock(&t->lock);
+    epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL, rx->sock, NULL);
+    t->members[rx->group_slot] = NULL;
+    t->count--;
+    pthread_mutex_unlock(&t->lock);
+    rx->group = NULL;
+}
+
+/* Internal: used by Device.stream_start(group=...); the group holds the Device until it leaves */
+struct stream_group *py_stream_group_join(PyObject *obj, py_device_object *device) {
+    py_stream_group_object *self = (py_stream_group_object *)obj;
+
+    if(!self->group) {
+        PyErr_SetString(PyExc_ValueError, "StreamGroup is closed");
+        return NULL;
+    }
+    if(PyList_Append(self->devices, (PyObject *)device) != 0)
+        return NULL;
+    device->stream_group = obj;
+    return self->group;
+}
+
+/* Internal: called whenever a Device's receiver goes away; drops the group's reference */
+void py_stream_group_leave(py_device_object *device) {
+    py_stream_group_object *self = (py_stream_group_object *)device->stream_group;
+    Py_ssize_t i;
+
+    if(!self)
+        return;
+    device->stream_group = NULL;
+    for(i = 0; i < PyList_GET_SIZE(self->devices); i++) {
+        if(PyList_GET_ITEM(self->devices, i) == (PyObject *)device) {
+            /* The caller still holds a reference, so this never frees the Device */
+            PyList_SetSlice(self->devices, i, i + 1, NULL);
+            break;
+        }
+    }
+}
+
+static int py_stream_group_is_member(py_stream_group_object *self, PyObject *obj) {
+    py_device_object *device = (py_device_object *)obj;
+
+    return self->group && device->rx && device->rx->group == self->group;
+}
+
+/*
+ *  Stops every member's stream and the group's threads.  Returns -1 with the
+ *  first member's error set if any failed, or with unraisable set (from
+ *  dealloc) reports each failure as it happens and returns 0.
+ */
+static int py_stream_group_close_group(py_stream_group_object *self, int unraisable) {
+    struct stream_group *group = self->group;
+    PyObject *device, *rv;
+    PyObject *type = NULL, *value = NULL, *traceback = NULL;
+
+    if(!group)
+        return 0;
+    /* Stopping a member makes it leave, which removes it from the list */
+    while(PyList_GET_SIZE(self->devices) > 0) {
+        device = PyList_GET_ITEM(self->devices, 0);
+        Py_INCREF(device);
+        rv = py_device_stream_stop((py_device_object *)device);
+        if(rv)
+            Py_DECREF(rv);
+        else if(unraisable)
+            PyErr_WriteUnraisable(device);
+        else if(!type)
+            PyErr_Fetch(&type, &value, &traceback);
+        else
+            PyErr_Clear();
+        if(PyList_GET_SIZE(self->devices) > 0 && PyList_GET_ITEM(self->devices, 0) == device) {
+            ((py_device_object *)device)->stream_group = NULL;
+            PyList_SetSlice(self->devices, 0, 1, NULL);
+        }
+        Py_DECREF(device);
+    }
+
+    self->group = NULL;
+    Py_BEGIN_ALLOW_THREADS
+    stream_group_destroy(group);
+    Py_END_ALLOW_THREADS
+    if(type) {
+        PyErr_Restore(type, value, traceback);
+        return -1;
+    }
+    return 0;
+}
+
+static int py_stream_group_init(py_stream_group_object *self, PyObject *args, PyObject *kwds) {
+    unsigned int threads = 1;
+    char *kwlist[] = {"threads", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &threads))
+        return -1;
+    if(self->group) {
+        PyErr_SetString(PyExc_RuntimeError, "StreamGroup is already initialized");
+        return -1;
+    }
+    if(threads < 1 || threads > STREAM_GROUP_MAX_THREADS) {
+        PyErr_Format(PyExc_ValueError, "threads must be between 1 and %d", STREAM_GROUP_MAX_THREADS);
+        return -1;
+    }
+    self->devices = PyList_New(0);
+    if(!self->devices)
+        return -1;
+    self->group = stream_group_create(threads);
+    if(!self->group) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    return 0;
+}
+
+static void py_stream_group_dealloc(py_stream_group_object *self) {
+    py_stream_group_close_group(self, 1);
+    Py_XDECREF(self->devices);
+    self->ob_type->tp_free((PyObject*)self);
+}
+
+PyDoc_STRVAR(StreamGroup_DOC_fileno,
+    "Return a file descriptor which becomes readable when a member receives data.");
+
+static PyObject *py_stream_group_fileno(py_stream_group_object *self) {
+    if(!self->group) {
+        PyErr_SetString(PyExc_ValueError, "StreamGroup is closed");
+        return NULL;
+    }
+    return PyInt_FromLong((long)self->group->pipe_fd[0]);
+}
+
+PyDoc_STRVAR(StreamGroup_DOC_ready,
+    "Wait up to timeout seconds (forever if None) for stream data and return\n"
+    "the list of member Devices with data waiting for stream_recv().");
+
+static PyObject *py_stream_group_ready(py_stream_group_object *self, PyObject *args, PyObject *kwds) {
+    PyObject *timeout_obj = Py_None, *result, *device;
+    char *kwlist[] = {"timeout", NULL};
+    struct stream_group *group = self->group;
+    struct pollfd pfd;
+    char scratch[16];
+    uint64_t deadline = 0, now;
+    long remaining = -1;
+    int slice;
+    Py_ssize_t i;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &timeout_obj))
+        return NULL;
+    if(!group) {
+        PyErr_SetString(PyExc_ValueError, "StreamGroup is closed");
+        return NULL;
+    }
+    if(timeout_obj != Py_None) {
+        double timeout = PyFloat_AsDouble(timeout_obj);
+        if(timeout == -1.0 && PyErr_Occurred())
+            return NULL;
+        remaining = 0;
+        if(timeout > 0.0) {
+            deadline = monotonic_ns() + (uint64_t)(timeout * 1e9);
+            remaining = 1;
+        }
+    }
+
+    /* Data which arrived before the last ready() call does not re-signal the pipe */
+    result = PyList_New(0);
+    if(!result)
+        return NULL;
+    for(;;) {
+        pthread_mutex_lock(&group->lock);
+        while(read(group->pipe_fd[0], scratch, sizeof(scratch)) > 0)
+            ;
+        group->signalled = 0;
+        pthread_mutex_unlock(&group->lock);
+
+        for(i = 0; i < PyList_GET_SIZE(self->devices); i++) {
+            device = PyList_GET_ITEM(self->devices, i);
+            if(py_stream_group_is_member(self, device) && stream_rx_available(((py_device_object *)device)->rx) > 0) {
+                if(PyList_Append(result, device) != 0) {
+                    Py_DECREF(result);
+                    return NULL;
+                }
+            }
+        }
+        if(deadline) {
+            /* Wakeups without data for a member still use up the timeout */
+            now = monotonic_ns();
+            remaining = now < deadline ? (long)((deadline - now + 999999) / 1000000) : 0;
+        }
+        if(PyList_GET_SIZE(result) > 0 || remaining == 0)
+            return result;
+
+        /* Wait in slices so that signals (e.g. KeyboardInterrupt) are noticed */
+        slice = (remaining < 0 || remaining > STREAM_GROUP_POLL_MS) ? STREAM_GROUP_POLL_MS : (int)remaining;
+        pfd.fd = group->pipe_fd[0];
+        pfd.events = POLLIN;
+        Py_BEGIN_ALLOW_THREADS
+        poll(&pfd, 1, slice);
+        Py_END_ALLOW_THREADS
+        if(PyErr_CheckSignals() != 0) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+}
+
+PyDoc_STRVAR(StreamGroup_DOC_devices,
+    "Return the Devices currently streaming through this group.");
+
+static PyObject *py_stream_group_devices(py_stream_group_object *self) {
+    PyObject *result, *device;
+    Py_ssize_t i;
+
+    result = PyList_New(0);
+    if(!result)
+        return NULL;
+    for(i = 0; i < PyList_GET_SIZE(self->devices); i++) {
+        device = PyList_GET_ITEM(self->devices, i);
+        if(py_stream_group_is_member(self, device) && PyList_Append(result, device) != 0) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+PyDoc_STRVAR(StreamGroup_DOC_stats,
+    "Return a list with the member count, epoll wakeups and socket services\n"
+    "of each of the group's threads.");
+
+static PyObject *py_stream_group_stats(py_stream_group_object *self) {
+    struct stream_group_thread *t;
+    PyObject *result, *dv;
+    unsigned long long wakeups, services;
+    unsigned int i, members;
+
+    if(!self->group) {
+        PyErr_SetString(PyExc_ValueError, "StreamGroup is closed");
+        return NULL;
+    }
+    result = PyList_New(self->group->thread_count);
+    if(!result)
+        return NULL;
+    for(i = 0; i < self->group->thread_count; i++) {
+        t = &self->group->threads[i];
+        pthread_mutex_lock(&t->lock);
+        members = t->count;
+        wakeups = t->wakeups;
+        services = t->services;
+        pthread_mutex_unlock(&t->lock);
+        dv = Py_BuildValue("{s:I,s:K,s:K}", "members", members, "wakeups", wakeups, "services", services);
+        if(!dv) { Py_DECREF(result); return NULL; }
+        PyList_SET_ITEM(result, i, dv);
+    }
+    return result;
+}
+
+PyDoc_STRVAR(StreamGroup_DOC_close,
+    "Stop every member's stream and the group's threads.");
+
+static PyObject *py_stream_group_close(py_stream_group_object *self) {
+    if(py_stream_group_close_group(self, 0) != 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef py_stream_group_methods[] = {
+    {"fileno",                  (PyCFunction)py_stream_group_fileno,            METH_NOARGS,                StreamGroup_DOC_fileno},
+    {"ready",                   (PyCFunction)py_stream_group_ready,             METH_KEYWORDS,              StreamGroup_DOC_ready},
+    {"devices",                 (PyCFunction)py_stream_group_devices,           METH_NOARGS,                StreamGroup_DOC_devices},
+    {"stats",                   (PyCFunction)py_stream_group_stats,             METH_NOARGS,                StreamGroup_DOC_stats},
+    {"close",                   (PyCFunction)py_stream_group_close,             METH_NOARGS,                StreamGroup_DOC_close},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_StreamGroup_type_doc,
+    "StreamGroup(threads=1)\n\n"
+    "Receives the streams of many tuners on a few shared epoll threads.  Add a\n"
+    "tuner with Device.stream_start(group=...), then wait for data across all\n"
+    "of them with ready() (or select() on the group) and read each with\n"
+    "stream_recv() as usual.");
+
+PyTypeObject hdhomerun_StreamGroup_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.StreamGroup",        /* tp_name */
+    sizeof(py_stream_group_object), /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_stream_group_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    hdhomerun_StreamGroup_type_doc, /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_stream_group_methods,        /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    (initproc)py_stream_group_init, /* tp_init */
+    (allocfunc)PyType_GenericAlloc, /* tp_alloc */
+    (newfunc)PyType_GenericNew,     /* tp_new */
+    (freefunc)PyObject_Del,         /* tp_free */
+};
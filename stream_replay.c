@@ -0,0 +1,301 @@
+/*
+ * stream_replay.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ *  Replays a captured transport stream into a native receiver's ring, in
+ *  VIDEO_DATA_PACKET_SIZE datagrams as the device would send them.  When
+ *  paced, each datagram is released at the time given by the first PCR PID,
+ *  interpolated between PCRs at the rate of the previous interval; a full
+ *  ring then overflows like the socket would.  Unpaced replay waits for room
+ *  instead, so that throughput tests see every packet.  Loss and jitter are
+ *  injected per datagram from a seeded generator, so runs are repeatable.
+ */
+
+#define REPLAY_WAIT_NS 100000000ULL         /* longest sleep before checking for a stop */
+#define REPLAY_FULL_WAIT_NS 1000000ULL
+#define REPLAY_MAX_LAG_NS 1000000000ULL     /* further behind than this and pacing restarts */
+#define REPLAY_PCR_JUMP 27000000ULL         /* larger PCR steps are discontinuities */
+#define REPLAY_PRIME_SIZE (TS_PACKET_SIZE * 4096)
+#define REPLAY_PCR_WRAP (((uint64_t)1 << 33) * 300)
+
+static void sleep_until(uint64_t due_ns) {
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(due_ns / 1000000000ULL);
+    ts.tv_nsec = (long)(due_ns % 1000000000ULL);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/* xorshift64* */
+static uint64_t replay_random(struct stream_replay *rp) {
+    rp->rng ^= rp->rng >> 12;
+    rp->rng ^= rp->rng << 25;
+    rp->rng ^= rp->rng >> 27;
+    return rp->rng * 2685821657736338717ULL;
+}
+
+/* Estimates the initial rate from the first two PCRs, so that the first interval is paced too */
+static void replay_prime(struct stream_replay *rp) {
+    uint8_t *buffer;
+    const uint8_t *pkt;
+    ssize_t got;
+    uint64_t pcr, first_pcr = 0, ticks;
+    int discontinuity, pid = -1;
+    size_t first = 0;
+
+    buffer = malloc(REPLAY_PRIME_SIZE);
+    if(!buffer)
+        return;
+    got = pread(rp->fd, buffer, REPLAY_PRIME_SIZE, 0);
+    for(pkt = buffer; got > 0 && pkt + TS_PACKET_SIZE <= buffer + got; pkt += TS_PACKET_SIZE) {
+        if(!ts_get_pcr(pkt, &pcr, &discontinuity))
+            continue;
+        if(pid < 0) {
+            pid = TS_PID(pkt);
+            first_pcr = pcr;
+            first = (size_t)(pkt - buffer);
+        } else if(TS_PID(pkt) == pid) {
+            ticks = (pcr + REPLAY_PCR_WRAP - first_pcr) % REPLAY_PCR_WRAP;
+            if(ticks > 0 && ticks <= REPLAY_PCR_JUMP)
+                rp->bytes_per_ns = (double)((size_t)(pkt - buffer) - first) / ((double)ticks * 1000.0 / 27.0);
+            break;
+        }
+    }
+    free(buffer);
+}
+
+int stream_replay_open(struct stream_rx *rx, const struct stream_replay_config *config) {
+    struct stream_replay *rp;
+    uint8_t probe[TS_PACKET_SIZE + 1];
+    ssize_t got;
+
+    rp = calloc(1, sizeof(*rp));
+    if(!rp)
+        return -1;
+    rp->fd = open(config->path, O_RDONLY | O_CLOEXEC);
+    if(rp->fd < 0) {
+        free(rp);
+        return -1;
+    }
+    /* Only plain 188 byte packet captures are supported */
+    got = pread(rp->fd, probe, sizeof(probe), 0);
+    if(got < 1 || probe[0] != TS_SYNC_BYTE || (got == sizeof(probe) && probe[TS_PACKET_SIZE] != TS_SYNC_BYTE)) {
+        close(rp->fd);
+        free(rp);
+        errno = EINVAL;
+        return -1;
+    }
+
+    rp->speed = config->speed;
+    if(config->loss >= 1.0)
+        rp->loss_threshold = UINT32_MAX;
+    else if(config->loss > 0.0)
+        rp->loss_threshold = (uint32_t)(config->loss * 4294967296.0);
+    rp->jitter_ns = (uint64_t)config->jitter_us * 1000;
+    rp->loop = config->loop;
+    rp->rng = config->seed ? config->seed : monotonic_ns() | 1;
+    rp->pcr_pid = -1;
+    if(rp->speed > 0.0)
+        replay_prime(rp);
+    rx->replay = rp;
+    return 0;
+}
+
+void stream_replay_close(struct stream_replay *rp) {
+    close(rp->fd);
+    free(rp);
+}
+
+/* Returns when the datagram is due and advances the clock over its PCRs */
+static uint64_t replay_schedule(struct stream_replay *rp, const uint8_t *datagram) {
+    const uint8_t *pkt;
+    uint64_t due, now, pcr, ticks, jitter;
+    int discontinuity;
+
+    now = monotonic_ns();
+    if(rp->base_ns == 0)
+        rp->base_ns = now;
+    due = rp->stream_ns;
+    if(rp->bytes_per_ns > 0.0)
+        due += (uint64_t)((double)rp->bytes_since_pcr / rp->bytes_per_ns);
+    due = rp->base_ns + (uint64_t)((double)due / rp->speed);
+    if(due + REPLAY_MAX_LAG_NS < now) {
+        /* The consumer stalled us; carry on from here rather than bursting to catch up */
+        rp->base_ns += now - due;
+        due = now;
+    }
+
+    for(pkt = datagram; pkt < datagram + VIDEO_DATA_PACKET_SIZE; pkt += TS_PACKET_SIZE) {
+        rp->bytes_since_pcr += TS_PACKET_SIZE;
+        if(!ts_get_pcr(pkt, &pcr, &discontinuity))
+            continue;
+        if(rp->pcr_pid < 0) {
+            rp->pcr_pid = TS_PID(pkt);
+        } else if(TS_PID(pkt) == rp->pcr_pid) {
+            ticks = (pcr + REPLAY_PCR_WRAP - rp->last_pcr) % REPLAY_PCR_WRAP;
+            if(!discontinuity && ticks > 0 && ticks <= REPLAY_PCR_JUMP) {
+                rp->stream_ns += ticks * 1000 / 27;
+                rp->bytes_per_ns = (double)rp->bytes_since_pcr / ((double)ticks * 1000.0 / 27.0);
+            }
+            /* Across a discontinuity stream time holds and the previous rate carries on */
+        } else {
+            continue;
+        }
+        rp->last_pcr = pcr;
+        rp->bytes_since_pcr = 0;
+    }
+
+    if(rp->jitter_ns > 0) {
+        jitter = replay_random(rp) % (rp->jitter_ns + 1);
+        due += jitter;
+    }
+    /* Jitter delays datagrams but never reorders them */
+    if(due < rp->last_due_ns)
+        due = rp->last_due_ns;
+    rp->last_due_ns = due;
+    return due;
+}
+
+static int replay_drop(struct stream_replay *rp) {
+    return rp->loss_threshold && (uint32_t)(replay_random(rp) >> 32) < rp->loss_threshold;
+}
+
+/* Reads up to count datagrams into buffer; returns the number read, 0 at the end, -1 on error */
+static int replay_read(struct stream_rx *rx, struct stream_replay *rp, uint8_t *buffer, unsigned int count) {
+    size_t want = (size_t)count * VIDEO_DATA_PACKET_SIZE, have = 0, packets;
+    ssize_t got;
+    uint8_t *pkt;
+
+    for(;;) {
+        while(have < want) {
+            got = read(rp->fd, buffer + have, want - have);
+            if(got < 0) {
+                if(errno == EINTR)
+                    continue;
+                return -1;
+            }
+            if(got == 0)
+                break;
+            have += (size_t)got;
+        }
+        if(have > 0)
+            break;
+        if(!rp->loop || lseek(rp->fd, 0, SEEK_SET) != 0)
+            return 0;
+        /* Start over; the first PCR of the next pass re-anchors the clock without advancing it */
+        pthread_mutex_lock(&rx->lock);
+        rp->loops++;
+        pthread_mutex_unlock(&rx->lock);
+        rp->pcr_pid = -1;
+    }
+
+    /* A short final datagram is padded out with null packets, dropping any partial packet */
+    packets = have / TS_PACKET_SIZE;
+    count = (unsigned int)((have + VIDEO_DATA_PACKET_SIZE - 1) / VIDEO_DATA_PACKET_SIZE);
+    for(pkt = buffer + packets * TS_PACKET_SIZE; pkt < buffer + (size_t)count * VIDEO_DATA_PACKET_SIZE; pkt += TS_PACKET_SIZE) {
+        memset(pkt, 0xFF, TS_PACKET_SIZE);
+        pkt[0] = TS_SYNC_BYTE;
+        pkt[1] = 0x1F;
+        pkt[2] = 0xFF;
+        pkt[3] = 0x10;
+    }
+    return packets > 0 ? (int)count : 0;
+}
+
+void *stream_replay_thread(void *arg) {
+    struct stream_rx *rx = arg;
+    struct stream_replay *rp = rx->replay;
+    unsigned int slots, i, ready;
+    uint64_t due, wait;
+    uint8_t *slot;
+    int count;
+
+    while(!rx->stopping) {
+        slots = stream_rx_free_slots(rx);
+        if(slots == 0) {
+            if(rp->speed <= 0.0) {
+                /* Unpaced: wait for the consumer rather than losing data */
+                sleep_until(monotonic_ns() + REPLAY_FULL_WAIT_NS);
+                continue;
+            }
+            count = replay_read(rx, rp, rx->scratch, 1);
+            if(count <= 0)
+                break;
+            sleep_until(replay_schedule(rp, rx->scratch));
+            pthread_mutex_lock(&rx->lock);
+            rx->overflow_packets++;
+            pthread_mutex_unlock(&rx->lock);
+            continue;
+        }
+        if(slots > rx->batch)
+            slots = rx->batch;
+
+        count = replay_read(rx, rp, rx->buffer + rx->head, slots);
+        if(count <= 0)
+            break;
+
+        /* Datagrams which survive are packed down to head and published in runs */
+        ready = 0;
+        for(i = 0; i < (unsigned int)count && !rx->stopping; i++) {
+            slot = rx->buffer + rx->head + (size_t)i * VIDEO_DATA_PACKET_SIZE;
+            if(rp->speed > 0.0) {
+                due = replay_schedule(rp, slot);
+                while(!rx->stopping && monotonic_ns() < due) {
+                    if(ready > 0) {
+                        stream_rx_push(rx, ready, monotonic_ns());
+                        /* head moved past what was pushed, so the slot index shifts down */
+                        i -= ready;
+                        count -= (int)ready;
+                        slot = rx->buffer + rx->head + (size_t)i * VIDEO_DATA_PACKET_SIZE;
+                        ready = 0;
+                    }
+                    wait = due - monotonic_ns();
+                    if(wait > REPLAY_WAIT_NS)
+                        wait = REPLAY_WAIT_NS;
+                    sleep_until(monotonic_ns() + wait);
+                }
+            }
+            if(replay_drop(rp)) {
+                pthread_mutex_lock(&rx->lock);
+                rp->dropped++;
+                pthread_mutex_unlock(&rx->lock);
+                continue;
+            }
+            if(i != ready)
+                memmove(rx->buffer + rx->head + (size_t)ready * VIDEO_DATA_PACKET_SIZE, slot, VIDEO_DATA_PACKET_SIZE);
+            ready++;
+        }
+        if(ready > 0)
+            stream_rx_push(rx, ready, monotonic_ns());
+    }
+
+    pthread_mutex_lock(&rx->lock);
+    rp->finished = 1;
+    pthread_mutex_unlock(&rx->lock);
+    return NULL;
+}
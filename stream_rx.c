@@ -0,0 +1,563 @@
+/*
+ * stream_rx.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/*
+ *  Native replacement for libhdhomerun's video socket, used when stream_start
+ *  is asked for options the library cannot provide.  A receiver thread (or,
+ *  for members of a StreamGroup, one of the group's epoll threads) pulls
+ *  datagrams with recvmmsg, up to a batch at a time, straight into a ring of
+ *  whole VIDEO_DATA_PACKET_SIZE slots; stream_rx_recv hands out contiguous
+ *  runs of it with the same "valid until the next call" contract as
+ *  hdhomerun_device_stream_recv.
+ *
+ *  The device is always given a udp:// target, so datagrams never carry an
+ *  RTP header.  Alternatively the ring can be filled from a capture file by
+ *  a replay thread (see stream_replay.c) instead of a socket.
+ *
+ *  With timestamps enabled every datagram's kernel receive time is folded
+ *  into log2 histograms (see stream_rx_timing_update) as it is committed,
+ *  so the analysis costs nothing per packet on the Python side.
+ *
+ *  Nothing in here touches Python state.
+ */
+
+#define STREAM_RX_POLL_MS 100
+#define STREAM_RX_HUGEPAGE_SIZE (2 * 1024 * 1024)
+#define STREAM_RX_BATCH_MAX 1024
+#define STREAM_RX_CMSG_SIZE CMSG_SPACE(sizeof(struct timespec))
+#define STREAM_RX_BURST_NS 100000ULL    /* datagrams closer than this belong to one burst */
+
+static int stream_rx_alloc(struct stream_rx *rx, const struct stream_rx_config *config) {
+    size_t slots = config->buffer_size / VIDEO_DATA_PACKET_SIZE;
+
+    /* One slot is always left empty to tell a full ring from an empty one */
+    if(slots < 2)
+        slots = 2;
+    rx->size = slots * VIDEO_DATA_PACKET_SIZE;
+    rx->mapped_size = rx->size;
+
+    if(config->hugepages) {
+        rx->mapped_size = (rx->mapped_size + STREAM_RX_HUGEPAGE_SIZE - 1) & ~((size_t)STREAM_RX_HUGEPAGE_SIZE - 1);
+        rx->buffer = mmap(NULL, rx->mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(rx->buffer != MAP_FAILED)
+            rx->hugepages = 1;
+        else
+            rx->mapped_size = rx->size;     /* none reserved; fall back to normal pages */
+    }
+    if(!rx->hugepages) {
+        rx->buffer = mmap(NULL, rx->mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(rx->buffer == MAP_FAILED) {
+            rx->buffer = NULL;
+            return -1;
+        }
+    }
+    if(config->mlock && mlock(rx->buffer, rx->mapped_size) == 0)
+        rx->locked = 1;
+
+    rx->stages = config->stages;
+    rx->batch = config->batch;
+    if(rx->batch < 1)
+        rx->batch = 1;
+    if(rx->batch > STREAM_RX_BATCH_MAX)
+        rx->batch = STREAM_RX_BATCH_MAX;
+    rx->msgs = calloc(rx->batch, sizeof(struct mmsghdr));
+    rx->iovs = calloc(rx->batch, sizeof(struct iovec));
+    if(!rx->msgs || !rx->iovs)
+        return -1;
+    if(config->timestamps) {
+        rx->controls = calloc(rx->batch, STREAM_RX_CMSG_SIZE);
+        if(!rx->controls)
+            return -1;
+    }
+    return 0;
+}
+
+static int stream_rx_open_socket(struct stream_rx *rx, const struct stream_rx_config *config) {
+    struct sockaddr_in addr;
+    struct timeval timeout;
+    socklen_t len = sizeof(addr);
+    int value;
+
+    rx->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(rx->sock < 0)
+        return -1;
+    fcntl(rx->sock, F_SETFD, FD_CLOEXEC);
+
+    if(config->group) {
+        /* The group's epoll thread only reads once the socket is ready */
+        fcntl(rx->sock, F_SETFL, fcntl(rx->sock, F_GETFL) | O_NONBLOCK);
+    } else {
+        /* Reads block so that busy polling applies; the timeout lets the thread notice a stop */
+        timeout.tv_sec = 0;
+        timeout.tv_usec = STREAM_RX_POLL_MS * 1000;
+        setsockopt(rx->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    if(config->rcvbuf > 0) {
+        /* SO_RCVBUFFORCE ignores rmem_max but needs CAP_NET_ADMIN */
+        value = config->rcvbuf;
+        if(setsockopt(rx->sock, SOL_SOCKET, SO_RCVBUFFORCE, &value, sizeof(value)) != 0)
+            setsockopt(rx->sock, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value));
+    }
+#ifdef SO_BUSY_POLL
+    if(config->busy_poll_us > 0) {
+        value = config->busy_poll_us;
+        if(setsockopt(rx->sock, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) == 0)
+            rx->busy_poll_us = config->busy_poll_us;
+    }
+#endif
+    if(config->timestamps) {
+        value = 1;
+        if(setsockopt(rx->sock, SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof(value)) != 0)
+            return -1;
+        rx->timing.enabled = 1;
+    }
+    len = sizeof(value);
+    if(getsockopt(rx->sock, SOL_SOCKET, SO_RCVBUF, &value, &len) == 0)
+        rx->rcvbuf = value;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = 0;
+    if(bind(rx->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        return -1;
+    len = sizeof(addr);
+    if(getsockname(rx->sock, (struct sockaddr *)&addr, &len) != 0)
+        return -1;
+    rx->port = ntohs(addr.sin_port);
+    return 0;
+}
+
+/* Number of slots the receiver thread may fill starting at head without wrapping */
+unsigned int stream_rx_free_slots(struct stream_rx *rx) {
+    size_t free_bytes, contiguous;
+
+    pthread_mutex_lock(&rx->lock);
+    free_bytes = (rx->tail + rx->size - rx->head - VIDEO_DATA_PACKET_SIZE) % rx->size;
+    pthread_mutex_unlock(&rx->lock);
+    contiguous = rx->size - rx->head;
+    if(free_bytes > contiguous)
+        free_bytes = contiguous;
+    return (unsigned int)(free_bytes / VIDEO_DATA_PACKET_SIZE);
+}
+
+static unsigned int log2_bucket(uint64_t value) {
+    unsigned int bucket = 0;
+
+    while(value > 1 && bucket < STREAM_RX_HISTOGRAM_BUCKETS - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+/* Kernel receive time of a datagram as CLOCK_REALTIME nanoseconds, or 0 if missing */
+static uint64_t stream_rx_arrival_ns(struct msghdr *msg) {
+    struct cmsghdr *cmsg;
+    struct timespec ts;
+
+    for(cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+        }
+    }
+    return 0;
+}
+
+/*
+ *  Folds one arrival into the timing analysis; called with the lock held.
+ *  Jitter is the RFC 3550 estimator applied to the change in inter-arrival
+ *  time, since the device's send times are not available.
+ */
+static void stream_rx_timing_update(struct stream_rx_timing *t, uint64_t arrival_ns, uint64_t now_ns) {
+    uint64_t gap_ns;
+    int64_t delta;
+
+    if(arrival_ns == 0) {
+        t->missing++;
+        return;
+    }
+    if(now_ns > arrival_ns)
+        t->latency[log2_bucket((now_ns - arrival_ns) / 1000)]++;
+
+    if(t->last_ns == 0 || arrival_ns < t->last_ns) {
+        t->last_ns = arrival_ns;
+        t->burst_length = 1;
+        return;
+    }
+    gap_ns = arrival_ns - t->last_ns;
+    t->last_ns = arrival_ns;
+    t->interarrival[log2_bucket(gap_ns / 1000)]++;
+
+    if(t->last_gap_ns != 0) {
+        delta = (int64_t)gap_ns - (int64_t)t->last_gap_ns;
+        if(delta < 0)
+            delta = -delta;
+        t->jitter_ns += ((double)delta - t->jitter_ns) / 16.0;
+    }
+    t->last_gap_ns = gap_ns;
+
+    if(gap_ns < STREAM_RX_BURST_NS) {
+        t->burst_length++;
+        return;
+    }
+    t->bursts[log2_bucket(t->burst_length)]++;
+    t->gaps[log2_bucket(gap_ns / 1000)]++;
+    if(gap_ns > t->max_gap_ns)
+        t->max_gap_ns = gap_ns;
+    t->burst_length = 1;
+}
+
+/* Moves head past count filled slots; called with the lock held */
+static void stream_rx_advance(struct stream_rx *rx, unsigned int count) {
+    size_t used;
+
+    ts_scan(rx->buffer + rx->head, (size_t)count * (VIDEO_DATA_PACKET_SIZE / TS_PACKET_SIZE), &rx->scan);
+    rx->head += (size_t)count * VIDEO_DATA_PACKET_SIZE;
+    if(rx->head >= rx->size)
+        rx->head = 0;
+    rx->packets += count;
+    rx->bytes += (unsigned long long)count * VIDEO_DATA_PACKET_SIZE;
+    used = (rx->head + rx->size - rx->tail) % rx->size;
+    if(used > rx->high_water)
+        rx->high_water = used;
+}
+
+/*
+ *  Accepts a batch of count datagrams received into consecutive slots at
+ *  head.  Bad datagrams are squeezed out so that the ring stays packed.
+ */
+static void stream_rx_commit(struct stream_rx *rx, unsigned int count) {
+    uint8_t *start = rx->buffer + rx->head, *write = start;
+    unsigned int i, good = 0, bad = 0;
+    uint64_t now_ns = 0, mono_ns = monotonic_ns(), arrival_ns;
+
+    if(rx->timing.enabled)
+        now_ns = (uint64_t)(wallclock_time() * 1000000000.0);
+
+    for(i = 0; i < count; i++) {
+        uint8_t *slot = rx->iovs[i].iov_base;
+
+        if(rx->msgs[i].msg_len != VIDEO_DATA_PACKET_SIZE || (rx->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ||
+           slot[0] != TS_SYNC_BYTE) {
+            bad++;
+            continue;
+        }
+        if(slot != write)
+            memmove(write, slot, VIDEO_DATA_PACKET_SIZE);
+        if(rx->timing.enabled) {
+            /* Stages get each datagram with its kernel arrival time moved onto the monotonic clock */
+            arrival_ns = stream_rx_arrival_ns(&rx->msgs[i].msg_hdr);
+            if(arrival_ns != 0 && arrival_ns <= now_ns && now_ns - arrival_ns < mono_ns)
+                arrival_ns = mono_ns - (now_ns - arrival_ns);
+            else
+                arrival_ns = mono_ns;
+            stream_stages_run(rx->stages, write, VIDEO_DATA_PACKET_SIZE, arrival_ns);
+        }
+        write += VIDEO_DATA_PACKET_SIZE;
+        good++;
+    }
+    if(!rx->timing.enabled && good > 0)
+        stream_stages_run(rx->stages, start, (size_t)(write - start), mono_ns);
+
+    pthread_mutex_lock(&rx->lock);
+    if(rx->timing.enabled) {
+        for(i = 0; i < count; i++)
+            stream_rx_timing_update(&rx->timing, stream_rx_arrival_ns(&rx->msgs[i].msg_hdr), now_ns);
+    }
+    stream_rx_advance(rx, good);
+    rx->network_errors += bad;
+    pthread_mutex_unlock(&rx->lock);
+}
+
+/*
+ *  For sources other than the socket: publishes count datagrams which were
+ *  written into the slots at head, after running the stages over them.
+ */
+void stream_rx_push(struct stream_rx *rx, unsigned int count, uint64_t arrival_ns) {
+    stream_stages_run(rx->stages, rx->buffer + rx->head, (size_t)count * VIDEO_DATA_PACKET_SIZE, arrival_ns);
+    pthread_mutex_lock(&rx->lock);
+    stream_rx_advance(rx, count);
+    pthread_mutex_unlock(&rx->lock);
+}
+
+/*
+ *  One receive pass: reads up to a batch of datagrams into the ring, or
+ *  drains one if the ring is full.  Returns the number of datagrams read,
+ *  0 if none were waiting and -1 if the socket failed.
+ */
+int stream_rx_service(struct stream_rx *rx) {
+    unsigned int slots, i;
+    ssize_t got;
+    int count;
+
+    /* Only the receiving thread moves head, so the slots from head on are ours to fill */
+    slots = stream_rx_free_slots(rx);
+    if(slots == 0) {
+        /* Full: drain a datagram so the loss is counted here rather than in the kernel */
+        got = recv(rx->sock, rx->scratch, sizeof(rx->scratch), 0);
+        rx->syscalls++;
+        if(got >= 0) {
+            pthread_mutex_lock(&rx->lock);
+            rx->overflow_packets++;
+            pthread_mutex_unlock(&rx->lock);
+            return 1;
+        }
+        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;
+        return 0;
+    }
+    if(slots > rx->batch)
+        slots = rx->batch;
+
+    for(i = 0; i < slots; i++) {
+        rx->iovs[i].iov_base = rx->buffer + rx->head + (size_t)i * VIDEO_DATA_PACKET_SIZE;
+        rx->iovs[i].iov_len = VIDEO_DATA_PACKET_SIZE;
+        memset(&rx->msgs[i].msg_hdr, 0, sizeof(rx->msgs[i].msg_hdr));
+        rx->msgs[i].msg_hdr.msg_iov = &rx->iovs[i];
+        rx->msgs[i].msg_hdr.msg_iovlen = 1;
+        if(rx->controls) {
+            rx->msgs[i].msg_hdr.msg_control = rx->controls + (size_t)i * STREAM_RX_CMSG_SIZE;
+            rx->msgs[i].msg_hdr.msg_controllen = STREAM_RX_CMSG_SIZE;
+        }
+    }
+    /* Wait for the first datagram, then take whatever else is already queued */
+    count = recvmmsg(rx->sock, rx->msgs, slots, MSG_WAITFORONE, NULL);
+    rx->syscalls++;
+    if(count > 0) {
+        stream_rx_commit(rx, (unsigned int)count);
+        return count;
+    }
+    if(count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        pthread_mutex_lock(&rx->lock);
+        rx->network_errors++;
+        pthread_mutex_unlock(&rx->lock);
+        return -1;
+    }
+    return 0;
+}
+
+static void *stream_rx_thread(void *arg) {
+    struct stream_rx *rx = arg;
+
+    while(!rx->stopping) {
+        if(stream_rx_service(rx) < 0)
+            break;
+    }
+    return NULL;
+}
+
+struct stream_rx *stream_rx_create(const struct stream_rx_config *config) {
+    struct stream_rx *rx;
+
+    rx = calloc(1, sizeof(struct stream_rx));
+    if(!rx)
+        return NULL;
+    rx->sock = -1;
+    rx->generation = fork_generation_current();
+    pthread_mutex_init(&rx->lock, NULL);
+    if(config->replay) {
+        if(stream_rx_alloc(rx, config) != 0 || stream_replay_open(rx, config->replay) != 0) {
+            stream_rx_destroy(rx);
+            return NULL;
+        }
+        if(pthread_create(&rx->thread, NULL, stream_replay_thread, rx) != 0) {
+            stream_rx_destroy(rx);
+            return NULL;
+        }
+        rx->running = 1;
+        return rx;
+    }
+    if(stream_rx_alloc(rx, config) != 0 || stream_rx_open_socket(rx, config) != 0) {
+        stream_rx_destroy(rx);
+        return NULL;
+    }
+    if(config->group) {
+        if(stream_group_add(config->group, rx) != 0) {
+            stream_rx_destroy(rx);
+            return NULL;
+        }
+        return rx;
+    }
+    if(pthread_create(&rx->thread, NULL, stream_rx_thread, rx) != 0) {
+        stream_rx_destroy(rx);
+        return NULL;
+    }
+    rx->running = 1;
+    return rx;
+}
+
+void stream_rx_destroy(struct stream_rx *rx) {
+    int inherited;
+
+    if(!rx)
+        return;
+    exporter_unregister(&rx->metrics);
+    /* After fork() the receiver thread, and the group's, only exist in the parent */
+    inherited = (rx->generation != fork_generation_current());
+    if(rx->running && !inherited) {
+        rx->stopping = 1;
+        pthread_join(rx->thread, NULL);
+    }
+    if(rx->group && !inherited)
+        stream_group_remove(rx->group, rx);
+    if(rx->replay)
+        stream_replay_close(rx->replay);
+    if(rx->sock >= 0)
+        close(rx->sock);
+    if(rx->buffer) {
+        if(rx->locked)
+            munlock(rx->buffer, rx->mapped_size);
+        munmap(rx->buffer, rx->mapped_size);
+    }
+    free(rx->msgs);
+    free(rx->iovs);
+    free(rx->controls);
+    if(!inherited)
+        pthread_mutex_destroy(&rx->lock);
+    free(rx);
+}
+
+/*
+ *  Same contract as hdhomerun_device_stream_recv: the data stays valid until
+ *  the next call.  Only whole datagrams are handed out, so a max_size below
+ *  one datagram never returns anything.
+ */
+uint8_t *stream_rx_recv(struct stream_rx *rx, size_t max_size, size_t *pactual_size) {
+    size_t head, length;
+    uint8_t *data;
+
+    max_size -= max_size % VIDEO_DATA_PACKET_SIZE;
+    *pactual_size = 0;
+    if(max_size == 0)
+        return NULL;
+
+    pthread_mutex_lock(&rx->lock);
+    /* Release what the caller was handed last time */
+    rx->tail += rx->pending;
+    if(rx->tail >= rx->size)
+        rx->tail = 0;
+    rx->pending = 0;
+
+    head = rx->head;
+    if(head == rx->tail) {
+        pthread_mutex_unlock(&rx->lock);
+        *pactual_size = 0;
+        return NULL;
+    }
+    length = (head > rx->tail ? head : rx->size) - rx->tail;
+    if(length > max_size)
+        length = max_size;
+    data = rx->buffer + rx->tail;
+    rx->pending = length;
+    pthread_mutex_unlock(&rx->lock);
+
+    *pactual_size = length;
+    return data;
+}
+
+/* Bytes received but not yet handed out by stream_rx_recv */
+size_t stream_rx_available(struct stream_rx *rx) {
+    size_t available;
+
+    pthread_mutex_lock(&rx->lock);
+    available = (rx->head + rx->size - rx->tail - rx->pending) % rx->size;
+    pthread_mutex_unlock(&rx->lock);
+    return available;
+}
+
+void stream_rx_flush(struct stream_rx *rx) {
+    pthread_mutex_lock(&rx->lock);
+    rx->tail = rx->head;
+    rx->pending = 0;
+    pthread_mutex_unlock(&rx->lock);
+}
+
+/* Clears the accumulated analysis but keeps tracking the current burst */
+static void stream_rx_timing_reset(struct stream_rx_timing *t) {
+    memset(t->interarrival, 0, sizeof(t->interarrival));
+    memset(t->bursts, 0, sizeof(t->bursts));
+    memset(t->gaps, 0, sizeof(t->gaps));
+    memset(t->latency, 0, sizeof(t->latency));
+    t->max_gap_ns = 0;
+    t->missing = 0;
+}
+
+void stream_rx_get_stats(struct stream_rx *rx, struct stream_rx_stats *stats, int reset) {
+    pthread_mutex_lock(&rx->lock);
+    stats->buffer_size = rx->size - VIDEO_DATA_PACKET_SIZE;
+    stats->occupancy = (rx->head + rx->size - rx->tail) % rx->size;
+    stats->high_water = rx->high_water;
+    stats->packets = rx->packets;
+    stats->bytes = rx->bytes;
+    stats->overflow_packets = rx->overflow_packets;
+    stats->network_errors = rx->network_errors;
+    stats->syscalls = rx->syscalls;
+    stats->scan = rx->scan;
+    stats->batch = rx->batch;
+    stats->rcvbuf = rx->rcvbuf;
+    stats->busy_poll_us = rx->busy_poll_us;
+    stats->hugepages = rx->hugepages;
+    stats->locked = rx->locked;
+    stats->timing = rx->timing;
+    stats->replay = rx->replay != NULL;
+    if(rx->replay) {
+        stats->replay_dropped = rx->replay->dropped;
+        stats->replay_loops = rx->replay->loops;
+        stats->replay_finished = rx->replay->finished;
+    }
+    if(reset) {
+        rx->high_water = stats->occupancy;
+        stream_rx_timing_reset(&rx->timing);
+    }
+    pthread_mutex_unlock(&rx->lock);
+}
+
+static void stream_rx_sample(void *owner, double *values) {
+    struct stream_rx *rx = owner;
+
+    /* Only the counters, not the whole stream_rx_stats with its timing histograms */
+    pthread_mutex_lock(&rx->lock);
+    values[0] = (double)rx->packets;
+    values[1] = (double)rx->bytes;
+    values[2] = (double)rx->overflow_packets;
+    values[3] = (double)rx->network_errors;
+    values[4] = (double)rx->scan.sync_errors;
+    values[5] = (double)rx->scan.transport_errors;
+    values[6] = (double)rx->scan.scrambled;
+    values[7] = (double)((rx->head + rx->size - rx->tail) % rx->size);
+    values[8] = (double)rx->high_water;
+    pthread_mutex_unlock(&rx->lock);
+}
+
+/* Publishes the receiver's counters through the metrics exporter until it is destroyed */
+void stream_rx_export(struct stream_rx *rx, const char *labels) {
+    exporter_register(&rx->metrics, EXPORTER_STREAM, rx, stream_rx_sample, labels);
+}
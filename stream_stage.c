@@ -0,0 +1,79 @@
+/*
+ * stream_stage.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  Each Device keeps a chain of native stages which see every transport
+ *  packet it receives.  With the native receiver they run on its thread as
+ *  datagrams arrive; with libhdhomerun's receiver they run on the data
+ *  stream_recv returns.  Stages are embedded in their owner's state and must
+ *  not call into Python.
+ */
+
+void stream_stages_init(struct stream_stages *stages) {
+    pthread_mutex_init(&stages->lock, NULL);
+    stages->head = NULL;
+}
+
+void stream_stages_destroy(struct stream_stages *stages) {
+    pthread_mutex_destroy(&stages->lock);
+}
+
+void stream_stages_attach(struct stream_stages *stages, struct stream_stage *stage) {
+    struct stream_stage **link;
+
+    pthread_mutex_lock(&stages->lock);
+    /* Append, so that stages run in the order they were added */
+    stage->next = NULL;
+    for(link = &stages->head; *link; link = &(*link)->next)
+        ;
+    *link = stage;
+    pthread_mutex_unlock(&stages->lock);
+}
+
+/* Once this returns the stage is no longer running and will not be called again */
+void stream_stages_detach(struct stream_stages *stages, struct stream_stage *stage) {
+    struct stream_stage **link;
+
+    pthread_mutex_lock(&stages->lock);
+    for(link = &stages->head; *link; link = &(*link)->next) {
+        if(*link == stage) {
+            *link = stage->next;
+            break;
+        }
+    }
+    stage->next = NULL;
+    pthread_mutex_unlock(&stages->lock);
+}
+
+/* Hands whole transport packets to every stage; arrival_ns is on the monotonic_ns() clock */
+void stream_stages_run(struct stream_stages *stages, const uint8_t *data, size_t length, uint64_t arrival_ns) {
+    struct stream_stage *stage;
+
+    length -= length % TS_PACKET_SIZE;
+    if(length == 0)
+        return;
+    pthread_mutex_lock(&stages->lock);
+    for(stage = stages->head; stage; stage = stage->next)
+        stage->process(stage, data, length, arrival_ns);
+    pthread_mutex_unlock(&stages->lock);
+}
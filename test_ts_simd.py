@@ -0,0 +1,190 @@
+#!/usr/bin/python
+
+# Hardware-free tests for the stream kernels in ts_simd.c.  Each dispatch level
+# is selected with HDHOMERUN_SIMD in a child interpreter, since the kernels are
+# picked once when the module is imported, and checked against the pure Python
+# references below.
+
+import os
+import cPickle
+import random
+import subprocess
+import sys
+import unittest
+
+import hdhomerun
+
+TS_PACKET_SIZE = 188
+TS_SYNC_CONFIRM = 3
+LEVELS = ('scalar', 'sse2', 'avx2')
+
+CHILD = r'''
+import cPickle, sys, hdhomerun
+cases = cPickle.load(sys.stdin)
+results = {'level': hdhomerun.simd_level()}
+results['crc'] = [hdhomerun.crc32_mpeg2(data, crc) for data, crc in cases['crc']]
+results['find_sync'] = [hdhomerun.ts_find_sync(data, start) for data, start in cases['find_sync']]
+results['check'] = [hdhomerun.ts_check(data) for data in cases['check']]
+results['realign'] = [hdhomerun.ts_realign(data) for data in cases['realign']]
+cPickle.dump(results, sys.stdout, 2)
+'''
+
+
+def crc32_mpeg2(data, crc=0xFFFFFFFF):
+    for c in data:
+        crc ^= ord(c) << 24
+        for i in range(8):
+            crc = ((crc << 1) ^ 0x04C11DB7 if crc & 0x80000000 else crc << 1) & 0xFFFFFFFF
+    return crc
+
+
+def find_sync(data, start=0):
+    for offset in range(max(start, 0), len(data)):
+        if all(data[o] == '\x47' for o in range(offset, len(data), TS_PACKET_SIZE)[:TS_SYNC_CONFIRM]):
+            return offset
+    return -1
+
+
+def ts_check(data):
+    counts = {'packets': 0, 'sync_errors': 0, 'transport_errors': 0, 'scrambled': 0}
+    for offset in range(0, len(data) - TS_PACKET_SIZE + 1, TS_PACKET_SIZE):
+        counts['packets'] += 1
+        if data[offset] != '\x47':
+            counts['sync_errors'] += 1
+            continue
+        counts['transport_errors'] += (ord(data[offset + 1]) & 0x80) != 0
+        counts['scrambled'] += (ord(data[offset + 3]) & 0xC0) != 0
+    return counts
+
+
+def ts_realign(data):
+    out, pos, locked = [], 0, False
+    while pos + TS_PACKET_SIZE <= len(data):
+        if not locked or data[pos] != '\x47':
+            found = find_sync(data, pos)
+            pos = found if found >= 0 else len(data)
+            locked = True
+            continue
+        out.append(data[pos:pos + TS_PACKET_SIZE])
+        pos += TS_PACKET_SIZE
+    out = ''.join(out)
+    return bytearray(out), len(data) - len(out)
+
+
+def noise(rng, length, sync_density=0.02):
+    """Random bytes with stray sync bytes scattered through them."""
+    return ''.join('\x47' if rng.random() < sync_density else chr(rng.randrange(256)) for i in range(length))
+
+
+def packets(rng, count):
+    result = []
+    for i in range(count):
+        header = chr(0x47) + chr(rng.randrange(256)) + chr(rng.randrange(256)) + chr(rng.randrange(256))
+        result.append(header + noise(rng, TS_PACKET_SIZE - 4))
+    return ''.join(result)
+
+
+def make_cases(seed=188):
+    rng = random.Random(seed)
+    cases = {'crc': [], 'find_sync': [], 'check': [], 'realign': []}
+
+    # CRC: every length around the 8 byte stride, then longer sections
+    for length in range(0, 40) + [183, 184, 1021, 4096]:
+        cases['crc'].append((noise(rng, length, 0.0), 0xFFFFFFFF))
+    for i in range(20):
+        cases['crc'].append((noise(rng, rng.randrange(1, 300), 0.0), rng.randrange(1 << 32)))
+
+    # find_sync: aligned runs after noise of every length around the vector widths
+    for lead in range(0, 70) + [127, 128, 129, 255, 256, 257, 1000]:
+        data = noise(rng, lead) + packets(rng, rng.randrange(1, 6)) + noise(rng, rng.randrange(0, 50))
+        for start in (0, lead, max(lead - 1, 0), lead + 1, len(data) - 1, len(data) + 5):
+            cases['find_sync'].append((data, start))
+    for i in range(100):
+        data = noise(rng, rng.randrange(0, 2000), rng.choice((0.0, 0.02, 0.2, 0.9)))
+        cases['find_sync'].append((data, rng.randrange(0, len(data) + 1)))
+    # Near misses: two of three sync bytes, and a run broken by a bad packet
+    data = noise(rng, 50, 0.0)
+    data = data[:10] + '\x47' + data[11:]
+    data += packets(rng, 2)
+    cases['find_sync'].append((data, 0))
+    data = packets(rng, 8)
+    data = data[:3 * TS_PACKET_SIZE] + 'x' + data[3 * TS_PACKET_SIZE + 1:]
+    cases['find_sync'].append((data, 1))
+    cases['find_sync'].append(('', 0))
+
+    # ts_check: whole multiples of the eight packet gather, and a few left over
+    for count in (0, 1, 7, 8, 9, 15, 16, 17, 64, 67):
+        data = bytearray(packets(rng, count) + noise(rng, rng.randrange(0, TS_PACKET_SIZE)))
+        for i in range(count):
+            if rng.random() < 0.2:
+                data[i * TS_PACKET_SIZE] = rng.randrange(256)
+        cases['check'].append(str(data))
+
+    # ts_realign: good runs separated by garbage
+    for i in range(30):
+        parts = []
+        for j in range(rng.randrange(1, 5)):
+            parts.append(noise(rng, rng.randrange(0, 400)))
+            parts.append(packets(rng, rng.randrange(0, 10)))
+        cases['realign'].append(''.join(parts))
+    return cases
+
+
+def run_level(level, cases):
+    env = dict(os.environ)
+    env['HDHOMERUN_SIMD'] = level
+    env['PYTHONPATH'] = os.pathsep.join([os.path.dirname(os.path.abspath(hdhomerun.__file__))] +
+                                        filter(None, [env.get('PYTHONPATH')]))
+    child = subprocess.Popen([sys.executable, '-c', CHILD], env=env, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    out, err = child.communicate(cPickle.dumps(cases, 2))
+    if child.returncode != 0:
+        raise RuntimeError('child for %s exited with %d' % (level, child.returncode))
+    return cPickle.loads(out)
+
+
+class SimdKernelTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.cases = make_cases()
+        cls.results = dict((level, run_level(level, cls.cases)) for level in LEVELS)
+
+    def test_references(self):
+        # Sanity checks of the references themselves
+        pat = '\x00\xb0\x0d\x00\x01\xc1\x00\x00\x00\x01\xe1\x00'
+        crc = crc32_mpeg2(pat)
+        self.assertEqual(crc32_mpeg2(pat + chr(crc >> 24) + chr((crc >> 16) & 0xFF) +
+                                     chr((crc >> 8) & 0xFF) + chr(crc & 0xFF)), 0)
+        self.assertEqual(find_sync('\x47' + 'x' * 187 + '\x47'), 0)
+        self.assertEqual(find_sync('x\x47' + 'x' * 187 + 'y'), -1)
+
+    def test_levels(self):
+        # Asking for a level the CPU lacks falls back to a lower one, never a higher one
+        self.assertEqual(self.results['scalar']['level'], 'scalar')
+        self.assertTrue(self.results['sse2']['level'] in ('scalar', 'sse2'))
+        self.assertTrue(LEVELS.index(self.results['avx2']['level']) >= LEVELS.index(self.results['sse2']['level']))
+
+    def check_level(self, level):
+        results = self.results[level]
+        if results['level'] != level:
+            self.skipTest('%s is not supported here' % level)
+        for (data, crc), got in zip(self.cases['crc'], results['crc']):
+            self.assertEqual(got, crc32_mpeg2(data, crc), 'crc32_mpeg2 of %d bytes' % len(data))
+        for (data, start), got in zip(self.cases['find_sync'], results['find_sync']):
+            self.assertEqual(got, find_sync(data, start), 'ts_find_sync of %d bytes from %d' % (len(data), start))
+        for data, got in zip(self.cases['check'], results['check']):
+            self.assertEqual(got, ts_check(data))
+        for data, got in zip(self.cases['realign'], results['realign']):
+            self.assertEqual(got, ts_realign(data))
+
+    def test_scalar(self):
+        self.check_level('scalar')
+
+    def test_sse2(self):
+        self.check_level('sse2')
+
+    def test_avx2(self):
+        self.check_level('avx2')
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,112 @@
+#!/usr/bin/python
+
+# Hardware-free tests for parse_packets() and PacketTable
+
+import struct
+import unittest
+
+from hdhomerun import parse_packets, PacketTable
+
+TS_PACKET_SIZE = 188
+RECORD_FORMAT = '=IHBBBBBxq'    # the PacketTable buffer format without its field names
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+
+
+def packet(pid, cc, pusi=False, tei=False, priority=False, scrambling=0,
+           adaptation=None, payload=True, pcr=None, discontinuity=False, rap=False):
+    """Build a packet; adaptation is the adaptation_field_length to use, if any."""
+    afc = (0x02 if adaptation is not None or pcr is not None else 0) | (0x01 if payload else 0)
+    header = struct.pack('>BHB', 0x47,
+                         (0x8000 if tei else 0) | (0x4000 if pusi else 0) | (0x2000 if priority else 0) | pid,
+                         (scrambling << 6) | (afc << 4) | cc)
+    field = ''
+    if afc & 0x02:
+        flags = (0x80 if discontinuity else 0) | (0x40 if rap else 0)
+        body = ''
+        if pcr is not None:
+            flags |= 0x10
+            base, ext = pcr // 300, pcr % 300
+            body = struct.pack('>IH', base >> 1, ((base & 1) << 15) | 0x7E00 | ext)
+        length = adaptation if adaptation is not None else 1 + len(body)
+        field = chr(length) + chr(flags) + body
+        field += '\xff' * (1 + length - len(field))
+    return (header + field).ljust(TS_PACKET_SIZE, '\xaa')
+
+
+def records(table):
+    raw = memoryview(table).tobytes()
+    return [struct.unpack_from(RECORD_FORMAT, raw, i * RECORD_SIZE) for i in range(len(table))]
+
+
+class ParsePacketsTest(unittest.TestCase):
+    def test_layout(self):
+        data = ''.join([
+            packet(0x0000, 0, pusi=True),
+            packet(0x1FFF, 15, tei=True, priority=True),
+            packet(0x0100, 3, scrambling=2),
+            packet(0x0101, 7, pcr=27000000 * 5 + 123, discontinuity=True, rap=True),
+            packet(0x0102, 1, adaptation=183, payload=False),
+        ])
+        table = parse_packets(data)
+        self.assertTrue(isinstance(table, PacketTable))
+        self.assertTrue(table.data is data)
+        self.assertEqual(len(table), 5)
+        self.assertEqual(RECORD_SIZE, 20)
+        view = memoryview(table)
+        self.assertEqual(view.itemsize, RECORD_SIZE)
+        self.assertEqual(len(view.tobytes()), 5 * RECORD_SIZE)
+
+        rows = records(table)
+        for i, row in enumerate(rows):
+            self.assertEqual(row[0], i * TS_PACKET_SIZE)
+        # offset, pid, cc, flags, scrambling, adaptation, payload_offset, pcr
+        self.assertEqual(rows[0], (0, 0x0000, 0, PacketTable.PUSI, 0, 1, 4, -1))
+        self.assertEqual(rows[1], (188, 0x1FFF, 15, PacketTable.TEI | PacketTable.PRIORITY, 0, 1, 4, -1))
+        self.assertEqual(rows[2], (376, 0x0100, 3, 0, 2, 1, 4, -1))
+        self.assertEqual(rows[3], (564, 0x0101, 7, PacketTable.DISCONTINUITY | PacketTable.RAP | PacketTable.PCR,
+                                   0, 3, 12, 27000000 * 5 + 123))
+        self.assertEqual(rows[4], (752, 0x0102, 1, 0, 0, 2, 0, -1))
+
+        # Indexing decodes the same record
+        item = table[3]
+        self.assertEqual(item['offset'], 564)
+        self.assertEqual(item['pid'], 0x0101)
+        self.assertEqual(item['pcr'], 27000000 * 5 + 123)
+        self.assertEqual(item['payload_offset'], 12)
+        self.assertRaises(IndexError, lambda: table[5])
+
+    def test_offsets_locate_packets(self):
+        data = ''.join(packet(0x100 + i % 3, i % 16) for i in range(50))
+        for row in records(parse_packets(data)):
+            offset, pid = row[0], row[1]
+            self.assertEqual(data[offset], '\x47')
+            self.assertEqual(struct.unpack('>H', data[offset + 1:offset + 3])[0] & 0x1FFF, pid)
+
+    def test_partial_and_sync_error(self):
+        data = packet(0x100, 0) + '\x00' * TS_PACKET_SIZE + packet(0x100, 1)[:100]
+        table = parse_packets(data)
+        self.assertEqual(len(table), 2)
+        self.assertEqual(table[1]['offset'], TS_PACKET_SIZE)
+        self.assertEqual(table[1]['flags'], PacketTable.SYNC_ERROR)
+        self.assertEqual(table[1]['pcr'], -1)
+        self.assertEqual(len(parse_packets('')), 0)
+
+    def test_by_pid(self):
+        pids = [0x100, 0x101, 0x100, 0x0, 0x101, 0x100]
+        data = ''.join(packet(pid, i) for i, pid in enumerate(pids)) + '\x00' * TS_PACKET_SIZE
+        index = parse_packets(data).by_pid()
+        self.assertEqual(sorted(index.keys()), [0x0, 0x100, 0x101])
+        self.assertEqual(list(index[0x100]), [0, 2, 5])
+        self.assertEqual(list(index[0x101]), [1, 4])
+        self.assertEqual(list(index[0x0]), [3])
+        self.assertEqual(struct.unpack('=3I', memoryview(index[0x100]).tobytes()), (0, 2, 5))
+
+    def test_buffer_types(self):
+        data = bytearray(packet(0x100, 0) * 3)
+        self.assertEqual(len(parse_packets(data)), 3)
+        self.assertEqual(len(parse_packets(buffer(str(data)))), 3)
+        self.assertRaises(TypeError, parse_packets, 12)
+
+
+if __name__ == '__main__':
+    unittest.main()
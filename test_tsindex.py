@@ -0,0 +1,137 @@
+#!/usr/bin/python
+
+# Hardware-free tests for the .tsidx reader (hdhomerun.TsIndex)
+
+import os
+import shutil
+import struct
+import tempfile
+import unittest
+
+from hdhomerun import TsIndex
+
+TSIDX_MAGIC = 'HDHRTSIX'
+TSIDX_VERSION = 1
+TSIDX_RECORD_SIZE = 32
+
+FLAG_PAT = 0x01
+FLAG_RAP = 0x02
+FLAG_TIME = 0x04
+FLAG_DISCONTINUITY = 0x08
+
+START_NS = 1500000000 * 1000000000
+
+
+def header(start_ns=START_NS, magic=TSIDX_MAGIC, version=TSIDX_VERSION, record_size=TSIDX_RECORD_SIZE):
+    return struct.pack('<8sIIQ8x', magic, version, record_size, start_ns)
+
+
+def record(offset, time, wallclock_ns, pid, flags):
+    # offset, 27 MHz stream time, wall clock, pid, flags, padding
+    return struct.pack('<QQQHB5x', offset, time, wallclock_ns, pid, flags)
+
+
+class TsIndexTest(unittest.TestCase):
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.path = os.path.join(self.tmpdir, 'rec.tsidx')
+        # One record per second; a PAT every 4 seconds and a random access point on the odd ones
+        self.records = []
+        for i in range(20):
+            flags = FLAG_TIME
+            if i % 4 == 0:
+                flags |= FLAG_PAT
+            if i % 4 == 3:
+                flags |= FLAG_RAP
+            if i == 10:
+                flags |= FLAG_DISCONTINUITY
+            self.records.append((i * 188 * 1000, i * 27000000, START_NS + i * 1000000000, 0x100 + i, flags))
+        self.write(self.records)
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def write(self, records, mode='wb'):
+        f = open(self.path, mode)
+        if mode == 'wb':
+            f.write(header())
+        for r in records:
+            f.write(record(*r))
+        f.close()
+
+    def test_records(self):
+        index = TsIndex(self.path)
+        self.assertEqual(len(index), len(self.records))
+        for i, (offset, time, wallclock_ns, pid, flags) in enumerate(self.records):
+            r = index[i]
+            self.assertEqual(r['index'], i)
+            self.assertEqual(r['offset'], offset)
+            self.assertAlmostEqual(r['time'], time / 27000000.0)
+            self.assertAlmostEqual(r['wallclock'], wallclock_ns / 1e9, places=3)
+            self.assertEqual(r['pid'], pid)
+            self.assertEqual(r['pat'], bool(flags & FLAG_PAT))
+            self.assertEqual(r['rap'], bool(flags & FLAG_RAP))
+            self.assertEqual(r['discontinuity'], bool(flags & FLAG_DISCONTINUITY))
+        self.assertRaises(IndexError, lambda: index[len(self.records)])
+        self.assertAlmostEqual(index.duration(), 19.0)
+
+    def test_find_time(self):
+        index = TsIndex(self.path)
+        # Any record: the last one at or before the target
+        for target, expected in ((0.0, 0), (0.5, 0), (1.0, 1), (9.99, 9), (19.0, 19), (100.0, 19)):
+            self.assertEqual(index.find_time(target, rap=False)['index'], expected)
+        # Random access: step back to a PAT or random access point
+        for target, expected in ((0.5, 0), (2.5, 0), (3.0, 3), (5.5, 4), (7.2, 7), (18.9, 16), (19.0, 19)):
+            self.assertEqual(index.find_time(target)['index'], expected)
+        self.assertEqual(index.find_time(-1.0)['index'], 0)
+
+    def test_find_before_start(self):
+        self.write([(0, 27000000, START_NS + 1000000000, 0x100, FLAG_PAT)])
+        index = TsIndex(self.path)
+        self.assertEqual(index.find_time(0.5), None)
+        self.assertEqual(index.find_time(1.0)['index'], 0)
+
+    def test_find_wallclock(self):
+        index = TsIndex(self.path)
+        start = START_NS / 1e9
+        self.assertEqual(index.find_wallclock(start - 1.0), None)
+        self.assertEqual(index.find_wallclock(start + 6.5, rap=False)['index'], 6)
+        self.assertEqual(index.find_wallclock(start + 6.5)['index'], 4)
+        self.assertEqual(index.find_wallclock(start + 1000.0)['index'], 19)
+
+    def test_empty(self):
+        self.write([])
+        index = TsIndex(self.path)
+        self.assertEqual(len(index), 0)
+        self.assertEqual(index.find_time(1.0), None)
+        self.assertEqual(index.duration(), 0.0)
+
+    def test_refresh(self):
+        index = TsIndex(self.path)
+        more = [(r[0] + 20 * 188 * 1000, r[1] + 20 * 27000000, r[2] + 20 * 1000000000, r[3], r[4]) for r in self.records]
+        self.write(more, 'ab')
+        # The new records only appear once the file is remapped
+        self.assertEqual(len(index), 20)
+        self.assertEqual(index.refresh(), 40)
+        self.assertEqual(len(index), 40)
+        self.assertEqual(index[39]['offset'], more[-1][0])
+        self.assertEqual(index.find_time(30.5, rap=False)['index'], 30)
+
+    def test_partial_record(self):
+        # A record still being written is not counted
+        f = open(self.path, 'ab')
+        f.write(record(0, 0, 0, 0, 0)[:TSIDX_RECORD_SIZE / 2])
+        f.close()
+        self.assertEqual(len(TsIndex(self.path)), 20)
+
+    def test_bad_header(self):
+        for bad in (header(magic='NOTTSIDX'), header(version=2), header(record_size=16), header()[:16]):
+            f = open(self.path, 'wb')
+            f.write(bad)
+            f.close()
+            self.assertRaises(IOError, TsIndex, self.path)
+        self.assertRaises(IOError, TsIndex, os.path.join(self.tmpdir, 'missing.tsidx'))
+
+
+if __name__ == '__main__':
+    unittest.main()
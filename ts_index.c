@@ -0,0 +1,309 @@
+/*
+ * ts_index.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ *  Encoding of the .tsidx format described in device_common.h, and the
+ *  TsIndex reader.  The reader maps the file and binary searches the records
+ *  in place, so opening and seeking cost the same for any recording length.
+ */
+
+void tsidx_encode_header(uint8_t *p, uint64_t start_ns) {
+    memset(p, 0, TSIDX_HEADER_SIZE);
+    memcpy(p, TSIDX_MAGIC, 8);
+    put_le32(p + 8, TSIDX_VERSION);
+    put_le32(p + 12, TSIDX_RECORD_SIZE);
+    put_le64(p + 16, start_ns);
+}
+
+void tsidx_encode_record(uint8_t *p, const struct tsidx_record *record) {
+    memset(p, 0, TSIDX_RECORD_SIZE);
+    put_le64(p, record->offset);
+    put_le64(p + 8, record->time);
+    put_le64(p + 16, record->wallclock_ns);
+    put_le16(p + 24, record->pid);
+    p[26] = record->flags;
+}
+
+void tsidx_decode_record(const uint8_t *p, struct tsidx_record *record) {
+    record->offset = get_le64(p);
+    record->time = get_le64(p + 8);
+    record->wallclock_ns = get_le64(p + 16);
+    record->pid = get_le16(p + 24);
+    record->flags = p[26];
+}
+
+typedef struct {
+    PyObject_HEAD
+    int fd;                 /* valid while map is set */
+    uint8_t *map;
+    size_t map_size;
+    Py_ssize_t count;
+    uint64_t start_ns;
+} py_tsindex_object;
+
+/* (Re)maps the file, picking up records appended by a recording in progress */
+static int tsindex_map(py_tsindex_object *self) {
+    struct stat st;
+    uint8_t *map;
+
+    if(fstat(self->fd, &st) != 0)
+        return -1;
+    if((size_t)st.st_size < TSIDX_HEADER_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, self->fd, 0);
+    if(map == MAP_FAILED)
+        return -1;
+    if(memcmp(map, TSIDX_MAGIC, 8) != 0 || get_le32(map + 8) != TSIDX_VERSION ||
+       get_le32(map + 12) != TSIDX_RECORD_SIZE) {
+        munmap(map, (size_t)st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    if(self->map)
+        munmap(self->map, self->map_size);
+    self->map = map;
+    self->map_size = (size_t)st.st_size;
+    self->count = (Py_ssize_t)((self->map_size - TSIDX_HEADER_SIZE) / TSIDX_RECORD_SIZE);
+    self->start_ns = get_le64(map + 16);
+    return 0;
+}
+
+static const uint8_t *tsindex_record(py_tsindex_object *self, Py_ssize_t i) {
+    return self->map + TSIDX_HEADER_SIZE + (size_t)i * TSIDX_RECORD_SIZE;
+}
+
+static PyObject *build_tsidx_record_dict(py_tsindex_object *self, Py_ssize_t i) {
+    struct tsidx_record record;
+
+    tsidx_decode_record(tsindex_record(self, i), &record);
+    return Py_BuildValue("{s:n,s:K,s:d,s:d,s:i,s:O,s:O,s:O}",
+                         "index", i,
+                         "offset", (unsigned long long)record.offset,
+                         "time", (double)record.time / 27000000.0,
+                         "wallclock", (double)record.wallclock_ns / 1000000000.0,
+                         "pid", (int)record.pid,
+                         "pat", (record.flags & TSIDX_FLAG_PAT) ? Py_True : Py_False,
+                         "rap", (record.flags & TSIDX_FLAG_RAP) ? Py_True : Py_False,
+                         "discontinuity", (record.flags & TSIDX_FLAG_DISCONTINUITY) ? Py_True : Py_False);
+}
+
+/*
+ *  Returns the last record whose field (stream time or wall clock) is at or
+ *  before target, stepping back to a PAT or random access point if asked;
+ *  -1 if there is none.
+ */
+static Py_ssize_t tsindex_search(py_tsindex_object *self, uint64_t target, int wallclock, int random_access) {
+    struct tsidx_record record;
+    Py_ssize_t lo = 0, hi = self->count, mid;
+
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        tsidx_decode_record(tsindex_record(self, mid), &record);
+        if((wallclock ? record.wallclock_ns : record.time) <= target)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for(mid = lo - 1; mid >= 0 && random_access; mid--) {
+        tsidx_decode_record(tsindex_record(self, mid), &record);
+        if(record.flags & (TSIDX_FLAG_PAT | TSIDX_FLAG_RAP))
+            break;
+    }
+    return mid;
+}
+
+static int py_tsindex_init(py_tsindex_object *self, PyObject *args, PyObject *kwds) {
+    char *path = NULL;
+    char *kwlist[] = {"path", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &path))
+        return -1;
+    if(self->map) {
+        PyErr_SetString(PyExc_RuntimeError, "TsIndex is already open");
+        return -1;
+    }
+    self->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(self->fd < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        return -1;
+    }
+    if(tsindex_map(self) != 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        close(self->fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void py_tsindex_dealloc(py_tsindex_object *self) {
+    if(self->map) {
+        munmap(self->map, self->map_size);
+        close(self->fd);
+    }
+    self->ob_type->tp_free((PyObject*)self);
+}
+
+static Py_ssize_t py_tsindex_length(py_tsindex_object *self) {
+    return self->count;
+}
+
+static PyObject *py_tsindex_item(py_tsindex_object *self, Py_ssize_t i) {
+    if(i < 0 || i >= self->count) {
+        PyErr_SetString(PyExc_IndexError, "index record out of range");
+        return NULL;
+    }
+    return build_tsidx_record_dict(self, i);
+}
+
+static PyObject *py_tsindex_find(py_tsindex_object *self, PyObject *args, PyObject *kwds, int wallclock) {
+    double target;
+    PyObject *rap_obj = NULL;
+    char *kwlist[] = {"seconds", "rap", NULL};
+    Py_ssize_t i;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "d|O!", kwlist, &target, &PyBool_Type, &rap_obj))
+        return NULL;
+    if(!self->map) {
+        PyErr_SetString(PyExc_ValueError, "TsIndex is not open");
+        return NULL;
+    }
+    if(target < 0.0)
+        target = 0.0;
+    i = tsindex_search(self, wallclock ? (uint64_t)(target * 1000000000.0) : (uint64_t)(target * 27000000.0),
+                       wallclock, rap_obj ? (rap_obj == Py_True) : 1);
+    if(i < 0)
+        Py_RETURN_NONE;
+    return build_tsidx_record_dict(self, i);
+}
+
+PyDoc_STRVAR(TsIndex_DOC_find_time,
+    "Return the record to start playback from to reach the given number of\n"
+    "seconds into the recording: the last PAT or random access point at or\n"
+    "before it (any record if rap is False), or None.  O(log n).");
+
+static PyObject *py_tsindex_find_time(py_tsindex_object *self, PyObject *args, PyObject *kwds) {
+    return py_tsindex_find(self, args, kwds, 0);
+}
+
+PyDoc_STRVAR(TsIndex_DOC_find_wallclock,
+    "As find_time(), for a wall clock time in seconds since the epoch.");
+
+static PyObject *py_tsindex_find_wallclock(py_tsindex_object *self, PyObject *args, PyObject *kwds) {
+    return py_tsindex_find(self, args, kwds, 1);
+}
+
+PyDoc_STRVAR(TsIndex_DOC_refresh,
+    "Remap the index to pick up records written since it was opened.\n"
+    "Returns the number of records.");
+
+static PyObject *py_tsindex_refresh(py_tsindex_object *self) {
+    if(!self->map) {
+        PyErr_SetString(PyExc_ValueError, "TsIndex is not open");
+        return NULL;
+    }
+    if(tsindex_map(self) != 0)
+        return PyErr_SetFromErrno(PyExc_IOError);
+    return PyInt_FromSsize_t(self->count);
+}
+
+PyDoc_STRVAR(TsIndex_DOC_duration,
+    "Return the stream time of the last record in seconds.");
+
+static PyObject *py_tsindex_duration(py_tsindex_object *self) {
+    struct tsidx_record record;
+
+    if(self->count == 0)
+        return PyFloat_FromDouble(0.0);
+    tsidx_decode_record(tsindex_record(self, self->count - 1), &record);
+    return PyFloat_FromDouble((double)record.time / 27000000.0);
+}
+
+static PySequenceMethods py_tsindex_as_sequence = {
+    (lenfunc)py_tsindex_length,     /* sq_length */
+    0,                              /* sq_concat */
+    0,                              /* sq_repeat */
+    (ssizeargfunc)py_tsindex_item,  /* sq_item */
+};
+
+static PyMethodDef py_tsindex_methods[] = {
+    {"find_time",               (PyCFunction)py_tsindex_find_time,              METH_KEYWORDS,              TsIndex_DOC_find_time},
+    {"find_wallclock",          (PyCFunction)py_tsindex_find_wallclock,         METH_KEYWORDS,              TsIndex_DOC_find_wallclock},
+    {"refresh",                 (PyCFunction)py_tsindex_refresh,                METH_NOARGS,                TsIndex_DOC_refresh},
+    {"duration",                (PyCFunction)py_tsindex_duration,               METH_NOARGS,                TsIndex_DOC_duration},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_TsIndex_type_doc,
+    "TsIndex(path)\n\n"
+    "Read-only view of a .tsidx recording index written by Device.record().\n"
+    "len() gives the number of records and indexing returns them as dicts.");
+
+PyTypeObject hdhomerun_TsIndex_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.TsIndex",            /* tp_name */
+    sizeof(py_tsindex_object),      /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_tsindex_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    &py_tsindex_as_sequence,        /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    hdhomerun_TsIndex_type_doc,     /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_tsindex_methods,             /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    (initproc)py_tsindex_init,      /* tp_init */
+    (allocfunc)PyType_GenericAlloc, /* tp_alloc */
+    (newfunc)PyType_GenericNew,     /* tp_new */
+    (freefunc)PyObject_Del,         /* tp_free */
+};
@@ -0,0 +1,372 @@
+/*
+ * ts_simd.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+#include <stdlib.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define TS_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ *  Bulk transport stream kernels: packet header flag counting, sync byte
+ *  search and realignment, and the MPEG-2 CRC32 used by PSI sections.
+ *
+ *  The vector versions are compiled per function for their instruction set
+ *  and picked once at start-up from what the CPU reports, so the module
+ *  itself needs no special compiler flags.  HDHOMERUN_SIMD=scalar (or sse2)
+ *  in the environment caps the choice, for comparison and testing.
+ *
+ *  The CRC is table driven (slicing by 8): SSE4.2's crc32 instruction
+ *  implements the Castagnoli polynomial, not the MPEG-2 one, and PSI
+ *  sections are too short for carry-less multiply folding to pay off.
+ */
+
+#define TS_SYNC_CONFIRM 3   /* consecutive sync bytes needed to accept an alignment */
+#define CRC32_MPEG2_POLY 0x04C11DB7
+
+static uint32_t crc_table[8][256];
+
+static void (*scan_impl)(const uint8_t *, size_t, struct ts_scan_counts *);
+static size_t (*find_sync_impl)(const uint8_t *, size_t, size_t);
+static const char *simd_level = "scalar";
+
+/*
+ *  Scalar kernels
+ */
+
+static void ts_scan_scalar(const uint8_t *data, size_t packets, struct ts_scan_counts *counts) {
+    const uint8_t *pkt;
+    size_t i;
+
+    for(i = 0; i < packets; i++) {
+        pkt = data + i * TS_PACKET_SIZE;
+        if(pkt[0] != TS_SYNC_BYTE) {
+            counts->sync_errors++;
+            continue;
+        }
+        counts->transport_errors += TS_TEI(pkt);
+        counts->scrambled += TS_SCRAMBLING(pkt) != 0;
+    }
+    counts->packets += packets;
+}
+
+/* True if every packet start from offset on (up to TS_SYNC_CONFIRM of them) holds a sync byte */
+static int ts_sync_at(const uint8_t *data, size_t length, size_t offset) {
+    int i;
+
+    for(i = 0; i < TS_SYNC_CONFIRM && offset < length; i++, offset += TS_PACKET_SIZE) {
+        if(data[offset] != TS_SYNC_BYTE)
+            return 0;
+    }
+    return 1;
+}
+
+static size_t ts_find_sync_scalar(const uint8_t *data, size_t length, size_t start) {
+    const uint8_t *p;
+
+    while(start < length) {
+        p = memchr(data + start, TS_SYNC_BYTE, length - start);
+        if(!p)
+            break;
+        start = (size_t)(p - data);
+        if(ts_sync_at(data, length, start))
+            return start;
+        start++;
+    }
+    return length;
+}
+
+/*
+ *  x86 kernels
+ */
+
+#ifdef TS_SIMD_X86
+
+__attribute__((target("sse2")))
+static size_t ts_find_sync_sse2(const uint8_t *data, size_t length, size_t start) {
+    const __m128i sync = _mm_set1_epi8((char)TS_SYNC_BYTE);
+    const size_t span = (TS_SYNC_CONFIRM - 1) * TS_PACKET_SIZE;
+    __m128i a, b, c;
+    unsigned int mask;
+
+    /* Sixteen candidate offsets at a time, each confirmed one and two packets on */
+    while(start + span + 16 <= length) {
+        a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + start)), sync);
+        b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + start + TS_PACKET_SIZE)), sync);
+        c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + start + 2 * TS_PACKET_SIZE)), sync);
+        mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(a, _mm_and_si128(b, c)));
+        if(mask)
+            return start + (size_t)__builtin_ctz(mask);
+        start += 16;
+    }
+    return ts_find_sync_scalar(data, length, start);
+}
+
+__attribute__((target("avx2")))
+static size_t ts_find_sync_avx2(const uint8_t *data, size_t length, size_t start) {
+    const __m256i sync = _mm256_set1_epi8((char)TS_SYNC_BYTE);
+    const size_t span = (TS_SYNC_CONFIRM - 1) * TS_PACKET_SIZE;
+    __m256i a, b, c;
+    unsigned int mask;
+
+    while(start + span + 32 <= length) {
+        a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + start)), sync);
+        b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + start + TS_PACKET_SIZE)), sync);
+        c = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + start + 2 * TS_PACKET_SIZE)), sync);
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(a, _mm256_and_si256(b, c)));
+        if(mask)
+            return start + (size_t)__builtin_ctz(mask);
+        start += 32;
+    }
+    return ts_find_sync_scalar(data, length, start);
+}
+
+/* Gathers the 4 byte headers of eight packets at once and tests them side by side */
+__attribute__((target("avx2,popcnt")))
+static void ts_scan_avx2(const uint8_t *data, size_t packets, struct ts_scan_counts *counts) {
+    const __m256i offsets = _mm256_setr_epi32(0, 1 * TS_PACKET_SIZE, 2 * TS_PACKET_SIZE, 3 * TS_PACKET_SIZE,
+                                              4 * TS_PACKET_SIZE, 5 * TS_PACKET_SIZE, 6 * TS_PACKET_SIZE,
+                                              7 * TS_PACKET_SIZE);
+    const __m256i sync_mask = _mm256_set1_epi32(0xFF), sync = _mm256_set1_epi32(TS_SYNC_BYTE);
+    const __m256i tei_mask = _mm256_set1_epi32(0x8000);
+    const __m256i scrambling_mask = _mm256_set1_epi32((int)0xC0000000), zero = _mm256_setzero_si256();
+    __m256i header, good, tei, clear;
+    unsigned int good_bits;
+    size_t i;
+
+    for(i = 0; i + 8 <= packets; i += 8) {
+        header = _mm256_i32gather_epi32((const int *)(data + i * TS_PACKET_SIZE), offsets, 1);
+        good = _mm256_cmpeq_epi32(_mm256_and_si256(header, sync_mask), sync);
+        tei = _mm256_cmpeq_epi32(_mm256_and_si256(header, tei_mask), tei_mask);
+        clear = _mm256_cmpeq_epi32(_mm256_and_si256(header, scrambling_mask), zero);
+        good_bits = (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(good));
+        counts->sync_errors += 8 - (unsigned int)__builtin_popcount(good_bits);
+        counts->transport_errors += (unsigned int)__builtin_popcount(good_bits &
+                                    (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(tei)));
+        counts->scrambled += (unsigned int)__builtin_popcount(good_bits &
+                             ~(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(clear)));
+    }
+    counts->packets += i;
+    ts_scan_scalar(data + i * TS_PACKET_SIZE, packets - i, counts);
+}
+
+#endif /* TS_SIMD_X86 */
+
+/*
+ *  Dispatch
+ */
+
+/* Internal: picks the kernels for this CPU; called once from module initialisation */
+void ts_simd_init(void) {
+    const char *cap = getenv("HDHOMERUN_SIMD");
+    uint32_t crc;
+    int i, j;
+
+    for(i = 0; i < 256; i++) {
+        crc = (uint32_t)i << 24;
+        for(j = 0; j < 8; j++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ CRC32_MPEG2_POLY : crc << 1;
+        crc_table[0][i] = crc;
+    }
+    for(i = 0; i < 256; i++) {
+        for(j = 1; j < 8; j++)
+            crc_table[j][i] = (crc_table[j - 1][i] << 8) ^ crc_table[0][crc_table[j - 1][i] >> 24];
+    }
+
+    scan_impl = ts_scan_scalar;
+    find_sync_impl = ts_find_sync_scalar;
+    simd_level = "scalar";
+    if(cap && strcmp(cap, "scalar") == 0)
+        return;
+#ifdef TS_SIMD_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) {
+        find_sync_impl = ts_find_sync_sse2;
+        simd_level = "sse2";
+    }
+    if(cap && strcmp(cap, "sse2") == 0)
+        return;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        scan_impl = ts_scan_avx2;
+        find_sync_impl = ts_find_sync_avx2;
+        simd_level = "avx2";
+    }
+#endif
+}
+
+/* Adds the header flags of whole packets to counts (which the caller zeroes) */
+void ts_scan(const uint8_t *data, size_t packets, struct ts_scan_counts *counts) {
+    scan_impl(data, packets, counts);
+}
+
+/* Returns the first offset from start at which packets line up, or length if there is none */
+size_t ts_find_sync(const uint8_t *data, size_t length, size_t start) {
+    return find_sync_impl(data, length, start);
+}
+
+/*
+ *  Copies the aligned packets of data to out (which may be data itself),
+ *  skipping anything between them; returns the number of bytes stored.  A
+ *  trailing partial packet is dropped.
+ */
+size_t ts_realign(const uint8_t *data, size_t length, uint8_t *out, size_t *pskipped) {
+    size_t pos = 0, used = 0, skipped = 0, next;
+    int locked = 0;
+
+    while(pos + TS_PACKET_SIZE <= length) {
+        /* Once aligned, packets are taken for as long as their sync bytes keep coming */
+        if(!locked || data[pos] != TS_SYNC_BYTE) {
+            next = ts_find_sync(data, length, pos);
+            skipped += next - pos;
+            pos = next;
+            locked = 1;
+            continue;
+        }
+        if(out + used != data + pos)
+            memmove(out + used, data + pos, TS_PACKET_SIZE);
+        used += TS_PACKET_SIZE;
+        pos += TS_PACKET_SIZE;
+    }
+    if(pskipped)
+        *pskipped = skipped + (length - pos);
+    return used;
+}
+
+/* MPEG-2 CRC32 (ISO/IEC 13818-1 Annex A); a whole section including its CRC gives 0 */
+uint32_t crc32_mpeg2(const uint8_t *data, size_t length, uint32_t crc) {
+    uint32_t high;
+
+    while(length >= 8) {
+        high = crc ^ (((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3]);
+        crc = crc_table[7][high >> 24] ^ crc_table[6][(high >> 16) & 0xFF] ^
+              crc_table[5][(high >> 8) & 0xFF] ^ crc_table[4][high & 0xFF] ^
+              crc_table[3][data[4]] ^ crc_table[2][data[5]] ^ crc_table[1][data[6]] ^ crc_table[0][data[7]];
+        data += 8;
+        length -= 8;
+    }
+    while(length-- > 0)
+        crc = (crc << 8) ^ crc_table[0][((crc >> 24) ^ *data++) & 0xFF];
+    return crc;
+}
+
+/*
+ *  Python interface
+ */
+
+const char hdhomerun_DOC_ts_check[] =
+    "Count the packets in data, and those among them with a bad sync byte, the\n"
+    "transport_error_indicator set or a scrambled payload.  data should be\n"
+    "aligned (see ts_realign()); a trailing partial packet is ignored.";
+
+PyObject *py_hdhomerun_ts_check(PyObject *module, PyObject *args, PyObject *kwds) {
+    struct ts_scan_counts counts;
+    char *kwlist[] = {"data", NULL};
+    Py_buffer view;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s*", kwlist, &view))
+        return NULL;
+    memset(&counts, 0, sizeof(counts));
+    Py_BEGIN_ALLOW_THREADS
+    ts_scan(view.buf, (size_t)view.len / TS_PACKET_SIZE, &counts);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    return Py_BuildValue("{s:K,s:K,s:K,s:K}",
+                         "packets", counts.packets,
+                         "sync_errors", counts.sync_errors,
+                         "transport_errors", counts.transport_errors,
+                         "scrambled", counts.scrambled);
+}
+
+const char hdhomerun_DOC_ts_find_sync[] =
+    "Return the first offset from start at which three packets (or as many as\n"
+    "remain) line up on sync bytes, or -1.";
+
+PyObject *py_hdhomerun_ts_find_sync(PyObject *module, PyObject *args, PyObject *kwds) {
+    Py_ssize_t start = 0;
+    char *kwlist[] = {"data", "start", NULL};
+    Py_buffer view;
+    size_t offset;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s*|n", kwlist, &view, &start))
+        return NULL;
+    if(start < 0)
+        start = 0;
+    offset = (size_t)view.len;
+    if(start < view.len)
+        offset = ts_find_sync(view.buf, (size_t)view.len, (size_t)start);
+    PyBuffer_Release(&view);
+    return PyInt_FromSsize_t(offset < (size_t)view.len ? (Py_ssize_t)offset : -1);
+}
+
+const char hdhomerun_DOC_ts_realign[] =
+    "Return a bytearray of the whole, aligned packets in data, with any bytes\n"
+    "between them (lost sync, partial packets) removed, and the number of bytes\n"
+    "removed.";
+
+PyObject *py_hdhomerun_ts_realign(PyObject *module, PyObject *args, PyObject *kwds) {
+    char *kwlist[] = {"data", NULL};
+    PyObject *result;
+    Py_buffer view;
+    size_t used, skipped;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s*", kwlist, &view))
+        return NULL;
+    result = PyByteArray_FromStringAndSize(NULL, view.len);
+    if(!result) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    used = ts_realign(view.buf, (size_t)view.len, (uint8_t *)PyByteArray_AS_STRING(result), &skipped);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    if(PyByteArray_Resize(result, (Py_ssize_t)used) != 0) {
+        Py_DECREF(result);
+        return NULL;
+    }
+    return Py_BuildValue("(Nn)", result, (Py_ssize_t)skipped);
+}
+
+const char hdhomerun_DOC_crc32_mpeg2[] =
+    "Return the MPEG-2 CRC32 of data, continuing from crc.  Over a complete PSI\n"
+    "section, including its CRC_32 field, the result is 0 if the section is\n"
+    "intact.";
+
+PyObject *py_hdhomerun_crc32_mpeg2(PyObject *module, PyObject *args, PyObject *kwds) {
+    unsigned int crc = 0xFFFFFFFF;
+    char *kwlist[] = {"data", "crc", NULL};
+    Py_buffer view;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s*|I", kwlist, &view, &crc))
+        return NULL;
+    crc = crc32_mpeg2(view.buf, (size_t)view.len, crc);
+    PyBuffer_Release(&view);
+    return PyLong_FromUnsignedLong(crc);
+}
+
+const char hdhomerun_DOC_simd_level[] =
+    "Return the instruction set the stream kernels use: 'avx2', 'sse2' or 'scalar'.";
+
+PyObject *py_hdhomerun_simd_level(PyObject *module) {
+    return PyString_FromString(simd_level);
+}
@@ -0,0 +1,463 @@
+/*
+ * ts_table.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  Packet header tables.  parse_packets() decodes the headers of a whole
+ *  chunk in one pass into fixed-size records, exported through the buffer
+ *  protocol with a PEP 3118 struct format so that numpy.asarray() sees named
+ *  columns.  Payloads are not copied; each record holds the packet's byte
+ *  offset in the chunk, which is kept alive as the table's data attribute.
+ */
+
+#define TS_TABLE_FORMAT "T{=I:offset:H:pid:B:cc:B:flags:B:scrambling:B:adaptation:B:payload_offset:x:q:pcr:}"
+
+#define TS_TABLE_TEI            0x01
+#define TS_TABLE_PUSI           0x02
+#define TS_TABLE_PRIORITY       0x04
+#define TS_TABLE_DISCONTINUITY  0x08
+#define TS_TABLE_RAP            0x10
+#define TS_TABLE_PCR            0x20
+#define TS_TABLE_SYNC_ERROR     0x40
+
+#define TS_TABLE_RECORD_SIZE 20
+
+/* Laid out by hand so that the record matches TS_TABLE_FORMAT exactly */
+static void ts_table_encode(uint8_t *out, uint32_t offset, const uint8_t *pkt) {
+    uint64_t pcr = 0;
+    int64_t pcr_value = -1;
+    int discontinuity = 0, payload;
+    uint8_t flags = 0;
+    uint16_t pid;
+
+    memset(out, 0, TS_TABLE_RECORD_SIZE);
+    memcpy(out, &offset, 4);
+    if(pkt[0] != TS_SYNC_BYTE) {
+        out[7] = TS_TABLE_SYNC_ERROR;
+        memcpy(out + 12, &pcr_value, 8);
+        return;
+    }
+
+    pid = TS_PID(pkt);
+    memcpy(out + 4, &pid, 2);
+    out[6] = TS_CC(pkt);
+    if(TS_TEI(pkt))
+        flags |= TS_TABLE_TEI;
+    if(TS_PUSI(pkt))
+        flags |= TS_TABLE_PUSI;
+    if(pkt[1] & 0x20)
+        flags |= TS_TABLE_PRIORITY;
+    if(TS_HAS_ADAPTATION(pkt) && pkt[4] > 0) {
+        if(pkt[5] & 0x80)
+            flags |= TS_TABLE_DISCONTINUITY;
+        if(pkt[5] & 0x40)
+            flags |= TS_TABLE_RAP;
+    }
+    if(ts_get_pcr(pkt, &pcr, &discontinuity)) {
+        flags |= TS_TABLE_PCR;
+        pcr_value = (int64_t)pcr;
+    }
+    out[7] = flags;
+    out[8] = TS_SCRAMBLING(pkt);
+    out[9] = (pkt[3] >> 4) & 0x03;
+    payload = ts_payload_offset(pkt);
+    out[10] = payload > 0 ? (uint8_t)payload : 0;
+    memcpy(out + 12, &pcr_value, 8);
+}
+
+/*
+ *  Shared buffer protocol support for the two array types
+ */
+
+typedef struct {
+    PyObject_HEAD
+    uint8_t *items;
+    Py_ssize_t count;
+    Py_ssize_t itemsize;
+    const char *format;
+} py_ts_array_object;
+
+static int py_ts_array_getbuffer(py_ts_array_object *self, Py_buffer *view, int flags) {
+    if(PyBuffer_FillInfo(view, (PyObject *)self, self->items, self->count * self->itemsize, 1, flags) != 0)
+        return -1;
+    view->itemsize = self->itemsize;
+    if(flags & PyBUF_FORMAT)
+        view->format = (char *)self->format;
+    if(flags & PyBUF_ND) {
+        view->ndim = 1;
+        view->shape = &self->count;
+    }
+    if(flags & PyBUF_STRIDES)
+        view->strides = &self->itemsize;
+    return 0;
+}
+
+static Py_ssize_t py_ts_array_getreadbuffer(py_ts_array_object *self, Py_ssize_t segment, void **pptr) {
+    if(segment != 0) {
+        PyErr_SetString(PyExc_SystemError, "accessing non-existent segment");
+        return -1;
+    }
+    *pptr = self->items;
+    return self->count * self->itemsize;
+}
+
+static Py_ssize_t py_ts_array_getsegcount(py_ts_array_object *self, Py_ssize_t *plen) {
+    if(plen)
+        *plen = self->count * self->itemsize;
+    return 1;
+}
+
+static PyBufferProcs py_ts_array_as_buffer = {
+    (readbufferproc)py_ts_array_getreadbuffer,  /* bf_getreadbuffer */
+    0,                                          /* bf_getwritebuffer */
+    (segcountproc)py_ts_array_getsegcount,      /* bf_getsegcount */
+    0,                                          /* bf_getcharbuffer */
+    (getbufferproc)py_ts_array_getbuffer,       /* bf_getbuffer */
+    0,                                          /* bf_releasebuffer */
+};
+
+static Py_ssize_t py_ts_array_length(py_ts_array_object *self) {
+    return self->count;
+}
+
+/*
+ *  PacketIndex: row numbers into a PacketTable
+ */
+
+static void py_packet_index_dealloc(py_ts_array_object *self) {
+    free(self->items);
+    PyObject_Del(self);
+}
+
+static PyObject *py_packet_index_item(py_ts_array_object *self, Py_ssize_t i) {
+    if(i < 0 || i >= self->count) {
+        PyErr_SetString(PyExc_IndexError, "packet index out of range");
+        return NULL;
+    }
+    return PyInt_FromLong((long)((uint32_t *)self->items)[i]);
+}
+
+static PySequenceMethods py_packet_index_as_sequence = {
+    (lenfunc)py_ts_array_length,            /* sq_length */
+    0,                                      /* sq_concat */
+    0,                                      /* sq_repeat */
+    (ssizeargfunc)py_packet_index_item,     /* sq_item */
+};
+
+PyDoc_STRVAR(hdhomerun_PacketIndex_type_doc,
+    "Row numbers of a PacketTable's packets on one PID, as an array of\n"
+    "unsigned 32 bit integers (buffer format 'I').");
+
+PyTypeObject hdhomerun_PacketIndex_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.PacketIndex",        /* tp_name */
+    sizeof(py_ts_array_object),     /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_packet_index_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    &py_packet_index_as_sequence,   /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    &py_ts_array_as_buffer,         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /* tp_flags */
+    hdhomerun_PacketIndex_type_doc, /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    0,                              /* tp_methods */
+    0,                              /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    0,                              /* tp_new */
+    0,                              /* tp_free */
+};
+
+/*
+ *  PacketTable: one record per packet
+ */
+
+typedef struct {
+    py_ts_array_object array;
+    PyObject *data;             /* the chunk the offsets refer to */
+} py_packet_table_object;
+
+static void py_packet_table_dealloc(py_packet_table_object *self) {
+    free(self->array.items);
+    Py_XDECREF(self->data);
+    PyObject_Del(self);
+}
+
+static PyObject *py_packet_table_item(py_packet_table_object *self, Py_ssize_t i) {
+    const uint8_t *record;
+    uint32_t offset;
+    uint16_t pid;
+    int64_t pcr;
+
+    if(i < 0 || i >= self->array.count) {
+        PyErr_SetString(PyExc_IndexError, "packet index out of range");
+        return NULL;
+    }
+    record = self->array.items + i * TS_TABLE_RECORD_SIZE;
+    memcpy(&offset, record, 4);
+    memcpy(&pid, record + 4, 2);
+    memcpy(&pcr, record + 12, 8);
+    return Py_BuildValue("{s:I,s:H,s:B,s:B,s:B,s:B,s:B,s:L}",
+                         "offset", offset,
+                         "pid", pid,
+                         "cc", record[6],
+                         "flags", record[7],
+                         "scrambling", record[8],
+                         "adaptation", record[9],
+                         "payload_offset", record[10],
+                         "pcr", (PY_LONG_LONG)pcr);
+}
+
+static PySequenceMethods py_packet_table_as_sequence = {
+    (lenfunc)py_ts_array_length,            /* sq_length */
+    0,                                      /* sq_concat */
+    0,                                      /* sq_repeat */
+    (ssizeargfunc)py_packet_table_item,     /* sq_item */
+};
+
+PyDoc_STRVAR(PacketTable_DOC_by_pid,
+    "Return a dict mapping each PID present to a PacketIndex of its rows.");
+
+static PyObject *py_packet_table_by_pid(py_packet_table_object *self) {
+    Py_ssize_t *counts, *next, i;
+    py_ts_array_object **indexes;
+    PyObject *result = NULL, *key;
+    const uint8_t *record;
+    uint16_t pid;
+    int ok = 1;
+
+    /* Two passes: size every PID's index, then fill them in row order */
+    counts = calloc(TS_PID_COUNT, sizeof(*counts));
+    next = calloc(TS_PID_COUNT, sizeof(*next));
+    indexes = calloc(TS_PID_COUNT, sizeof(*indexes));
+    if(!counts || !next || !indexes) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    for(i = 0; i < self->array.count; i++) {
+        record = self->array.items + i * TS_TABLE_RECORD_SIZE;
+        if(record[7] & TS_TABLE_SYNC_ERROR)
+            continue;
+        memcpy(&pid, record + 4, 2);
+        counts[pid]++;
+    }
+
+    result = PyDict_New();
+    if(!result)
+        goto out;
+    for(pid = 0; pid < TS_PID_COUNT && ok; pid++) {
+        if(!counts[pid])
+            continue;
+        indexes[pid] = PyObject_New(py_ts_array_object, &hdhomerun_PacketIndex_type);
+        if(!indexes[pid]) {
+            ok = 0;
+            break;
+        }
+        indexes[pid]->count = counts[pid];
+        indexes[pid]->itemsize = sizeof(uint32_t);
+        indexes[pid]->format = "I";
+        indexes[pid]->items = malloc((size_t)counts[pid] * sizeof(uint32_t));
+        key = PyInt_FromLong(pid);
+        if(!indexes[pid]->items || !key || PyDict_SetItem(result, key, (PyObject *)indexes[pid]) != 0) {
+            if(!indexes[pid]->items)
+                PyErr_NoMemory();
+            ok = 0;
+        }
+        Py_XDECREF(key);
+        Py_DECREF(indexes[pid]);   /* the dict holds it now */
+    }
+    if(!ok) {
+        Py_CLEAR(result);
+        goto out;
+    }
+    for(i = 0; i < self->array.count; i++) {
+        record = self->array.items + i * TS_TABLE_RECORD_SIZE;
+        if(record[7] & TS_TABLE_SYNC_ERROR)
+            continue;
+        memcpy(&pid, record + 4, 2);
+        ((uint32_t *)indexes[pid]->items)[next[pid]++] = (uint32_t)i;
+    }
+
+out:
+    free(counts);
+    free(next);
+    free(indexes);
+    return result;
+}
+
+static PyMethodDef py_packet_table_methods[] = {
+    {"by_pid",                  (PyCFunction)py_packet_table_by_pid,            METH_NOARGS,                PacketTable_DOC_by_pid},
+    {NULL,                      NULL,                                           0,                          NULL}  /* Sentinel */
+};
+
+static PyMemberDef py_packet_table_members[] = {
+    {"data",                    T_OBJECT,   offsetof(py_packet_table_object, data),     READONLY,   "The chunk which was parsed."},
+    {NULL}  /* Sentinel */
+};
+
+PyDoc_STRVAR(hdhomerun_PacketTable_type_doc,
+    "The decoded headers of a chunk of packets, created by parse_packets().\n\n"
+    "Supports len(), indexing (a dict per packet) and the buffer protocol,\n"
+    "with one 20 byte record per packet: offset (of the packet in data), pid,\n"
+    "cc, flags, scrambling, adaptation (adaptation_field_control),\n"
+    "payload_offset (0 without a payload) and pcr (27MHz, -1 if absent).\n"
+    "numpy.asarray(table) gives a structured array with those columns.  The\n"
+    "flag bits are available as TEI, PUSI, PRIORITY, DISCONTINUITY, RAP, PCR\n"
+    "and SYNC_ERROR; a packet with SYNC_ERROR set has no other fields.");
+
+PyTypeObject hdhomerun_PacketTable_type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                              /* ob_size */
+    "hdhomerun.PacketTable",        /* tp_name */
+    sizeof(py_packet_table_object), /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)py_packet_table_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    &py_packet_table_as_sequence,   /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    &py_ts_array_as_buffer,         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /* tp_flags */
+    hdhomerun_PacketTable_type_doc, /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    py_packet_table_methods,        /* tp_methods */
+    py_packet_table_members,        /* tp_members */
+    0,                              /* tp_getset */
+    0,                              /* tp_base */
+    0,                              /* tp_dict */
+    0,                              /* tp_descr_get */
+    0,                              /* tp_descr_set */
+    0,                              /* tp_dictoffset */
+    0,                              /* tp_init */
+    0,                              /* tp_alloc */
+    0,                              /* tp_new */
+    0,                              /* tp_free */
+};
+
+/* Internal: publishes the flag bits as PacketTable class attributes; call after PyType_Ready */
+int ts_table_add_constants(void) {
+    static const struct { const char *name; long value; } constants[] = {
+        {"TEI", TS_TABLE_TEI},
+        {"PUSI", TS_TABLE_PUSI},
+        {"PRIORITY", TS_TABLE_PRIORITY},
+        {"DISCONTINUITY", TS_TABLE_DISCONTINUITY},
+        {"RAP", TS_TABLE_RAP},
+        {"PCR", TS_TABLE_PCR},
+        {"SYNC_ERROR", TS_TABLE_SYNC_ERROR},
+    };
+    PyObject *value;
+    size_t i;
+
+    for(i = 0; i < sizeof(constants) / sizeof(constants[0]); i++) {
+        value = PyInt_FromLong(constants[i].value);
+        if(!value || PyDict_SetItemString(hdhomerun_PacketTable_type.tp_dict, constants[i].name, value) != 0) {
+            Py_XDECREF(value);
+            return -1;
+        }
+        Py_DECREF(value);
+    }
+    return 0;
+}
+
+const char hdhomerun_DOC_parse_packets[] =
+    "Decode the header of every 188 byte packet in data (e.g. the result of\n"
+    "Device.stream_recv()) and return them as a PacketTable.  A trailing\n"
+    "partial packet is ignored.";
+
+PyObject *py_hdhomerun_parse_packets(PyObject *module, PyObject *args, PyObject *kwds) {
+    PyObject *data;
+    char *kwlist[] = {"data", NULL};
+    py_packet_table_object *table;
+    Py_buffer view;
+    Py_ssize_t i;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &data))
+        return NULL;
+    if(PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) != 0)
+        return NULL;
+    /* Records hold the packet's byte offset in 32 bits */
+    if((unsigned long long)view.len > UINT32_MAX) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError, "data must be smaller than 4 GiB");
+        return NULL;
+    }
+
+    table = PyObject_New(py_packet_table_object, &hdhomerun_PacketTable_type);
+    if(!table) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    table->array.count = view.len / TS_PACKET_SIZE;
+    table->array.itemsize = TS_TABLE_RECORD_SIZE;
+    table->array.format = TS_TABLE_FORMAT;
+    table->array.items = malloc(table->array.count > 0 ? (size_t)table->array.count * TS_TABLE_RECORD_SIZE : 1);
+    Py_INCREF(data);
+    table->data = data;
+    if(!table->array.items) {
+        PyBuffer_Release(&view);
+        Py_DECREF(table);
+        return PyErr_NoMemory();
+    }
+
+    for(i = 0; i < table->array.count; i++)
+        ts_table_encode(table->array.items + i * TS_TABLE_RECORD_SIZE, (uint32_t)(i * TS_PACKET_SIZE),
+                        (const uint8_t *)view.buf + i * TS_PACKET_SIZE);
+    PyBuffer_Release(&view);
+    return (PyObject *)table;
+}
@@ -0,0 +1,121 @@
+/*
+ * ts_util.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  MPEG-2 transport stream helpers (ISO/IEC 13818-1) shared by the stream
+ *  stages.  None of these touch Python state.
+ */
+
+/* Returns the offset of the packet's payload, or -1 if it carries none */
+int ts_payload_offset(const uint8_t *pkt) {
+    int offset = 4;
+
+    if(pkt[0] != TS_SYNC_BYTE || !TS_HAS_PAYLOAD(pkt))
+        return -1;
+    if(TS_HAS_ADAPTATION(pkt))
+        offset += 1 + pkt[4];
+    if(offset >= TS_PACKET_SIZE)
+        return -1;
+    return offset;
+}
+
+/*
+ *  If the packet starts a PSI section, returns a pointer to its table_id and
+ *  stores the number of section bytes present in this packet.
+ */
+const uint8_t *ts_section_start(const uint8_t *pkt, size_t *plength) {
+    int offset = ts_payload_offset(pkt);
+
+    if(offset < 0 || !TS_PUSI(pkt))
+        return NULL;
+    offset += 1 + pkt[offset];  /* pointer_field */
+    if(offset >= TS_PACKET_SIZE)
+        return NULL;
+    *plength = (size_t)(TS_PACKET_SIZE - offset);
+    return pkt + offset;
+}
+
+/* Extracts up to max PMT PIDs from a PAT section; returns the number found or -1 */
+int ts_parse_pat(const uint8_t *section, size_t length, uint16_t *pmt_pids, int max) {
+    size_t section_length, pos;
+    uint16_t program_number;
+    int count = 0;
+
+    if(length < 8 || section[0] != 0x00)
+        return -1;
+    section_length = ((size_t)(section[1] & 0x0F) << 8) | section[2];
+    if(section_length < 9 || section_length + 3 > length || crc32_mpeg2(section, section_length + 3, 0xFFFFFFFF) != 0)
+        return -1;
+
+    /* Programs run from after the 8 byte header up to the CRC */
+    for(pos = 8; pos + 4 <= section_length + 3 - 4 && count < max; pos += 4) {
+        program_number = (uint16_t)((section[pos] << 8) | section[pos + 1]);
+        if(program_number == 0)
+            continue;   /* network PID */
+        pmt_pids[count++] = (uint16_t)(((section[pos + 2] & 0x1F) << 8) | section[pos + 3]);
+    }
+    return count;
+}
+
+/*
+ *  Extracts the program number, PCR PID and up to max elementary streams
+ *  (PID and stream_type) from a PMT section; returns the number found or -1.
+ */
+int ts_parse_pmt(const uint8_t *section, size_t length, uint16_t *pprogram, uint16_t *ppcr_pid,
+                 uint16_t *es_pids, uint8_t *stream_types, int max) {
+    size_t section_length, pos, end, info_length;
+    int count = 0;
+
+    if(length < 12 || section[0] != 0x02)
+        return -1;
+    section_length = ((size_t)(section[1] & 0x0F) << 8) | section[2];
+    if(section_length < 13 || section_length + 3 > length || crc32_mpeg2(section, section_length + 3, 0xFFFFFFFF) != 0)
+        return -1;
+
+    *pprogram = (uint16_t)((section[3] << 8) | section[4]);
+    *ppcr_pid = (uint16_t)(((section[8] & 0x1F) << 8) | section[9]);
+    info_length = ((size_t)(section[10] & 0x0F) << 8) | section[11];
+
+    /* Stream loop entries run from after the program descriptors up to the CRC */
+    end = section_length + 3 - 4;
+    for(pos = 12 + info_length; pos + 5 <= end && count < max; pos += 5 + info_length) {
+        stream_types[count] = section[pos];
+        es_pids[count] = (uint16_t)(((section[pos + 1] & 0x1F) << 8) | section[pos + 2]);
+        info_length = ((size_t)(section[pos + 3] & 0x0F) << 8) | section[pos + 4];
+        count++;
+    }
+    return count;
+}
+
+/* Stores the 27MHz PCR carried in the packet's adaptation field; returns 1 if present */
+int ts_get_pcr(const uint8_t *pkt, uint64_t *ppcr, int *pdiscontinuity) {
+    uint64_t base;
+
+    if(pkt[0] != TS_SYNC_BYTE || !TS_HAS_ADAPTATION(pkt) || pkt[4] < 7 || !(pkt[5] & 0x10))
+        return 0;
+    base = ((uint64_t)pkt[6] << 25) | ((uint64_t)pkt[7] << 17) | ((uint64_t)pkt[8] << 9) |
+           ((uint64_t)pkt[9] << 1) | ((uint64_t)pkt[10] >> 7);
+    *ppcr = base * 300 + ((((uint64_t)pkt[10] & 0x01) << 8) | pkt[11]);
+    *pdiscontinuity = (pkt[5] & 0x80) != 0;
+    return 1;
+}
@@ -0,0 +1,122 @@
+/*
+ * write_queue.c
+ *
+ * Copyright © 2015 Michael Mohr <akihana@gmail.com>.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "device_common.h"
+
+/*
+ *  A writer thread for the stages which put data on disk.  Stages run on the
+ *  receive thread with the stage chain locked, so they hand finished buffers
+ *  over here instead of blocking in write().  Jobs run in the order they were
+ *  pushed.  Only once limit jobs are waiting does a push wait for the writer,
+ *  so a disk which falls behind for good slows the receiver down rather than
+ *  using up memory without bound.
+ */
+
+static void *write_queue_thread(void *arg) {
+    struct write_queue *wq = (struct write_queue *)arg;
+    struct write_job *job;
+
+    pthread_mutex_lock(&wq->lock);
+    for(;;) {
+        while(!wq->head && !wq->stopping)
+            pthread_cond_wait(&wq->cond, &wq->lock);
+        job = wq->head;
+        if(!job)
+            break;
+        wq->head = job->next;
+        if(!wq->head)
+            wq->tail = NULL;
+        pthread_mutex_unlock(&wq->lock);
+
+        wq->run(wq->owner, job, 0);
+
+        pthread_mutex_lock(&wq->lock);
+        wq->pending--;
+        pthread_cond_broadcast(&wq->cond);
+    }
+    pthread_mutex_unlock(&wq->lock);
+    return NULL;
+}
+
+/* Returns 0 once the thread is running, or an errno value */
+int write_queue_start(struct write_queue *wq, size_t limit, write_job_fn run, void *owner) {
+    int error;
+
+    memset(wq, 0, sizeof(*wq));
+    wq->limit = limit;
+    wq->run = run;
+    wq->owner = owner;
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+    error = pthread_create(&wq->thread, NULL, write_queue_thread, wq);
+    if(error) {
+        pthread_cond_destroy(&wq->cond);
+        pthread_mutex_destroy(&wq->lock);
+        return error;
+    }
+    wq->started = 1;
+    wq->generation = fork_generation_current();
+    return 0;
+}
+
+void write_queue_push(struct write_queue *wq, struct write_job *job) {
+    job->next = NULL;
+    pthread_mutex_lock(&wq->lock);
+    while(wq->pending >= wq->limit)
+        pthread_cond_wait(&wq->cond, &wq->lock);
+    if(wq->tail)
+        wq->tail->next = job;
+    else
+        wq->head = job;
+    wq->tail = job;
+    wq->pending++;
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+/*
+ *  Runs every job still queued and stops the thread.  In a forked child the
+ *  thread is gone and the files belong to the parent, so the jobs are only
+ *  discarded.  The GIL should not be held.
+ */
+void write_queue_stop(struct write_queue *wq) {
+    struct write_job *job;
+
+    if(!wq->started)
+        return;
+    wq->started = 0;
+    if(wq->generation == fork_generation_current()) {
+        pthread_mutex_lock(&wq->lock);
+        wq->stopping = 1;
+        pthread_cond_broadcast(&wq->cond);
+        pthread_mutex_unlock(&wq->lock);
+        pthread_join(wq->thread, NULL);
+        pthread_cond_destroy(&wq->cond);
+        pthread_mutex_destroy(&wq->lock);
+        return;
+    }
+    while((job = wq->head) != NULL) {
+        wq->head = job->next;
+        wq->run(wq->owner, job, 1);
+    }
+    wq->tail = NULL;
+    wq->pending = 0;
+}